@@ -35,7 +35,10 @@
 #include <pthread.h>
 #include <libsoup/soup.h>
 #include "ai-engine.h"
+#include "ai-scheduler.h"
+#include "ai-detections.h"
 #include "ann-plugin.h"
+#include "auto-buffer.h"
 #include "utils.h"
 
 typedef struct global_param
@@ -47,14 +50,116 @@ typedef struct global_param
 	SoupServer * server;
 	json_object * jconfig;
 	ssize_t count;
+	ai_scheduler_t ** schedulers;	// one micro-batching scheduler (engine pool) per engine config
+	
+	ssize_t num_engines;			// all instances of all pools
 	ai_engine_t ** engines;
 }global_param_t;
 global_param_t * global_param_parse_args(global_param_t * params, int argc, char ** argv);
 void global_param_cleanup(global_param_t * params);
 
-static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define global_lock()	pthread_mutex_lock(&g_mutex)
-#define global_unlock()	pthread_mutex_unlock(&g_mutex)
+
+/*
+ * the request is paused while waiting in the scheduler's queue,
+ * the response is filled and the message unpaused on the main loop.
+ */
+typedef struct ai_server_request
+{
+	SoupServer * server;
+	SoupMessage * msg;
+	enum ai_detections_format format;	// negotiated with the 'Accept' header
+	
+	guint status;
+	const char * content_type;
+	auto_buffer_t response[1];
+}ai_server_request_t;
+
+static gboolean ai_server_request_finish(gpointer user_data)
+{
+	ai_server_request_t * request = user_data;
+	assert(request);
+	
+	SoupMessage * msg = request->msg;
+	if(request->response->length > 0)
+	{
+		// hand over the serialized results without copying
+		unsigned char * data = request->response->data;
+		SoupBuffer * body = soup_buffer_new_with_owner(data, request->response->length, data, free);
+		soup_message_headers_set_content_type(msg->response_headers, request->content_type, NULL);
+		soup_message_body_append_buffer(msg->response_body, body);
+		soup_buffer_free(body);
+		memset(request->response, 0, sizeof(request->response));
+	}
+	auto_buffer_cleanup(request->response);
+	soup_message_set_status(msg, request->status);
+	soup_server_unpause_message(request->server, msg);
+	
+	g_object_unref(msg);
+	free(request);
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * serialized on the dispatch thread, only the negotiated format is built
+ */
+static void on_prediction(void * user_data, input_frame_t * frame, enum ai_request_status status, const ai_detections_t * detections)
+{
+	ai_server_request_t * request = user_data;
+	assert(request);
+	
+	debug_printf("status=%d, detections=%p", status, detections);
+	request->status = SOUP_STATUS_OK;
+	if(status != ai_request_status_ok || NULL == detections)
+	{
+		const char * response = (status == ai_request_status_expired)?
+			"{\"err_code\":1,\"err_msg\":\"deadline exceeded\"}":"{\"err_code\":1}";
+		request->content_type = "application/json";
+		auto_buffer_push_data(request->response, response, strlen(response));
+	}else
+	{
+		request->content_type = ai_detections_format_to_mime_type(request->format);
+		ssize_t cb = ai_detections_serialize(detections, request->format, request->response);
+		if(cb < 0) request->status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+	}
+	
+	g_main_context_invoke(NULL, ai_server_request_finish, request);
+}
+
+/*
+ * engines without native results (e.g. ai-engine::caffe): the json of predict_batch() is returned as is
+ */
+static void on_prediction_json(void * user_data, input_frame_t * frame, enum ai_request_status status, json_object * jresult)
+{
+	ai_server_request_t * request = user_data;
+	assert(request);
+	
+	debug_printf("status=%d, jresult=%p", status, jresult);
+	if(status != ai_request_status_ok || NULL == jresult)
+	{
+		if(jresult) json_object_put(jresult);
+		jresult = json_object_new_object();
+		json_object_object_add(jresult, "err_code", json_object_new_int(1));
+		if(status == ai_request_status_expired) json_object_object_add(jresult, "err_msg", json_object_new_string("deadline exceeded"));
+	}
+	
+	const char * response = json_object_to_json_string_ext(jresult, JSON_C_TO_STRING_PLAIN);
+	assert(response);
+	request->status = SOUP_STATUS_OK;
+	request->content_type = "application/json";
+	auto_buffer_push_data(request->response, response, strlen(response));
+	json_object_put(jresult);
+	
+	g_main_context_invoke(NULL, ai_server_request_finish, request);
+}
+
+static enum ai_request_priority parse_priority(const char * sz_priority)
+{
+	if(NULL == sz_priority) return ai_request_priority_normal;
+	if(strcasecmp(sz_priority, "live") == 0) return ai_request_priority_live;
+	if(strcasecmp(sz_priority, "normal") == 0) return ai_request_priority_normal;
+	if(strcasecmp(sz_priority, "backfill") == 0) return ai_request_priority_backfill;
+	return atoi(sz_priority);
+}
 
 
 void on_request_ai_engine(SoupServer * server, SoupMessage * msg, const char * path, 
@@ -71,6 +176,8 @@ void on_request_ai_engine(SoupServer * server, SoupMessage * msg, const char * p
 	}
 	
 	int engine_index = 0;
+	enum ai_request_priority priority = ai_request_priority_normal;
+	double deadline = 0;	// no deadline
 	if(query)
 	{
 		const char * sz_index = g_hash_table_lookup(query, "engine");
@@ -82,9 +189,13 @@ void on_request_ai_engine(SoupServer * server, SoupMessage * msg, const char * p
 				return;
 			}
 		}
+		priority = parse_priority(g_hash_table_lookup(query, "priority"));
+		
+		const char * sz_deadline = g_hash_table_lookup(query, "deadline");	// in milliseconds
+		if(sz_deadline) deadline = atof(sz_deadline) / 1000.0;
 	}
-	ai_engine_t * engine = params->engines[engine_index];
-	assert(engine);
+	ai_scheduler_t * scheduler = params->schedulers[engine_index];
+	assert(scheduler);
 	
 	const char * content_type = soup_message_headers_get_content_type(msg->request_headers, NULL);
 	printf("content-type: %s\n", content_type);
@@ -94,36 +205,37 @@ void on_request_ai_engine(SoupServer * server, SoupMessage * msg, const char * p
 		return;
 	}
 	
-	input_frame_t frame[1];
-	memset(frame, 0, sizeof(frame));
+	input_frame_t * frame = input_frame_new();
 	int rc = input_frame_set_jpeg(frame, 
 		(unsigned char *)msg->request_body->data, 
 		msg->request_body->length, NULL, 0);
-	assert(0 == rc);
+	if(rc)
+	{
+		input_frame_unref(frame);
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
 	
-	json_object * jresult = NULL;
+	printf("frame: %d x %d, priority=%d, deadline=%.3f\n", frame->width, frame->height, priority, deadline);
 	
-	printf("frame: %d x %d\n", frame->width, frame->height);
-	global_lock();
-	rc = engine->predict(engine, frame, &jresult);
-	global_unlock();
-	input_frame_clear(frame);
+	ai_server_request_t * request = calloc(1, sizeof(*request));
+	assert(request);
+	request->server = server;
+	request->msg = g_object_ref(msg);
+	request->format = ai_detections_format_from_accept(soup_message_headers_get_one(msg->request_headers, "Accept"));
 	
-	printf("rc=%d, jresult=%p\n", rc, jresult);
-	if(rc || NULL == jresult)
+	soup_server_pause_message(server, msg);
+	if(ai_scheduler_has_native_detections(scheduler))
+		rc = ai_scheduler_submit_detections(scheduler, frame, priority, deadline, on_prediction, request);
+	else
+		rc = ai_scheduler_submit(scheduler, frame, priority, deadline, on_prediction_json, request);
+	input_frame_unref(frame);	// the scheduler holds its own reference
+	
+	if(rc)	// queue is full
 	{
-		if(jresult) json_object_put(jresult);
-		jresult = json_object_new_object();
-		json_object_object_add(jresult, "err_code", json_object_new_int(1));
+		request->status = SOUP_STATUS_SERVICE_UNAVAILABLE;
+		ai_server_request_finish(request);
 	}
-	
-	const char * response = json_object_to_json_string_ext(jresult, JSON_C_TO_STRING_PLAIN);
-	assert(response);
-	int cb = strlen(response);
-	
-	soup_message_set_response(msg, "application/json", SOUP_MEMORY_COPY, response, cb);
-	soup_message_set_status(msg, SOUP_STATUS_OK);
-	json_object_put(jresult);
 	return;
 }
 
@@ -136,7 +248,7 @@ static global_param_t g_params[1] = {{
 int main(int argc, char **argv)
 {
 	global_param_t * params = global_param_parse_args(NULL, argc, argv);
-	assert(params && params->count && params->engines);
+	assert(params && params->count && params->schedulers);
 	
 	SoupServer * server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "ai-server", NULL);
 	assert(server);
@@ -238,7 +350,16 @@ global_param_t * global_param_parse_args(global_param_t * params, int argc, char
 	// init plugins
 	ann_plugins_helpler_init(NULL, plugins_dir, params);
 	
-	// init ai-engines
+	/*
+	 * init ai-engines, optional keys of each entry of "engines" (defaults in brackets):
+	 *   "plugin_name":  ["ai-engine::darknet"]
+	 *   "instances":    [1] engine instances sharing one scheduler, one worker thread each
+	 *   "max_batch":    [8] frames per forward pass
+	 *   "max_delay":    [5.0] milliseconds to wait for a batch to fill up
+	 *   "max_queue":    [max_batch * 16] pending frames
+	 *   "cpus":         [unpinned] e.g. [ 0, 4 ], instance ii is pinned on cpus[ii % num_cpus]
+	 *   "omp_threads":  [unchanged] OpenMP threads per instance, e.g. 4 with "instances": 2 on an 8-core host
+	 */
 	json_object * jai_engines = NULL;
 	json_bool ok = json_object_object_get_ex(jconfig, "engines", &jai_engines);
 	assert(ok && jai_engines);
@@ -246,7 +367,11 @@ global_param_t * global_param_parse_args(global_param_t * params, int argc, char
 	int count = json_object_array_length(jai_engines);
 	assert(count > 0);
 	
-	ai_engine_t ** engines = calloc(count, sizeof(*engines));
+	ai_scheduler_t ** schedulers = calloc(count, sizeof(*schedulers));
+	assert(schedulers);
+	
+	ssize_t num_engines = 0;
+	ai_engine_t ** engines = NULL;
 	for(int i = 0; i < count; ++i)
 	{
 		json_object * jengine = json_object_array_get_idx(jai_engines, i);
@@ -254,15 +379,47 @@ global_param_t * global_param_parse_args(global_param_t * params, int argc, char
 		
 		const char * plugin_name = json_get_value(jengine, string, plugin_name);
 		if(NULL == plugin_name) plugin_name = "ai-engine::darknet";
-		ai_engine_t * engine = ai_engine_init(NULL, plugin_name, params);
+		
+		// engine pool: independent instances of the same plugin, each one is driven by its own worker thread
+		int instances = json_get_value_default(jengine, int, instances, 1);
+		if(instances < 1) instances = 1;
+		
+		engines = realloc(engines, (num_engines + instances) * sizeof(*engines));
 		assert(engines);
+		ai_engine_t ** pool = &engines[num_engines];
+		for(int ii = 0; ii < instances; ++ii)
+		{
+			ai_engine_t * engine = ai_engine_init(NULL, plugin_name, params);
+			assert(engine);
+			
+			int rc = engine->init(engine, jengine);
+			assert(0 == rc);
+			pool[ii] = engine;
+		}
+		num_engines += instances;
 		
-		int rc = engine->init(engine, jengine);
-		assert(0 == rc);
+		// micro-batching: max_delay in milliseconds
+		int max_batch = json_get_value_default(jengine, int, max_batch, 8);
+		double max_delay = json_get_value_default(jengine, double, max_delay, 5.0);
+		int max_queue = json_get_value(jengine, int, max_queue);
+		schedulers[i] = ai_scheduler_new_pool(pool, instances, max_batch, max_delay / 1000.0, max_queue);
+		assert(schedulers[i]);
 		
-		engines[i] = engine;
+		// "cpus": [ ... ], instance ii is pinned on cpus[ii % num_cpus]
+		// "omp_threads": OpenMP threads per instance
+		json_object * jcpus = NULL;
+		int num_cpus = 0;
+		if(json_object_object_get_ex(jengine, "cpus", &jcpus) && jcpus) num_cpus = json_object_array_length(jcpus);
+		int omp_threads = json_get_value(jengine, int, omp_threads);
+		for(int ii = 0; ii < instances; ++ii)
+		{
+			int cpu = (num_cpus > 0)?json_object_get_int(json_object_array_get_idx(jcpus, ii % num_cpus)):-1;
+			ai_scheduler_set_worker_affinity(schedulers[i], ii, cpu, omp_threads);
+		}
 	}
 	params->count = count;
+	params->schedulers = schedulers;
+	params->num_engines = num_engines;
 	params->engines = engines;
 
 	return params;
@@ -271,10 +428,17 @@ global_param_t * global_param_parse_args(global_param_t * params, int argc, char
 void global_param_cleanup(global_param_t * params)
 {
 	if(NULL == params) return;
-	if(params->count && params->engines)
+	if(params->count && params->schedulers)
+	{
+		// stop the schedulers before the engines
+		for(ssize_t i = 0; i < params->count; ++i) ai_scheduler_free(params->schedulers[i]);
+		free(params->schedulers);
+		params->schedulers = NULL;
+	}
+	if(params->num_engines && params->engines)
 	{
 		ai_engine_t ** engines = params->engines;
-		for(ssize_t i = 0; i < params->count; ++i)
+		for(ssize_t i = 0; i < params->num_engines; ++i)
 		{
 			if(engines[i]) {
 				ai_engine_cleanup(engines[i]);
@@ -284,8 +448,9 @@ void global_param_cleanup(global_param_t * params)
 		}
 		free(engines);
 		params->engines = NULL;
-		params->count = 0;
+		params->num_engines = 0;
 	}
+	params->count = 0;
 	if(params->jconfig) json_object_put(params->jconfig);
 	params->jconfig = NULL;
 }
@@ -45,6 +45,8 @@
 #include "input-frame.h"
 
 #include "utils.h"
+#include "motion-gate.h"
+#include "ai-tracker.h"
 #include "da_panel.h"
 
 #define IO_PLUGIN_DEFAULT "io-plugin::input-source"
@@ -55,6 +57,7 @@
 
 struct ai_context;
 
+#define MAX_LABELS (256)
 #define MAX_REGION_POINTS (16)
 #define MAX_REGIONS (256)
 
@@ -99,6 +102,14 @@ typedef struct shell_context
 	json_object * jresult;
 	enum json_tokener_error jerr;
 	
+	motion_gate_t * motion_gate;	// NULL: predict every frame
+	rect_d roi;						// (relative) area of the frame sent by the current request
+	
+	ai_tracker_t * tracker;			// NULL: draw the raw detections
+	int new_result;					// jresult was received by the current request
+	int num_labels;
+	const char * labels[MAX_LABELS];	// class names --> class_index of the tracker
+	ai_detections_t detections[1];
 	
 }shell_context_t;
 
@@ -129,10 +140,20 @@ typedef struct ai_context
 	json_object * jinput;
 	json_object * jai_engine;
 	
+	int motion_gate_enabled;
+	motion_gate_params_t motion_gate_params[1];
+	
+	int tracker_enabled;
+	ai_tracker_params_t tracker_params[1];
+	
 	// settings
 	ssize_t regions_count;
 	region_data_t * regions;
 	
+	int roi_enabled;	// only infer the union bounding box of the regions
+	double roi_margin;	// (relative to the frame) added to each side of the roi, the vehicles rise above their regions
+	rect_d roi;
+	
 	int image_width;
 	int image_height;
 	cairo_surface_t * masks;
@@ -238,6 +259,32 @@ static shell_context_t g_shell[1];
 static void init_windows(shell_context_t * shell);
 
 
+/* detections of the cropped image --> relative coordinates of the whole frame */
+static void map_detections_from_roi(json_object * jresult, const rect_d * roi)
+{
+	if(roi->x == 0 && roi->y == 0 && roi->cx == 1 && roi->cy == 1) return;
+	
+	json_object * jdetections = NULL;
+	if(!json_object_object_get_ex(jresult, "detections", &jdetections) || NULL == jdetections) return;
+	
+	int count = json_object_array_length(jdetections);
+	for(int i = 0; i < count; ++i)
+	{
+		json_object * jdet = json_object_array_get_idx(jdetections, i);
+		if(NULL == jdet) continue;
+		
+		double x = json_get_value(jdet, double, left);
+		double y = json_get_value(jdet, double, top);
+		double cx = json_get_value(jdet, double, width);
+		double cy = json_get_value(jdet, double, height);
+		
+		json_object_object_add(jdet, "left", json_object_new_double(roi->x + x * roi->cx));
+		json_object_object_add(jdet, "top", json_object_new_double(roi->y + y * roi->cy));
+		json_object_object_add(jdet, "width", json_object_new_double(cx * roi->cx));
+		json_object_object_add(jdet, "height", json_object_new_double(cy * roi->cy));
+	}
+}
+
 static size_t on_response(void * ptr, size_t size, size_t n, void * user_data)
 {
 	assert(user_data);
@@ -261,9 +308,11 @@ static size_t on_response(void * ptr, size_t size, size_t n, void * user_data)
 	shell->jerr = jerr;
 	if(jerr == json_tokener_success) 
 	{
+		map_detections_from_roi(jresult, &shell->roi);
 		pthread_mutex_lock(&shell->mutex);
 		if(shell->jresult) json_object_put(shell->jresult);
 		shell->jresult = jresult;
+		shell->new_result = 1;
 		pthread_mutex_unlock(&shell->mutex);
 	}
 	json_tokener_reset(jtok);
@@ -282,7 +331,39 @@ static void auto_free_ptr(void * ptr)
 }
 
 
-int ai_request(shell_context_t * shell, const input_frame_t * frame)
+/*
+ * crop the frame to the roi (a view of the frame, no copy), 
+ * the pixels outside of every region are never sent to the ai-engine.
+ */
+static void get_roi_image(const ai_context_t * ctx, const input_frame_t * frame, bgra_image_t * image, rect_d * roi)
+{
+	*image = frame->bgra[0];
+	*roi = (rect_d){0, 0, 1, 1};
+	if(!ctx->roi_enabled || ctx->roi.cx <= 0 || ctx->roi.cy <= 0) return;
+	
+	int x1 = (int)floor(ctx->roi.x * frame->width);
+	int y1 = (int)floor(ctx->roi.y * frame->height);
+	int x2 = (int)ceil((ctx->roi.x + ctx->roi.cx) * frame->width);
+	int y2 = (int)ceil((ctx->roi.y + ctx->roi.cy) * frame->height);
+	if(x1 < 0) x1 = 0;
+	if(y1 < 0) y1 = 0;
+	if(x2 > frame->width) x2 = frame->width;
+	if(y2 > frame->height) y2 = frame->height;
+	if((x2 - x1) < 16 || (y2 - y1) < 16) return;
+	
+	int stride = frame->stride?frame->stride:(frame->width * 4);
+	image->data = frame->data + (ssize_t)stride * y1 + x1 * 4;
+	image->width = x2 - x1;
+	image->height = y2 - y1;
+	image->stride = stride;
+	
+	roi->x = (double)x1 / frame->width;
+	roi->y = (double)y1 / frame->height;
+	roi->cx = (double)(x2 - x1) / frame->width;
+	roi->cy = (double)(y2 - y1) / frame->height;
+}
+
+int ai_request(shell_context_t * shell, const bgra_image_t * image)
 {
 	ai_context_t * ctx = shell->user_data;
 	assert(ctx);
@@ -291,7 +372,7 @@ int ai_request(shell_context_t * shell, const input_frame_t * frame)
 	assert(curl);
 	
 	AUTO_FREE_PTR unsigned char * jpeg_data = NULL;
-	long cb_jpeg = bgra_image_to_jpeg_stream((bgra_image_t *)frame->bgra, &jpeg_data, 95);
+	long cb_jpeg = bgra_image_to_jpeg_stream((bgra_image_t *)image, &jpeg_data, 95);
 	assert(cb_jpeg > 0 && jpeg_data);
 	curl_easy_reset(curl);
 	curl_easy_setopt(curl, CURLOPT_URL, ctx->server_url);
@@ -319,6 +400,79 @@ int ai_request(shell_context_t * shell, const input_frame_t * frame)
 	return 0;
 }
 
+static int get_class_index(shell_context_t * shell, const char * class_name)
+{
+	for(int i = 0; i < shell->num_labels; ++i) {
+		if(strcmp(shell->labels[i], class_name) == 0) return i;
+	}
+	if(shell->num_labels >= MAX_LABELS) return -1;
+	shell->labels[shell->num_labels] = strdup(class_name);
+	return shell->num_labels++;
+}
+
+/*
+ * inferred: feed the detections of jresult to the tracker,
+ * otherwise propagate the tracks (propagate: the tracker skipped the frame) or hold them (static scene),
+ * then replace jresult with the confirmed tracks. (called with shell->mutex locked)
+ */
+static void update_tracks(shell_context_t * shell, int inferred, int propagate)
+{
+	ai_detections_t * detections = shell->detections;
+	if(inferred)
+	{
+		ai_detections_reset(detections);
+		detections->labels = shell->labels;
+		
+		json_object * jdetections = NULL;
+		if(shell->jresult) json_object_object_get_ex(shell->jresult, "detections", &jdetections);
+		int count = jdetections?json_object_array_length(jdetections):0;
+		for(int i = 0; i < count; ++i)
+		{
+			json_object * jdet = json_object_array_get_idx(jdetections, i);
+			const char * class_name = json_get_value(jdet, string, class);
+			int class_index = class_name?get_class_index(shell, class_name):-1;
+			if(class_index < 0) continue;
+			
+			ai_detection_box_t * box = ai_detections_add(detections);
+			box->left = json_get_value(jdet, double, left);
+			box->top = json_get_value(jdet, double, top);
+			box->width = json_get_value(jdet, double, width);
+			box->height = json_get_value(jdet, double, height);
+			box->confidence = json_get_value(jdet, double, confidence);
+			box->class_index = class_index;
+		}
+		detections->num_labels = shell->num_labels;
+		ai_tracker_update(shell->tracker, detections);
+	}else if(propagate)
+	{
+		ai_tracker_predict(shell->tracker);
+	}
+	
+	const ai_track_t * tracks = NULL;
+	ssize_t count = ai_tracker_get_tracks(shell->tracker, &tracks);
+	json_object * jresult = json_object_new_object();
+	json_object * jdetections = json_object_new_array();
+	json_object_object_add(jresult, "detections", jdetections);
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		const ai_track_t * track = &tracks[i];
+		if(!track->confirmed) continue;
+		
+		json_object * jdet = json_object_new_object();
+		json_object_object_add(jdet, "class", json_object_new_string(shell->labels[track->class_index]));
+		json_object_object_add(jdet, "track_id", json_object_new_int(track->id));
+		json_object_object_add(jdet, "confidence", json_object_new_double(track->box.confidence));
+		json_object_object_add(jdet, "left", json_object_new_double(track->box.left));
+		json_object_object_add(jdet, "top", json_object_new_double(track->box.top));
+		json_object_object_add(jdet, "width", json_object_new_double(track->box.width));
+		json_object_object_add(jdet, "height", json_object_new_double(track->box.height));
+		json_object_array_add(jdetections, jdet);
+	}
+	
+	if(shell->jresult) json_object_put(shell->jresult);
+	shell->jresult = jresult;
+}
+
 static gboolean on_idle(shell_context_t * shell);
 void * ai_thread(void * user_data)
 {
@@ -332,11 +486,25 @@ void * ai_thread(void * user_data)
 		shell->is_busy = 1;
 		pthread_mutex_unlock(&shell->mutex);
 		
-		rc = ai_request(shell, shell->frame);
+		bgra_image_t image[1];
+		get_roi_image(shell->user_data, shell->frame, image, &shell->roi);
+		
+		// between the keyframes: propagate the tracks, static scene (or no result): hold the last results
+		int predict = 1;
+		if(shell->tracker) predict = ai_tracker_need_inference(shell->tracker);
+		int propagate = !predict;
+		if(predict && shell->motion_gate) predict = (0 != motion_gate_update(shell->motion_gate, image));
+		shell->new_result = 0;
+		rc = predict?ai_request(shell, image):0;
+		
+		// the gate took this frame as its reference: no result, so do not let the next frames match it
+		if(predict && (rc || !shell->new_result) && shell->motion_gate) motion_gate_reset(shell->motion_gate);
 		
 		pthread_mutex_lock(&shell->mutex);
 		//shell->is_busy = 0;
 		shell->is_dirty = (0 == rc);
+		if(shell->tracker) update_tracks(shell, predict && 0 == rc && shell->new_result, propagate);
+		if(shell->jresult) json_object_object_add(shell->jresult, "cached", json_object_new_boolean(!predict || rc));
 		g_idle_add((GSourceFunc)on_idle, shell);
 		
 	}
@@ -369,6 +537,8 @@ shell_context_t * shell_context_init(int argc, char ** argv, void * user_data)
 	assert(shell->curl);
 	shell->jtok = json_tokener_new();
 	
+	if(ctx->motion_gate_enabled) shell->motion_gate = motion_gate_new(ctx->motion_gate_params);
+	if(ctx->tracker_enabled) shell->tracker = ai_tracker_new(ctx->tracker_params);
 
 	assert(ctx);
 	ctx->shell = shell;
@@ -411,6 +581,21 @@ void shell_context_cleanup(shell_context_t * shell)
 		int rc = pthread_join(shell->th, &exit_code);
 		printf("ai_thread exited with code %ld, rc = %d\n", (long)exit_code, rc);
 	}
+	
+	if(shell->motion_gate)
+	{
+		motion_gate_stats_t stats[1];
+		motion_gate_get_stats(shell->motion_gate, stats);
+		printf("motion gate: %ld frames, %ld predicted, %ld skipped\n", stats->frames, stats->predicted, stats->skipped);
+		motion_gate_free(shell->motion_gate);
+		shell->motion_gate = NULL;
+	}
+	
+	ai_tracker_free(shell->tracker);
+	shell->tracker = NULL;
+	ai_detections_cleanup(shell->detections);
+	for(int i = 0; i < shell->num_labels; ++i) free((void *)shell->labels[i]);
+	shell->num_labels = 0;
 	return;
 }
 
@@ -672,9 +857,37 @@ static void draw_frame(da_panel_t * panel, const input_frame_t * frame, json_obj
 				
 				cairo_move_to(cr, x * width, y * height + 20);
 				cairo_show_text(cr, class_name);
+				
+				int track_id = json_get_value(jdet, int, track_id);
+				if(track_id > 0) {
+					char sz_id[32] = "";
+					snprintf(sz_id, sizeof(sz_id), " #%d", track_id);
+					cairo_show_text(cr, sz_id);
+				}
 			}
 		}
 		
+		if(json_get_value(jresult, int, cached))
+		{
+			cairo_set_source_rgb(cr, 1, 1, 0);
+			cairo_set_font_size(cr, 15);
+			cairo_move_to(cr, 10, 20);
+			cairo_show_text(cr, "(cached)");
+		}
+		
+		cairo_destroy(cr);
+	}
+	
+	if(ctx->roi_enabled && ctx->roi.cx > 0 && ctx->roi.cy > 0)
+	{
+		double dashes[1] = { 6 };
+		cairo_t * cr = cairo_create(surface);
+		cairo_set_line_width(cr, 1);
+		cairo_set_dash(cr, dashes, 1, 0);
+		cairo_set_source_rgb(cr, 0, 1, 1);
+		cairo_rectangle(cr, ctx->roi.x * frame->width, ctx->roi.y * frame->height, 
+			ctx->roi.cx * frame->width, ctx->roi.cy * frame->height);
+		cairo_stroke(cr);
 		cairo_destroy(cr);
 	}
 	
@@ -712,6 +925,20 @@ static int load_config(ai_context_t * ctx, const char * conf_file)
 	assert(ctx->video_src && ctx->video_src[0]);
 	
 	
+	// "motion-gate": { "enabled": true, "width": 160, "pixel_thresh": 20, "change_ratio": 0.002, "cooldown": 5, "max_skipped": 150 }
+	json_object * jmotion_gate = NULL;
+	motion_gate_params_t * params = ctx->motion_gate_params;
+	motion_gate_params_init(params);
+	if(json_object_object_get_ex(jconfig, "motion-gate", &jmotion_gate) && jmotion_gate)
+	{
+		ctx->motion_gate_enabled = json_get_value_default(jmotion_gate, int, enabled, 1);
+		params->width = json_get_value_default(jmotion_gate, int, width, params->width);
+		params->pixel_thresh = json_get_value_default(jmotion_gate, int, pixel_thresh, params->pixel_thresh);
+		params->change_ratio = json_get_value_default(jmotion_gate, double, change_ratio, params->change_ratio);
+		params->cooldown = json_get_value_default(jmotion_gate, int, cooldown, params->cooldown);
+		params->max_skipped = json_get_value_default(jmotion_gate, int, max_skipped, params->max_skipped);
+	}
+	
 	if(NULL == ctx->server_url) ctx->server_url = json_get_value(jai_engine, string, url);
 	else json_object_object_add(jai_engine, "url", json_object_new_string(ctx->server_url));
 	
@@ -764,6 +991,56 @@ static int load_config(ai_context_t * ctx, const char * conf_file)
 		}
 #undef set_if_min_or_max
 	}
+	
+	// "tracker": { "enabled": true, "keyframe_interval": 3, "iou_thresh": 0.3, "min_hits": 3, "max_misses": 5,
+	//              "min_confidence": 0.3, "confidence_decay": 0.9 }
+	json_object * jtracker = NULL;
+	ai_tracker_params_t * tracker_params = ctx->tracker_params;
+	ai_tracker_params_init(tracker_params);
+	if(json_object_object_get_ex(jconfig, "tracker", &jtracker) && jtracker)
+	{
+		ctx->tracker_enabled = json_get_value_default(jtracker, int, enabled, 1);
+		tracker_params->keyframe_interval = json_get_value_default(jtracker, int, keyframe_interval, tracker_params->keyframe_interval);
+		tracker_params->iou_thresh = json_get_value_default(jtracker, double, iou_thresh, tracker_params->iou_thresh);
+		tracker_params->min_hits = json_get_value_default(jtracker, int, min_hits, tracker_params->min_hits);
+		tracker_params->max_misses = json_get_value_default(jtracker, int, max_misses, tracker_params->max_misses);
+		tracker_params->min_confidence = json_get_value_default(jtracker, double, min_confidence, tracker_params->min_confidence);
+		tracker_params->confidence_decay = json_get_value_default(jtracker, double, confidence_decay, tracker_params->confidence_decay);
+	}
+	
+	// "roi": { "enabled": true, "margin": 0.1 }
+	json_object * jroi = NULL;
+	ctx->roi_enabled = 0;
+	ctx->roi_margin = 0.1;
+	if(json_object_object_get_ex(jconfig, "roi", &jroi) && jroi)
+	{
+		ctx->roi_enabled = json_get_value_default(jroi, int, enabled, 1);
+		ctx->roi_margin = json_get_value_default(jroi, double, margin, ctx->roi_margin);
+	}
+	
+	// union bounding box of the regions
+	double x_min = 1.0, y_min = 1.0, x_max = 0.0, y_max = 0.0;
+	for(int i = 0; i < regions_count; ++i)
+	{
+		const region_data_t * region = &ctx->regions[i];
+		if(region->count < 3) continue;
+		if(region->bbox.x < x_min) x_min = region->bbox.x;
+		if(region->bbox.y < y_min) y_min = region->bbox.y;
+		if(region->bbox.x + region->bbox.cx > x_max) x_max = region->bbox.x + region->bbox.cx;
+		if(region->bbox.y + region->bbox.cy > y_max) y_max = region->bbox.y + region->bbox.cy;
+	}
+	if(x_max > x_min && y_max > y_min)
+	{
+		x_min -= ctx->roi_margin; y_min -= ctx->roi_margin;
+		x_max += ctx->roi_margin; y_max += ctx->roi_margin;
+		if(x_min < 0) x_min = 0;
+		if(y_min < 0) y_min = 0;
+		if(x_max > 1) x_max = 1;
+		if(y_max > 1) y_max = 1;
+		ctx->roi = (rect_d){x_min, y_min, x_max - x_min, y_max - y_min};
+	}
+	debug_printf("roi: %s, {%.3f, %.3f, %.3f, %.3f}", ctx->roi_enabled?"enabled":"disabled",
+		ctx->roi.x, ctx->roi.y, ctx->roi.cx, ctx->roi.cy);
 	return 0;
 }
 
@@ -0,0 +1,121 @@
+#ifndef _AI_DETECTIONS_H_
+#define _AI_DETECTIONS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <json-c/json.h>
+#include "auto-buffer.h"
+
+/**
+ * @ingroup ai_detections
+ * @{
+ *
+ * ai_detections: native (packed) detection results,
+ *   produced by the engines without building json-c trees,
+ *   and serialized only at the edge (http response, file, ...)
+ */
+typedef struct ai_detection_box
+{
+	float left, top, width, height;	// relative or absolute coordinates, as configured by the engine
+	float confidence;
+	int32_t class_index;			// index of the label table
+}ai_detection_box_t;
+
+typedef struct ai_detections
+{
+	const char * model;
+	int num_labels;
+	const char * const * labels;	// label table, owned by the engine
+
+	ssize_t count;
+	ssize_t capacity;
+	ai_detection_box_t * boxes;
+}ai_detections_t;
+
+ai_detections_t * ai_detections_init(ai_detections_t * detections, ssize_t capacity);
+void ai_detections_cleanup(ai_detections_t * detections);
+int ai_detections_reserve(ai_detections_t * detections, ssize_t count);
+ai_detection_box_t * ai_detections_add(ai_detections_t * detections);		// append one (uninitialized) box
+#define ai_detections_reset(detections) do { (detections)->count = 0; } while(0)
+
+static inline const char * ai_detections_get_label(const ai_detections_t * detections, int class_index)
+{
+	if(NULL == detections->labels || class_index < 0 || class_index >= detections->num_labels) return "";
+	return detections->labels[class_index];
+}
+
+/*
+ * serialization formats
+ *  - json:    {"model": "...", "detections": [{"class", "class_index", "confidence", "left", "top", "width", "height"}, ...]}
+ *  - msgpack: the same object tree as json
+ *  - binary:  little-endian,
+ *      header { char magic[4] = "AIDT"; uint16 version = 1; uint16 box_size = 24;
+ *               uint32 count; uint32 num_labels; uint32 model_length; uint32 reserved; }
+ *      char model[model_length];
+ *      labels: num_labels * { uint16 length; char label[length]; }
+ *      boxes:  count * { float32 left, top, width, height, confidence; int32 class_index; }
+ */
+enum ai_detections_format
+{
+	ai_detections_format_json = 0,
+	ai_detections_format_binary,
+	ai_detections_format_msgpack,
+	ai_detections_formats_count
+};
+#define AI_DETECTIONS_BINARY_MAGIC "AIDT"
+#define AI_DETECTIONS_BINARY_VERSION (1)
+
+const char * ai_detections_format_to_mime_type(enum ai_detections_format format);
+// content negotiation: pick the format from a http 'Accept' header, (NULL or '*/*': json)
+enum ai_detections_format ai_detections_format_from_accept(const char * accept);
+
+// append the serialized results to @buf, return the number of bytes written or -1 on error
+ssize_t ai_detections_serialize(const ai_detections_t * detections, enum ai_detections_format format, auto_buffer_t * buf);
+json_object * ai_detections_to_json(const ai_detections_t * detections);
+
+/**
+ * @}
+ */
+
+
+/**
+ * @ingroup ai_nms
+ * @{
+ *
+ * non-maximum suppression (post-processing of the detectors)
+ *   - the candidates are prefiltered by the callers (score > threshold)
+ *   - per-class NMS: the boxes of each class are sorted by score,
+ *     a box is removed if its IoU with a kept (higher score) box is greater than iou_thresh
+ *   - the IoU of one kept box against the remaining boxes is computed with SIMD
+ *     (same dispatch level as img_preprocess_get_simd_level())
+ */
+typedef struct ai_nms_box
+{
+	float left, top, width, height;
+	float score;
+	int32_t class_index;
+	int32_t index;		// user data, e.g. the index of the source detection
+}ai_nms_box_t;
+
+typedef struct ai_nms_context ai_nms_context_t;		// reusable scratch buffers, not thread-safe
+ai_nms_context_t * ai_nms_context_new(void);
+void ai_nms_context_free(ai_nms_context_t * nms);
+
+/*
+ * the kept boxes are moved to the front of @boxes, sorted by score (descending),
+ * at most top_k boxes are kept (<= 0: unlimited), return the number of boxes kept.
+ */
+ssize_t ai_nms(ai_nms_context_t * nms, ai_nms_box_t * boxes, ssize_t count, float iou_thresh, ssize_t top_k);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
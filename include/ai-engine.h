@@ -9,6 +9,7 @@ extern "C" {
 #include <stdint.h>
 #include <json-c/json.h>
 #include "input-frame.h"
+#include "ai-detections.h"
 
 typedef struct int_dim4
 {
@@ -61,17 +62,31 @@ typedef struct ai_engine
 	
 	int (* load_config)(struct ai_engine * engine, json_object * jconfig);
 	int (* predict)(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults);
+	
+	// results[i]: the predictions of frames[i] (NULL if nothing was found), 
+	// return the number of frames which have results, or -1 on error.
+	// frames == NULL: the first @count items of get_workspace() were already filled by the caller (in place).
+	int (* predict_batch)(struct ai_engine * engine, const input_frame_t * frames[], int count, json_object * results[]);
+	
+	// (optional) native results, no json-c trees: results[i] (reused by the caller) are reset and filled,
+	// undecodable frames get no boxes, return the number of frames predicted, or -1 on error.
+	int (* predict_detections)(struct ai_engine * engine, const input_frame_t * frames[], int count, ai_detections_t results[]);
 	int (* update)(struct ai_engine * engine, const ai_tensor_t * truth);
 	int (* get_property)(struct ai_engine * engine, const char * name, void ** p_value);
 	int (* set_property)(struct ai_engine * engine, const char * name, const void * value, size_t length);
 
 	// public member functions
-	ai_tensor_t * (* get_workspace)(struct ai_engine * engine);		// pre-allocated global memory (GPU or CPU)
+	// pre-allocated global memory (GPU or CPU): the network input tensor {max_batch, c, h, w},
+	// owned by the engine, NULL if the plugin does not support in-place inputs.
+	ai_tensor_t * (* get_workspace)(struct ai_engine * engine);
 }ai_engine_t;
 
 ai_engine_t * ai_engine_init(ai_engine_t * engine, const char * plugin_type, void * user_data);
 void ai_engine_cleanup(ai_engine_t * engine);
 
+int ai_engine_predict_batch(ai_engine_t * engine, const input_frame_t * frames[], int count, json_object * results[]);
+int ai_engine_predict_detections(ai_engine_t * engine, const input_frame_t * frames[], int count, ai_detections_t results[]);
+
 #ifdef __cplusplus
 }
 #endif
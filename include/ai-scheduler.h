@@ -0,0 +1,106 @@
+#ifndef _AI_SCHEDULER_H_
+#define _AI_SCHEDULER_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <json-c/json.h>
+#include "ai-engine.h"
+#include "input-frame.h"
+
+/**
+ * @ingroup ai_scheduler
+ * @{
+ *
+ * ai_scheduler: dynamic micro-batching in front of an ai_engine.
+ *
+ * - requests from many producers (io_inputs, http sessions, ...) are queued,
+ *   and dispatch threads run them through engine->predict_batch().
+ * - engine pool: each dispatch thread (worker) owns one engine instance,
+ *   a batch goes to whichever instance is idle first.
+ * - a batch is dispatched when it has max_batch frames, or when the oldest
+ *   queued request has waited for max_delay seconds, or when the tightest deadline is due.
+ * - higher priorities are served first, then earlier deadlines, then arrival order.
+ * - requests whose deadline has passed before dispatching are completed with ai_request_status_expired.
+ */
+typedef struct ai_scheduler ai_scheduler_t;
+
+enum ai_request_priority
+{
+	ai_request_priority_backfill = 0,
+	ai_request_priority_normal = 1,
+	ai_request_priority_live = 2,
+	ai_request_priorities_count
+};
+
+enum ai_request_status
+{
+	ai_request_status_ok = 0,
+	ai_request_status_failed = -1,
+	ai_request_status_expired = -2,
+	ai_request_status_cancelled = -3,	// the scheduler was stopped
+};
+
+/*
+ * called on the dispatch thread once per request.
+ * jresult (may be NULL) is owned by the callee.
+ */
+typedef void (* ai_request_callback)(void * user_data, input_frame_t * frame,
+	enum ai_request_status status, json_object * jresult);
+
+/*
+ * native results: called on the dispatch thread once per request,
+ * detections (NULL unless status is ok) are owned by the scheduler, and only valid during the callback.
+ * engines without predict_detections() complete these requests with ai_request_status_failed,
+ * check ai_scheduler_has_native_detections() and use ai_scheduler_submit() for those engines.
+ */
+typedef void (* ai_detections_callback)(void * user_data, input_frame_t * frame,
+	enum ai_request_status status, const ai_detections_t * detections);
+
+typedef struct ai_scheduler_stats
+{
+	long requests_submitted;
+	long requests_rejected;		// queue is full
+	long requests_expired;
+	long batches;
+	long frames_predicted;
+	double avg_batch_size;
+	double avg_queue_delay;		// seconds, submit --> dispatch
+	double avg_predict_time;	// seconds per batch
+}ai_scheduler_stats_t;
+
+// max_delay: in seconds, max_queue: 0 means (max_batch * 16)
+ai_scheduler_t * ai_scheduler_new(ai_engine_t * engine, int max_batch, double max_delay, int max_queue);
+ai_scheduler_t * ai_scheduler_new_pool(ai_engine_t * engines[], int num_engines, int max_batch, double max_delay, int max_queue);
+void ai_scheduler_free(ai_scheduler_t * scheduler);	// pending requests are completed with ai_request_status_cancelled
+
+int ai_scheduler_get_workers(ai_scheduler_t * scheduler);
+int ai_scheduler_has_native_detections(ai_scheduler_t * scheduler);	// every engine of the pool implements predict_detections()
+// pin the worker thread on @cpu (< 0: unchanged), omp_threads: OpenMP threads used by the worker (<= 0: unchanged)
+int ai_scheduler_set_worker_affinity(ai_scheduler_t * scheduler, int index, int cpu, int omp_threads);
+
+/*
+ * ai_scheduler_submit(): the scheduler holds a reference of the (heap) frame until the callback returns.
+ * deadline: relative time in seconds, <= 0: no deadline.
+ * return -1 if the request was not accepted (queue full or stopped), the callback will not be called.
+ */
+int ai_scheduler_submit(ai_scheduler_t * scheduler, input_frame_t * frame,
+	enum ai_request_priority priority, double deadline,
+	ai_request_callback callback, void * user_data);
+
+int ai_scheduler_submit_detections(ai_scheduler_t * scheduler, input_frame_t * frame,
+	enum ai_request_priority priority, double deadline,
+	ai_detections_callback callback, void * user_data);
+
+void ai_scheduler_get_stats(ai_scheduler_t * scheduler, ai_scheduler_stats_t * stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
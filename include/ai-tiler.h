@@ -0,0 +1,70 @@
+#ifndef _AI_TILER_H_
+#define _AI_TILER_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ai-engine.h"
+#include "ai-detections.h"
+#include "input-frame.h"
+
+/**
+ * @ingroup ai_tiler
+ * @{
+ *
+ * ai_tiler: sliced inference of high-resolution frames.
+ *
+ * - the frame is split into overlapping tiles (zero-copy views of the BGRA frame),
+ *   the grid adapts to the frame size and is capped by max_tiles (the tiles grow instead).
+ * - the tiles (and optionally the whole frame, for the large objects) are predicted
+ *   in one engine->predict_detections() call, so the engine batches them.
+ * - the boxes are mapped back to the frame and merged by a global per-class NMS,
+ *   boxes cut by an inner tile edge are dropped when another pass sees the whole object.
+ * - a tile whose coarse luma grid did not change since its last inference is skipped,
+ *   and its previous boxes are reused.
+ *
+ * one tiler per stream (the skip check compares consecutive frames), not thread-safe.
+ */
+typedef struct ai_tiler ai_tiler_t;
+
+typedef struct ai_tiler_params
+{
+	int tile_width, tile_height;	// source pixels per tile, <= 0: twice the network input (or 832)
+	float overlap;					// fraction of the tile shared with the neighbours, default 0.2
+	int max_tiles;					// default 16
+	int full_frame;					// also predict the whole frame, default 1
+	float nms_thresh;				// IoU threshold of the global NMS, default 0.45
+	float change_thresh;			// luma difference (0 ~ 255) of one grid cell, default 6, <= 0: never skip
+	int max_skipped;				// re-run an unchanged tile after this many frames, default 30
+	int relative;					// the engine (and the results) use relative coordinates, default 1
+}ai_tiler_params_t;
+void ai_tiler_params_init(ai_tiler_params_t * params);	// defaults
+
+typedef struct ai_tiler_stats
+{
+	long frames;
+	long tiles_predicted;		// including the whole-frame passes
+	long tiles_skipped;
+}ai_tiler_stats_t;
+
+ai_tiler_t * ai_tiler_new(const ai_tiler_params_t * params);	// params: NULL: defaults
+void ai_tiler_free(ai_tiler_t * tiler);
+
+/*
+ * results: reset and filled with the merged boxes of @frame,
+ * frames that cannot be tiled (RGB planar, or not larger than one tile) are predicted as a whole.
+ * return 0 on success, -1 on error (or if the engine does not support predict_detections())
+ */
+int ai_tiler_predict(ai_tiler_t * tiler, ai_engine_t * engine, const input_frame_t * frame, ai_detections_t * results);
+void ai_tiler_get_stats(const ai_tiler_t * tiler, ai_tiler_stats_t * stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,78 @@
+#ifndef _AI_TRACKER_H_
+#define _AI_TRACKER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ai-detections.h"
+
+/**
+ * @ingroup ai_tracker
+ * @{
+ *
+ * ai_tracker: SORT-style multi-object tracker.
+ *
+ * - each track is a constant-velocity Kalman filter of its box (center, width, height),
+ *   the noises are proportional to the height of the box (independent of the units of the boxes).
+ * - detections are associated with the predicted tracks of the same class by the Hungarian
+ *   algorithm on (1 - IoU), pairs below iou_thresh are rejected.
+ * - between the inferred frames, ai_tracker_predict() propagates the boxes and decays their confidence;
+ *   ai_tracker_need_inference() asks for a detector pass every keyframe_interval frames,
+ *   or earlier when a track is unconfirmed or its confidence fell below min_confidence.
+ *
+ * deterministic (no randomness, stable ordering), one tracker per stream, not thread-safe.
+ */
+typedef struct ai_tracker ai_tracker_t;
+
+typedef struct ai_tracker_params
+{
+	float iou_thresh;			// minimum IoU of a match, default 0.3
+	int min_hits;				// matches before a track is confirmed (reported), default 3
+	int max_misses;				// inferred frames without a match before a track is deleted, default 5
+	int keyframe_interval;		// K: run the detector at least every K frames, default 3
+	float min_confidence;		// a confirmed track below this asks for a detector pass, default 0.3
+	float confidence_decay;		// confidence multiplier of each frame without a match, default 0.9
+	float std_position;			// Kalman noises, relative to the box height, default 1/20
+	float std_velocity;			// default 1/160
+}ai_tracker_params_t;
+void ai_tracker_params_init(ai_tracker_params_t * params);	// defaults
+
+typedef struct ai_track
+{
+	uint32_t id;				// stable, starts from 1
+	int32_t class_index;
+	ai_detection_box_t box;		// current (predicted or corrected) box, box.confidence: decayed confidence
+	float vx, vy;				// velocity of the center, per frame
+	int confirmed;
+	int hits;					// number of matches
+	int misses;					// consecutive inferred frames without a match
+	int age;					// frames since the track was created
+}ai_track_t;
+
+ai_tracker_t * ai_tracker_new(const ai_tracker_params_t * params);	// params: NULL: defaults
+void ai_tracker_free(ai_tracker_t * tracker);
+void ai_tracker_reset(ai_tracker_t * tracker);
+
+int ai_tracker_need_inference(const ai_tracker_t * tracker);	// 1: run the detector on the next frame
+
+// inferred frame: predict, associate, correct; return the number of tracks
+ssize_t ai_tracker_update(ai_tracker_t * tracker, const ai_detections_t * detections);
+// frame without inference: propagate the tracks; return the number of tracks
+ssize_t ai_tracker_predict(ai_tracker_t * tracker);
+
+ssize_t ai_tracker_get_tracks(const ai_tracker_t * tracker, const ai_track_t ** p_tracks);	// all the tracks (confirmed or not)
+// results: reset and filled with the confirmed tracks (labels of the last detections),
+// track_ids (optional, capacity >= the number of tracks): the id of each box
+ssize_t ai_tracker_to_detections(const ai_tracker_t * tracker, ai_detections_t * results, uint32_t * track_ids);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
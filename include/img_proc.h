@@ -44,6 +44,98 @@ int img_utils_get_png_size(const unsigned char * png, size_t length, int * p_wid
 /**
 * @}
 */
+
+/**
+ * @ingroup img_jpeg_decode
+ * @{
+ *
+ * img_jpeg_decode: the decode path of the ai-engines (libjpeg-turbo)
+ *   - DCT scaling: the smallest of 1/8, 1/4, 1/2, 1/1 which keeps the (cropped) output >= min_width x min_height,
+ *   - crop: only the rows and the iMCU columns of the region are decoded (jpeg_skip_scanlines / jpeg_crop_scanline),
+ *   - several scanlines per call, directly into the caller's buffer (BGRA, any stride).
+ */
+typedef struct img_jpeg_decode_params
+{
+	int min_width, min_height;		// <= 0: full resolution
+	int crop_x, crop_y;				// source pixels
+	int crop_width, crop_height;	// <= 0: no crop, clipped to the image
+}img_jpeg_decode_params_t;
+void img_jpeg_decode_params_init(img_jpeg_decode_params_t * params);	// full resolution, no crop
+
+// dst == NULL: only the output size, capacity: bytes of dst (>= stride * height)
+int img_jpeg_decode(const unsigned char * jpeg, size_t length, const img_jpeg_decode_params_t * params,
+	unsigned char * dst, int stride, size_t capacity, int * p_width, int * p_height);
+// image: (re)allocated to the output size, params: NULL: full resolution
+int bgra_image_from_jpeg_stream_scaled(bgra_image_t * image, const unsigned char * jpeg, size_t length,
+	const img_jpeg_decode_params_t * params);
+
+/**
+* @}
+*/
+
+/**
+ * @ingroup img_preprocess
+ * @{
+ *
+ * img_preprocess: uint8 pixels --> float32 planes (NCHW), used by the ai-engines
+ *   dst = ((float)src - mean) * scale
+ *
+ * The SIMD kernels (SSE4.1 / AVX2 / AVX-512) are selected at runtime (CPUID),
+ * the scalar kernel is the reference implementation.
+ */
+enum img_simd_level
+{
+	img_simd_level_scalar = 0,
+	img_simd_level_sse4,
+	img_simd_level_avx2,
+	img_simd_level_avx512,
+	img_simd_levels_count
+};
+enum img_simd_level img_preprocess_get_simd_level(void);
+int img_preprocess_set_simd_level(enum img_simd_level level);	// return -1 if the cpu does not support @level
+const char * img_simd_level_to_string(enum img_simd_level level);
+
+// BGRA/BGRx --> R, G, B planes. stride: bytes per row (0: width * 4), mean/scale: per-channel (R, G, B), NULL: 0 / 1.0
+int img_bgra_to_planar_f32(const unsigned char * bgra, int width, int height, int stride,
+	const float mean[3], const float scale[3], float * dst);
+// single channel
+int img_u8_to_f32(const unsigned char * src, ssize_t count, float mean, float scale, float * dst);
+
+/*
+ * fused resize + letterbox + normalize:
+ *   BGRA/BGRx (any size) --> R, G, B float planes of dst_width x dst_height (the network input tensor),
+ *   without any intermediate full-resolution image.
+ */
+enum img_resize_mode
+{
+	img_resize_mode_auto = 0,	// area when shrinking by 2x or more, otherwise bilinear
+	img_resize_mode_bilinear,
+	img_resize_mode_area,
+};
+
+typedef struct img_resize_params
+{
+	enum img_resize_mode mode;
+	int letterbox;			// keep the aspect ratio (same geometry as darknet's letterbox_image), pad the borders
+	float pad_value;		// normalized value of the borders
+	const float * mean;		// per-channel (R, G, B), NULL: 0
+	const float * scale;	// per-channel (R, G, B), NULL: 1.0
+	int num_threads;		// number of row bands processed in parallel, <= 1: the calling thread only
+}img_resize_params_t;
+
+typedef struct img_letterbox
+{
+	int x, y;				// position of the resized image in the output
+	int width, height;		// size of the resized image
+}img_letterbox_t;
+
+int img_bgra_resize_to_planar_f32(const unsigned char * bgra, int width, int height, int stride,
+	int dst_width, int dst_height, const img_resize_params_t * params,
+	float * dst, img_letterbox_t * p_letterbox);
+
+/**
+ * @}
+ */
 #ifdef __cplusplus
 }
 #endif
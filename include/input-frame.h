@@ -17,6 +17,11 @@ enum input_frame_type
 	input_frame_type_bgra = 1,
 	input_frame_type_jpeg = 2,
 	input_frame_type_png  = 3,
+	
+	// raw (uncompressed) layouts other than packed BGRA/BGRx
+	input_frame_type_rgb_planar = 4,	// 3 planes: R, G, B (stride: bytes per row of one plane)
+	input_frame_type_gray8 = 5,
+	input_frame_type_nv12 = 6,			// Y plane + interleaved UV plane (half resolution)
 
 	input_frame_type_image_masks = 0x7FFF,
 	input_frame_type_json_flag = 0x8000,
@@ -53,11 +58,45 @@ typedef struct input_frame
 		char * json_str;
 		void * meta_data;	// json_object
 //	};
+	
+	void * payload;		// input_frame_payload_t *, (NULL: data was allocated by the frame itself)
+	long refs;			// input_frame_ref() / input_frame_unref(), heap objects only
 }input_frame_t;
 void input_frame_free(input_frame_t * frame);
 input_frame_t * input_frame_new();
 void input_frame_clear(input_frame_t * frame);
 
+input_frame_t * input_frame_ref(input_frame_t * frame);
+void input_frame_unref(input_frame_t * frame);		// free the frame when the last reference was released
+
+/**
+ * input_frame_payload: refcounted image buffer
+ * 	drawn from a size-classed pool, or wraps an external buffer (adopted)
+ * 	frames which share the same payload must treat the image data as read-only.
+ */
+typedef struct input_frame_payload input_frame_payload_t;
+typedef void (* input_frame_payload_release_func)(void * data, void * user_data);
+
+input_frame_payload_t * input_frame_payload_new(size_t size);
+input_frame_payload_t * input_frame_payload_wrap(void * data, size_t size, 
+	input_frame_payload_release_func release, void * user_data);
+input_frame_payload_t * input_frame_payload_ref(input_frame_payload_t * payload);
+void input_frame_payload_unref(input_frame_payload_t * payload);
+unsigned char * input_frame_payload_get_data(const input_frame_payload_t * payload);
+size_t input_frame_payload_get_size(const input_frame_payload_t * payload);
+void input_frame_pool_set_limit(size_t max_cached_bytes);
+
+// take over one reference of the payload
+int input_frame_attach_payload(input_frame_t * frame, enum input_frame_type type, 
+	input_frame_payload_t * payload, ssize_t length, 
+	int width, int height, int channels, int stride);
+
+// zero-copy ownership transfer: release(data, user_data) will be called when the last frame drops the buffer
+int input_frame_adopt_buffer(input_frame_t * frame, enum input_frame_type type,
+	unsigned char * data, ssize_t length,
+	int width, int height, int channels, int stride,
+	input_frame_payload_release_func release, void * user_data);
+
 int input_frame_set_bgra(input_frame_t * input, const bgra_image_t * bgra, const char * json_str, ssize_t cb_json);
 int input_frame_set_jpeg(input_frame_t * input, const unsigned char * data, ssize_t length, const char * json_str, ssize_t cb_json);
 int input_frame_set_png(input_frame_t * input, const unsigned char * data, ssize_t length, const char * json_str, ssize_t cb_json);
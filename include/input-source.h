@@ -50,6 +50,17 @@ enum input_source_type input_source_type_parse_uri(const char * uri, char ** p_c
  * @ingroup input_source
  * @{
  */
+typedef struct input_source_stats
+{
+	long frames_received;	// decoded frames
+	long frames_delivered;	// frames accepted by the consumer
+	long frames_dropped;	// stale frames dropped at the source
+	long frames_rejected;	// frames refused by the consumer (backpressure)
+	long frames_throttled;	// frames discarded by the fps cap
+	long frames_skipped;	// encoded frames dropped before decode (fps cap, keyframes_only)
+	double process_time;	// average time spent delivering one frame (in seconds)
+}input_source_stats_t;
+
 typedef struct input_source
 {
 	void * user_data;
@@ -57,6 +68,20 @@ typedef struct input_source
 
 	enum input_source_type 		type;
 	enum input_source_subtype 	subtype;
+	
+	int zero_copy;		// video sources: frames hold a reference of the decoded GstBuffer instead of a copy
+	int max_buffers;	// video sources: max queued frames before the stale ones are dropped
+	double max_fps;		// video sources: per-stream fps cap, <= 0: unlimited
+	int decoder_threads;	// video sources: max-threads of libav decoders, (0: auto, < 0: keep the decoder's default)
+	
+	// video sources: decimation, can be changed while playing by set_decimation()
+	double fps;				// videorate max-rate, <= 0: unlimited
+	int keyframes_only;		// drop the delta units before decode (once cleared: until the next keyframe)
+	
+	// video sources: output geometry and pixel format (set before set_uri)
+	int width;			// 0x0: default (640x480), -1: keep the source size
+	int height;
+	char format[16];	// "BGRA"(default), "BGRx", "RGBP"(RGB planar), "GRAY8", "NV12"
 
 	int (* set_uri)(struct input_source * input, const char * uri);
 
@@ -65,10 +90,13 @@ typedef struct input_source
 	int (* pause)(struct input_source * input);
 	int (* restart)(struct input_source * input);
 	
+	// return -1 if the frame was not accepted (backpressure)
 	int (* on_new_frame)(struct input_source * input, const input_frame_t * frame);
 
 	long (* set_frame)(struct input_source * input, const input_frame_t * frame);
 	long (* get_frame)(struct input_source * input, long prev_frame, input_frame_t * frame);
+	int (* get_stats)(struct input_source * input, input_source_stats_t * stats);
+	int (* set_decimation)(struct input_source * input, double fps, int keyframes_only);
 }input_source_t;
 input_source_t * input_source_new(void * user_data);
 //~ input_source_t * input_source_new_from_uri(const char * uri, void * user_data);
@@ -0,0 +1,78 @@
+#ifndef _INT8_CONV_H_
+#define _INT8_CONV_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup int8_conv
+ * @{
+ *
+ * int8 convolution for the quantized cpu inference:
+ *  - weights: symmetric int8, one scale per output channel (batchnorm folded into the multipliers)
+ *  - inputs: symmetric int8, one scale per tensor (calibrated, or dynamic: max|x| of each input)
+ *  - im2col + int8 GEMM with int32 accumulators, then dequantized to float32
+ */
+enum int8_conv_level
+{
+	int8_conv_level_scalar = 0,
+	int8_conv_level_avx2,			// vpmaddwd on sign-extended int16
+	int8_conv_level_vnni,			// vpdpbusd (avx512-vnni, 256-bit)
+	int8_conv_levels_count
+};
+enum int8_conv_level int8_conv_get_level(void);
+int int8_conv_set_level(enum int8_conv_level level);	// return -1 if the cpu does not support @level
+const char * int8_conv_level_to_string(enum int8_conv_level level);
+
+typedef struct int8_conv
+{
+	int in_c, in_h, in_w;
+	int out_c, out_h, out_w;
+	int size, stride, pad;
+
+	int k;					// in_c * size * size
+	int k_padded;			// rows of the weights are zero-padded to a multiple of 32 bytes
+
+	int8_t * weights;		// [out_c][k_padded]
+	int32_t * weight_sums;	// [out_c]
+	float * multipliers;	// [out_c]: weight scale * (folded) batchnorm scale
+	float * biases;			// [out_c]
+	float input_scale;		// <= 0: dynamic
+}int8_conv_t;
+
+/*
+ * weights: float32 [out_c][in_c][size][size] (darknet layout)
+ * scales: per-channel factors applied after the convolution (folded batchnorm), NULL: 1.0
+ * biases: NULL: 0
+ */
+int8_conv_t * int8_conv_init(int8_conv_t * conv, int in_c, int in_h, int in_w,
+	int out_c, int size, int stride, int pad,
+	const float * weights, const float * scales, const float * biases);
+void int8_conv_cleanup(int8_conv_t * conv);
+
+typedef struct int8_conv_scratch
+{
+	size_t size;
+	void * data;
+}int8_conv_scratch_t;
+void int8_conv_scratch_cleanup(int8_conv_scratch_t * scratch);
+
+/*
+ * input: float32 [in_c][in_h][in_w], output: float32 [out_c][out_h * out_w] (before the activation)
+ * the scratch buffer only grows, so the steady state does not allocate.
+ */
+void int8_conv_forward(const int8_conv_t * conv, const float * input, float * output, int8_conv_scratch_t * scratch);
+
+float int8_max_abs(const float * data, ssize_t count);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
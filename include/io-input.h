@@ -48,6 +48,10 @@ typedef struct io_input
 	long (* get_frame)(struct io_input * input, long prev_frame, input_frame_t * frame);
 	long (* set_frame)(struct io_input * input, const input_frame_t * frame);
 	
+	// zero-copy access to the latest frame: the frame stays valid until release_frame() is called
+	long (* get_frame_ref)(struct io_input * input, long prev_frame, const input_frame_t ** p_frame);
+	void (* release_frame)(struct io_input * input, const input_frame_t * frame);
+	
 	// user-defined callbacks
 	int (* on_new_frame)(struct io_input * input, const input_frame_t * frame);
 
@@ -57,6 +61,8 @@ typedef struct io_input
 
 io_input_t * io_input_init(io_input_t * input, const char * sz_type, void * user_data);
 void io_input_cleanup(io_input_t * input);
+int io_input_set_frame_slots(io_input_t * input, int num_slots);	// frame_buffer size, (call before run)
+long io_input_get_frames_dropped(io_input_t * input);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,61 @@
+#ifndef _JPEG_ENCODER_H_
+#define _JPEG_ENCODER_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "img_proc.h"
+
+/**
+ * @ingroup jpeg_encoder
+ * @{
+ *
+ * jpeg_encoder: a pool of libjpeg compressors shared by the outputs.
+ *
+ * A frame is cut into horizontal slices (whole MCU rows), the slices are encoded in parallel
+ * with a restart interval of one slice, and their entropy-coded segments are joined with RSTn markers:
+ * the result is one baseline JPEG (with a DRI marker), byte-identical to a single-threaded encode
+ * with the same restart interval.
+ *
+ * The compressors and the slice buffers are reused; any thread may call jpeg_encoder_encode(),
+ * the slices of concurrent frames share the workers.
+ */
+typedef struct jpeg_encoder jpeg_encoder_t;
+
+enum jpeg_subsampling
+{
+	jpeg_subsampling_444 = 0,
+	jpeg_subsampling_422,
+	jpeg_subsampling_420,
+};
+
+typedef struct jpeg_encode_params
+{
+	int quality;						// 1 ~ 100, default 95
+	enum jpeg_subsampling subsampling;	// default 4:2:0
+	int max_slices;						// 0: one slice per worker, 1: no restart markers
+}jpeg_encode_params_t;
+void jpeg_encode_params_init(jpeg_encode_params_t * params);	// defaults
+
+jpeg_encoder_t * jpeg_encoder_new(int num_workers);		// num_workers <= 0: one per cpu core
+void jpeg_encoder_free(jpeg_encoder_t * encoder);
+jpeg_encoder_t * jpeg_encoder_get_default(void);		// shared by the process, never freed
+
+/*
+ * image: BGRA (stride 0: width * 4), params: NULL: defaults
+ * p_jpeg / p_capacity: the output buffer, reused and grown with realloc() (*p_jpeg may be NULL)
+ * return the length of the jpeg stream, or -1 on error
+ */
+ssize_t jpeg_encoder_encode(jpeg_encoder_t * encoder, const bgra_image_t * image, const jpeg_encode_params_t * params,
+	unsigned char ** p_jpeg, size_t * p_capacity);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,68 @@
+#ifndef _MOTION_GATE_H_
+#define _MOTION_GATE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "img_proc.h"
+
+/**
+ * @ingroup motion_gate
+ * @{
+ *
+ * motion_gate: decide whether a frame of a fixed camera has to be predicted.
+ *
+ * - the BGRA frame is reduced to a small grayscale image (box average, about @width pixels per row),
+ * - compared with the frame of the last inference: pixels which differ by more than pixel_thresh,
+ *   motion when their fraction reaches change_ratio,
+ * - after a motion, @cooldown more frames are predicted (the objects settle down),
+ *   and an unchanged scene is still predicted every @max_skipped frames.
+ *
+ * the kernels follow img_preprocess_get_simd_level(). one gate per stream, not thread-safe.
+ */
+typedef struct motion_gate motion_gate_t;
+
+typedef struct motion_gate_params
+{
+	int width;				// width of the grayscale image, default 160
+	int pixel_thresh;		// gray level difference (0 ~ 255) of a changed pixel, default 20
+	double change_ratio;	// fraction of changed pixels, default 0.002
+	int cooldown;			// frames predicted after the last motion, default 5
+	int max_skipped;		// refresh an unchanged scene after this many frames, <= 0: never, default 150
+}motion_gate_params_t;
+void motion_gate_params_init(motion_gate_params_t * params);	// defaults
+
+typedef struct motion_gate_stats
+{
+	long frames;
+	long predicted;
+	long skipped;
+	double last_ratio;		// fraction of changed pixels of the last frame
+}motion_gate_stats_t;
+
+motion_gate_t * motion_gate_new(const motion_gate_params_t * params);	// params: NULL: defaults
+void motion_gate_free(motion_gate_t * gate);
+
+/*
+ * return 1 if the frame has to be predicted, 0 if the results of the last inference are still valid,
+ * -1 on error (invalid image).
+ */
+int motion_gate_update(motion_gate_t * gate, const bgra_image_t * image);
+void motion_gate_reset(motion_gate_t * gate);		// the next frame will be predicted
+void motion_gate_get_stats(const motion_gate_t * gate, motion_gate_stats_t * stats);
+
+// kernels (exported for the tests)
+void motion_gate_luma_row(const unsigned char * bgra, int width, uint16_t * sums, enum img_simd_level level);	// sums[x] += gray(x)
+ssize_t motion_gate_count_changed(const unsigned char * a, const unsigned char * b, ssize_t count, int thresh, enum img_simd_level level);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -52,6 +52,7 @@ typedef struct app_timer
 }app_timer_t;
 double app_timer_start(app_timer_t * timer);
 double app_timer_stop(app_timer_t * timer);
+double app_timer_get_time(void);	// CLOCK_MONOTONIC, in seconds
 void global_timer_start();
 void global_timer_stop(const char * prefix);
 
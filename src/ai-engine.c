@@ -96,6 +96,45 @@ int ai_tensor_resize(ai_tensor_t * tensor, const int_dim4 * size)
 	return 0;
 }
 
+static int ai_engine_predict_batch_default(ai_engine_t * engine, const input_frame_t * frames[], int count, json_object * results[])
+{
+	// fallback: one frame at a time
+	if(NULL == engine->predict || NULL == frames) return -1;
+	
+	int num_results = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		results[i] = NULL;
+		int rc = engine->predict(engine, frames[i], &results[i]);
+		if(0 == rc && results[i]) ++num_results;
+	}
+	return num_results;
+}
+
+int ai_engine_predict_batch(ai_engine_t * engine, const input_frame_t * frames[], int count, json_object * results[])
+{
+	assert(engine && results);
+	if(count <= 0) return 0;
+	
+	if(NULL == frames) {	// in-place input
+		if(NULL == engine->get_workspace || NULL == engine->get_workspace(engine)) return -1;
+		return engine->predict_batch?engine->predict_batch(engine, NULL, count, results):-1;
+	}
+	
+	if(engine->predict_batch) return engine->predict_batch(engine, frames, count, results);
+	return ai_engine_predict_batch_default(engine, frames, count, results);
+}
+
+int ai_engine_predict_detections(ai_engine_t * engine, const input_frame_t * frames[], int count, ai_detections_t results[])
+{
+	assert(engine && results);
+	if(count <= 0) return 0;
+	if(NULL == engine->predict_detections) return -1;
+	
+	if(NULL == frames && (NULL == engine->get_workspace || NULL == engine->get_workspace(engine))) return -1;
+	return engine->predict_detections(engine, frames, count, results);
+}
+
 ai_engine_t * ai_engine_init(ai_engine_t * engine, const char * plugin_type, void * user_data)
 {
 	if(NULL == plugin_type) plugin_type = "ai-engine::darknet";
@@ -114,6 +153,7 @@ ai_engine_t * ai_engine_init(ai_engine_t * engine, const char * plugin_type, voi
 
 	engine->user_data = user_data;
 	engine->init = plugin->init_func;
+	engine->predict_batch = ai_engine_predict_batch_default;	// overrided by plugins which support batching
 	
 	return engine;
 }
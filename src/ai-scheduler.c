@@ -0,0 +1,500 @@
+/*
+ * ai-scheduler.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include "ai-scheduler.h"
+#include "utils.h"
+
+#define AI_SCHEDULER_MAX_BATCH	(256)
+#define AI_SCHEDULER_MAX_WORKERS	(256)
+
+typedef struct ai_request
+{
+	input_frame_t * frame;
+	int priority;
+	double deadline;		// absolute (monotonic) time, 0: no deadline
+	double submit_time;
+	long seq;
+
+	ai_request_callback callback;
+	ai_detections_callback on_detections;	// native results, used instead of callback if set
+	void * user_data;
+}ai_request_t;
+
+typedef struct ai_scheduler_worker
+{
+	struct ai_scheduler * scheduler;
+	ai_engine_t * engine;		// owned by this worker exclusively
+	int index;
+	pthread_t th;
+
+	int omp_threads;			// applied by the worker itself (a per-thread setting of OpenMP), 0: unchanged
+	int omp_threads_applied;
+}ai_scheduler_worker_t;
+
+struct ai_scheduler
+{
+	int max_batch;
+	double max_delay;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+
+	int num_workers;
+	ai_scheduler_worker_t * workers;
+
+	/* priority queue (binary heap) */
+	int max_queue;
+	int count;
+	ai_request_t ** heap;
+	long seq;
+
+	/* stats, protected by the mutex */
+	long requests_submitted;
+	long requests_rejected;
+	long requests_expired;
+	long batches;
+	long frames_predicted;
+	double queue_delay;			// accumulated
+	double predict_time;		// accumulated
+	double est_predict_time;	// moving average, used to dispatch before the deadlines
+};
+
+/*
+ * ai_request_before(a, b): a should be served first
+ *   higher priority > earlier deadline > arrival order
+ */
+static inline int ai_request_before(const ai_request_t * a, const ai_request_t * b)
+{
+	if(a->priority != b->priority) return a->priority > b->priority;
+	if(a->deadline != b->deadline)
+	{
+		if(a->deadline <= 0) return 0;
+		if(b->deadline <= 0) return 1;
+		return a->deadline < b->deadline;
+	}
+	return a->seq < b->seq;
+}
+
+/* scheduler->mutex locked */
+static void heap_push(ai_scheduler_t * scheduler, ai_request_t * request)
+{
+	assert(scheduler->count < scheduler->max_queue);
+	ai_request_t ** heap = scheduler->heap;
+	int i = scheduler->count++;
+	while(i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if(!ai_request_before(request, heap[parent])) break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = request;
+}
+
+static ai_request_t * heap_pop(ai_scheduler_t * scheduler)
+{
+	if(scheduler->count <= 0) return NULL;
+	ai_request_t ** heap = scheduler->heap;
+	ai_request_t * top = heap[0];
+	ai_request_t * last = heap[--scheduler->count];
+
+	int count = scheduler->count;
+	int i = 0;
+	while(1)
+	{
+		int child = i * 2 + 1;
+		if(child >= count) break;
+		if((child + 1) < count && ai_request_before(heap[child + 1], heap[child])) ++child;
+		if(!ai_request_before(heap[child], last)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	if(count > 0) heap[i] = last;
+	return top;
+}
+
+static void ai_request_complete(ai_request_t * request, enum ai_request_status status, json_object * jresult)
+{
+	if(request->on_detections) {
+		request->on_detections(request->user_data, request->frame, 
+			(status == ai_request_status_ok)?ai_request_status_failed:status, NULL);	// no native results
+		if(jresult) json_object_put(jresult);
+	}
+	else if(request->callback) request->callback(request->user_data, request->frame, status, jresult);
+	else if(jresult) json_object_put(jresult);
+
+	input_frame_unref(request->frame);
+	free(request);
+}
+
+static void ai_request_complete_detections(ai_request_t * request, enum ai_request_status status, const ai_detections_t * detections)
+{
+	if(status != ai_request_status_ok) detections = NULL;
+	if(request->on_detections) request->on_detections(request->user_data, request->frame, status, detections);
+	else if(request->callback)
+	{
+		// json is only built for the requests which need it (no detections: NULL, the same as predict_batch)
+		json_object * jresult = (detections && detections->count > 0)?ai_detections_to_json(detections):NULL;
+		request->callback(request->user_data, request->frame, status, jresult);
+	}
+
+	input_frame_unref(request->frame);
+	free(request);
+}
+
+/* scheduler->mutex locked, return the time (monotonic) when the pending requests should be dispatched */
+static double ai_scheduler_get_flush_time(ai_scheduler_t * scheduler)
+{
+	double oldest = 0;
+	double earliest_deadline = 0;
+	for(int i = 0; i < scheduler->count; ++i)
+	{
+		const ai_request_t * request = scheduler->heap[i];
+		if(oldest == 0 || request->submit_time < oldest) oldest = request->submit_time;
+		if(request->deadline > 0 && (earliest_deadline == 0 || request->deadline < earliest_deadline))
+			earliest_deadline = request->deadline;
+	}
+
+	double flush_time = oldest + scheduler->max_delay;
+	if(earliest_deadline > 0)
+	{
+		// leave enough time for the prediction itself
+		double due_time = earliest_deadline - scheduler->est_predict_time;
+		if(due_time < flush_time) flush_time = due_time;
+	}
+	return flush_time;
+}
+
+/*
+ * omp_set_num_threads() is resolved at runtime,
+ * so that the scheduler does not depend on OpenMP when no plugin uses it.
+ */
+static void worker_apply_omp_threads(ai_scheduler_worker_t * worker)
+{
+	int omp_threads = __atomic_load_n(&worker->omp_threads, __ATOMIC_RELAXED);
+	if(omp_threads <= 0 || omp_threads == worker->omp_threads_applied) return;
+
+	void (* set_num_threads)(int) = (void (*)(int))dlsym(RTLD_DEFAULT, "omp_set_num_threads");
+	if(set_num_threads) set_num_threads(omp_threads);
+	worker->omp_threads_applied = omp_threads;
+	debug_printf("worker[%d]: omp_threads=%d%s", worker->index, omp_threads, set_num_threads?"":" (OpenMP not loaded)");
+}
+
+static void * ai_scheduler_dispatch_thread(void * user_data)
+{
+	ai_scheduler_worker_t * worker = user_data;
+	assert(worker && worker->scheduler);
+	ai_scheduler_t * scheduler = worker->scheduler;
+	ai_engine_t * engine = worker->engine;
+
+	const int max_batch = scheduler->max_batch;
+	ai_request_t * batch[max_batch];
+	ai_request_t * expired[max_batch];
+	const input_frame_t * frames[max_batch];
+	json_object * results[max_batch];
+	ai_detections_t detections[max_batch];	// reused by every batch
+	memset(detections, 0, sizeof(detections));
+
+	pthread_mutex_lock(&scheduler->mutex);
+	while(!scheduler->quit)
+	{
+		if(scheduler->count == 0)
+		{
+			pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+			continue;
+		}
+
+		double now = app_timer_get_time();
+		if(scheduler->count < max_batch)
+		{
+			double flush_time = ai_scheduler_get_flush_time(scheduler);
+			if(now < flush_time)
+			{
+				struct timespec timeout = {
+					.tv_sec = (time_t)flush_time,
+					.tv_nsec = (long)((flush_time - (double)(time_t)flush_time) * 1000000000.0),
+				};
+				pthread_cond_timedwait(&scheduler->cond, &scheduler->mutex, &timeout);
+				continue;
+			}
+		}
+
+		int count = 0;
+		int num_expired = 0;
+		double queue_delay = 0;
+		while(count < max_batch && num_expired < max_batch)
+		{
+			ai_request_t * request = heap_pop(scheduler);
+			if(NULL == request) break;
+			if(request->deadline > 0 && request->deadline < now) {
+				expired[num_expired++] = request;
+				continue;
+			}
+			queue_delay += now - request->submit_time;
+			frames[count] = request->frame;
+			results[count] = NULL;
+			batch[count++] = request;
+		}
+		scheduler->requests_expired += num_expired;
+		if(scheduler->count > 0) pthread_cond_signal(&scheduler->cond);	// let an idle worker take the rest
+		pthread_mutex_unlock(&scheduler->mutex);
+
+		for(int i = 0; i < num_expired; ++i) ai_request_complete(expired[i], ai_request_status_expired, NULL);
+
+		double predict_time = 0;
+		if(count > 0)
+		{
+			worker_apply_omp_threads(worker);
+			int native = (NULL != engine->predict_detections);
+			int rc = native?ai_engine_predict_detections(engine, frames, count, detections)
+				:ai_engine_predict_batch(engine, frames, count, results);
+			predict_time = app_timer_get_time() - now;
+
+			debug_printf("%s(): worker[%d]: batch_size=%d, rc=%d, time_elapsed=%.3f ms", __FUNCTION__,
+				worker->index, count, rc, predict_time * 1000);
+
+			enum ai_request_status status = (rc < 0)?ai_request_status_failed:ai_request_status_ok;
+			for(int i = 0; i < count; ++i)
+			{
+				if(native) ai_request_complete_detections(batch[i], status, &detections[i]);
+				else ai_request_complete(batch[i], status, results[i]);
+			}
+		}
+
+		pthread_mutex_lock(&scheduler->mutex);
+		if(count > 0)
+		{
+			++scheduler->batches;
+			scheduler->frames_predicted += count;
+			scheduler->queue_delay += queue_delay;
+			scheduler->predict_time += predict_time;
+			scheduler->est_predict_time = (scheduler->est_predict_time > 0)?
+				(scheduler->est_predict_time * 0.75 + predict_time * 0.25):predict_time;
+		}
+	}
+
+	pthread_mutex_unlock(&scheduler->mutex);
+	for(int i = 0; i < max_batch; ++i) ai_detections_cleanup(&detections[i]);
+	pthread_exit((void *)(long)0);
+}
+
+ai_scheduler_t * ai_scheduler_new(ai_engine_t * engine, int max_batch, double max_delay, int max_queue)
+{
+	assert(engine);
+	return ai_scheduler_new_pool(&engine, 1, max_batch, max_delay, max_queue);
+}
+
+ai_scheduler_t * ai_scheduler_new_pool(ai_engine_t * engines[], int num_engines, int max_batch, double max_delay, int max_queue)
+{
+	assert(engines && num_engines > 0);
+	if(num_engines > AI_SCHEDULER_MAX_WORKERS) return NULL;
+	if(max_batch <= 0) max_batch = 1;
+	if(max_batch > AI_SCHEDULER_MAX_BATCH) max_batch = AI_SCHEDULER_MAX_BATCH;
+	if(max_delay < 0) max_delay = 0;
+	if(max_queue <= 0) max_queue = max_batch * 16;
+	if(max_queue < max_batch) max_queue = max_batch;
+
+	ai_scheduler_t * scheduler = calloc(1, sizeof(*scheduler));
+	assert(scheduler);
+
+	scheduler->max_batch = max_batch;
+	scheduler->max_delay = max_delay;
+	scheduler->max_queue = max_queue;
+	scheduler->heap = calloc(max_queue, sizeof(*scheduler->heap));
+	assert(scheduler->heap);
+
+	pthread_mutex_init(&scheduler->mutex, NULL);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&scheduler->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	scheduler->workers = calloc(num_engines, sizeof(*scheduler->workers));
+	assert(scheduler->workers);
+	scheduler->num_workers = num_engines;
+	for(int i = 0; i < num_engines; ++i)
+	{
+		ai_scheduler_worker_t * worker = &scheduler->workers[i];
+		assert(engines[i]);
+		worker->scheduler = scheduler;
+		worker->engine = engines[i];
+		worker->index = i;
+		int rc = pthread_create(&worker->th, NULL, ai_scheduler_dispatch_thread, worker);
+		assert(0 == rc);
+	}
+
+	debug_printf("%s(): workers=%d, max_batch=%d, max_delay=%.3f ms, max_queue=%d", __FUNCTION__,
+		num_engines, max_batch, max_delay * 1000, max_queue);
+	return scheduler;
+}
+
+int ai_scheduler_get_workers(ai_scheduler_t * scheduler)
+{
+	assert(scheduler);
+	return scheduler->num_workers;
+}
+
+int ai_scheduler_has_native_detections(ai_scheduler_t * scheduler)
+{
+	assert(scheduler);
+	for(int i = 0; i < scheduler->num_workers; ++i)
+	{
+		if(NULL == scheduler->workers[i].engine->predict_detections) return 0;
+	}
+	return 1;
+}
+
+int ai_scheduler_set_worker_affinity(ai_scheduler_t * scheduler, int index, int cpu, int omp_threads)
+{
+	assert(scheduler);
+	if(index < 0 || index >= scheduler->num_workers) return -1;
+	ai_scheduler_worker_t * worker = &scheduler->workers[index];
+
+	if(omp_threads > 0) __atomic_store_n(&worker->omp_threads, omp_threads, __ATOMIC_RELAXED);
+	if(cpu < 0) return 0;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	int rc = pthread_setaffinity_np(worker->th, sizeof(cpus), &cpus);
+	if(rc) {
+		fprintf(stderr, "[WARNING]::%s(): worker[%d] can not be pinned on cpu %d, err_code=%d\n",
+			__FUNCTION__, index, cpu, rc);
+		return -1;
+	}
+	return 0;
+}
+
+void ai_scheduler_free(ai_scheduler_t * scheduler)
+{
+	if(NULL == scheduler) return;
+
+	pthread_mutex_lock(&scheduler->mutex);
+	scheduler->quit = 1;
+	pthread_cond_broadcast(&scheduler->cond);
+	pthread_mutex_unlock(&scheduler->mutex);
+
+	for(int i = 0; i < scheduler->num_workers; ++i)
+	{
+		void * exit_code = NULL;
+		pthread_join(scheduler->workers[i].th, &exit_code);
+	}
+	free(scheduler->workers);
+
+	// cancel all pending requests
+	for(int i = 0; i < scheduler->count; ++i) ai_request_complete(scheduler->heap[i], ai_request_status_cancelled, NULL);
+	scheduler->count = 0;
+
+	pthread_cond_destroy(&scheduler->cond);
+	pthread_mutex_destroy(&scheduler->mutex);
+	free(scheduler->heap);
+	free(scheduler);
+}
+
+static int ai_scheduler_push(ai_scheduler_t * scheduler, input_frame_t * frame,
+	enum ai_request_priority priority, double deadline, ai_request_t * request)
+{
+	assert(scheduler && frame && request);
+	if(priority < 0) priority = ai_request_priority_backfill;
+	if(priority >= ai_request_priorities_count) priority = ai_request_priorities_count - 1;
+
+	request->priority = priority;
+	request->submit_time = app_timer_get_time();
+	request->deadline = (deadline > 0)?(request->submit_time + deadline):0;
+
+	pthread_mutex_lock(&scheduler->mutex);
+	if(scheduler->quit || scheduler->count >= scheduler->max_queue)
+	{
+		++scheduler->requests_rejected;
+		pthread_mutex_unlock(&scheduler->mutex);
+		free(request);
+		return -1;
+	}
+
+	request->frame = input_frame_ref(frame);
+	request->seq = scheduler->seq++;
+	heap_push(scheduler, request);
+	++scheduler->requests_submitted;
+
+	// wake up the dispatcher: a full batch, or a new deadline may be earlier than its current timeout
+	pthread_cond_signal(&scheduler->cond);
+	pthread_mutex_unlock(&scheduler->mutex);
+	return 0;
+}
+
+int ai_scheduler_submit(ai_scheduler_t * scheduler, input_frame_t * frame,
+	enum ai_request_priority priority, double deadline,
+	ai_request_callback callback, void * user_data)
+{
+	ai_request_t * request = calloc(1, sizeof(*request));
+	assert(request);
+	request->callback = callback;
+	request->user_data = user_data;
+	return ai_scheduler_push(scheduler, frame, priority, deadline, request);
+}
+
+int ai_scheduler_submit_detections(ai_scheduler_t * scheduler, input_frame_t * frame,
+	enum ai_request_priority priority, double deadline,
+	ai_detections_callback callback, void * user_data)
+{
+	ai_request_t * request = calloc(1, sizeof(*request));
+	assert(request);
+	request->on_detections = callback;
+	request->user_data = user_data;
+	return ai_scheduler_push(scheduler, frame, priority, deadline, request);
+}
+
+void ai_scheduler_get_stats(ai_scheduler_t * scheduler, ai_scheduler_stats_t * stats)
+{
+	assert(scheduler && stats);
+	pthread_mutex_lock(&scheduler->mutex);
+	stats->requests_submitted = scheduler->requests_submitted;
+	stats->requests_rejected = scheduler->requests_rejected;
+	stats->requests_expired = scheduler->requests_expired;
+	stats->batches = scheduler->batches;
+	stats->frames_predicted = scheduler->frames_predicted;
+
+	stats->avg_batch_size = (scheduler->batches > 0)?
+		((double)scheduler->frames_predicted / (double)scheduler->batches):0;
+	stats->avg_queue_delay = (scheduler->frames_predicted > 0)?
+		(scheduler->queue_delay / (double)scheduler->frames_predicted):0;
+	stats->avg_predict_time = (scheduler->batches > 0)?
+		(scheduler->predict_time / (double)scheduler->batches):0;
+	pthread_mutex_unlock(&scheduler->mutex);
+	return;
+}
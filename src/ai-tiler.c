@@ -0,0 +1,499 @@
+/*
+ * ai-tiler.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "ai-tiler.h"
+#include "img_proc.h"
+#include "utils.h"
+
+#define AI_TILER_GRID			(8)		// luma cells per tile side
+#define AI_TILER_SAMPLE_STEP	(4)		// pixels between two samples of a cell
+#define AI_TILER_EDGE_MARGIN	(2.0f)	// a box closer than this to a tile edge was cut by the edge
+
+typedef struct ai_tile
+{
+	int x, y, width, height;
+
+	int has_signature;
+	int skipped;					// frames since the last inference
+	float signature[AI_TILER_GRID * AI_TILER_GRID];	// mean luma of each cell at the last inference
+
+	ai_detections_t boxes[1];		// boxes of the last inference, in frame pixels
+}ai_tile_t;
+
+struct ai_tiler
+{
+	ai_tiler_params_t params;
+	ai_tiler_stats_t stats;
+
+	// grid of the last frame, rebuilt when the frame (or the tile) size changes
+	int frame_width, frame_height;
+	int tile_width, tile_height;	// requested size
+	int overlap_x, overlap_y;		// actual overlap of the neighbours, in pixels
+	int num_tiles;					// 0: the frame is predicted as a whole
+	ai_tile_t * tiles;				// [num_tiles + 1], tiles[num_tiles]: the whole frame
+
+	// per inference
+	input_frame_t * views;			// [num_tiles + 1]
+	const input_frame_t ** frames;
+	ai_detections_t * results;
+	int * run_index;				// results[i] --> tiles[run_index[i]]
+
+	ai_nms_context_t * nms;
+	ssize_t candidates_capacity;
+	ai_nms_box_t * candidates;
+
+	// label table of the engine (copied into the results)
+	const char * model;
+	int num_labels;
+	const char * const * labels;
+};
+
+void ai_tiler_params_init(ai_tiler_params_t * params)
+{
+	assert(params);
+	memset(params, 0, sizeof(*params));
+	params->overlap = 0.2f;
+	params->max_tiles = 16;
+	params->full_frame = 1;
+	params->nms_thresh = 0.45f;
+	params->change_thresh = 6.0f;
+	params->max_skipped = 30;
+	params->relative = 1;
+}
+
+ai_tiler_t * ai_tiler_new(const ai_tiler_params_t * params)
+{
+	ai_tiler_t * tiler = calloc(1, sizeof(*tiler));
+	assert(tiler);
+
+	if(params) tiler->params = *params;
+	else ai_tiler_params_init(&tiler->params);
+
+	if(tiler->params.overlap < 0) tiler->params.overlap = 0;
+	if(tiler->params.overlap > 0.5f) tiler->params.overlap = 0.5f;
+	if(tiler->params.max_tiles < 1) tiler->params.max_tiles = 1;
+
+	tiler->nms = ai_nms_context_new();
+	return tiler;
+}
+
+static void ai_tiler_clear_grid(ai_tiler_t * tiler)
+{
+	if(tiler->tiles) {
+		for(int i = 0; i <= tiler->num_tiles; ++i) ai_detections_cleanup(tiler->tiles[i].boxes);
+		free(tiler->tiles);
+		tiler->tiles = NULL;
+	}
+	if(tiler->results) {
+		for(int i = 0; i <= tiler->num_tiles; ++i) ai_detections_cleanup(&tiler->results[i]);
+		free(tiler->results);
+		tiler->results = NULL;
+	}
+	free(tiler->views);
+	free(tiler->frames);
+	free(tiler->run_index);
+	tiler->views = NULL;
+	tiler->frames = NULL;
+	tiler->run_index = NULL;
+	tiler->num_tiles = 0;
+	tiler->frame_width = 0;
+	tiler->frame_height = 0;
+}
+
+void ai_tiler_free(ai_tiler_t * tiler)
+{
+	if(NULL == tiler) return;
+	ai_tiler_clear_grid(tiler);
+	ai_nms_context_free(tiler->nms);
+	free(tiler->candidates);
+	free(tiler);
+}
+
+void ai_tiler_get_stats(const ai_tiler_t * tiler, ai_tiler_stats_t * stats)
+{
+	assert(tiler && stats);
+	*stats = tiler->stats;
+}
+
+/******************************************************************************
+ * grid
+ *****************************************************************************/
+static inline int grid_count(int size, int tile, int step)
+{
+	if(size <= tile) return 1;
+	return (size - tile + step - 1) / step + 1;
+}
+
+static void ai_tiler_layout(ai_tiler_t * tiler, int width, int height, int tile_width, int tile_height)
+{
+	if(tiler->tiles && width == tiler->frame_width && height == tiler->frame_height
+		&& tile_width == tiler->tile_width && tile_height == tiler->tile_height) return;
+
+	ai_tiler_clear_grid(tiler);
+
+	// the tiles grow until the grid fits in max_tiles
+	int tw = tile_width, th = tile_height;
+	int cols = 1, rows = 1;
+	for(;;)
+	{
+		if(tw > width) tw = width;
+		if(th > height) th = height;
+		int step_x = (int)(tw * (1.0f - tiler->params.overlap));
+		int step_y = (int)(th * (1.0f - tiler->params.overlap));
+		if(step_x < 1) step_x = 1;
+		if(step_y < 1) step_y = 1;
+
+		cols = grid_count(width, tw, step_x);
+		rows = grid_count(height, th, step_y);
+		if(cols * rows <= tiler->params.max_tiles) break;
+		tw = tw * 5 / 4 + 1;
+		th = th * 5 / 4 + 1;
+	}
+
+	int num_tiles = (cols * rows > 1)?(cols * rows):0;
+	tiler->tiles = calloc(num_tiles + 1, sizeof(*tiler->tiles));
+	tiler->results = calloc(num_tiles + 1, sizeof(*tiler->results));
+	tiler->views = calloc(num_tiles + 1, sizeof(*tiler->views));
+	tiler->frames = calloc(num_tiles + 1, sizeof(*tiler->frames));
+	tiler->run_index = calloc(num_tiles + 1, sizeof(*tiler->run_index));
+	assert(tiler->tiles && tiler->results && tiler->views && tiler->frames && tiler->run_index);
+
+	// evenly spread: the actual overlap is at least the requested one
+	for(int row = 0; row < rows && num_tiles > 0; ++row)
+	{
+		for(int col = 0; col < cols; ++col)
+		{
+			ai_tile_t * tile = &tiler->tiles[row * cols + col];
+			tile->x = (cols > 1)?(int)((int64_t)(width - tw) * col / (cols - 1)):0;
+			tile->y = (rows > 1)?(int)((int64_t)(height - th) * row / (rows - 1)):0;
+			tile->width = tw;
+			tile->height = th;
+		}
+	}
+	ai_tile_t * whole = &tiler->tiles[num_tiles];
+	whole->x = 0;
+	whole->y = 0;
+	whole->width = width;
+	whole->height = height;
+
+	for(int i = 0; i <= num_tiles; ++i) {
+		ai_detections_init(tiler->tiles[i].boxes, 0);
+		ai_detections_init(&tiler->results[i], 0);
+	}
+
+	tiler->num_tiles = num_tiles;
+	tiler->frame_width = width;
+	tiler->frame_height = height;
+	tiler->tile_width = tile_width;
+	tiler->tile_height = tile_height;
+	tiler->overlap_x = (cols > 1)?(tw - (width - tw) / (cols - 1)):0;
+	tiler->overlap_y = (rows > 1)?(th - (height - th) / (rows - 1)):0;
+
+	debug_printf("%s(): frame %d x %d, %d x %d tiles of %d x %d, overlap %d x %d", __FUNCTION__,
+		width, height, cols, rows, tw, th, tiler->overlap_x, tiler->overlap_y);
+}
+
+/******************************************************************************
+ * frame difference
+ *****************************************************************************/
+/* mean luma of each cell, sampled every AI_TILER_SAMPLE_STEP pixels */
+static void tile_signature(const bgra_image_t * image, int stride, const ai_tile_t * tile, float signature[])
+{
+	for(int gy = 0; gy < AI_TILER_GRID; ++gy)
+	{
+		int y0 = tile->y + tile->height * gy / AI_TILER_GRID;
+		int y1 = tile->y + tile->height * (gy + 1) / AI_TILER_GRID;
+		for(int gx = 0; gx < AI_TILER_GRID; ++gx)
+		{
+			int x0 = tile->x + tile->width * gx / AI_TILER_GRID;
+			int x1 = tile->x + tile->width * (gx + 1) / AI_TILER_GRID;
+
+			uint32_t sum = 0, count = 0;
+			for(int y = y0; y < y1; y += AI_TILER_SAMPLE_STEP)
+			{
+				const unsigned char * p = image->data + (ssize_t)stride * y + x0 * 4;
+				for(int x = x0; x < x1; x += AI_TILER_SAMPLE_STEP, p += AI_TILER_SAMPLE_STEP * 4)
+				{
+					sum += (p[0] * 29 + p[1] * 150 + p[2] * 77) >> 8;	// B, G, R
+					++count;
+				}
+			}
+			signature[gy * AI_TILER_GRID + gx] = count?((float)sum / (float)count):0.0f;
+		}
+	}
+}
+
+/* update the signature of the tile, return 1 if the tile has to be predicted */
+static int tile_changed(const ai_tiler_t * tiler, const bgra_image_t * image, int stride, ai_tile_t * tile)
+{
+	float signature[AI_TILER_GRID * AI_TILER_GRID];
+	tile_signature(image, stride, tile, signature);
+
+	int changed = !tile->has_signature
+		|| tiler->params.change_thresh <= 0
+		|| tile->skipped >= tiler->params.max_skipped;
+	for(int i = 0; !changed && i < AI_TILER_GRID * AI_TILER_GRID; ++i)
+	{
+		if(fabsf(signature[i] - tile->signature[i]) > tiler->params.change_thresh) changed = 1;
+	}
+
+	// compared with the frame of the last inference, so that slow drifts add up
+	if(changed) {
+		memcpy(tile->signature, signature, sizeof(signature));
+		tile->has_signature = 1;
+	}
+	return changed;
+}
+
+/******************************************************************************
+ * predict
+ *****************************************************************************/
+/* keep the box unless it was cut by an inner edge of the tile and another pass can see it whole */
+static int keep_tile_box(const ai_tiler_t * tiler, const ai_tile_t * tile, float left, float top, float width, float height)
+{
+	const float margin = AI_TILER_EDGE_MARGIN;
+	const int full_frame = tiler->params.full_frame;
+
+	int cut_x = (tile->x > 0 && left <= margin)
+		|| (tile->x + tile->width < tiler->frame_width && left + width >= tile->width - margin);
+	int cut_y = (tile->y > 0 && top <= margin)
+		|| (tile->y + tile->height < tiler->frame_height && top + height >= tile->height - margin);
+
+	if(cut_x && (full_frame || width < tiler->overlap_x)) return 0;
+	if(cut_y && (full_frame || height < tiler->overlap_y)) return 0;
+	return 1;
+}
+
+static void ai_tiler_reserve_candidates(ai_tiler_t * tiler, ssize_t count)
+{
+	if(count <= tiler->candidates_capacity) return;
+	ssize_t capacity = tiler->candidates_capacity * 2;
+	if(capacity < count) capacity = count;
+	tiler->candidates = realloc(tiler->candidates, sizeof(*tiler->candidates) * capacity);
+	assert(tiler->candidates);
+	tiler->candidates_capacity = capacity;
+}
+
+static void set_bgra_view(input_frame_t * view, const bgra_image_t * image, int stride, const ai_tile_t * tile)
+{
+	memset(view, 0, sizeof(*view));
+	view->type = input_frame_type_bgra;
+	view->data = image->data + (ssize_t)stride * tile->y + tile->x * 4;
+	view->width = tile->width;
+	view->height = tile->height;
+	view->channels = 4;
+	view->stride = stride;
+	view->length = (ssize_t)stride * (tile->height - 1) + tile->width * 4;
+}
+
+/* frames which cannot be tiled */
+static int ai_tiler_predict_whole(ai_tiler_t * tiler, ai_engine_t * engine, const input_frame_t * frame, ai_detections_t * results)
+{
+	ai_detections_t detections[1];
+	memset(detections, 0, sizeof(detections));
+	int rc = ai_engine_predict_detections(engine, &frame, 1, detections);
+	if(rc > 0) {
+		results->model = detections->model;
+		results->num_labels = detections->num_labels;
+		results->labels = detections->labels;
+		rc = ai_detections_reserve(results, detections->count);
+		assert(0 == rc);
+		memcpy(results->boxes, detections->boxes, sizeof(*results->boxes) * detections->count);
+		results->count = detections->count;
+		++tiler->stats.tiles_predicted;
+	}
+	ai_detections_cleanup(detections);
+	++tiler->stats.frames;
+	return (rc < 0)?-1:0;
+}
+
+int ai_tiler_predict(ai_tiler_t * tiler, ai_engine_t * engine, const input_frame_t * frame, ai_detections_t * results)
+{
+	assert(tiler && engine && frame && results);
+	if(NULL == engine->predict_detections) return -1;
+	ai_detections_reset(results);
+
+	// BGRA source: the tiles are views of the frame
+	const bgra_image_t * image = NULL;
+	bgra_image_t decoded[1];
+	memset(decoded, 0, sizeof(decoded));
+	int type = frame->type & input_frame_type_image_masks;
+	if(type == input_frame_type_bgra && frame->channels != 3) image = frame->bgra;
+	else if(type == input_frame_type_jpeg || type == input_frame_type_png)
+	{
+		if(bgra_image_load_data(decoded, frame->data, frame->length) || NULL == decoded->data) {
+			bgra_image_clear(decoded);
+			return -1;
+		}
+		image = decoded;
+	}
+	if(NULL == image || NULL == image->data || image->width <= 0 || image->height <= 0) {
+		return ai_tiler_predict_whole(tiler, engine, frame, results);
+	}
+	int stride = (image->stride >= image->width * 4)?image->stride:(image->width * 4);
+
+	// tile size: twice the network input by default
+	int tile_width = tiler->params.tile_width, tile_height = tiler->params.tile_height;
+	if(tile_width <= 0 || tile_height <= 0)
+	{
+		ai_tensor_t * workspace = engine->get_workspace?engine->get_workspace(engine):NULL;
+		int net_width = (workspace && workspace->dim->w > 0)?workspace->dim->w:416;
+		int net_height = (workspace && workspace->dim->h > 0)?workspace->dim->h:416;
+		if(tile_width <= 0) tile_width = net_width * 2;
+		if(tile_height <= 0) tile_height = net_height * 2;
+	}
+	ai_tiler_layout(tiler, image->width, image->height, tile_width, tile_height);
+
+	// select the tiles to predict
+	const int num_tiles = tiler->num_tiles;
+	ai_tile_t * whole = &tiler->tiles[num_tiles];
+	int use_whole = (num_tiles == 0 || tiler->params.full_frame);
+	int num_runs = 0;
+	for(int i = 0; i < num_tiles; ++i)
+	{
+		ai_tile_t * tile = &tiler->tiles[i];
+		if(!tile_changed(tiler, image, stride, tile)) {
+			++tile->skipped;
+			++tiler->stats.tiles_skipped;
+			continue;
+		}
+		tile->skipped = 0;
+		tiler->run_index[num_runs++] = i;
+	}
+	if(use_whole)
+	{
+		// with tiles, the whole frame changed if any tile did
+		int changed = (num_tiles > 0)?(num_runs > 0 || whole->skipped >= tiler->params.max_skipped):tile_changed(tiler, image, stride, whole);
+		if(changed) {
+			whole->skipped = 0;
+			tiler->run_index[num_runs++] = num_tiles;
+		}else {
+			++whole->skipped;
+			++tiler->stats.tiles_skipped;
+		}
+	}
+
+	int rc = 0;
+	if(num_runs > 0)
+	{
+		for(int i = 0; i < num_runs; ++i) {
+			set_bgra_view(&tiler->views[i], image, stride, &tiler->tiles[tiler->run_index[i]]);
+			tiler->frames[i] = &tiler->views[i];
+		}
+		rc = ai_engine_predict_detections(engine, tiler->frames, num_runs, tiler->results);
+		tiler->stats.tiles_predicted += num_runs;
+	}
+
+	// map the boxes to the frame, (the tiles which were not predicted keep their previous boxes)
+	for(int i = 0; rc >= 0 && i < num_runs; ++i)
+	{
+		ai_tile_t * tile = &tiler->tiles[tiler->run_index[i]];
+		const ai_detections_t * detections = &tiler->results[i];
+		if(detections->labels) {
+			tiler->model = detections->model;
+			tiler->num_labels = detections->num_labels;
+			tiler->labels = detections->labels;
+		}
+
+		ai_detections_reset(tile->boxes);
+		for(ssize_t ii = 0; ii < detections->count; ++ii)
+		{
+			const ai_detection_box_t * src = &detections->boxes[ii];
+			float sx = tiler->params.relative?tile->width:1.0f;
+			float sy = tiler->params.relative?tile->height:1.0f;
+			float left = src->left * sx, top = src->top * sy;
+			float width = src->width * sx, height = src->height * sy;
+			if(tile != whole && !keep_tile_box(tiler, tile, left, top, width, height)) continue;
+
+			ai_detection_box_t * box = ai_detections_add(tile->boxes);
+			box->left = left + tile->x;
+			box->top = top + tile->y;
+			box->width = width;
+			box->height = height;
+			box->confidence = src->confidence;
+			box->class_index = src->class_index;
+		}
+	}
+
+	// global NMS of the boxes of every pass
+	ssize_t num_candidates = 0;
+	for(int i = 0; rc >= 0 && i <= num_tiles; ++i)
+	{
+		const ai_tile_t * tile = &tiler->tiles[i];
+		if(tile == whole && !use_whole) continue;
+
+		ai_tiler_reserve_candidates(tiler, num_candidates + tile->boxes->count);
+		for(ssize_t ii = 0; ii < tile->boxes->count; ++ii)
+		{
+			const ai_detection_box_t * box = &tile->boxes->boxes[ii];
+			ai_nms_box_t * candidate = &tiler->candidates[num_candidates++];
+			candidate->left = box->left;
+			candidate->top = box->top;
+			candidate->width = box->width;
+			candidate->height = box->height;
+			candidate->score = box->confidence;
+			candidate->class_index = box->class_index;
+			candidate->index = i;
+		}
+	}
+
+	if(rc >= 0)
+	{
+		ssize_t num_kept = ai_nms(tiler->nms, tiler->candidates, num_candidates, tiler->params.nms_thresh, 0);
+		results->model = tiler->model;
+		results->num_labels = tiler->num_labels;
+		results->labels = tiler->labels;
+		int ok = ai_detections_reserve(results, num_kept);
+		assert(0 == ok);
+
+		float sx = tiler->params.relative?(1.0f / image->width):1.0f;
+		float sy = tiler->params.relative?(1.0f / image->height):1.0f;
+		for(ssize_t i = 0; i < num_kept; ++i)
+		{
+			const ai_nms_box_t * candidate = &tiler->candidates[i];
+			ai_detection_box_t * box = &results->boxes[i];
+			box->left = candidate->left * sx;
+			box->top = candidate->top * sy;
+			box->width = candidate->width * sx;
+			box->height = candidate->height * sy;
+			box->confidence = candidate->score;
+			box->class_index = candidate->class_index;
+		}
+		results->count = num_kept;
+	}
+	++tiler->stats.frames;
+
+	bgra_image_clear(decoded);
+	return (rc < 0)?-1:0;
+}
+
+#undef AI_TILER_GRID
+#undef AI_TILER_SAMPLE_STEP
+#undef AI_TILER_EDGE_MARGIN
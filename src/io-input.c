@@ -52,82 +52,175 @@ enum io_input_type io_input_type_from_string(const char * sz_type)
 }
 
 // internal datatype
-typedef struct double_buffer double_buffer_t;
-struct double_buffer
+/*
+ * frame_ring: N-slot ring of frames (producer / multi-consumers)
+ *
+ * readers take a reference on the latest published slot and never wait for the producer;
+ * the producer only writes slots that are neither published as 'latest' nor referenced,
+ * if every slot is busy the new frame is dropped. (slow readers just skip frames)
+ *
+ * slot->refs:  number of readers, or FRAME_SLOT_WRITING while the producer owns the slot.
+ */
+#define IO_INPUT_DEFAULT_FRAME_SLOTS	(4)
+#define IO_INPUT_MAX_FRAME_SLOTS		(64)
+#define FRAME_SLOT_WRITING				(1L << 30)
+
+typedef struct frame_slot
 {
-	input_frame_t * frames[2];
-	pthread_mutex_t mutex;
+	input_frame_t frame[1];		// must be the first member ( released by frame pointer )
+	long seq;					// frame_number of the stored frame
+	long refs;
+}frame_slot_t;
+
+typedef struct frame_ring frame_ring_t;
+struct frame_ring
+{
+	int num_slots;
+	frame_slot_t * slots;
+	
+	long latest;				// index of the latest published slot, -1: empty
 	long frame_number;
-	long (* set)(double_buffer_t * dbuf, const input_frame_t * frame);
-	long (* get)(double_buffer_t * dbuf, input_frame_t * frame);
+	int next_slot;				// producer's cursor
+	long frames_dropped;
+	pthread_mutex_t mutex;		// serialize producers only (some plugins call set_frame from multiple threads)
+	
+	long (* set)(frame_ring_t * ring, const input_frame_t * frame);
+	long (* get)(frame_ring_t * ring, long prev_frame, input_frame_t * frame);
+	long (* acquire)(frame_ring_t * ring, long prev_frame, const input_frame_t ** p_frame);
+	void (* release)(frame_ring_t * ring, const input_frame_t * frame);
 };
 
-static void double_buffer_free(double_buffer_t * dbuf)
+static void frame_ring_free(frame_ring_t * ring)
 {
-	pthread_mutex_lock(&dbuf->mutex);
-	input_frame_free(dbuf->frames[0]);
-	input_frame_free(dbuf->frames[1]);
-	dbuf->frames[0] = NULL;
-	dbuf->frames[1] = NULL;
-	pthread_mutex_unlock(&dbuf->mutex);
-	pthread_mutex_destroy(&dbuf->mutex);
-	free(dbuf);
+	if(NULL == ring) return;
+	for(int i = 0; i < ring->num_slots; ++i)
+	{
+		assert(0 == ring->slots[i].refs);
+		input_frame_clear(ring->slots[i].frame);
+	}
+	free(ring->slots);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring);
 	return;
 }
 
-static long double_buffer_set(double_buffer_t * dbuf, const input_frame_t * frame)
+static long frame_ring_set(frame_ring_t * ring, const input_frame_t * frame)
 {
-	if(NULL == dbuf->frames[1]) return -1;
+	pthread_mutex_lock(&ring->mutex);
+	long latest = __atomic_load_n(&ring->latest, __ATOMIC_RELAXED);
 	
-	input_frame_copy(dbuf->frames[1], frame);
-	pthread_mutex_lock(&dbuf->mutex);
-
-	if(frame->frame_number > 0)
+	// find a free slot
+	frame_slot_t * slot = NULL;
+	int index = ring->next_slot;
+	for(int i = 0; i < ring->num_slots; ++i, index = (index + 1) % ring->num_slots)
 	{
-		dbuf->frame_number = frame->frame_number;
-	}else
+		if(index == latest) continue;
+		long refs = 0;
+		if(__atomic_compare_exchange_n(&ring->slots[index].refs, &refs, FRAME_SLOT_WRITING, 
+			0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			slot = &ring->slots[index];
+			break;
+		}
+	}
+	
+	if(NULL == slot)	// all slots are held by readers, drop this frame
 	{
-		++dbuf->frame_number;
+		__atomic_add_fetch(&ring->frames_dropped, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&ring->mutex);
+		return -1;
 	}
-	long frame_number = dbuf->frame_number;
+	ring->next_slot = (index + 1) % ring->num_slots;
+	
+	long frame_number = (frame->frame_number > 0)?frame->frame_number:(ring->frame_number + 1);
+	input_frame_copy(slot->frame, frame);
+	slot->frame->frame_number = frame_number;
+	slot->seq = frame_number;
+	
+	// publish: use fetch_sub (not store) to keep the transient increments of rejected readers balanced
+	__atomic_fetch_sub(&slot->refs, FRAME_SLOT_WRITING, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->frame_number, frame_number, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->latest, (long)index, __ATOMIC_RELEASE);
 	
-	input_frame_t * tmp = dbuf->frames[0];
-	dbuf->frames[0] = dbuf->frames[1];
-	dbuf->frames[1] = tmp;
-	pthread_mutex_unlock(&dbuf->mutex);
+	pthread_mutex_unlock(&ring->mutex);
 	return frame_number;
 }
 
-
-static long double_buffer_get(double_buffer_t * dbuf, input_frame_t * frame)
+static long frame_ring_acquire(frame_ring_t * ring, long prev_frame, const input_frame_t ** p_frame)
 {
-	if(NULL == dbuf->frames[0]) return -1;
-	if(NULL == frame) return dbuf->frame_number;	// query current frame_number only
-	
-	pthread_mutex_lock(&dbuf->mutex);
-	input_frame_copy(frame, dbuf->frames[0]);
-	if(dbuf->frame_number > 0)
+	assert(p_frame);
+	*p_frame = NULL;
+	while(1)
 	{
-		frame->frame_number = dbuf->frame_number;
+		long index = __atomic_load_n(&ring->latest, __ATOMIC_ACQUIRE);
+		if(index < 0) return -1;
+		
+		frame_slot_t * slot = &ring->slots[index];
+		long refs = __atomic_add_fetch(&slot->refs, 1, __ATOMIC_ACQUIRE);
+		if(refs & FRAME_SLOT_WRITING)	// the slot was recycled by the producer, retry with the newer one
+		{
+			__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		
+		long frame_number = slot->seq;
+		if(prev_frame >= 0 && frame_number <= prev_frame)	// no new frame
+		{
+			__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE);
+			return frame_number;
+		}
+		*p_frame = slot->frame;
+		return frame_number;
 	}
-	pthread_mutex_unlock(&dbuf->mutex);
-	return frame->frame_number;
+	return -1;
+}
+
+static void frame_ring_release(frame_ring_t * ring, const input_frame_t * frame)
+{
+	if(NULL == frame) return;
+	frame_slot_t * slot = (frame_slot_t *)frame;
+	assert(slot >= ring->slots && slot < (ring->slots + ring->num_slots));
+	
+	long refs = __atomic_sub_fetch(&slot->refs, 1, __ATOMIC_RELEASE);
+	assert(refs >= 0);
+	UNUSED(refs);
+	return;
+}
+
+static long frame_ring_get(frame_ring_t * ring, long prev_frame, input_frame_t * frame)
+{
+	if(NULL == frame) return __atomic_load_n(&ring->frame_number, __ATOMIC_ACQUIRE);	// query current frame_number only
+	
+	const input_frame_t * latest = NULL;
+	long frame_number = frame_ring_acquire(ring, prev_frame, &latest);
+	if(NULL == latest) return frame_number;
+	
+	input_frame_copy(frame, latest);
+	frame_ring_release(ring, latest);
+	return frame_number;
 }
 
-double_buffer_t * double_buffer_new(void)
+static frame_ring_t * frame_ring_new(int num_slots)
 {
-	double_buffer_t * dbuf = calloc(1, sizeof(*dbuf));
-	assert(dbuf);
+	if(num_slots < 2) num_slots = 2;
+	if(num_slots > IO_INPUT_MAX_FRAME_SLOTS) num_slots = IO_INPUT_MAX_FRAME_SLOTS;
+	
+	frame_ring_t * ring = calloc(1, sizeof(*ring));
+	assert(ring);
 
-	int rc = pthread_mutex_init(&dbuf->mutex, NULL);
+	int rc = pthread_mutex_init(&ring->mutex, NULL);
 	assert(0 == rc);
 
-	dbuf->frames[0] = input_frame_new();
-	dbuf->frames[1] = input_frame_new();
+	ring->slots = calloc(num_slots, sizeof(*ring->slots));
+	assert(ring->slots);
+	ring->num_slots = num_slots;
+	ring->latest = -1;
 	
-	dbuf->set = double_buffer_set;
-	dbuf->get = double_buffer_get;
-	return dbuf;
+	ring->set = frame_ring_set;
+	ring->get = frame_ring_get;
+	ring->acquire = frame_ring_acquire;
+	ring->release = frame_ring_release;
+	return ring;
 }
 
 /*****************************************************************
@@ -136,17 +229,49 @@ double_buffer_t * double_buffer_new(void)
 static long io_input_get_frame(struct io_input * input, long prev_frame, input_frame_t * frame)
 {
 	if(NULL == input || NULL == input->frame_buffer) return -1;
-	long frame_number =  double_buffer_get(input->frame_buffer, frame);
+	long frame_number = frame_ring_get(input->frame_buffer, prev_frame, frame);
 	//~ debug_printf("get_frame: type=%d, size=%d x %d, length=%ld", frame->type, frame->width, frame->height, (long)frame->length);
 	return frame_number;
 }
 
+static long io_input_get_frame_ref(struct io_input * input, long prev_frame, const input_frame_t ** p_frame)
+{
+	if(NULL == input || NULL == input->frame_buffer || NULL == p_frame) return -1;
+	return frame_ring_acquire(input->frame_buffer, prev_frame, p_frame);
+}
+
+static void io_input_release_frame(struct io_input * input, const input_frame_t * frame)
+{
+	if(NULL == input || NULL == input->frame_buffer) return;
+	frame_ring_release(input->frame_buffer, frame);
+}
+
 static long io_input_set_frame(struct io_input * input, const input_frame_t * frame)
 {
 	if(NULL == input || NULL == input->frame_buffer) return -1;
 
 	//~ debug_printf("set_frame: type=%d, size=%d x %d, length=%ld", frame->type, frame->width, frame->height, (long)frame->length);
-	return double_buffer_set(input->frame_buffer, frame);
+	return frame_ring_set(input->frame_buffer, frame);
+}
+
+int io_input_set_frame_slots(io_input_t * input, int num_slots)
+{
+	if(NULL == input || num_slots <= 0) return -1;
+	frame_ring_t * ring = input->frame_buffer;
+	if(ring && ring->num_slots == num_slots) return 0;
+	if(ring && ring->latest >= 0) return -1;		// frames have been published, can not resize any more
+	
+	input->frame_buffer = frame_ring_new(num_slots);
+	assert(input->frame_buffer);
+	frame_ring_free(ring);
+	return 0;
+}
+
+long io_input_get_frames_dropped(io_input_t * input)
+{
+	if(NULL == input || NULL == input->frame_buffer) return -1;
+	frame_ring_t * ring = input->frame_buffer;
+	return __atomic_load_n(&ring->frames_dropped, __ATOMIC_RELAXED);
 }
 
 /*****************************************************************
@@ -169,11 +294,13 @@ io_input_t * io_input_init(io_input_t * input, const char * sz_type, void * user
 
 	input->user_data = user_data;
 
-	input->frame_buffer = double_buffer_new();
+	input->frame_buffer = frame_ring_new(IO_INPUT_DEFAULT_FRAME_SLOTS);
 	assert(input->frame_buffer);
 
 	input->set_frame = io_input_set_frame;
 	input->get_frame = io_input_get_frame;
+	input->get_frame_ref = io_input_get_frame_ref;
+	input->release_frame = io_input_release_frame;
 
 	if(plugin)
 	{
@@ -195,7 +322,8 @@ void io_input_cleanup(io_input_t * input)
 	{
 		input->cleanup(input);
 	}
-	double_buffer_free(input->frame_buffer);
+	frame_ring_free(input->frame_buffer);
+	input->frame_buffer = NULL;
 	return;
 }
 
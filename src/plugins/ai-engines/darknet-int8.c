@@ -0,0 +1,280 @@
+/*
+ * darknet-int8.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
+
+#include "utils.h"
+#include "int8_conv.h"
+#include "darknet-int8.h"
+
+// activations.c, not exported by darknet.h
+void activate_array(float * x, const int n, const ACTIVATION a);
+
+typedef void (* darknet_forward_func)(struct layer l, struct network net);
+
+typedef struct darknet_int8_layer
+{
+	int index;
+	darknet_forward_func forward_fp32;
+	int8_conv_t conv[1];
+	float max_input;		// calibration
+}darknet_int8_layer_t;
+
+struct darknet_int8_context
+{
+	struct darknet_int8_context * next;	// registry
+
+	network * net;
+	layer * layers;				// key of the registry: the hooks only receive copies of the layer and the network
+	int count;
+	darknet_int8_layer_t * items;
+	darknet_int8_layer_t ** by_index;	// [net->n], NULL: float32 layer
+
+	int calibrating;
+	int8_conv_scratch_t scratch[1];	// one network runs one forward at a time
+};
+
+/******************************************************************************
+ * registry: net.layers --> context
+ *****************************************************************************/
+static pthread_mutex_t s_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static darknet_int8_context_t * s_registry;
+
+static void registry_add(darknet_int8_context_t * ctx)
+{
+	pthread_mutex_lock(&s_registry_mutex);
+	ctx->next = s_registry;
+	s_registry = ctx;
+	pthread_mutex_unlock(&s_registry_mutex);
+}
+
+static void registry_remove(darknet_int8_context_t * ctx)
+{
+	pthread_mutex_lock(&s_registry_mutex);
+	darknet_int8_context_t ** p_ctx = &s_registry;
+	while(*p_ctx && *p_ctx != ctx) p_ctx = &(*p_ctx)->next;
+	if(*p_ctx) *p_ctx = ctx->next;
+	pthread_mutex_unlock(&s_registry_mutex);
+}
+
+static darknet_int8_context_t * registry_find(const layer * layers)
+{
+	pthread_mutex_lock(&s_registry_mutex);
+	darknet_int8_context_t * ctx = s_registry;
+	while(ctx && ctx->layers != layers) ctx = ctx->next;
+	pthread_mutex_unlock(&s_registry_mutex);
+	return ctx;
+}
+
+/******************************************************************************
+ * forward
+ *****************************************************************************/
+static void forward_int8_convolutional_layer(layer l, network net)
+{
+	darknet_int8_context_t * ctx = registry_find(net.layers);
+	assert(ctx && net.index >= 0 && net.index < ctx->net->n);
+	darknet_int8_layer_t * item = ctx->by_index[net.index];
+	assert(item);
+
+	if(ctx->calibrating)
+	{
+		float max_value = int8_max_abs(net.input, (ssize_t)l.inputs * l.batch);
+		if(max_value > item->max_input) item->max_input = max_value;
+		item->forward_fp32(l, net);
+		return;
+	}
+
+	for(int b = 0; b < l.batch; ++b)
+	{
+		int8_conv_forward(item->conv, net.input + (ssize_t)l.inputs * b, l.output + (ssize_t)l.outputs * b, ctx->scratch);
+	}
+	activate_array(l.output, l.outputs * l.batch, l.activation);
+}
+
+static int is_quantizable(const layer * l)
+{
+	if(l->type != CONVOLUTIONAL) return 0;
+	if(l->groups > 1 || l->xnor) return 0;
+	if(l->out_c != l->n || l->n <= 0) return 0;
+	return 1;
+}
+
+/* the same arithmetic as darknet's normalize_cpu(), scale_bias() and add_bias() */
+static void fold_batchnorm(const layer * l, float * scales, float * biases)
+{
+	for(int m = 0; m < l->n; ++m)
+	{
+		if(l->batch_normalize) {
+			float factor = l->scales[m] / (sqrtf(l->rolling_variance[m]) + .000001f);
+			scales[m] = factor;
+			biases[m] = l->biases[m] - l->rolling_mean[m] * factor;
+		}else {
+			scales[m] = 1.0f;
+			biases[m] = l->biases[m];
+		}
+	}
+}
+
+darknet_int8_context_t * darknet_int8_context_new(network * net, int quantize_first_layer)
+{
+	assert(net && net->n > 0);
+	darknet_int8_context_t * ctx = calloc(1, sizeof(*ctx));
+	assert(ctx);
+	ctx->net = net;
+	ctx->layers = net->layers;
+	ctx->items = calloc(net->n, sizeof(*ctx->items));
+	ctx->by_index = calloc(net->n, sizeof(*ctx->by_index));
+	assert(ctx->items && ctx->by_index);
+
+	for(int i = 0; i < net->n; ++i)
+	{
+		layer * l = &net->layers[i];
+		if(!is_quantizable(l)) continue;
+		if(i == 0 && !quantize_first_layer) continue;	// 3 input channels: little to gain, most of the error
+
+		float * scales = calloc(l->n, sizeof(float));
+		float * biases = calloc(l->n, sizeof(float));
+		assert(scales && biases);
+		fold_batchnorm(l, scales, biases);
+
+		darknet_int8_layer_t * item = &ctx->items[ctx->count++];
+		item->index = i;
+		item->forward_fp32 = l->forward;
+		int8_conv_init(item->conv, l->c, l->h, l->w, l->n, l->size, l->stride, l->pad, l->weights, scales, biases);
+		assert(item->conv->out_h == l->out_h && item->conv->out_w == l->out_w);
+		free(scales);
+		free(biases);
+
+		ctx->by_index[i] = item;
+		l->forward = forward_int8_convolutional_layer;
+	}
+
+	registry_add(ctx);
+	debug_printf("%s(): %d / %d layers quantized (%s)", __FUNCTION__, ctx->count, net->n,
+		int8_conv_level_to_string(int8_conv_get_level()));
+	return ctx;
+}
+
+void darknet_int8_context_free(darknet_int8_context_t * ctx)
+{
+	if(NULL == ctx) return;
+	registry_remove(ctx);
+
+	for(int i = 0; i < ctx->count; ++i)
+	{
+		darknet_int8_layer_t * item = &ctx->items[i];
+		ctx->net->layers[item->index].forward = item->forward_fp32;
+		int8_conv_cleanup(item->conv);
+	}
+	int8_conv_scratch_cleanup(ctx->scratch);
+	free(ctx->items);
+	free(ctx->by_index);
+	free(ctx);
+}
+
+int darknet_int8_layers_count(const darknet_int8_context_t * ctx)
+{
+	return ctx?ctx->count:0;
+}
+
+void darknet_int8_calibrate_begin(darknet_int8_context_t * ctx)
+{
+	assert(ctx);
+	for(int i = 0; i < ctx->count; ++i) ctx->items[i].max_input = 0;
+	ctx->calibrating = 1;
+}
+
+int darknet_int8_calibrate_end(darknet_int8_context_t * ctx)
+{
+	assert(ctx);
+	ctx->calibrating = 0;
+
+	int num_calibrated = 0;
+	for(int i = 0; i < ctx->count; ++i)
+	{
+		darknet_int8_layer_t * item = &ctx->items[i];
+		if(item->max_input <= 0) continue;	// not reached: keep the dynamic scale
+		item->conv->input_scale = item->max_input / 127.0f;
+		++num_calibrated;
+	}
+	return num_calibrated;
+}
+
+int darknet_int8_load_scales(darknet_int8_context_t * ctx, const char * filename)
+{
+	assert(ctx && filename);
+	json_object * jscales = json_object_from_file(filename);
+	if(NULL == jscales) return -1;
+
+	json_object * jlayers = NULL;
+	if(!json_object_object_get_ex(jscales, "layers", &jlayers) || !json_object_is_type(jlayers, json_type_array)) {
+		json_object_put(jscales);
+		return -1;
+	}
+
+	int num_loaded = 0;
+	int count = json_object_array_length(jlayers);
+	for(int i = 0; i < count; ++i)
+	{
+		json_object * jlayer = json_object_array_get_idx(jlayers, i);
+		int index = json_get_value_default(jlayer, int, index, -1);
+		double scale = json_get_value_default(jlayer, double, input_scale, 0.0);
+		if(index < 0 || index >= ctx->net->n || NULL == ctx->by_index[index]) continue;
+
+		ctx->by_index[index]->conv->input_scale = (float)scale;
+		++num_loaded;
+	}
+	json_object_put(jscales);
+	return num_loaded;
+}
+
+int darknet_int8_save_scales(const darknet_int8_context_t * ctx, const char * filename)
+{
+	assert(ctx && filename);
+	json_object * jscales = json_object_new_object();
+	json_object * jlayers = json_object_new_array();
+	json_object_object_add(jscales, "layers", jlayers);
+
+	for(int i = 0; i < ctx->count; ++i)
+	{
+		const darknet_int8_layer_t * item = &ctx->items[i];
+		if(item->conv->input_scale <= 0) continue;
+
+		json_object * jlayer = json_object_new_object();
+		json_object_object_add(jlayer, "index", json_object_new_int(item->index));
+		json_object_object_add(jlayer, "input_scale", json_object_new_double(item->conv->input_scale));
+		json_object_array_add(jlayers, jlayer);
+	}
+
+	int rc = json_object_to_file_ext((char *)filename, jscales, JSON_C_TO_STRING_PRETTY);
+	json_object_put(jscales);
+	return rc;
+}
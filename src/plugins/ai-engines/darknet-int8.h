@@ -0,0 +1,38 @@
+#ifndef _DARKNET_INT8_H_
+#define _DARKNET_INT8_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "darknet.h"
+
+/*
+ * darknet_int8: int8 cpu inference of the convolutional layers of a loaded (float32) network.
+ *   - the forward() of each eligible layer is replaced, the other layers still run in float32
+ *   - weights: per-channel int8, the batchnorm is folded into the per-channel multipliers and biases
+ *   - inputs: per-layer scales, calibrated on sample images (max |x|), or computed for each input (dynamic)
+ */
+typedef struct darknet_int8_context darknet_int8_context_t;
+
+darknet_int8_context_t * darknet_int8_context_new(network * net, int quantize_first_layer);
+void darknet_int8_context_free(darknet_int8_context_t * ctx);	// restore the float32 layers
+int darknet_int8_layers_count(const darknet_int8_context_t * ctx);
+
+/*
+ * calibration:
+ *   darknet_int8_calibrate_begin(); network_predict() over the samples; darknet_int8_calibrate_end();
+ * between begin and end, the layers run in float32 and record the range of their inputs.
+ */
+void darknet_int8_calibrate_begin(darknet_int8_context_t * ctx);
+int darknet_int8_calibrate_end(darknet_int8_context_t * ctx);	// return the number of layers calibrated
+
+// {"layers": [{"index": layer_index, "input_scale": scale}, ...]}
+int darknet_int8_load_scales(darknet_int8_context_t * ctx, const char * filename);
+int darknet_int8_save_scales(const darknet_int8_context_t * ctx, const char * filename);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
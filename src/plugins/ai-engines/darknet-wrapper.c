@@ -26,14 +26,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <strings.h>
+#include <dirent.h>
 
 #include "img_proc.h"
 #include "utils.h"
 #include "darknet-wrapper.h"
 
 #include "darknet.h"
+#include "darknet-int8.h"
 #include <cairo/cairo.h>
 
+// network.c, not exported by darknet.h: fill the boxes into caller-owned (reusable) arrays
+int num_detections(network * net, float thresh);
+void fill_network_boxes(network * net, int w, int h, float thresh, float hier, int * map, int relative, detection * dets);
+
+#define DARKNET_WORKSPACE_ALIGNMENT (64)
+
 static const char * s_coco_names[80] = {
 	"person",
 	"bicycle",
@@ -132,8 +141,172 @@ typedef struct darknet_private
 	float thresh; 	// confidence threshold, default = 0.5f;
 	float hier; 	// yolov2 only, default = 0.5f;
 	float nms; 		// Non-maximum Suppression (NMS), default = 0.45;
+	
+	int max_batch;	// the layer buffers are allocated for the [net] batch of the cfg file
+	
+	int top_k;		// max detections per frame, 0: unlimited
+	
+	int letterbox;			// keep the aspect ratio of the input images
+	int preprocess_threads;	// row bands of the (fused) resize
+	
+	/*
+	 * workspace: allocated once when the network was loaded, 
+	 * the steady-state predict_batch() does not allocate.
+	 */
+	ai_tensor_t input[1];		// {max_batch, 3, net->h, net->w}, aligned to DARKNET_WORKSPACE_ALIGNMENT
+	
+	int num_classes;
+	int mask_size;				// (l.coords - 4) of the output layer
+	int dets_capacity;
+	detection * dets;			// boxes of one batch item, with their prob / mask arrays
+	
+	ssize_t detections_capacity;
+	ai_detection_t * detections;	// results of the last predict_batch(), results[i] point into this array
+	ssize_t offsets_capacity;
+	ssize_t * offsets;				// results[i] --> detections + offsets[i]
+	
+	// post-processing
+	ai_nms_context_t * nms_ctx;
+	ssize_t candidates_capacity;
+	ai_nms_box_t * candidates;	// (box, class) pairs above the threshold
+	int * det_slots;			// dets[i] --> results index, (dets_capacity items)
+	
+	darknet_int8_context_t * int8;	// quantized convolutional layers, NULL: float32
 }darknet_private_t;
 
+static int darknet_max_boxes(const network * net)
+{
+	int max_boxes = 0;
+	for(int i = 0; i < net->n; ++i)
+	{
+		const layer * l = &net->layers[i];
+		if(l->type == YOLO || l->type == REGION) max_boxes += l->w * l->h * l->n;
+		else if(l->type == DETECTION) max_boxes += l->side * l->side * l->n;
+	}
+	return max_boxes;
+}
+
+static void workspace_reserve_dets(darknet_private_t * priv, int count)
+{
+	if(count <= priv->dets_capacity) return;
+	
+	detection * dets = realloc(priv->dets, sizeof(*dets) * count);
+	assert(dets);
+	for(int i = priv->dets_capacity; i < count; ++i)
+	{
+		memset(&dets[i], 0, sizeof(dets[i]));
+		dets[i].prob = calloc(priv->num_classes, sizeof(float));
+		assert(dets[i].prob);
+		if(priv->mask_size > 0) {
+			dets[i].mask = calloc(priv->mask_size, sizeof(float));
+			assert(dets[i].mask);
+		}
+	}
+	priv->dets = dets;
+	priv->dets_capacity = count;
+	
+	priv->det_slots = realloc(priv->det_slots, sizeof(*priv->det_slots) * count);
+	assert(priv->det_slots);
+}
+
+static void workspace_reserve_candidates(darknet_private_t * priv, ssize_t count)
+{
+	if(count <= priv->candidates_capacity) return;
+	
+	ssize_t new_capacity = priv->candidates_capacity * 2;
+	if(new_capacity < count) new_capacity = count;
+	
+	ai_nms_box_t * candidates = realloc(priv->candidates, sizeof(*candidates) * new_capacity);
+	assert(candidates);
+	priv->candidates = candidates;
+	priv->candidates_capacity = new_capacity;
+}
+
+static void workspace_reserve_detections(darknet_private_t * priv, ssize_t count)
+{
+	if(count <= priv->detections_capacity) return;
+	
+	ssize_t new_capacity = priv->detections_capacity * 2;
+	if(new_capacity < count) new_capacity = count;
+	
+	ai_detection_t * detections = realloc(priv->detections, sizeof(*detections) * new_capacity);
+	assert(detections);
+	priv->detections = detections;
+	priv->detections_capacity = new_capacity;
+}
+
+static void workspace_reserve_offsets(darknet_private_t * priv, ssize_t count)
+{
+	if(count <= priv->offsets_capacity) return;
+	
+	ssize_t * offsets = realloc(priv->offsets, sizeof(*offsets) * count);
+	assert(offsets);
+	priv->offsets = offsets;
+	priv->offsets_capacity = count;
+}
+
+static void darknet_workspace_init(darknet_private_t * priv)
+{
+	network * net = priv->net;
+	layer l = net->layers[net->n - 1];
+	
+	priv->num_classes = l.classes;
+	priv->mask_size = (l.coords > 4)?(l.coords - 4):0;
+	
+	int_dim4 size = { .n = priv->max_batch, .c = 3, .h = net->h, .w = net->w };
+	ai_tensor_t * input = priv->input;
+	input->type = ai_tensor_data_type_float32;
+	input->dim[0] = size;
+	input->length = (size_t)size.n * size.c * size.h * size.w;
+	
+	void * data = NULL;
+	int rc = posix_memalign(&data, DARKNET_WORKSPACE_ALIGNMENT, sizeof(float) * input->length);
+	assert(0 == rc && data);
+	input->data = data;
+	
+	workspace_reserve_dets(priv, darknet_max_boxes(net));
+	workspace_reserve_detections(priv, 64 * priv->max_batch);
+	workspace_reserve_candidates(priv, 1024);
+	workspace_reserve_offsets(priv, priv->max_batch);
+	
+	priv->nms_ctx = ai_nms_context_new();
+	return;
+}
+
+static void darknet_workspace_cleanup(darknet_private_t * priv)
+{
+	free(priv->input->data);
+	memset(priv->input, 0, sizeof(priv->input));
+	
+	for(int i = 0; i < priv->dets_capacity; ++i)
+	{
+		free(priv->dets[i].prob);
+		free(priv->dets[i].mask);
+	}
+	free(priv->dets);
+	priv->dets = NULL;
+	priv->dets_capacity = 0;
+	
+	free(priv->det_slots);
+	priv->det_slots = NULL;
+	
+	free(priv->candidates);
+	priv->candidates = NULL;
+	priv->candidates_capacity = 0;
+	
+	ai_nms_context_free(priv->nms_ctx);
+	priv->nms_ctx = NULL;
+	
+	free(priv->detections);
+	priv->detections = NULL;
+	priv->detections_capacity = 0;
+	
+	free(priv->offsets);
+	priv->offsets = NULL;
+	priv->offsets_capacity = 0;
+}
+
+static void darknet_quantize_int8(darknet_private_t * priv, json_object * jconfig);
 darknet_private_t * darknet_private_new(darknet_context_t * darknet, json_object * jconfig)
 {
 	darknet_private_t * priv = calloc(1, sizeof(*priv));
@@ -193,19 +366,58 @@ darknet_private_t * darknet_private_new(darknet_context_t * darknet, json_object
 		priv->labels = labels;
 	}
 	assert(priv->labels_count == num_classes);
+	darknet->num_labels = priv->labels_count;
+	darknet->labels = (const char * const *)priv->labels;
+	
+	// the batch capacity is fixed when the network was parsed (cfg: [net] batch=N)
+	int max_batch = json_get_value_default(jconfig, int, max_batch, net->batch);
+	if(max_batch < 1 || max_batch > net->batch) max_batch = net->batch;
+	if(max_batch < 1) max_batch = 1;
+	priv->max_batch = max_batch;
 	set_batch_network(net, 1);
 	
 	priv->relative = json_get_value_default(jconfig, int, relative, 1);
+	darknet->relative = priv->relative;
 	
 	priv->thresh = json_get_value_default(jconfig, double, threshod, 0.5);
 	priv->hier = json_get_value_default(jconfig, double, hier, 0.5);
 	priv->nms = json_get_value_default(jconfig, double, nms, 0.45);
+	priv->top_k = json_get_value_default(jconfig, int, top_k, 0);
+	
+	priv->letterbox = json_get_value_default(jconfig, int, letterbox, 0);
+	priv->preprocess_threads = json_get_value_default(jconfig, int, preprocess_threads, 1);
 	
 	priv->net = net;
+	darknet_workspace_init(priv);
+	
+#ifdef DARKNET_INT8
+	const char * quantize = json_get_value_default(jconfig, string, quantize, "int8");
+#else
+	const char * quantize = json_get_value_default(jconfig, string, quantize, "none");
+#endif
+	if(quantize && strcasecmp(quantize, "int8") == 0) darknet_quantize_int8(priv, jconfig);
 	return priv;
 }
 
 static ssize_t darknet_predict(darknet_context_t * darknet, const bgra_image_t frame[1], ai_detection_t ** p_results);
+static ssize_t darknet_predict_batch(darknet_context_t * darknet, int count, const bgra_image_t * frames[], 
+	ai_detection_t * results[], ssize_t counts[]);
+const char * darknet_detection_get_class_names(darknet_context_t * darknet, ai_detection_t * det)
+{
+	if(det->class_names[0]) return det->class_names;
+	
+	char * p = det->class_names;
+	char * p_end = det->class_names + sizeof(det->class_names);
+	for(int i = 0; i < det->num_klass && p < p_end; ++i)
+	{
+		int klass = det->klass_list[i];
+		if(klass < 0 || klass >= darknet->num_labels) continue;
+		p += snprintf(p, p_end - p, "%s%s", (p == det->class_names)?"":", ", darknet->labels[klass]);
+	}
+	return det->class_names;
+}
+
+static ai_tensor_t * darknet_get_workspace(darknet_context_t * darknet);
 darknet_context_t * darknet_context_new(json_object * jconfig, void * user_data)
 {
 	assert(jconfig && user_data);
@@ -215,6 +427,8 @@ darknet_context_t * darknet_context_new(json_object * jconfig, void * user_data)
 	
 	darknet->user_data = user_data;
 	darknet->predict = darknet_predict;
+	darknet->predict_batch = darknet_predict_batch;
+	darknet->get_workspace = darknet_get_workspace;
 	
 	darknet_private_t * priv = darknet_private_new(darknet, jconfig);
 	assert(priv && darknet->priv == priv);
@@ -228,10 +442,15 @@ void darknet_context_free(darknet_context_t * darknet)
 	darknet_private_t * priv = darknet->priv;
 	if(priv)
 	{
+		darknet_int8_context_free(priv->int8);
+		priv->int8 = NULL;
+		
 		network * net = priv->net;
 		if(net) free_network(net);
 		priv->net = NULL;
 		
+		darknet_workspace_cleanup(priv);
+		
 		if(priv->labels && priv->labels != (char **)s_coco_names)
 		{
 			for(int i = 0; i < priv->labels_count; ++i) free(priv->labels[i]);
@@ -249,161 +468,333 @@ void darknet_context_free(darknet_context_t * darknet)
 }
 
 
-static int bgra_image_to_f32(const bgra_image_t * restrict bgra, float * restrict dst)
+/*
+ * RGB planar (u8) --> network input (f32): 
+ * dst: (width * height * 3) floats, either the network input or the data of a darknet image.
+ */
+static void rgb_planar_to_f32(const bgra_image_t * restrict frame, float * restrict dst)
 {
-	static const float scalar = 1.0f / 255.0f;
-	assert(dst);
+	static const float scale = 1.0f / 255.0f;
+	int width = frame->width;
+	int height = frame->height;
+	int stride = (frame->stride > 0)?frame->stride:width;	// bytes per row of one plane
+	
+	const unsigned char * plane = frame->data;
+	for(int c = 0; c < 3; ++c, plane += (ssize_t)stride * height)
+	{
+		if(stride == width)
+		{
+			img_u8_to_f32(plane, (ssize_t)width * height, 0.0f, scale, dst);
+			dst += (ssize_t)width * height;
+			continue;
+		}
+		
+		const unsigned char * src = plane;
+		for(int y = 0; y < height; ++y, src += stride, dst += width)
+		{
+			img_u8_to_f32(src, width, 0.0f, scale, dst);
+		}
+	}
+	return;
+}
 
-	ssize_t size = bgra->width * bgra->height;
-	float * r_plane = dst;
-	float * g_plane = r_plane + size;
-	float * b_plane = g_plane + size;
+static void darknet_load_input(darknet_private_t * priv, const bgra_image_t * frame, float * input)
+{
+	static const float scale[3] = { 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f };
+	network * net = priv->net;
+	int width = net->w;
+	int height = net->h;
 	
-	// from bgr (NHWC) to float32 (NCHW)
-	const unsigned char * bgra_data = bgra->data;
-	for(int pos = 0; pos < size; ++pos, bgra_data += 4)
+	if(frame->channels == 3)	// RGB planar (native network layout)
 	{
-		r_plane[pos] = ((float) bgra_data[2]) * scalar;
-		g_plane[pos] = ((float) bgra_data[1]) * scalar;
-		b_plane[pos] = ((float) bgra_data[0]) * scalar;
+		if(frame->width == width && frame->height == height)
+		{
+			rgb_planar_to_f32(frame, input);
+			return;
+		}
+		
+		// the source was not scaled to the network size, let darknet resize it (allocates)
+		image im = make_image(frame->width, frame->height, 3);
+		assert(im.data);
+		rgb_planar_to_f32(frame, im.data);
+		
+		image resized = priv->letterbox?letterbox_image(im, width, height):resize_image(im, width, height);
+		memcpy(input, resized.data, sizeof(*input) * width * height * 3);
+		free_image(resized);
+		free_image(im);
+		return;
 	}
-	return 0;
+	
+	// resize + letterbox + normalize in one pass, directly into the network input
+	img_resize_params_t params = {
+		.mode = img_resize_mode_auto,
+		.letterbox = priv->letterbox,
+		.pad_value = 0.5f,	// darknet's letterbox_image() fills the borders with 0.5
+		.scale = scale,
+		.num_threads = priv->preprocess_threads,
+	};
+	int stride = (frame->stride >= frame->width * 4)?frame->stride:0;
+	int rc = img_bgra_resize_to_planar_f32(frame->data, frame->width, frame->height, stride,
+		width, height, &params, input, NULL);
+	assert(0 == rc);
+	return;
+}
+
+static inline int is_output_layer(const layer * l)
+{
+	return (l->type == YOLO || l->type == REGION || l->type == DETECTION);
 }
 
-static bgra_image_t * bgra_image_resize(bgra_image_t * dst, int width, int height, const bgra_image_t * src)
+static void shift_output_layers(network * net, ssize_t offset)
 {
-	assert(src && width > 1 && height > 1 && src->width > 1 && src->height > 1 && src->data);
-	cairo_surface_t * origin = cairo_image_surface_create_for_data((unsigned char *)src->data,
-		CAIRO_FORMAT_ARGB32,
-		src->width, src->height, src->width * 4);
-	assert(origin);
+	for(int i = 0; i < net->n; ++i) 
+	{
+		layer * l = &net->layers[i];
+		if(is_output_layer(l)) l->output += offset * l->outputs;
+	}
+}
+
+/*
+ * fill_network_boxes() only reads the first batch item of the output layers, 
+ * shift their output pointers to the requested item while collecting the boxes.
+ * 
+ * (width, height): the size used to correct the boxes, 
+ * the results are appended to priv->detections at @offset.
+ */
+static ssize_t darknet_get_detections(darknet_private_t * priv, int batch_index, int width, int height, ssize_t offset)
+{
+	network * net = priv->net;
 	
-	double sx = (double)width / (double)src->width;
-	double sy = (double)height / (double)src->height;
+	if(batch_index > 0) shift_output_layers(net, batch_index);
 	
-	cairo_surface_t * resized = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-	assert(resized);
+	float thresh = priv->thresh;
+	float hier = priv->hier;
+	float nms = priv->nms;
+	int relative = priv->relative;
+	int num_classes = priv->num_classes;
+	assert(num_classes == priv->labels_count);
 	
-	cairo_t * cr = cairo_create(resized);
-	assert(cr);
+	int count = num_detections(net, thresh);
+	workspace_reserve_dets(priv, count);
 	
-	cairo_scale(cr, sx, sy);
-	cairo_set_source_surface(cr, origin, 0, 0);
-	cairo_paint(cr);
+	// the output layers overwrite every prob[] (0 if below the threshold), the NMS below does not modify them
+	detection * dets = priv->dets;
+	fill_network_boxes(net, width, height, thresh, hier, NULL, relative, dets);
+	debug_printf("num_classes: %d, boxes: %d\n", num_classes, count);
 	
-	cairo_destroy(cr);
+	// prefilter: only the (box, class) pairs above the threshold take part in the NMS
+	ssize_t num_candidates = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		const float * prob = dets[i].prob;
+		box b = dets[i].bbox;
+		for(int j = 0; j < num_classes; ++j)
+		{
+			if(prob[j] <= thresh) continue;
+			
+			workspace_reserve_candidates(priv, num_candidates + 1);
+			ai_nms_box_t * candidate = &priv->candidates[num_candidates++];
+			candidate->left = b.x - b.w / 2.0f;
+			candidate->top = b.y - b.h / 2.0f;
+			candidate->width = b.w;
+			candidate->height = b.h;
+			candidate->score = prob[j];
+			candidate->class_index = j;
+			candidate->index = i;
+		}
+	}
 	
-	unsigned char * image_data = cairo_image_surface_get_data(resized);
-	assert(image_data);
+	// per-class NMS, the kept pairs are sorted by confidence
+	ssize_t num_kept = ai_nms(priv->nms_ctx, priv->candidates, num_candidates, nms, 0);
 	
-	dst = bgra_image_init(dst, width, height, image_data);
-	assert(dst);
+	// merge the classes of the same box (multi-labels), at most top_k boxes
+	int dets_count = 0;
+	if(num_kept > 0)
+	{
+		workspace_reserve_detections(priv, offset + num_kept);
+		ai_detection_t * results = priv->detections + offset;
+		
+		int * det_slots = priv->det_slots;
+		for(int i = 0; i < count; ++i) det_slots[i] = -1;
+		
+		for(ssize_t i = 0; i < num_kept; ++i)
+		{
+			const ai_nms_box_t * candidate = &priv->candidates[i];
+			int slot = det_slots[candidate->index];
+			if(slot >= 0)	// one more label of an existing result
+			{
+				ai_detection_t * result = &results[slot];
+				if(result->num_klass < MAX_AI_DETECTION_CLASSES) result->klass_list[result->num_klass++] = candidate->class_index;
+				continue;
+			}
+			if(priv->top_k > 0 && dets_count >= priv->top_k) continue;
+			
+			det_slots[candidate->index] = dets_count;
+			ai_detection_t * result = &results[dets_count++];
+			result->class_names[0] = '\0';
+			result->klass = candidate->class_index;
+			result->klass_list[0] = candidate->class_index;
+			result->num_klass = 1;
+			result->confidence = candidate->score;
+			result->x = candidate->left;
+			result->y = candidate->top;
+			result->cx = candidate->width;
+			result->cy = candidate->height;
+			
+			debug_printf("result[%d]: class=%d, confidence=%.3f, bbox:{%.3f, %.3f, %.3f, %.3f}\n", dets_count - 1,
+				result->klass, result->confidence,
+				result->x, result->y, result->cx, result->cy);
+		}
+	}
 	
-	cairo_surface_destroy(origin);
-	cairo_surface_destroy(resized);
-	return dst;
+	if(batch_index > 0) shift_output_layers(net, -batch_index);
+	return dets_count;
 }
 
-
-static ssize_t darknet_predict(darknet_context_t * darknet, const bgra_image_t frame[1], ai_detection_t ** p_results)
+/*
+ * frames == NULL: the first @count items of the workspace were filled by the caller,
+ *   (count <= max_batch), the boxes are relative to the network input.
+ * results[i] point into the workspace, and remain valid until the next call.
+ */
+static ssize_t darknet_predict_batch(darknet_context_t * darknet, int count, const bgra_image_t * frames[], 
+	ai_detection_t * results[], ssize_t counts[])
 {
 	darknet_private_t * priv = darknet->priv;
 	network * net = priv->net;
+	assert(count > 0 && results && counts);
+	assert(frames || count <= priv->max_batch);
 
 	int width = net->w;
 	int height = net->h;
-	debug_printf("network size: %d x %d\n", width, height);
-	debug_printf("resize: %d x %d   --> %d x %d\n", frame->width, frame->height, width, height);
-	bgra_image_t * resized = bgra_image_resize(NULL, width, height, frame);
-	assert(resized && (resized->width == width) && (resized->height == height) && resized->data);
+	ssize_t input_size = (ssize_t)width * height * 3;
+	debug_printf("network size: %d x %d, batch: %d / %d\n", width, height, count, priv->max_batch);
 	
-	float * input = malloc(width * height * 3 * sizeof(float));
-	assert(input);
+	float * input = priv->input->f32;
+	workspace_reserve_offsets(priv, count);		// only grows when more than max_batch frames are passed
+	ssize_t * offsets = priv->offsets;
+	ssize_t total = 0;
 	
-	bgra_image_to_f32(resized, input);
-	bgra_image_clear(resized); free(resized);
+	ssize_t num_predicted = 0;
+	for(int offset = 0; offset < count; offset += priv->max_batch)
+	{
+		int batch = count - offset;
+		if(batch > priv->max_batch) batch = priv->max_batch;
+		
+		if(frames) {
+			for(int i = 0; i < batch; ++i) darknet_load_input(priv, frames[offset + i], input + input_size * i);
+		}
+		
+		if(batch != net->batch) set_batch_network(net, batch);
+		network_predict(net, input);
+		
+		for(int i = 0; i < batch; ++i) 
+		{
+			// the boxes are corrected for the letterbox geometry of the original image size
+			const bgra_image_t * frame = frames?frames[offset + i]:NULL;
+			int box_width = (frame && priv->letterbox)?frame->width:width;
+			int box_height = (frame && priv->letterbox)?frame->height:height;
+			
+			offsets[offset + i] = total;
+			counts[offset + i] = darknet_get_detections(priv, i, box_width, box_height, total);
+			total += counts[offset + i];
+		}
+		num_predicted += batch;
+	}
 	
-	network_predict(net, input);
-	free(input);
+	// priv->detections may have been moved while growing
+	for(int i = 0; i < count; ++i) results[i] = priv->detections + offsets[i];
+	return num_predicted;
+}
+
+static ssize_t darknet_predict(darknet_context_t * darknet, const bgra_image_t frame[1], ai_detection_t ** p_results)
+{
+	const bgra_image_t * frames[1] = { frame };
+	ai_detection_t * results[1] = { NULL };
+	ssize_t counts[1] = { 0 };
 	
-	int count = 0;
-	float thresh = priv->thresh;
-	float hier = priv->hier;
-	float nms = priv->nms;
-	int relative = priv->relative;
+	darknet_predict_batch(darknet, 1, frames, results, counts);
+	if(p_results) *p_results = results[0];
+	return counts[0];
+}
+
+static ai_tensor_t * darknet_get_workspace(darknet_context_t * darknet)
+{
+	darknet_private_t * priv = darknet->priv;
+	assert(priv);
+	return priv->input;
+}
+
+/*
+ * int8 calibration: run the float32 network over (up to) @max_images sample images,
+ * return the number of images used.
+ */
+static int darknet_int8_calibrate(darknet_private_t * priv, const char * calibration_dir, int max_images)
+{
+	DIR * dir = opendir(calibration_dir);
+	if(NULL == dir) {
+		fprintf(stderr, "[WARNING]::%s(%s): opendir failed\n", __FUNCTION__, calibration_dir);
+		return 0;
+	}
 	
-	layer l = net->layers[net->n - 1];
-	detection * dets = get_network_boxes(net, width, height, thresh, hier, NULL, relative, &count);
+	network * net = priv->net;
+	if(net->batch != 1) set_batch_network(net, 1);
 	
-	ai_detection_t * results = calloc(count, sizeof(*results));
-	assert(results);
+	int num_samples = 0;
+	darknet_int8_calibrate_begin(priv->int8);
 	
-	int dets_count = 0;
-	if(dets && count > 0)
+	struct dirent * entry = NULL;
+	while(num_samples < max_images && (entry = readdir(dir)))
 	{
-		int num_classes = l.classes;
-		do_nms_sort(dets, count, num_classes, nms);
+		if(entry->d_name[0] == '.') continue;
 		
-		debug_printf("num_classes: %d\n", num_classes);
-		assert(num_classes == priv->labels_count);
-		// check confidence
-		for(int i = 0; i < count; ++i)
+		char path[4096] = "";
+		snprintf(path, sizeof(path), "%s/%s", calibration_dir, entry->d_name);
+		
+		bgra_image_t image[1];
+		memset(image, 0, sizeof(image));
+		if(bgra_image_load_from_file(image, path) == 0 && image->data)
 		{
-			char label[4096] = "";
-			int klass = -1;
-			int classes[num_classes];
-			int confirmed_classes_count = 0;
-			memset(classes, 0, num_classes * sizeof(classes[0]));
-			
-			float confidence = 0.0;
-			for(int j = 0; j < num_classes; ++j)
-			{
-				if(dets[i].prob[j] > thresh)
-				{
-					if(klass < 0) // set main class
-					{
-						strcat(label, priv->labels[j]);
-						klass = j;
-						confidence = dets[i].prob[j];
-					}else
-					{
-						strcat(label, ", ");
-						strcat(label, priv->labels[j]); 
-					}
-					classes[confirmed_classes_count++] = j;
-				}
-			}
-			
-			if(klass >= 0)
-			{
-				printf("[%d]: confidence=%.3f, label=%s\n", dets_count, confidence, label);
-				ai_detection_t * result = &results[dets_count++];
-				
-				memcpy(result->klass_list, classes, confirmed_classes_count * sizeof(int));
-				
-				// box: (center_pos + size)	-->  bounding box
-				box b = dets[i].bbox;
-				result->x = (b.x - b.w / 2.0);
-				result->y = (b.y - b.h / 2.0);
-				result->cx = b.w;
-				result->cy = b.h;
-				
-				debug_printf("result: bbox:{%.3f, %.3f, %.3f, %.3f}\n", 
-					result->x, result->y, result->cx, result->cy);
-				
-				strncpy(result->class_names, label, sizeof(result->class_names));
-				result->confidence = confidence;
-				result->klass = klass;
-			}
+			darknet_load_input(priv, image, priv->input->f32);
+			network_predict(net, priv->input->f32);
+			++num_samples;
 		}
-		
-		free_detections(dets, count);
+		bgra_image_clear(image);
 	}
+	closedir(dir);
 	
-	if(p_results) *p_results = results;
-	return dets_count;
+	darknet_int8_calibrate_end(priv->int8);
+	debug_printf("%s(%s): %d images", __FUNCTION__, calibration_dir, num_samples);
+	return num_samples;
 }
 
+/*
+ * config:
+ *   "quantize": "int8" | "none"
+ *   "calibration_file": per-layer input scales, loaded if it exists, otherwise written after the calibration
+ *   "calibration_dir": sample images, "calibration_images": default 32
+ *   "quantize_first_layer": default 0
+ * without scales, each layer computes the scale of its input at runtime (dynamic).
+ */
+static void darknet_quantize_int8(darknet_private_t * priv, json_object * jconfig)
+{
+	int quantize_first_layer = json_get_value_default(jconfig, int, quantize_first_layer, 0);
+	const char * calibration_file = json_get_value(jconfig, string, calibration_file);
+	const char * calibration_dir = json_get_value(jconfig, string, calibration_dir);
+	int max_images = json_get_value_default(jconfig, int, calibration_images, 32);
+	
+	priv->int8 = darknet_int8_context_new(priv->net, quantize_first_layer);
+	assert(priv->int8);
+	
+	if(calibration_file && darknet_int8_load_scales(priv->int8, calibration_file) > 0) return;
+	if(NULL == calibration_dir || max_images <= 0) return;
+	
+	int num_samples = darknet_int8_calibrate(priv, calibration_dir, max_images);
+	if(num_samples > 0 && calibration_file) darknet_int8_save_scales(priv->int8, calibration_file);
+	return;
+}
+
+
+
 
 #if defined(_TEST_DARKNET_WRAPPER) && defined(_STAND_ALONE)
 int main(int argc, char ** argv)
@@ -439,14 +830,13 @@ int main(int argc, char ** argv)
 		double cy = det->cy * (double)frame->height;
 		
 		printf("class: %s, bbox: {%.3f, %.3f, %.3f, %.3f}\n",
-			det->class_names,
+			darknet_detection_get_class_names(darknet, det),
 			x, y, cx, cy);
 			
 		cairo_rectangle(cr, x, y, cx, cy);
 		cairo_stroke(cr);
 	}
 	cairo_destroy(cr);
-	free(results);
 	cairo_surface_write_to_png(png, "result.png");
 	cairo_surface_destroy(png);
 	
@@ -7,15 +7,18 @@ extern "C" {
 #endif
 
 #include "img_proc.h"
+#include "ai-engine.h"
+#include "ai-detections.h"
 
 #define MAX_AI_DETECTION_NAME_LEN (1024)
 #define MAX_AI_DETECTION_CLASSES	(80)
 typedef struct ai_detection
 {
-	char class_names[MAX_AI_DETECTION_NAME_LEN];		// multi-labels support
-	int klass_list[MAX_AI_DETECTION_CLASSES];		
+	char class_names[MAX_AI_DETECTION_NAME_LEN];		// multi-labels support, built on demand (darknet_detection_get_class_names())
+	int klass_list[MAX_AI_DETECTION_CLASSES];		// sorted by confidence (descending)
+	int num_klass;
 	
-	int klass;				// main class
+	int klass;				// main class (the highest confidence)
 	float confidence;
 	union
 	{
@@ -30,12 +33,29 @@ typedef struct darknet_context
 	void * priv;
 
 	int gpu_index;
+	
+	int num_labels;
+	const char * const * labels;	// label table, ai_detection_t::klass --> labels[klass]
+	int relative;					// the boxes are relative to the image size (config: "relative", default 1)
+	
+	// the results are owned by the context, and remain valid until the next predict
 	ssize_t (* predict)(struct darknet_context * darknet, const bgra_image_t frame[1], ai_detection_t ** p_results);
+	
+	// results[i] / counts[i]: detections of frames[i], return the number of frames predicted
+	// frames == NULL: predict the first @count items already loaded into the workspace
+	ssize_t (* predict_batch)(struct darknet_context * darknet, int count, const bgra_image_t * frames[], 
+		ai_detection_t * results[], ssize_t counts[]);
+	
+	// network input: {max_batch, 3, height, width}, planar RGB float32 in [0, 1]
+	ai_tensor_t * (* get_workspace)(struct darknet_context * darknet);
 }darknet_context_t;
 
 darknet_context_t * darknet_context_new(json_object * jconfig, void * user_data);
 void darknet_context_free(darknet_context_t * darknet);
 
+// "label_1, label_2, ..." of det->klass_list
+const char * darknet_detection_get_class_names(darknet_context_t * darknet, ai_detection_t * det);
+
 
 
 
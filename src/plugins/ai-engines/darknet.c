@@ -35,7 +35,11 @@
 #include "darknet.h"				// original library header, libdarknet.so / libdarknet.a
 #include "darknet-wrapper.h"
 
+#ifdef DARKNET_INT8
+#define AI_PLUGIN_TYPE_STRING "ai-engine::darknet-int8"	// quantize = "int8" by default
+#else
 #define AI_PLUGIN_TYPE_STRING "ai-engine::darknet"
+#endif
 
 /* Entry-Point Functions */
 #ifdef __cplusplus
@@ -64,76 +68,231 @@ static int ai_plugin_darknet_load_config(struct ai_engine * engine, json_object
 {
 	return 0;
 }
-static int ai_plugin_darknet_predict(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults)
+/*
+ * jpeg frames are decoded at the smallest DCT scale which still covers (net_width x net_height),
+ * 0: at full size (pixel boxes are measured on the decoded image)
+ */
+static bgra_image_t * frame_to_bgra(const input_frame_t * frame, int net_width, int net_height)
 {
-	debug_printf("%s(): frame: type=%d, size=%d x %d", __FUNCTION__,
-		frame->type,
-		frame->width, frame->height);
-		
-	int rc = -1;
-	darknet_context_t * darknet = engine->priv;
-	assert(darknet);
-
 	bgra_image_t * bgra = NULL;
 	int type = frame->type & input_frame_type_image_masks;
 
-	if(type == input_frame_type_bgra) bgra = (bgra_image_t *)frame->bgra;
+	if(type == input_frame_type_bgra || type == input_frame_type_rgb_planar) bgra = (bgra_image_t *)frame->bgra;	// channels: 4 (BGRA/BGRx) or 3 (RGB planar)
 	else if(type == input_frame_type_png || type == input_frame_type_jpeg)
 	{
-		bgra = bgra_image_init(NULL, frame->width, frame->height, NULL);
-		rc = bgra_image_load_data(bgra, frame->data, frame->length);
-		if(rc)
+		bgra = calloc(1, sizeof(*bgra));
+		assert(bgra);
+		int rc = -1;
+		if(type == input_frame_type_jpeg) {
+			img_jpeg_decode_params_t params[1];
+			img_jpeg_decode_params_init(params);
+			params->min_width = net_width;
+			params->min_height = net_height;
+			rc = bgra_image_from_jpeg_stream_scaled(bgra, frame->data, frame->length, params);
+		}else {
+			rc = bgra_image_load_data(bgra, frame->data, frame->length);
+		}
+		if(rc || NULL == bgra->data)
 		{
 			bgra_image_clear(bgra);
+			free(bgra);
 			bgra = NULL;
 		}
 	}
-	if(bgra)
+	return bgra;
+}
+
+static json_object * detections_to_json(darknet_context_t * darknet, ai_detection_t * results, ssize_t count)
+{
+	json_object * jresults = json_object_new_object();
+	json_object_object_add(jresults, "model", json_object_new_string("darknet::YOLOV3"));
+	
+	json_object * jdetections = json_object_new_array();
+	json_object_object_add(jresults, "detections", jdetections);
+
+	for(ssize_t i = 0; i < count; ++i)
 	{
-		ai_detection_t * results = NULL;
-		
-		app_timer_t timer[1];
-		double time_elapsed = 0;
-		app_timer_start(timer);
-		ssize_t count = darknet->predict(darknet, bgra, &results);
+		json_object * jdet = json_object_new_object();
+		json_object_object_add(jdet, "class", json_object_new_string(darknet_detection_get_class_names(darknet, &results[i])));
+		json_object_object_add(jdet, "class_index", json_object_new_int(results[i].klass));
+		json_object_object_add(jdet, "confidence", json_object_new_double(results[i].confidence));
+		json_object_object_add(jdet, "left", json_object_new_double(results[i].x));
+		json_object_object_add(jdet, "top", json_object_new_double(results[i].y));
+		json_object_object_add(jdet, "width", json_object_new_double(results[i].cx));
+		json_object_object_add(jdet, "height", json_object_new_double(results[i].cy));
+
+		json_object_array_add(jdetections, jdet);
+	}
+	return jresults;
+}
+
+static int ai_plugin_darknet_predict(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults)
+{
+	debug_printf("%s(): frame: type=%d, size=%d x %d", __FUNCTION__,
+		frame->type,
+		frame->width, frame->height);
+	
+	json_object * results[1] = { NULL };
+	int num_results = engine->predict_batch(engine, &frame, 1, results);
+	if(num_results <= 0) return -1;
+	
+	if(p_jresults) *p_jresults = results[0];
+	else json_object_put(results[0]);
+	return 0;
+}
+
+/*
+ * frames per darknet_predict_frames() call: the per-call arrays have a fixed size,
+ * larger requests are run in chunks (the wrapper splits each chunk by max_batch).
+ */
+#define DARKNET_PLUGIN_MAX_FRAMES	(64)
+
+/*
+ * run the decodable frames through the network (count <= DARKNET_PLUGIN_MAX_FRAMES):
+ *   frames[i] --> detections[batch_index[i]] / counts[batch_index[i]], (batch_index[i] < 0: not decodable)
+ *   frames == NULL: the input was written into the workspace by the caller
+ * the detections are owned by the darknet context (valid until the next call), return the number of frames predicted.
+ */
+static int darknet_predict_frames(darknet_context_t * darknet, const input_frame_t * frames[], int count,
+	ai_detection_t * detections[], ssize_t counts[], int batch_index[])
+{
+	assert(count <= DARKNET_PLUGIN_MAX_FRAMES);
+	if(NULL == frames)
+	{
+		for(int i = 0; i < count; ++i) batch_index[i] = i;
+		darknet->predict_batch(darknet, count, NULL, detections, counts);
+		return count;
+	}
+	
+	const bgra_image_t * images[DARKNET_PLUGIN_MAX_FRAMES];
+	const ai_tensor_t * input = darknet->get_workspace(darknet);
+	assert(input);
+	
+	int batch = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		batch_index[i] = -1;
+		bgra_image_t * bgra = darknet->relative?frame_to_bgra(frames[i], input->dim->w, input->dim->h)
+			:frame_to_bgra(frames[i], 0, 0);
+		if(NULL == bgra) continue;
 		
-		time_elapsed = app_timer_stop(timer);
-		debug_printf("[INFO]::darknet->predict()::time_elapsed=%.3f ms", 
-			time_elapsed * 1000);
+		batch_index[i] = batch;
+		images[batch] = bgra;
+		detections[batch] = NULL;
+		counts[batch] = 0;
+		++batch;
+	}
+	if(batch == 0) return 0;
+	
+	app_timer_t timer[1];
+	double time_elapsed = 0;
+	app_timer_start(timer);
+	darknet->predict_batch(darknet, batch, images, detections, counts);
+	
+	time_elapsed = app_timer_stop(timer);
+	debug_printf("[INFO]::darknet->predict_batch(%d)::time_elapsed=%.3f ms", 
+		batch, time_elapsed * 1000);
+	
+	for(int i = 0; i < count; ++i)
+	{
+		int index = batch_index[i];
+		if(index < 0) continue;
+		if(images[index] != frames[i]->bgra)
+		{
+			bgra_image_clear((bgra_image_t *)images[index]);
+			free((bgra_image_t *)images[index]);
+		}
+	}
+	return batch;
+}
+
+static int ai_plugin_darknet_predict_batch(struct ai_engine * engine, const input_frame_t * frames[], int count, json_object * results[])
+{
+	darknet_context_t * darknet = engine->priv;
+	assert(darknet);
+	if(count <= 0) return 0;
+	assert(frames || count <= DARKNET_PLUGIN_MAX_FRAMES);
+	
+	ai_detection_t * detections[DARKNET_PLUGIN_MAX_FRAMES];
+	ssize_t counts[DARKNET_PLUGIN_MAX_FRAMES];
+	int batch_index[DARKNET_PLUGIN_MAX_FRAMES];
+	
+	int num_predicted = 0;
+	int num_results = 0;
+	for(int offset = 0; offset < count; offset += DARKNET_PLUGIN_MAX_FRAMES)
+	{
+		int chunk = count - offset;
+		if(chunk > DARKNET_PLUGIN_MAX_FRAMES) chunk = DARKNET_PLUGIN_MAX_FRAMES;
 		
-		if(count > 0  && p_jresults)
+		num_predicted += darknet_predict_frames(darknet, frames?(frames + offset):NULL, chunk, detections, counts, batch_index);
+		for(int i = 0; i < chunk; ++i)
 		{
-			json_object * jresults = json_object_new_object();
-			json_object_object_add(jresults, "model", json_object_new_string("darknet::YOLOV3"));
+			results[offset + i] = NULL;
+			int index = batch_index[i];
+			if(index < 0 || counts[index] <= 0) continue;
 			
-			json_object * jdetections = json_object_new_array();
-			json_object_object_add(jresults, "detections", jdetections);
-
-			for(ssize_t i = 0; i < count; ++i)
-			{
-				json_object * jdet = json_object_new_object();
-				json_object_object_add(jdet, "class", json_object_new_string(results[i].class_names));
-				json_object_object_add(jdet, "class_index", json_object_new_int(results[i].klass));
-				json_object_object_add(jdet, "confidence", json_object_new_double(results[i].confidence));
-				json_object_object_add(jdet, "left", json_object_new_double(results[i].x));
-				json_object_object_add(jdet, "top", json_object_new_double(results[i].y));
-				json_object_object_add(jdet, "width", json_object_new_double(results[i].cx));
-				json_object_object_add(jdet, "height", json_object_new_double(results[i].cy));
-
-				json_object_array_add(jdetections, jdet);
-			}
-			*p_jresults = jresults;
-			rc = 0;
+			results[offset + i] = detections_to_json(darknet, detections[index], counts[index]);
+			++num_results;
 		}
+	}
+	if(num_predicted <= 0) return -1;
+	return num_results;
+}
 
-		if(results) free(results);
-		if(bgra != frame->bgra)
+static int ai_plugin_darknet_predict_detections(struct ai_engine * engine, const input_frame_t * frames[], int count, ai_detections_t results[])
+{
+	darknet_context_t * darknet = engine->priv;
+	assert(darknet);
+	if(count <= 0) return 0;
+	assert(frames || count <= DARKNET_PLUGIN_MAX_FRAMES);
+	
+	ai_detection_t * detections[DARKNET_PLUGIN_MAX_FRAMES];
+	ssize_t counts[DARKNET_PLUGIN_MAX_FRAMES];
+	int batch_index[DARKNET_PLUGIN_MAX_FRAMES];
+	
+	int num_predicted = 0;
+	for(int offset = 0; offset < count; offset += DARKNET_PLUGIN_MAX_FRAMES)
+	{
+		int chunk = count - offset;
+		if(chunk > DARKNET_PLUGIN_MAX_FRAMES) chunk = DARKNET_PLUGIN_MAX_FRAMES;
+		
+		num_predicted += darknet_predict_frames(darknet, frames?(frames + offset):NULL, chunk, detections, counts, batch_index);
+		for(int i = 0; i < chunk; ++i)
 		{
-			bgra_image_clear(bgra);
-			free(bgra);
+			ai_detections_t * result = &results[offset + i];
+			result->model = "darknet::YOLOV3";
+			result->num_labels = darknet->num_labels;
+			result->labels = darknet->labels;
+			ai_detections_reset(result);
+			
+			int index = batch_index[i];
+			if(index < 0 || counts[index] <= 0) continue;
+			
+			int rc = ai_detections_reserve(result, counts[index]);
+			assert(0 == rc);
+			for(ssize_t ii = 0; ii < counts[index]; ++ii)
+			{
+				const ai_detection_t * det = &detections[index][ii];
+				ai_detection_box_t * box = &result->boxes[ii];
+				box->left = det->x;
+				box->top = det->y;
+				box->width = det->cx;
+				box->height = det->cy;
+				box->confidence = det->confidence;
+				box->class_index = det->klass;
+			}
+			result->count = counts[index];
 		}
 	}
-	return rc;
+	if(num_predicted <= 0) return -1;
+	return num_predicted;
+}
+
+static ai_tensor_t * ai_plugin_darknet_get_workspace(struct ai_engine * engine)
+{
+	darknet_context_t * darknet = engine->priv;
+	assert(darknet);
+	return darknet->get_workspace(darknet);
 }
 
 static int ai_plugin_darknet_update(struct ai_engine * engine, const ai_tensor_t * truth)
@@ -170,9 +329,12 @@ int ann_plugin_init(ai_engine_t * engine, json_object * jconfig)
 	engine->cleanup = ai_plugin_darknet_cleanup;
 	engine->load_config = ai_plugin_darknet_load_config;
 	engine->predict = ai_plugin_darknet_predict;
+	engine->predict_batch = ai_plugin_darknet_predict_batch;
+	engine->predict_detections = ai_plugin_darknet_predict_detections;
 	engine->update = ai_plugin_darknet_update;
 	engine->get_property = ai_plugin_darknet_get_property;
 	engine->set_property = ai_plugin_darknet_set_property;
+	engine->get_workspace = ai_plugin_darknet_get_workspace;
 	return 0;
 }
 
@@ -18,7 +18,15 @@ function build()
 	case "${target}" in
 		darknet|darknet-wrapper):
 			gcc -std=gnu99 -g -Wall -D_DEBUG -fPIC -shared -o plugins/libaiplugin-darknet.so \
-				darknet.c darknet-wrapper.c -Iinclude -I. \
+				darknet.c darknet-wrapper.c darknet-int8.c -Iinclude -I. \
+				utils/*.c \
+				${DARKNET_CFLAGS} ${DARKNET_LIBS} \
+				-lm -lpthread -ljson-c -ljpeg -lpng -lcairo \
+				`pkg-config --cflags --libs gio-2.0 glib-2.0`
+		;;
+		darknet-int8):
+			gcc -std=gnu99 -g -Wall -O2 -D_DEBUG -DDARKNET_INT8 -fPIC -shared -o plugins/libaiplugin-darknet-int8.so \
+				darknet.c darknet-wrapper.c darknet-int8.c -Iinclude -I. \
 				utils/*.c \
 				${DARKNET_CFLAGS} ${DARKNET_LIBS} \
 				-lm -lpthread -ljson-c -ljpeg -lpng -lcairo \
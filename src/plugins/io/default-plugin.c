@@ -36,6 +36,7 @@
 #include "auto-buffer.h"
 
 #include "input-source.h"
+#include "ingest-engine.h"
 #include <gst/gst.h>
 
 #define ANN_PLUGIN_TYPE_STRING "io-plugin::input-source"
@@ -75,11 +76,13 @@ static void init_plugin_context(void)
 // input-source callback function
 static int io_plugin_input_source_on_new_frame(struct input_source * priv, const input_frame_t * frame)
 {
-	int rc = -1;
+	long rc = 0;
 	io_input_t * input = priv->user_data;
 	if(input->set_frame) rc = input->set_frame(input, frame);
+	if(rc < 0) return -1;		// all frame slots are busy, report backpressure to the source
+	
 	if(input->on_new_frame) rc = input->on_new_frame(input, frame);
-	return rc;
+	return (int)rc;
 }
 
 /****************************************
@@ -91,6 +94,27 @@ static int io_plugin_input_source_load_config(io_input_t * input, json_object *
 	input_source_t * priv = input->priv;
 	assert(priv);
 	
+	int frame_slots = json_get_value(jconfig, int, frame_slots);
+	if(frame_slots > 0) io_input_set_frame_slots(input, frame_slots);
+	
+	// zero_copy: frames reference the decoded GstBuffer directly (keep frame_slots below the decoder's pool size)
+	priv->zero_copy = json_get_value(jconfig, int, zero_copy);
+	priv->max_buffers = json_get_value(jconfig, int, max_buffers);
+	priv->max_fps = json_get_value(jconfig, double, max_fps);
+	priv->decoder_threads = json_get_value_default(jconfig, int, decoder_threads, 1);
+	priv->fps = json_get_value(jconfig, double, fps);
+	priv->keyframes_only = json_get_value(jconfig, int, keyframes_only);
+	
+	// process-wide: the size of the shared ingest worker pool (0: number of cpus)
+	int ingest_workers = json_get_value(jconfig, int, ingest_workers);
+	if(ingest_workers > 0) ingest_engine_set_workers(ingest_workers);
+	
+	// output geometry / pixel format, should match the ai-engine's network input
+	priv->width = json_get_value(jconfig, int, width);
+	priv->height = json_get_value(jconfig, int, height);
+	const char * format = json_get_value(jconfig, string, format);
+	if(format) strncpy(priv->format, format, sizeof(priv->format) - 1);
+	
 	const char * uri = json_get_value(jconfig, string, uri);
 	return priv->set_uri(priv, uri);
 }
@@ -98,8 +122,29 @@ static int io_plugin_input_source_load_config(io_input_t * input, json_object *
 
 static int io_plugin_get_property(struct io_input * input, const char * name, char ** p_value, size_t * p_length)
 {
-	// TODO: ...
+	if(NULL == name || NULL == p_value) return -1;
+	input_source_t * priv = input->priv;
+	assert(priv);
 	
+	if(strcasecmp(name, "stats") == 0)
+	{
+		input_source_stats_t stats[1];
+		memset(stats, 0, sizeof(stats));
+		if(priv->get_stats) priv->get_stats(priv, stats);
+		
+		char sz_stats[320] = "";
+		int cb = snprintf(sz_stats, sizeof(sz_stats), 
+			"{\"frames_received\": %ld, \"frames_delivered\": %ld, "
+			"\"frames_dropped\": %ld, \"frames_rejected\": %ld, \"frames_throttled\": %ld, \"frames_skipped\": %ld, "
+			"\"ring_frames_dropped\": %ld, \"process_time\": %.6f, \"ingest_workers\": %d}",
+			stats->frames_received, stats->frames_delivered, 
+			stats->frames_dropped, stats->frames_rejected, stats->frames_throttled, stats->frames_skipped,
+			io_input_get_frames_dropped(input), stats->process_time,
+			ingest_engine_get_workers());
+		*p_value = strdup(sz_stats);
+		if(p_length) *p_length = cb;
+		return 0;
+	}
 	return -1;
 }
 
@@ -112,6 +157,20 @@ static int io_plugin_set_property(io_input_t * input, const char * name, const c
 	if(priv && strcasecmp(name, "uri") == 0 && value)
 	{
 		priv->set_uri(priv, value);
+	}else if(priv && strcasecmp(name, "zero_copy") == 0 && value)
+	{
+		priv->zero_copy = (strcasecmp(value, "true") == 0 || atoi(value) != 0);
+		rc = 0;
+	}else if(priv && strcasecmp(name, "fps") == 0 && value)
+	{
+		double fps = atof(value);
+		if(priv->set_decimation) rc = priv->set_decimation(priv, fps, priv->keyframes_only);
+		else { priv->fps = fps; rc = 0; }
+	}else if(priv && strcasecmp(name, "keyframes_only") == 0 && value)
+	{
+		int keyframes_only = (strcasecmp(value, "true") == 0 || atoi(value) != 0);
+		if(priv->set_decimation) rc = priv->set_decimation(priv, priv->fps, keyframes_only);
+		else { priv->keyframes_only = keyframes_only; rc = 0; }
 	}
 	
 	return rc;
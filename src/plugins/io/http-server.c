@@ -147,7 +147,9 @@ static int io_plugin_httpd_load_config(io_input_t * input, json_object * jconfig
 	const char * port = json_get_value_default(jconfig, string, port, "9001");
 	const char * path = json_get_value_default(jconfig, string, path, "/");
 	int local_only = json_get_value(jconfig, int, local_only);
+	int frame_slots = json_get_value(jconfig, int, frame_slots);
 	
+	if(frame_slots > 0) io_input_set_frame_slots(input, frame_slots);
 	if(port) httpd->port = strdup(port);
 	if(path) httpd->path = strdup(path);
 	httpd->local_only = local_only;
@@ -374,6 +376,11 @@ static http_session_t * http_session_new(SoupServer * server, SoupMessage * msg,
 static const char no_error[] = "{ \"error-code\": 0, \"message\": \"\" }";
 static int on_get(http_session_t * session);
 static int on_post(http_session_t * session);
+static void release_soup_buffer(void * data, void * user_data)
+{
+	soup_buffer_free((SoupBuffer *)user_data);
+}
+
 static void * http_session_process(http_session_t * session)	// response: json format
 {
 	assert(session);
@@ -429,10 +436,10 @@ static int on_get(http_session_t * session)
 	assert(msg);
 	
 	io_input_t * input = httpd->input;
-	assert(input && input->get_frame);
-	input_frame_t * frame = input_frame_new();
-	long frame_number = input->get_frame(input, -1, frame);
-	if(frame_number > 0)
+	assert(input && input->get_frame_ref);
+	const input_frame_t * frame = NULL;
+	long frame_number = input->get_frame_ref(input, -1, &frame);
+	if(frame_number > 0 && frame)
 	{
 		json_object * jresponse = json_object_new_object();
 
@@ -459,7 +466,7 @@ static int on_get(http_session_t * session)
 		json_object_put(jresponse);
 	}
 
-	input_frame_free(frame);
+	if(frame) input->release_frame(input, frame);
 	if(rc) soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
 	return rc;
 }
@@ -502,22 +509,37 @@ static int on_post(http_session_t * session)
 	
 	input_frame_t * frame = input_frame_new();
 
-	//~ SoupBuffer * in_buf = soup_message_body_flatten(request);
-	//~ assert(in_buf);
-
-	//~ const unsigned char * image_data = NULL;
-	const unsigned char * image_data = (unsigned char *)request->data;
-	//~ gsize length = 0;
-	//~ soup_buffer_get_data(in_buf, &image_data, &length);
-	//~ assert(image_data && length <= request->length);
+	// zero-copy: the frame (and every ring slot sharing it) holds the flattened request buffer
+	SoupBuffer * in_buf = soup_message_body_flatten(request);
+	assert(in_buf);
 
+	const unsigned char * image_data = NULL;
+	gsize length = 0;
+	soup_buffer_get_data(in_buf, (const guint8 **)&image_data, &length);
+	
 	rc = -1;
+	int width = 0;
+	int height = 0;
 	if(g_content_type_equals(content_type, "image/jpeg"))
 	{
-		rc = input_frame_set_jpeg(frame, (unsigned char *)image_data, request->length, NULL, 0);
+		rc = img_utils_get_jpeg_size(image_data, length, &width, &height);
+		if(0 == rc && width > 0 && height > 0)
+		{
+			rc = input_frame_adopt_buffer(frame, input_frame_type_jpeg, (unsigned char *)image_data, length,
+				width, height, 0, 0, 
+				release_soup_buffer, in_buf);
+			in_buf = NULL;
+		}
 	}else if(g_content_type_equals(content_type, "image/png"))
 	{
-		rc = input_frame_set_png(frame, (unsigned char *)image_data, request->length, NULL, 0);
+		rc = img_utils_get_png_size(image_data, length, &width, &height);
+		if(0 == rc && width > 0 && height > 0)
+		{
+			rc = input_frame_adopt_buffer(frame, input_frame_type_png, (unsigned char *)image_data, length,
+				width, height, 0, 0, 
+				release_soup_buffer, in_buf);
+			in_buf = NULL;
+		}
 	}else if(strcasecmp(content_type, "image/bgra") == 0 && params)
 	{
 		const char * sz_width = g_hash_table_lookup(params, "width");
@@ -525,8 +547,8 @@ static int on_post(http_session_t * session)
 		const char * sz_channels = g_hash_table_lookup(params, "channels");
 		const char * sz_stride = g_hash_table_lookup(params, "stride");
 
-		int width = sz_width?atoi(sz_width):-1;
-		int height = sz_height?atoi(sz_height):-1;
+		width = sz_width?atoi(sz_width):-1;
+		height = sz_height?atoi(sz_height):-1;
 		int stride = 0;
 		int channels = 4;
 
@@ -536,11 +558,15 @@ static int on_post(http_session_t * session)
 			stride = sz_stride?atoi(sz_stride):(width * channels);
 		}
 
-		assert((stride * height) == request->length);
-		rc = input_frame_set_bgra(frame,
-			&(bgra_image_t){.data = (unsigned char *)image_data, .width = width, .height = height, .channels = channels, .stride = stride },
-			NULL, 0);
+		if(width > 0 && height > 0 && (stride * height) == length)
+		{
+			rc = input_frame_adopt_buffer(frame, input_frame_type_bgra, (unsigned char *)image_data, length,
+				width, height, channels, stride, 
+				release_soup_buffer, in_buf);
+			in_buf = NULL;
+		}
 	}
+	if(in_buf) soup_buffer_free(in_buf);
 
 	if(0 == rc)
 	{
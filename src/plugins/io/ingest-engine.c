@@ -0,0 +1,328 @@
+/*
+ * ingest-engine.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include "utils.h"
+#include "ingest-engine.h"
+
+#define INGEST_ENGINE_MAX_WORKERS	(256)
+
+struct ingest_stream
+{
+	GstAppSink * sink;
+	ingest_stream_process_func process;
+	void * user_data;
+
+	/* scheduling states, protected by the engine's mutex */
+	int active;
+	int queued;
+	int busy;
+	long pending;				// new-sample notifications not yet served
+	struct ingest_stream * next;
+
+	/* fps cap (accessed by the owning worker only) */
+	double min_interval;		// 1 / max_fps
+	double last_delivered;
+
+	/* stats */
+	long frames_received;
+	long frames_pulled;
+	long frames_delivered;
+	long frames_throttled;
+	long frames_rejected;
+	long process_time_ns;		// accumulated
+};
+
+typedef struct ingest_engine
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;		// ready queue is not empty / stop
+	pthread_cond_t idle_cond;	// a stream has finished processing
+
+	int num_workers;
+	pthread_t * workers;
+	long generation;			// bumped on stop: the workers of an older generation quit
+
+	long num_streams;
+	ingest_stream_t * head;		// ready queue
+	ingest_stream_t * tail;
+}ingest_engine_t;
+
+static ingest_engine_t s_engine[1] = {{
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.idle_cond = PTHREAD_COND_INITIALIZER,
+}};
+static int s_num_workers;
+
+/* engine->mutex locked */
+static void ready_queue_push(ingest_engine_t * engine, ingest_stream_t * stream)
+{
+	assert(!stream->queued);
+	stream->queued = 1;
+	stream->next = NULL;
+	if(engine->tail) engine->tail->next = stream;
+	else engine->head = stream;
+	engine->tail = stream;
+	pthread_cond_signal(&engine->cond);
+}
+
+static ingest_stream_t * ready_queue_pop(ingest_engine_t * engine)
+{
+	ingest_stream_t * stream = engine->head;
+	if(NULL == stream) return NULL;
+
+	engine->head = stream->next;
+	if(NULL == engine->head) engine->tail = NULL;
+	stream->next = NULL;
+	stream->queued = 0;
+	return stream;
+}
+
+static void ready_queue_remove(ingest_engine_t * engine, ingest_stream_t * stream)
+{
+	if(!stream->queued) return;
+	ingest_stream_t * prev = NULL;
+	ingest_stream_t * node = engine->head;
+	while(node && node != stream) { prev = node; node = node->next; }
+	assert(node);
+
+	if(prev) prev->next = stream->next;
+	else engine->head = stream->next;
+	if(engine->tail == stream) engine->tail = prev;
+	stream->next = NULL;
+	stream->queued = 0;
+}
+
+#define stats_add(stream, field, value) __atomic_add_fetch(&(stream)->field, value, __ATOMIC_RELAXED)
+static int ingest_stream_serve(ingest_stream_t * stream)
+{
+	GstSample * sample = gst_app_sink_try_pull_sample(stream->sink, 0);
+	if(NULL == sample) return 0;	// nothing left (dropped by the appsink or stopped)
+	stats_add(stream, frames_pulled, 1);
+
+	double now = app_timer_get_time();
+	if(stream->min_interval > 0 && (now - stream->last_delivered) < stream->min_interval)
+	{
+		stats_add(stream, frames_throttled, 1);
+		gst_sample_unref(sample);
+		return 1;
+	}
+
+	long rc = stream->process(stream->user_data, sample);
+	gst_sample_unref(sample);
+
+	double time_elapsed = app_timer_get_time() - now;
+	stats_add(stream, process_time_ns, (long)(time_elapsed * 1000000000.0));
+
+	if(rc < 0)
+	{
+		stats_add(stream, frames_rejected, 1);
+		return 1;
+	}
+	stats_add(stream, frames_delivered, 1);
+	stream->last_delivered = now;
+	return 1;
+}
+
+static void * ingest_worker_thread(void * user_data)
+{
+	ingest_engine_t * engine = s_engine;
+	const long generation = (long)user_data;
+
+	pthread_mutex_lock(&engine->mutex);
+	while(generation == engine->generation)
+	{
+		ingest_stream_t * stream = ready_queue_pop(engine);
+		if(NULL == stream)
+		{
+			pthread_cond_wait(&engine->cond, &engine->mutex);
+			continue;
+		}
+
+		stream->busy = 1;
+		--stream->pending;
+		pthread_mutex_unlock(&engine->mutex);
+
+		int served = ingest_stream_serve(stream);
+
+		pthread_mutex_lock(&engine->mutex);
+		stream->busy = 0;
+		if(!served || stream->pending < 0) stream->pending = 0;
+
+		// one sample per turn: requeue at the tail to keep the streams fair
+		if(stream->active && stream->pending > 0) ready_queue_push(engine, stream);
+		if(!stream->active) pthread_cond_broadcast(&engine->idle_cond);
+	}
+	pthread_mutex_unlock(&engine->mutex);
+	pthread_exit((void *)(long)0);
+}
+
+/* engine->mutex locked */
+static void ingest_engine_start(ingest_engine_t * engine)
+{
+	if(engine->workers) return;
+
+	int num_workers = s_num_workers;
+	if(num_workers <= 0) num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(num_workers <= 0) num_workers = 1;
+	if(num_workers > INGEST_ENGINE_MAX_WORKERS) num_workers = INGEST_ENGINE_MAX_WORKERS;
+
+	engine->workers = calloc(num_workers, sizeof(*engine->workers));
+	assert(engine->workers);
+	engine->num_workers = num_workers;
+	for(int i = 0; i < num_workers; ++i)
+	{
+		int rc = pthread_create(&engine->workers[i], NULL, ingest_worker_thread, (void *)engine->generation);
+		assert(0 == rc);
+	}
+	debug_printf("%s(): %d workers", __FUNCTION__, num_workers);
+}
+
+/* engine->mutex locked, the lock will be released temporarily while joining the workers */
+static void ingest_engine_stop(ingest_engine_t * engine)
+{
+	if(NULL == engine->workers) return;
+
+	pthread_t * workers = engine->workers;
+	int num_workers = engine->num_workers;
+	engine->workers = NULL;
+	engine->num_workers = 0;
+	++engine->generation;
+	pthread_cond_broadcast(&engine->cond);
+	pthread_mutex_unlock(&engine->mutex);
+
+	for(int i = 0; i < num_workers; ++i)
+	{
+		void * exit_code = NULL;
+		pthread_join(workers[i], &exit_code);
+	}
+	free(workers);
+
+	pthread_mutex_lock(&engine->mutex);
+}
+
+int ingest_engine_set_workers(int num_workers)
+{
+	if(num_workers < 0) return -1;
+	pthread_mutex_lock(&s_engine->mutex);
+	s_num_workers = num_workers;
+	pthread_mutex_unlock(&s_engine->mutex);
+	return 0;
+}
+
+int ingest_engine_get_workers(void)
+{
+	pthread_mutex_lock(&s_engine->mutex);
+	int num_workers = s_engine->num_workers;
+	pthread_mutex_unlock(&s_engine->mutex);
+	return num_workers;
+}
+
+/*****************************************************************
+ * ingest_stream
+*****************************************************************/
+static GstFlowReturn ingest_stream_on_new_sample(GstAppSink * sink, gpointer user_data)
+{
+	ingest_stream_t * stream = user_data;
+	ingest_engine_t * engine = s_engine;
+
+	pthread_mutex_lock(&engine->mutex);
+	stats_add(stream, frames_received, 1);
+	++stream->pending;
+	if(stream->active && !stream->queued && !stream->busy) ready_queue_push(engine, stream);
+	pthread_mutex_unlock(&engine->mutex);
+
+	return GST_FLOW_OK;		// the sample stays queued in the appsink until pulled (or dropped)
+}
+
+ingest_stream_t * ingest_stream_new(GstElement * appsink, ingest_stream_process_func process, void * user_data)
+{
+	assert(appsink && process);
+	ingest_engine_t * engine = s_engine;
+
+	ingest_stream_t * stream = calloc(1, sizeof(*stream));
+	assert(stream);
+	stream->sink = GST_APP_SINK(appsink);
+	stream->process = process;
+	stream->user_data = user_data;
+	stream->active = 1;
+
+	pthread_mutex_lock(&engine->mutex);
+	if(0 == engine->num_streams++) ingest_engine_start(engine);
+	pthread_mutex_unlock(&engine->mutex);
+
+	GstAppSinkCallbacks callbacks = { .new_sample = ingest_stream_on_new_sample, };
+	gst_app_sink_set_callbacks(stream->sink, &callbacks, stream, NULL);
+	return stream;
+}
+
+void ingest_stream_free(ingest_stream_t * stream)
+{
+	if(NULL == stream) return;
+	ingest_engine_t * engine = s_engine;
+
+	pthread_mutex_lock(&engine->mutex);
+	stream->active = 0;
+	ready_queue_remove(engine, stream);
+	while(stream->busy) pthread_cond_wait(&engine->idle_cond, &engine->mutex);
+
+	if(0 == --engine->num_streams) ingest_engine_stop(engine);
+	pthread_mutex_unlock(&engine->mutex);
+
+	free(stream);
+}
+
+void ingest_stream_set_max_fps(ingest_stream_t * stream, double max_fps)
+{
+	assert(stream);
+	stream->min_interval = (max_fps > 0)?(1.0 / max_fps):0;
+}
+
+void ingest_stream_get_stats(ingest_stream_t * stream, ingest_stream_stats_t * stats)
+{
+	assert(stream && stats);
+#define stats_load(stream, field) __atomic_load_n(&(stream)->field, __ATOMIC_RELAXED)
+	stats->frames_received = stats_load(stream, frames_received);
+	stats->frames_pulled = stats_load(stream, frames_pulled);
+	stats->frames_delivered = stats_load(stream, frames_delivered);
+	stats->frames_throttled = stats_load(stream, frames_throttled);
+	stats->frames_rejected = stats_load(stream, frames_rejected);
+	
+	long frames_processed = stats->frames_delivered + stats->frames_rejected;
+	stats->process_time = (frames_processed > 0)?
+		((double)stats_load(stream, process_time_ns) / 1000000000.0 / (double)frames_processed):0;
+#undef stats_load
+	return;
+}
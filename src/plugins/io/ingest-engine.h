@@ -0,0 +1,56 @@
+#ifndef _INGEST_ENGINE_H_
+#define _INGEST_ENGINE_H_
+
+#include <stdio.h>
+#include <gst/gst.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup ingest_engine
+ * @{
+ *
+ * ingest_engine: multiplexes the appsinks of many video sources
+ * onto a bounded pool of worker threads shared by the whole process.
+ *
+ * The workers pull the decoded samples and run the (convert / copy / deliver) callbacks,
+ * decoding itself stays on the streaming thread of each pipeline (see input-source.c:
+ * libav max-threads is bounded by "decoder_threads", and the fps cap drops whole GOPs in front of the decoder).
+ *
+ * - streams with pending samples are served in FIFO (round-robin) order,
+ *   one sample per turn, so a busy stream can not starve the others.
+ * - per-stream fps cap: decoded samples arriving faster than max_fps are pulled and discarded.
+ */
+typedef struct ingest_stream ingest_stream_t;
+
+// return -1 if the frame was not accepted (backpressure)
+typedef long (* ingest_stream_process_func)(void * user_data, GstSample * sample);
+
+typedef struct ingest_stream_stats
+{
+	long frames_received;	// samples queued into the appsink
+	long frames_pulled;
+	long frames_delivered;	// accepted by the consumer
+	long frames_throttled;	// discarded by the fps cap
+	long frames_rejected;	// refused by the consumer (backpressure)
+	double process_time;	// average time spent in the process callback (in seconds)
+}ingest_stream_stats_t;
+
+int ingest_engine_set_workers(int num_workers);	// takes effect when the engine (re)starts, 0: number of cpus
+int ingest_engine_get_workers(void);
+
+ingest_stream_t * ingest_stream_new(GstElement * appsink, ingest_stream_process_func process, void * user_data);
+void ingest_stream_free(ingest_stream_t * stream);	// the pipeline should be stopped first
+void ingest_stream_set_max_fps(ingest_stream_t * stream, double max_fps);	// <= 0: unlimited
+void ingest_stream_get_stats(ingest_stream_t * stream, ingest_stream_stats_t * stats);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
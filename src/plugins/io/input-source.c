@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "input-source.h"
 
@@ -34,12 +35,16 @@
 #endif
 
 #include <pthread.h>
+#include <unistd.h>
 #include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
 
 #include <glib.h>
 #include <gio/gio.h>
 
 #include "utils.h"
+#include "ingest-engine.h"
 
 enum input_source_type guess_file_type(const char * path_name, int * subtype)
 {
@@ -156,12 +161,32 @@ typedef struct video_source
 	input_frame_t frame[1];
 	
 	/* private context */
-	GMainLoop * loop;
 	GstElement * pipeline;
-	GstElement * filter;
-	GstElement * sink;
+	GstElement * sink;		// appsink
+	GstElement * rate;		// videorate (decimation before scale / convert)
 
 	char * gst_command;
+	
+	// cached caps, re-parsed only when the sample carries new caps (renegotiation)
+	GstCaps * caps;
+	int width;
+	int height;
+	int stride;
+	ssize_t frame_size;
+	enum input_frame_type frame_type;
+	int channels;
+	
+	// samples are pulled by the shared ingest engine
+	ingest_stream_t * stream;
+	
+	// keyframes_only: delta units were dropped, keep dropping them until the next keyframe (decoder input probe only)
+	int waiting_for_keyframe;
+	
+	// fps cap in front of the decoder: whole GOPs are dropped (gop_interval: microseconds, 0: off)
+	gint64 gop_interval;
+	gint64 last_gop_time;		// decoder input probe only
+	int gop_dropped;			// decoder input probe only
+	long frames_skipped;		// encoded frames dropped before decode
 
 	/* virtual methods */
 	//~ int (* play)(input_source_t * input);
@@ -463,8 +488,8 @@ static int 	input_source_restart(struct input_source * input)
 
 static int 	input_source_on_new_frame(struct input_source * input, const input_frame_t * frame)
 {
-	input->set_frame(input, frame);	// default process
-	return 0;
+	long rc = input->set_frame(input, frame);	// default process
+	return (rc < 0)?-1:0;
 }
 
 static long input_source_set_frame(struct input_source * input, const input_frame_t * new_frame)
@@ -522,68 +547,274 @@ static gboolean video_source_on_error(GstBus * bus, GstMessage * message, video_
 	return FALSE;
 }
 
-static void video_source_on_bgra_filter(GstElement * filter, GstBuffer * buffer, video_source_t * src)
+static const struct video_output_format
+{
+	const char * name;					// gstreamer format
+	enum input_frame_type frame_type;
+	int channels;
+}s_video_output_formats[] = {
+	{ "BGRA", input_frame_type_bgra, 4 },
+	{ "BGRx", input_frame_type_bgra, 4 },
+	{ "RGBP", input_frame_type_rgb_planar, 3 },
+	{ "GRAY8", input_frame_type_gray8, 1 },
+	{ "NV12", input_frame_type_nv12, 1 },
+};
+static const struct video_output_format * video_output_format_find(const char * name)
+{
+	if(NULL == name || !name[0]) return &s_video_output_formats[0];
+	for(size_t i = 0; i < (sizeof(s_video_output_formats) / sizeof(s_video_output_formats[0])); ++i)
+	{
+		if(strcasecmp(name, s_video_output_formats[i].name) == 0) return &s_video_output_formats[i];
+	}
+	if(strcasecmp(name, "rgb_planar") == 0) return &s_video_output_formats[2];
+	return NULL;
+}
+
+static void video_source_update_caps(video_source_t * src, GstCaps * caps)
 {
-//	debug_printf("%s()...\n", __FUNCTION__);
 	input_source_t * input = src->input;
 	input_source_private_t * priv = input->priv;
-	assert(input && priv);
-
-	int width = 0;
-	int height = 0;
-
-	GstPad * pad = gst_element_get_static_pad(filter, "src");
-	assert(pad);
-
-	GstCaps * caps = gst_pad_get_current_caps(pad);
-	assert(caps);
-
-	GstStructure * info = gst_caps_get_structure(caps, 0);
-	assert(info);
-
-	gboolean rc = FALSE;
-	rc = gst_structure_get_int(info, "width", &width); assert(rc);
-	rc = gst_structure_get_int(info, "height", &height); assert(rc);
-
-	if(width != priv->height && height != priv->height)
+	
+	GstVideoInfo info[1];
+	gboolean rc = gst_video_info_from_caps(info, caps);
+	assert(rc);
+	
+	int width = GST_VIDEO_INFO_WIDTH(info);
+	int height = GST_VIDEO_INFO_HEIGHT(info);
+	const char * fmt = GST_VIDEO_INFO_NAME(info);
+	const struct video_output_format * format = video_output_format_find(fmt);
+	assert(format);
+	
+	src->width = width;
+	src->height = height;
+	src->stride = GST_VIDEO_INFO_PLANE_STRIDE(info, 0);
+	src->frame_size = GST_VIDEO_INFO_SIZE(info);
+	src->frame_type = format->frame_type;
+	src->channels = format->channels;
+	
+	if(width != priv->width || height != priv->height)
 	{
 		priv->frame_number = 0;	// reset
 		priv->width = width;
 		priv->height = height;
 
-		const char * fmt = gst_structure_get_string(info, "format");
 		printf("[thread_id: %ld]::uri: %s\n",
                  (long)pthread_self(), priv->uri);
         printf("== format: %s, size=%dx%d\n", fmt, width, height);
 	}
-	gst_object_unref(pad);
+	return;
+}
 
+typedef struct gst_buffer_ref
+{
+	GstBuffer * buffer;
 	GstMapInfo map[1];
-	memset(map, 0, sizeof(map));
+}gst_buffer_ref_t;
+static void release_gst_buffer(void * data, void * user_data)
+{
+	gst_buffer_ref_t * ref = user_data;
+	assert(ref && ref->buffer);
+	
+	gst_buffer_unmap(ref->buffer, ref->map);
+	gst_buffer_unref(ref->buffer);
+	free(ref);
+}
+
+static long video_source_process_sample(video_source_t * src, GstSample * sample)
+{
+	input_source_t * input = src->input;
+	input_source_private_t * priv = input->priv;
+	assert(input && priv);
 
+	GstBuffer * buffer = gst_sample_get_buffer(sample);
+	GstCaps * caps = gst_sample_get_caps(sample);
+	if(NULL == buffer || NULL == caps) return -1;
+	
+	if(caps != src->caps)		// renegotiated
+	{
+		gst_caps_replace(&src->caps, caps);
+		video_source_update_caps(src, caps);
+	}
+	
+	int width = src->width;
+	int height = src->height;
+	int stride = src->stride;
+	int channels = src->channels;
+	enum input_frame_type frame_type = src->frame_type;
+	ssize_t size = src->frame_size;
+	
 	input_frame_t frame[1] = {{
-		.type = input_frame_type_bgra,
+		.type = frame_type,
 	}};
-	rc = gst_buffer_map(buffer, map, GST_MAP_READ);
-	if(rc)
+	
+	gboolean rc = FALSE;
+	if(input->zero_copy)
+	{
+		// the frame holds a (mapped) reference of the GstBuffer, 
+		// which will be unmapped and released along with the last frame sharing it
+		gst_buffer_ref_t * ref = calloc(1, sizeof(*ref));
+		assert(ref);
+		rc = gst_buffer_map(buffer, ref->map, GST_MAP_READ);
+		if(rc)
+		{
+			assert(ref->map->size >= size);
+			ref->buffer = gst_buffer_ref(buffer);
+			input_frame_adopt_buffer(frame, frame_type, ref->map->data, size, width, height, channels, stride,
+				release_gst_buffer, ref);
+		}else
+		{
+			free(ref);
+		}
+	}else
 	{
-		bgra_image_init(frame->image, width, height, map->data);
-		gst_buffer_unmap(buffer, map);
+		GstMapInfo map[1];
+		memset(map, 0, sizeof(map));
+		rc = gst_buffer_map(buffer, map, GST_MAP_READ);
+		if(rc)
+		{
+			// copy once into a pooled payload, downstream consumers share it by reference
+			assert(map->size >= size);
+			input_frame_payload_t * payload = input_frame_payload_new(size);
+			memcpy(input_frame_payload_get_data(payload), map->data, size);
+			gst_buffer_unmap(buffer, map);
+			
+			input_frame_attach_payload(frame, frame_type, payload, size, width, height, channels, stride);
+		}
 	}
+	if(!rc) return -1;
 
+	long ret = 0;
 	priv->frame_number++;
 	if(input->on_new_frame)
 	{
-		input->on_new_frame(input, frame);
+		ret = input->on_new_frame(input, frame);
 	}else
 	{
-		input->set_frame(input, frame);
-		
+		ret = input->set_frame(input, frame);
 	}
 	input_frame_clear(frame);
-	return;
+	return ret;
+}
+
+static long video_source_on_sample(void * user_data, GstSample * sample)
+{
+	return video_source_process_sample((video_source_t *)user_data, sample);
+}
+
+static int video_source_get_stats(input_source_t * input, input_source_stats_t * stats)
+{
+	input_source_private_t * priv = input->priv;
+	video_source_t * src = (video_source_t *)priv->video_src;
+	assert(stats);
+	if(NULL == src->stream) return -1;
+
+	ingest_stream_stats_t stream_stats[1];
+	memset(stream_stats, 0, sizeof(stream_stats));
+	ingest_stream_get_stats(src->stream, stream_stats);
+	
+	stats->frames_received = stream_stats->frames_received;
+	stats->frames_delivered = stream_stats->frames_delivered;
+	stats->frames_rejected = stream_stats->frames_rejected;
+	stats->frames_throttled = stream_stats->frames_throttled;
+	stats->frames_skipped = __atomic_load_n(&src->frames_skipped, __ATOMIC_RELAXED);
+	stats->process_time = stream_stats->process_time;
+	
+	stats->frames_dropped = stream_stats->frames_received - stream_stats->frames_pulled;	// including the ones still queued (<= max_buffers)
+	if(stats->frames_dropped < 0) stats->frames_dropped = 0;
+	return 0;
+}
+
+static GstPadProbeReturn video_source_drop_before_decode(video_source_t * src)
+{
+	__atomic_add_fetch(&src->frames_skipped, 1, __ATOMIC_RELAXED);
+	return GST_PAD_PROBE_DROP;
+}
+
+static GstPadProbeReturn video_source_on_decoder_input(GstPad * pad, GstPadProbeInfo * info, video_source_t * src)
+{
+	GstBuffer * buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	int delta_unit = (buffer && GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT));
+	
+	/*
+	 * fps cap: each keyframe decides whether its GOP is decoded,
+	 * a GOP starting less than 3/4 of the interval after the last decoded one is dropped with its delta units.
+	 * (intra-only streams, e.g. MJPEG: every frame is a GOP)
+	 */
+	if(!delta_unit)
+	{
+		gint64 gop_interval = __atomic_load_n(&src->gop_interval, __ATOMIC_RELAXED);
+		gint64 now = g_get_monotonic_time();
+		src->gop_dropped = (gop_interval > 0 && src->last_gop_time > 0 && (now - src->last_gop_time) < gop_interval * 3 / 4);
+		if(!src->gop_dropped) src->last_gop_time = now;
+	}
+	if(src->gop_dropped) return video_source_drop_before_decode(src);
+	
+	// keyframes_only: drop the delta units before they reach the decoder (can be toggled live)
+	if(__atomic_load_n(&src->input->keyframes_only, __ATOMIC_RELAXED))
+	{
+		if(!delta_unit) return GST_PAD_PROBE_OK;
+		src->waiting_for_keyframe = 1;
+		return video_source_drop_before_decode(src);
+	}
+	
+	// re-enabled: the following delta units reference frames which were never decoded
+	if(src->waiting_for_keyframe)
+	{
+		if(delta_unit) return video_source_drop_before_decode(src);
+		src->waiting_for_keyframe = 0;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static void video_source_on_element_added(GstBin * bin, GstBin * sub_bin, GstElement * element, video_source_t * src)
+{
+	GstElementFactory * factory = gst_element_get_factory(element);
+	if(NULL == factory) return;
+	
+	// bound the per-stream decoder threads (libav decoders spawn one thread per cpu by default)
+	const char * name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory));
+	if(name && strncmp(name, "avdec_", sizeof("avdec_") - 1) == 0)
+	{
+		int decoder_threads = src->input->decoder_threads;
+		if(decoder_threads >= 0) g_object_set(element, "max-threads", decoder_threads, NULL);
+	}
+	
+	const char * klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+	if(klass && strstr(klass, "Decoder") && strstr(klass, "Video"))
+	{
+		GstPad * pad = gst_element_get_static_pad(element, "sink");
+		if(pad)
+		{
+			gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, 
+				(GstPadProbeCallback)video_source_on_decoder_input, src, NULL);
+			gst_object_unref(pad);
+		}
+	}
 }
 
+static int video_source_set_decimation(input_source_t * input, double fps, int keyframes_only)
+{
+	input_source_private_t * priv = input->priv;
+	video_source_t * src = (video_source_t *)priv->video_src;
+	if(NULL == src->rate) return -1;
+	
+	input->fps = fps;
+	__atomic_store_n(&input->keyframes_only, keyframes_only, __ATOMIC_RELAXED);
+	
+	// videorate only takes integer rates, the ingest engine caps the fractional part
+	gint max_rate = (fps > 0)?(gint)ceil(fps):G_MAXINT;
+	if(max_rate < 1) max_rate = 1;
+	g_object_set(src->rate, "max-rate", max_rate, NULL);
+	
+	double max_fps = input->max_fps;
+	if(fps > 0 && (max_fps <= 0 || fps < max_fps)) max_fps = fps;
+	if(src->stream) ingest_stream_set_max_fps(src->stream, max_fps);
+	
+	// the same cap in front of the decoder (GOP granularity), the ingest engine trims the rest after decode
+	gint64 gop_interval = (max_fps > 0)?(gint64)(1000000.0 / max_fps):0;
+	__atomic_store_n(&src->gop_interval, gop_interval, __ATOMIC_RELAXED);
+	return 0;
+}
 
 static int video_source_set_uri(video_source_t * src, input_source_t * input, const char * cooked_uri, int subtype)
 {
@@ -595,9 +826,9 @@ static int video_source_set_uri(video_source_t * src, input_source_t * input, co
 
 	enum input_source_type type = input->type;
 
-#define RTSP_SRC_FMT		"rtspsrc location=\"%s\" ! decodebin ! videoconvert "
-#define HTTP_SRC_FMT		"souphttpsrc location=\"%s\" ! decodebin ! videoconvert "
-#define HLS_SRC_FMT			"souphttpsrc location=\"%s\" ! hlsdemux ! decodebin ! videoconvert "
+#define RTSP_SRC_FMT		"rtspsrc location=\"%s\" ! decodebin "
+#define HTTP_SRC_FMT		"souphttpsrc location=\"%s\" ! decodebin "
+#define HLS_SRC_FMT			"souphttpsrc location=\"%s\" ! hlsdemux ! decodebin "
 #if !defined(_WIN32) && !defined(_WIN32)
 #define V4L2_SRC_FMT		"v4l2src device=%s "
 #else
@@ -605,13 +836,41 @@ static int video_source_set_uri(video_source_t * src, input_source_t * input, co
 #endif
 #define FILE_SRC_FMT		"filesrc location=\"%s\" ! decodebin "
 
-#define BGRA_PIPELINE 	" ! videoconvert "						\
-						" ! videoscale ! video/x-raw,format=BGRA,width=640,height=480 ! videoconvert ! identity name=\"filter\" "		\
-						" ! fakesink sync=true"														
-
-					//	" ! ximagesink "
-					//	" ! fakesink sync=true"														
+#define VIDEO_OUTPUT_DEFAULT_WIDTH	(640)
+#define VIDEO_OUTPUT_DEFAULT_HEIGHT	(480)
+	
+	// output: videorate ! [videoscale !] videoconvert ! video/x-raw,format=...[,width=...,height=...] ! appsink
+	// (videoconvert passes the buffers through when the caps already match)
+	const struct video_output_format * format = video_output_format_find(input->format);
+	if(NULL == format)
+	{
+		fprintf(stderr, "[ERROR]::unsupported output format '%s'\n", input->format);
+		return -1;
+	}
+	int width = input->width;
+	int height = input->height;
+	if(0 == width && 0 == height)
+	{
+		width = VIDEO_OUTPUT_DEFAULT_WIDTH;
+		height = VIDEO_OUTPUT_DEFAULT_HEIGHT;
+	}
 	
+	char output_pipeline[512] = "";
+	if(width > 0 && height > 0)
+	{
+		snprintf(output_pipeline, sizeof(output_pipeline), 
+			" ! videorate name=\"rate\" drop-only=true"
+			" ! videoscale ! videoconvert ! video/x-raw,format=%s,width=%d,height=%d"
+			" ! appsink name=\"sink\" sync=true max-buffers=2 drop=true",
+			format->name, width, height);
+	}else	// keep the source size
+	{
+		snprintf(output_pipeline, sizeof(output_pipeline), 
+			" ! videorate name=\"rate\" drop-only=true"
+			" ! videoconvert ! video/x-raw,format=%s"
+			" ! appsink name=\"sink\" sync=true max-buffers=2 drop=true",
+			format->name);
+	}
 
 	char gst_command[8192] = "";
 	int cb = 0;
@@ -619,34 +878,34 @@ static int video_source_set_uri(video_source_t * src, input_source_t * input, co
 	{
 	case input_source_type_rtsp:
 		cb = snprintf(gst_command, sizeof(gst_command),
-			RTSP_SRC_FMT BGRA_PIPELINE,
-			cooked_uri);
+			RTSP_SRC_FMT "%s",
+			cooked_uri, output_pipeline);
 		break;
 	case input_source_type_http:
 	case input_source_type_https:
 		if(subtype == input_source_subtype_hls)
 		{
 			cb = snprintf(gst_command, sizeof(gst_command),
-				HLS_SRC_FMT BGRA_PIPELINE,
-				cooked_uri);
+				HLS_SRC_FMT "%s",
+				cooked_uri, output_pipeline);
 		}else
 		{
 			cb = snprintf(gst_command, sizeof(gst_command),
-				HTTP_SRC_FMT BGRA_PIPELINE,
-				cooked_uri);
+				HTTP_SRC_FMT "%s",
+				cooked_uri, output_pipeline);
 		}
 		break;
 	case input_source_type_file:
 		assert(subtype == input_source_subtype_default || subtype == input_source_subtype_video);
-		cb = snprintf(gst_command, sizeof(gst_command), FILE_SRC_FMT BGRA_PIPELINE,
-			cooked_uri);
+		cb = snprintf(gst_command, sizeof(gst_command), FILE_SRC_FMT "%s",
+			cooked_uri, output_pipeline);
 		break;
 	case input_source_type_v4l2:
 	#if !defined(_WIN32) && !defined(_WIN32)
-		cb = snprintf(gst_command, sizeof(gst_command), V4L2_SRC_FMT BGRA_PIPELINE,
-			cooked_uri);
+		cb = snprintf(gst_command, sizeof(gst_command), V4L2_SRC_FMT "%s",
+			cooked_uri, output_pipeline);
 	#else
-		cb = snprintf(gst_command, sizeof(gst_command), "ksvideosrc" BGRA_PIPELINE);
+		cb = snprintf(gst_command, sizeof(gst_command), "ksvideosrc" "%s", output_pipeline);
 	#endif
 		break;
 	default:
@@ -671,13 +930,26 @@ static int video_source_set_uri(video_source_t * src, input_source_t * input, co
 		return -1;
 	}
 
-	GstElement * filter = gst_bin_get_by_name(GST_BIN(pipeline), "filter");
-	assert(filter);
-
-	g_signal_connect(filter, "handoff", G_CALLBACK(video_source_on_bgra_filter), src);
+	GstElement * sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	assert(sink);
+	
+	// leaky queue: keep only the newest max_buffers frames when the consumer falls behind
+	if(input->max_buffers > 0) gst_app_sink_set_max_buffers(GST_APP_SINK(sink), input->max_buffers);
+	gst_app_sink_set_drop(GST_APP_SINK(sink), TRUE);
+	
+	src->stream = ingest_stream_new(sink, video_source_on_sample, src);
+	assert(src->stream);
+	
+	g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(video_source_on_element_added), src);
 
 	src->pipeline = pipeline;
-	src->filter = filter;
+	src->sink = sink;
+	src->rate = gst_bin_get_by_name(GST_BIN(pipeline), "rate");
+	assert(src->rate);
+	
+	input->get_stats = video_source_get_stats;
+	input->set_decimation = video_source_set_decimation;
+	video_source_set_decimation(input, input->fps, input->keyframes_only);
 
 	GstBus * bus = gst_element_get_bus(pipeline);
 	assert(bus);
@@ -686,11 +958,6 @@ static int video_source_set_uri(video_source_t * src, input_source_t * input, co
 	g_signal_connect(bus, "message::eos", G_CALLBACK(video_source_on_eos), src);
 	g_signal_connect(bus, "message::error", G_CALLBACK(video_source_on_error), src);
 
-	GMainLoop * loop = g_main_loop_new(NULL, FALSE);
-	assert(loop);
-
-	src->loop = loop;
-	
 	src->gst_command = strdup(gst_command);
 	return 0;
 }
@@ -711,13 +978,29 @@ static int video_source_stop(input_source_t * input)
 	input_source_private_t * priv = input->priv;
 	video_source_t * src = (video_source_t *)priv->video_src;
 	assert(src->input == input && priv->input == input);
+	if(NULL == src->pipeline) return 0;
 	
 	GstStateChangeReturn ret_code = gst_element_set_state(src->pipeline, GST_STATE_NULL);
 	if(ret_code == GST_STATE_CHANGE_FAILURE) return -1;
 
 	GstState state = 0;
 	ret_code = gst_element_get_state(src->pipeline, &state, NULL, GST_CLOCK_TIME_NONE);
+	
+	// no more new-sample callbacks, detach from the ingest engine
+	ingest_stream_free(src->stream);
+	src->stream = NULL;
 
+	if(src->sink) 
+	{
+		gst_object_unref(src->sink);
+		src->sink = NULL;
+	}
+	if(src->rate)
+	{
+		gst_object_unref(src->rate);
+		src->rate = NULL;
+	}
+	gst_caps_replace(&src->caps, NULL);
 	gst_object_unref(src->pipeline);
 	src->pipeline = NULL;
 
@@ -38,11 +38,11 @@ function build()
 	case "${target}" in
 		input-source|default-plugin)
 			${CC} -fPIC -shared -o plugins/libioplugin-default.so \
-				default-plugin.c input-source.c \
+				default-plugin.c input-source.c ingest-engine.c \
 				${CFLAGS}	\
 				utils/*.c \
 				-lm -lpthread -ljpeg -lpng \
-				`pkg-config --cflags --libs gstreamer-1.0 gio-2.0 glib-2.0 cairo json-c` 
+				`pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0 gstreamer-video-1.0 gio-2.0 glib-2.0 cairo json-c` 
 			;;
 		tcp-server)
 			echo "make libioplugin-tcpd ..."
@@ -175,6 +175,47 @@ void http_auto_buffer_cleanup(http_auto_buffer_t * buf)
 	return;
 }
 
+/**
+ * @}
+ */
+
+/**
+ * @ingroup output-module
+ * @{
+ */
+http_chunk_t * http_chunk_new(size_t size)
+{
+	http_chunk_t * chunk = malloc(sizeof(*chunk) + size);
+	assert(chunk);
+	memset(chunk, 0, sizeof(*chunk));
+	chunk->refs = 1;
+	chunk->size = size;
+	return chunk;
+}
+
+http_chunk_t * http_chunk_ref(http_chunk_t * chunk)
+{
+	assert(chunk);
+	__atomic_add_fetch(&chunk->refs, 1, __ATOMIC_RELAXED);
+	return chunk;
+}
+
+void http_chunk_unref(http_chunk_t * chunk)
+{
+	if(NULL == chunk) return;
+	if(__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0) free(chunk);
+}
+
+int http_chunk_append(http_chunk_t * chunk, const void * data, size_t length)
+{
+	assert(chunk && chunk->refs == 1);		// immutable once shared
+	if(chunk->num_iov >= HTTP_CHUNK_MAX_IOV) return -1;
+	chunk->iov[chunk->num_iov].iov_base = (void *)data;
+	chunk->iov[chunk->num_iov].iov_len = length;
+	++chunk->num_iov;
+	chunk->length += length;
+	return 0;
+}
 /**
  * @}
  */
@@ -647,6 +688,53 @@ static enum http_stage http_session_on_read(struct http_session * session, void
 	return stage;
 }
 
+/* session->mutex locked; return the number of bytes written, -1: connection closed */
+static ssize_t write_chunks(http_session_t * session)
+{
+	ssize_t total = 0;
+	while(1)
+	{
+		if(NULL == session->chunk)
+		{
+			if(NULL == session->next_chunk) break;
+			session->chunk = session->next_chunk;
+			session->next_chunk = NULL;
+			session->chunk_pos = 0;
+		}
+
+		// the iovecs of the unwritten part
+		http_chunk_t * chunk = session->chunk;
+		struct iovec iov[HTTP_CHUNK_MAX_IOV];
+		int num_iov = 0;
+		size_t skip = session->chunk_pos;
+		for(int i = 0; i < chunk->num_iov; ++i)
+		{
+			if(skip >= chunk->iov[i].iov_len) { skip -= chunk->iov[i].iov_len; continue; }
+			iov[num_iov].iov_base = (unsigned char *)chunk->iov[i].iov_base + skip;
+			iov[num_iov].iov_len = chunk->iov[i].iov_len - skip;
+			++num_iov;
+			skip = 0;
+		}
+
+		ssize_t cb = (num_iov > 0)?writev(session->fd, iov, num_iov):0;
+		if(cb < 0)
+		{
+			if(errno == EWOULDBLOCK || errno == EAGAIN) break;
+			return -1;
+		}
+		total += cb;
+		session->chunk_pos += cb;
+		if(session->chunk_pos >= chunk->length)
+		{
+			http_chunk_unref(chunk);
+			session->chunk = NULL;
+			session->chunk_pos = 0;
+			++session->chunks_sent;
+		}
+	}
+	return total;
+}
+
 static enum http_stage http_session_on_write(struct http_session * session, void * user_data)
 {
 	pthread_mutex_lock(&session->mutex);
@@ -656,26 +744,38 @@ static enum http_stage http_session_on_write(struct http_session * session, void
 	
 	ssize_t cb = 0;
 	ssize_t cb_avaliable = buf->length - buf->cur_pos;
-	if(cb_avaliable > 0)
+	while(cb_avaliable > 0)
 	{
-		cb = write(session->fd, buf->data, cb_avaliable);
+		cb = write(session->fd, buf->data + buf->cur_pos, cb_avaliable);
 		if(cb <= 0)		// connection closed
 		{
 			int err = errno;
-			if(cb == 0 || err != EWOULDBLOCK)
+			if(cb == 0 || (err != EWOULDBLOCK && err != EAGAIN))
 			{
-				session->on_error(session, user_data);
 				pthread_mutex_unlock(&session->mutex);
+				session->on_error(session, user_data);
 				return http_stage_cleanup;
 			}
-		}else
-		{
-			cb_avaliable -= cb;
-			buf->set_pos(buf, buf->cur_pos + cb);
+			break;
 		}
+		cb_avaliable -= cb;
+		buf->set_pos(buf, cb);
 	}
-	pthread_mutex_unlock(&session->mutex);
-	if(cb_avaliable == 0)	// all data been written
+
+	// the shared chunks, after the headers
+	if(cb_avaliable == 0 && write_chunks(session) < 0)
+	{
+		pthread_mutex_unlock(&session->mutex);
+		session->on_error(session, user_data);
+		return http_stage_cleanup;
+	}
+
+	/*
+	 * all data been written: disable write-end events before unlocking,
+	 * push_chunk() queues its chunk under the same lock and only then re-enables them,
+	 * so a chunk pushed meanwhile is never left without an EPOLLOUT
+	 */
+	if(cb_avaliable == 0 && NULL == session->chunk && NULL == session->next_chunk)
 	{
 		tcp_server_t * tcp = (tcp_server_t *)session->server;
 		assert(tcp && tcp->efd > 0);
@@ -688,6 +788,7 @@ static enum http_stage http_session_on_write(struct http_session * session, void
 		int rc = epoll_ctl(efd, EPOLL_CTL_MOD, session->fd, ev);
 		assert(0 == rc);
 	}
+	pthread_mutex_unlock(&session->mutex);
 	return http_stage_cleanup;
 }
 
@@ -755,6 +856,22 @@ static int http_session_on_response(struct http_session * session)
 
 
 
+/* keep only the newest chunk pending: a slow client skips the frames it cannot keep up with */
+static int http_session_push_chunk(struct http_session * session, http_chunk_t * chunk)
+{
+	assert(session && chunk);
+	pthread_mutex_lock(&session->mutex);
+	if(session->next_chunk)
+	{
+		http_chunk_unref(session->next_chunk);
+		++session->chunks_dropped;
+	}
+	session->next_chunk = http_chunk_ref(chunk);
+	pthread_mutex_unlock(&session->mutex);
+
+	return session->on_response(session);		// enable write-end
+}
+
 http_session_t * http_session_new(struct tcp_server * server, int peer_fd, int async_mode, void * user_data)
 {
 	http_session_t * session = calloc(1, sizeof(*session));
@@ -786,6 +903,7 @@ http_session_t * http_session_new(struct tcp_server * server, int peer_fd, int a
 	// default callback
 	session->on_request = http->on_request?http->on_request:http_session_on_request;
 	session->on_response = http->on_response?http->on_response:http_session_on_response;
+	session->push_chunk = http_session_push_chunk;
 
 	if(async_mode)
 	{
@@ -826,6 +944,8 @@ void http_session_free(http_session_t * session)
 
 	http_auto_buffer_cleanup(session->in_buf);
 	http_auto_buffer_cleanup(session->out_buf);
+	http_chunk_unref(session->chunk);
+	http_chunk_unref(session->next_chunk);
 
 	http_header_cleanup(session->request_hdr);
 	http_header_cleanup(session->response_hdr);
@@ -2,6 +2,7 @@
 #define _HTTPD_H_
 
 #include <stdio.h>
+#include <sys/uio.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -32,6 +33,32 @@ void auto_buffer_cleanup(http_auto_buffer_t * buf);
  * @}
  */
 
+/**
+ * @ingroup output-module
+ * @{
+ *
+ * http_chunk: a refcounted, immutable response chunk shared by many sessions (e.g. one mjpeg frame),
+ * written with writev() from its iovecs; the storage (data) is owned by the chunk.
+ */
+#define HTTP_CHUNK_MAX_IOV	(4)
+typedef struct http_chunk
+{
+	long refs;
+	int num_iov;
+	struct iovec iov[HTTP_CHUNK_MAX_IOV];
+	size_t length;				// sum of the iovecs
+	size_t size;				// bytes of data
+	unsigned char data[];
+}http_chunk_t;
+http_chunk_t * http_chunk_new(size_t size);		// refs = 1
+http_chunk_t * http_chunk_ref(http_chunk_t * chunk);
+void http_chunk_unref(http_chunk_t * chunk);
+// append an iovec, @data: the chunk's own storage or static data
+int http_chunk_append(http_chunk_t * chunk, const void * data, size_t length);
+/**
+ * @}
+ */
+
 /**
  * @ingroup output-module
  * @{
@@ -157,6 +184,13 @@ typedef struct http_session
 	int (* on_request)(struct http_session * session);
 	int (* on_response)(struct http_session * session);
 
+	/* streaming: written after out_buf, at most one chunk in flight and one pending (protected by mutex) */
+	http_chunk_t * chunk;			// being written
+	size_t chunk_pos;				// bytes of chunk already written
+	http_chunk_t * next_chunk;		// the newest chunk, replaces an older one not yet started
+	long chunks_sent;
+	long chunks_dropped;			// replaced before being sent (slow client)
+	int (* push_chunk)(struct http_session * session, http_chunk_t * chunk);	// takes a new reference
 }http_session_t;
 http_session_t * http_session_new(struct tcp_server * server, int peer_fd, int async_mode, void * user_data);
 void http_session_free(http_session_t * session);
@@ -96,48 +96,43 @@
 	//~ int (* need_data)(struct mjpg_server * mjpg);		// virtual callback, need override 
 //~ }mjpg_server_t;
 
-typedef struct jpeg_buffer
-{
-	unsigned char * data;
-	ssize_t length;
-	struct timespec timestamp[1];
-}jpeg_buffer_t;
-
-static void jpeg_buffer_clear(jpeg_buffer_t * jbuf)
-{
-	if(NULL == jbuf) return;
-	free(jbuf->data);
-	jbuf->data = NULL;
-	jbuf->length = 0;
-}
-
-static void jpeg_buffer_set(jpeg_buffer_t * jbuf, const unsigned char * data, ssize_t length, struct timespec * timestamp)
+/*
+ * each frame is built once as a shared chunk: partial header + jpeg + EOL,
+ * the sessions hold references and write it with writev().
+ */
+static http_chunk_t * mjpg_frame_new(const unsigned char * data, ssize_t length, const struct timespec * timestamp)
 {
-	assert(jbuf);
+	struct timespec ts[1];
 	if(NULL == timestamp)
 	{
-		clock_gettime(CLOCK_MONOTONIC, jbuf->timestamp);
-	}else
-	{
-		memcpy(jbuf->timestamp, timestamp, sizeof(jbuf->timestamp));
+		clock_gettime(CLOCK_MONOTONIC, ts);
+		timestamp = ts;
 	}
-	
-	jbuf->data = realloc(jbuf->data, length);
-	assert(jbuf);
 
-	memcpy(jbuf->data, data, length);
-	jbuf->length = length;
-	return;
+	char partial_hdr[PATH_MAX] = "";
+	ssize_t cb = snprintf(partial_hdr, sizeof(partial_hdr), MJPG_STREAMING_PARTIAL_HDR_FMT,
+		(long)length,
+		(int)timestamp->tv_sec,
+		(int)(timestamp->tv_nsec / 1000));
+	assert(cb > 0 && cb < (ssize_t)sizeof(partial_hdr));
+
+	http_chunk_t * frame = http_chunk_new(cb + length);
+	memcpy(frame->data, partial_hdr, cb);
+	memcpy(frame->data + cb, data, length);
+
+	http_chunk_append(frame, frame->data, cb);
+	http_chunk_append(frame, frame->data + cb, length);
+	http_chunk_append(frame, MJPG_STREAMING_PARTIAL_EOL, EOL_SIZE);
+	return frame;
 }
 
-
 typedef struct mjpg_server_private
 {
 	mjpg_server_t * server;
 	pthread_mutex_t mutex;			// http response mutex
 	pthread_cond_t cond;
 
-	pthread_mutex_t buffer_mutex;	// jpeg_buffer mutex
+	pthread_mutex_t buffer_mutex;	// frame mutex
 	
 	int async_mode;
 	pthread_t th;
@@ -147,51 +142,40 @@ typedef struct mjpg_server_private
 
 	int is_busy;
 
-	jpeg_buffer_t * buffers[2];		// double buffer
+	http_chunk_t * frame;			// the newest frame
+
+	unsigned char * jpeg_data;		// update_bgra(): the encoder's output, reused
+	size_t jpeg_capacity;
 	
-	long (* get_data)(struct mjpg_server_private * priv, unsigned char ** p_data, ssize_t * p_length, struct timespec * timestamp);
+	long (* get_data)(struct mjpg_server_private * priv, http_chunk_t ** p_frame);
 	long (* set_data)(struct mjpg_server_private * priv, const unsigned char * data, ssize_t length, struct timespec * timestamp);
 }mjpg_server_private_t;
 
-static long mjpg_server_private_get_data(struct mjpg_server_private * priv, unsigned char ** p_data, ssize_t * p_length, struct timespec * timestamp)
+/* *p_frame: a new reference to the newest frame (NULL: empty) */
+static long mjpg_server_private_get_data(struct mjpg_server_private * priv, http_chunk_t ** p_frame)
 {
-	assert(priv && p_data && p_length);
+	assert(priv && p_frame);
 	
 	pthread_mutex_lock(&priv->buffer_mutex);
-	jpeg_buffer_t * jpeg = priv->buffers[0];
-	assert(jpeg && jpeg->data && jpeg->length > 0);
-
-	assert(p_data);
-	unsigned char * data = *p_data;
-	data = realloc(data, jpeg->length);
-	assert(data);
-
-	*p_data = data;
-	memcpy(data, jpeg->data, jpeg->length);
-	*p_length = jpeg->length;
-
-	if(timestamp)
-	{
-		memcpy(timestamp, jpeg->timestamp, sizeof(jpeg->timestamp));
-	}
-	
+	*p_frame = priv->frame?http_chunk_ref(priv->frame):NULL;
+	long frame_number = priv->frame_number;
 	pthread_mutex_unlock(&priv->buffer_mutex);
-	return priv->frame_number;
+	return frame_number;
 }
 
 static long mjpg_server_private_set_data(struct mjpg_server_private * priv, const unsigned char * data, ssize_t length, struct timespec * timestamp)
 {
 	assert(priv && data && length > 0);
-	assert(priv->buffers[1]);
 
-	jpeg_buffer_set(priv->buffers[1], data, length, timestamp);
+	http_chunk_t * frame = mjpg_frame_new(data, length, timestamp);
 
-	// swap buffer
+	// swap frame
 	pthread_mutex_lock(&priv->buffer_mutex);
-	jpeg_buffer_t * tmp = priv->buffers[1];
-	priv->buffers[1] = priv->buffers[0];
-	priv->buffers[0] = tmp;
+	http_chunk_t * old_frame = priv->frame;
+	priv->frame = frame;
+	long frame_number = ++priv->frame_number;
 	pthread_mutex_unlock(&priv->buffer_mutex);
+	http_chunk_unref(old_frame);
 
 	pthread_mutex_lock(&priv->mutex);
 
@@ -199,7 +183,7 @@ static long mjpg_server_private_set_data(struct mjpg_server_private * priv, cons
 	if(!priv->is_busy) pthread_cond_signal(&priv->cond);
 	pthread_mutex_unlock(&priv->mutex);
 	
-	return ++priv->frame_number;
+	return frame_number;
 }
 
 mjpg_server_private_t * mjpg_server_private_new(mjpg_server_t * server)
@@ -208,9 +192,6 @@ mjpg_server_private_t * mjpg_server_private_new(mjpg_server_t * server)
 	mjpg_server_private_t * priv = calloc(1, sizeof(*priv));
 	assert(priv);
 
-	priv->buffers[0] = calloc(1, sizeof(*priv->buffers[0]));
-	priv->buffers[1] = calloc(1, sizeof(*priv->buffers[1]));
-
 	priv->server = server;
 	rc = pthread_mutex_init(&priv->mutex, NULL);
 	assert(0 == rc);
@@ -254,17 +235,12 @@ void mjpg_server_private_free(mjpg_server_private_t * priv)
 	
 
 	pthread_mutex_lock(&priv->buffer_mutex);
-
-	jpeg_buffer_clear(priv->buffers[0]);
-	jpeg_buffer_clear(priv->buffers[1]);
-	
-	free(priv->buffers[0]);
-	free(priv->buffers[1]);
-	priv->buffers[0] = NULL;
-	priv->buffers[1] = NULL;
+	http_chunk_unref(priv->frame);
+	priv->frame = NULL;
 	pthread_mutex_unlock(&priv->buffer_mutex);
 	
 	pthread_mutex_destroy(&priv->buffer_mutex);
+	free(priv->jpeg_data);
 	free(priv);
 	return;
 }
@@ -283,20 +259,12 @@ static void * mjpg_server_process(void * user_data)
 	while(1)
 	{
 		int rc = pthread_cond_wait(&priv->cond, &priv->mutex);
-
-		printf("cond wait=%d, is_busy=%d\n", rc, priv->is_busy);
 		if(rc != 0) break;		// server error
 	//	if(http->quit) break;	// http server was stopped by app-thread
 		
-		unsigned char * jpeg_data = NULL;
-		ssize_t jpeg_length = 0;
-		struct timespec timestamp[1];
-		memset(timestamp, 0, sizeof(timestamp));
-		
-		long frame_number = priv->get_data(priv, &jpeg_data, &jpeg_length, timestamp);
-		printf("frame_number: %ld\n", frame_number);
-		
-		if(frame_number <= 0) continue;	// empty buffer
+		http_chunk_t * frame = NULL;
+		long frame_number = priv->get_data(priv, &frame);
+		if(frame_number <= 0 || NULL == frame) continue;	// empty buffer
 
 		priv->is_busy = 1;
 		//~ pthread_mutex_unlock(&priv->mutex);		// unlock mutex to accept new signals
@@ -304,12 +272,7 @@ static void * mjpg_server_process(void * user_data)
 	//	pthread_mutex_lock(&http->mutex);
 		http_session_t ** sessions = http->sessions;
 
-		if(timestamp->tv_sec == 0)	
-		{
-			clock_gettime(CLOCK_MONOTONIC, timestamp);
-		}
-
-		debug_printf("%s()::on new frame(), sessions_count = %d", (int)http->sessions_count);
+		debug_printf("on new frame(), sessions_count = %d", (int)http->sessions_count);
 		for(size_t i = 0; i < http->sessions_count && !http->quit; ++i)
 		{
 			http_session_t * session = sessions[i];
@@ -326,23 +289,15 @@ static void * mjpg_server_process(void * user_data)
 				stage = session->request_hdr->stage = http_stage_response_final;
 			}
 
-			if(jpeg_data && jpeg_length > 0 && frame_number >= server->frame_number)	// new frame available
+			if(frame_number >= server->frame_number)	// new frame available
 			{
-				char partial_hdr[PATH_MAX] = "";
-				ssize_t cb = snprintf(partial_hdr, sizeof(partial_hdr), MJPG_STREAMING_PARTIAL_HDR_FMT,
-					(long)jpeg_length,
-					(int)timestamp->tv_sec,
-					(int)(timestamp->tv_nsec / 100));
-				out_buf->push(out_buf, partial_hdr, cb);
-				out_buf->push(out_buf, jpeg_data, jpeg_length);
-				out_buf->push(out_buf, MJPG_STREAMING_PARTIAL_EOL, EOL_SIZE);
-				session->on_response(session);		// enable write-end
+				session->push_chunk(session, frame);	// shared, a slow session keeps only the newest frame
 			}
 		}
 		
 		server->frame_number = frame_number;	// update frame_number
 	//	pthread_mutex_unlock(&http->mutex);
-		if(jpeg_data) free(jpeg_data);
+		http_chunk_unref(frame);
 
 
 		//~ pthread_mutex_lock(&priv->mutex);		// lock mutex before cond_wait
@@ -439,24 +394,23 @@ static int mjpg_server_update_jpeg(struct mjpg_server * mjpg, const unsigned cha
 
 static int mjpg_server_update_bgra(struct mjpg_server * mjpg, const unsigned char * bgra_data, int width, int height, int channels)
 {
-	unsigned char * jpeg_data = NULL;
-	ssize_t length = 0;
+	mjpg_server_private_t * priv = mjpg->priv;
+	assert(priv);
 
 	bgra_image_t bgra[1] = {{
 		.data = (unsigned char *)bgra_data,
 		.width = width,
 		.height = height,
 		.channels = 4,
+		.stride = width * 4,
 	}};
-	length = bgra_image_to_jpeg_stream(bgra, &jpeg_data, 95);
+	jpeg_encoder_t * encoder = mjpg->jpeg_encoder?mjpg->jpeg_encoder:jpeg_encoder_get_default();
+	ssize_t length = jpeg_encoder_encode(encoder, bgra, mjpg->jpeg_params, &priv->jpeg_data, &priv->jpeg_capacity);
 	assert(length > 0);
 
-	debug_printf("jpg_data: %p, length = %ld\n", jpeg_data, (long)length);
+	debug_printf("jpg_data: %p, length = %ld\n", priv->jpeg_data, (long)length);
 
-	mjpg->update_jpeg(mjpg, jpeg_data, length);
-	free(jpeg_data);
-
-	
+	mjpg->update_jpeg(mjpg, priv->jpeg_data, length);
 	return 0;
 }
 
@@ -476,6 +430,7 @@ mjpg_server_t * mjpg_server_init(mjpg_server_t * mjpg, const char * port, int lo
 
 	mjpg->update_jpeg = mjpg_server_update_jpeg;
 	mjpg->update_bgra = mjpg_server_update_bgra;
+	jpeg_encode_params_init(mjpg->jpeg_params);
 	mjpg->need_data = mjpg_server_need_data;
 
 	mjpg->run = mjpg_server_run;
@@ -7,6 +7,7 @@ extern "C" {
 #endif
 
 #include "httpd.h"
+#include "jpeg-encoder.h"
 
 /**
  * @ingroup dlp-framework
@@ -32,6 +33,8 @@ typedef struct mjpg_server
 	// push mode
 	int (* update_jpeg)(struct mjpg_server * mjpg, const unsigned char * jpeg_data, size_t length);
 	int (* update_bgra)(struct mjpg_server * mjpg, const unsigned char * bgra_data, int width, int height, int channels);
+	jpeg_encoder_t * jpeg_encoder;			// update_bgra(): NULL: the shared default encoder
+	jpeg_encode_params_t jpeg_params[1];	// quality and chroma subsampling of this output
 
 	// pull mode
 	int (* need_data)(struct mjpg_server * mjpg);		// virtual callback, need override 
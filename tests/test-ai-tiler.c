@@ -0,0 +1,210 @@
+/*
+ * test-ai-tiler.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "ai-tiler.h"
+#include "img_proc.h"
+
+/*
+ * usuage: test-ai-tiler
+ *   drive ai_tiler_predict() with a fake engine which 'detects' the bounding box of the red pixels,
+ *   and check the mapping of the tiles, the merge of the overlapping boxes and the skipped tiles.
+ */
+
+#define FRAME_WIDTH		(1024)
+#define FRAME_HEIGHT	(512)
+
+static const char * s_labels[] = { "red" };
+
+static int fake_predict_detections(ai_engine_t * engine, const input_frame_t * frames[], int count, ai_detections_t results[])
+{
+	for(int i = 0; i < count; ++i)
+	{
+		const input_frame_t * frame = frames[i];
+		ai_detections_t * detections = &results[i];
+		ai_detections_reset(detections);
+		detections->model = "fake";
+		detections->labels = s_labels;
+		detections->num_labels = 1;
+		assert(frame->type == input_frame_type_bgra && frame->channels == 4);
+
+		int x0 = frame->width, y0 = frame->height, x1 = -1, y1 = -1;
+		for(int y = 0; y < frame->height; ++y)
+		{
+			const unsigned char * p = frame->data + (ssize_t)frame->stride * y;
+			for(int x = 0; x < frame->width; ++x, p += 4)
+			{
+				if(p[2] != 255 || p[1] != 0 || p[0] != 0) continue;
+				if(x < x0) x0 = x;
+				if(x > x1) x1 = x;
+				if(y < y0) y0 = y;
+				if(y > y1) y1 = y;
+			}
+		}
+		if(x1 < 0) continue;
+
+		ai_detection_box_t * box = ai_detections_add(detections);
+		box->left = (float)x0 / frame->width;
+		box->top = (float)y0 / frame->height;
+		box->width = (float)(x1 - x0 + 1) / frame->width;
+		box->height = (float)(y1 - y0 + 1) / frame->height;
+		box->confidence = 0.9f;
+		box->class_index = 0;
+	}
+	return count;
+}
+
+static void draw_frame(bgra_image_t * image, int x, int y, int width, int height)
+{
+	for(int row = 0; row < image->height; ++row)
+	{
+		unsigned char * p = image->data + (ssize_t)image->width * 4 * row;
+		for(int col = 0; col < image->width; ++col, p += 4)
+		{
+			int inside = (col >= x && col < x + width && row >= y && row < y + height);
+			p[0] = inside?0:((col + row) & 0x3f) + 64;		// a static textured background
+			p[1] = inside?0:((col ^ row) & 0x3f) + 64;
+			p[2] = inside?255:96;
+			p[3] = 255;
+		}
+	}
+}
+
+static int check_single_box(const char * title, const ai_detections_t * results, int x, int y, int width, int height)
+{
+	if(results->count != 1) {
+		fprintf(stderr, "[FAILED]: %s: %ld boxes, (expected 1)\n", title, (long)results->count);
+		return -1;
+	}
+	const ai_detection_box_t * box = &results->boxes[0];
+	const float tolerance = 1.5f;
+	if(fabsf(box->left * FRAME_WIDTH - x) > tolerance || fabsf(box->top * FRAME_HEIGHT - y) > tolerance
+		|| fabsf(box->width * FRAME_WIDTH - width) > tolerance || fabsf(box->height * FRAME_HEIGHT - height) > tolerance)
+	{
+		fprintf(stderr, "[FAILED]: %s: box {%.1f, %.1f, %.1f, %.1f} != {%d, %d, %d, %d}\n", title,
+			box->left * FRAME_WIDTH, box->top * FRAME_HEIGHT, box->width * FRAME_WIDTH, box->height * FRAME_HEIGHT,
+			x, y, width, height);
+		return -1;
+	}
+	if(strcmp(ai_detections_get_label(results, box->class_index), "red") != 0) {
+		fprintf(stderr, "[FAILED]: %s: label '%s'\n", title, ai_detections_get_label(results, box->class_index));
+		return -1;
+	}
+	printf("[OK]: %s\n", title);
+	return 0;
+}
+
+static int run_case(ai_tiler_t * tiler, ai_engine_t * engine, bgra_image_t * image, ai_detections_t * results,
+	const char * title, int x, int y, int width, int height)
+{
+	draw_frame(image, x, y, width, height);
+
+	input_frame_t frame[1];
+	memset(frame, 0, sizeof(frame));
+	frame->type = input_frame_type_bgra;
+	frame->bgra[0] = *image;
+
+	int rc = ai_tiler_predict(tiler, engine, frame, results);
+	assert(0 == rc);
+	return check_single_box(title, results, x, y, width, height);
+}
+
+int main(int argc, char **argv)
+{
+	ai_engine_t engine[1];
+	memset(engine, 0, sizeof(engine));
+	engine->predict_detections = fake_predict_detections;
+
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, FRAME_WIDTH, FRAME_HEIGHT, NULL);
+
+	ai_detections_t results[1];
+	memset(results, 0, sizeof(results));
+
+	// 5 x 3 tiles of 256 x 256, the neighbours share 64 pixels
+	ai_tiler_params_t params[1];
+	ai_tiler_params_init(params);
+	params->tile_width = 256;
+	params->tile_height = 256;
+	params->overlap = 0.25f;
+	params->max_tiles = 32;
+
+	ai_tiler_t * tiler = ai_tiler_new(params);
+	ai_tiler_stats_t stats[1], last[1];
+
+	if(run_case(tiler, engine, image, results, "small object", 100, 100, 40, 40)) return 1;
+	ai_tiler_get_stats(tiler, last);
+	assert(last->frames == 1 && last->tiles_predicted == 16 && last->tiles_skipped == 0);
+
+	// the same frame: nothing is predicted, the previous boxes are reused
+	if(run_case(tiler, engine, image, results, "unchanged frame", 100, 100, 40, 40)) return 1;
+	ai_tiler_get_stats(tiler, stats);
+	if(stats->tiles_predicted != last->tiles_predicted || stats->tiles_skipped != 16) {
+		fprintf(stderr, "[FAILED]: unchanged frame: %ld tiles predicted\n", stats->tiles_predicted - last->tiles_predicted);
+		return 1;
+	}
+	*last = *stats;
+
+	// only the tiles around the old and the new position (and the whole frame) are predicted
+	if(run_case(tiler, engine, image, results, "moved object", 600, 400, 40, 40)) return 1;
+	ai_tiler_get_stats(tiler, stats);
+	long num_predicted = stats->tiles_predicted - last->tiles_predicted;
+	if(num_predicted <= 1 || num_predicted >= 16) {
+		fprintf(stderr, "[FAILED]: moved object: %ld tiles predicted\n", num_predicted);
+		return 1;
+	}
+	printf("  %ld / 16 passes predicted\n", num_predicted);
+
+	// across the edges of the tiles: the cut boxes are dropped
+	if(run_case(tiler, engine, image, results, "object on a tile edge", 370, 230, 40, 40)) return 1;
+	if(run_case(tiler, engine, image, results, "object larger than a tile", 300, 150, 300, 200)) return 1;
+	ai_tiler_free(tiler);
+
+	// without the whole-frame pass, the small boxes cut by the edges are found whole in the overlaps
+	params->full_frame = 0;
+	tiler = ai_tiler_new(params);
+	if(run_case(tiler, engine, image, results, "object on a tile edge, tiles only", 370, 230, 40, 40)) return 1;
+	ai_tiler_get_stats(tiler, stats);
+	assert(stats->tiles_predicted == 15);
+	ai_tiler_free(tiler);
+
+	// a frame not larger than one tile is predicted as a whole
+	params->tile_width = 2048;
+	params->tile_height = 1024;
+	tiler = ai_tiler_new(params);
+	if(run_case(tiler, engine, image, results, "single tile", 10, 20, 30, 40)) return 1;
+	ai_tiler_get_stats(tiler, stats);
+	assert(stats->tiles_predicted == 1);
+	ai_tiler_free(tiler);
+
+	ai_detections_cleanup(results);
+	bgra_image_clear(image);
+	return 0;
+}
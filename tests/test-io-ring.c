@@ -0,0 +1,227 @@
+/*
+ * test-io-ring.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ann-plugin.h"
+#include "io-input.h"
+
+/*
+ * usuage: test-io-ring [num_frames]
+ *   one writer publishes numbered frames (every pixel and the json carry the frame_number)
+ *   while readers take them with get_frame_ref() (held for a while) or get_frame() (copied),
+ *   and check that no torn, recycled or repeated frame is ever returned.
+ */
+
+#define FRAME_WIDTH		(64)
+#define FRAME_HEIGHT	(48)
+#define NUM_READERS		(6)
+
+static int ring_test_init(void * object, json_object * jconfig)
+{
+	return 0;
+}
+
+// io_input_init() only needs a plugin to resolve: no io-plugin is loaded from disk
+static ann_plugin_t s_plugin[1] = {{
+	.type = (char *)"io-plugin::ring-test",
+	.init_func = (void *)ring_test_init,
+}};
+static ann_plugin_t * find_plugin(ann_plugins_helpler_t * helpler, const char * sz_type)
+{
+	return (strcmp(sz_type, s_plugin->type) == 0)?s_plugin:NULL;
+}
+
+typedef struct reader_context
+{
+	pthread_t th;
+	int id;
+	io_input_t * input;
+	int copy;					// get_frame() instead of get_frame_ref()
+	int hold;					// yields while holding the reference
+	const volatile int * done;
+
+	long frames_read;
+	int failed;
+}reader_context_t;
+
+static int verify_frame(const input_frame_t * frame, long frame_number)
+{
+	char json[100] = "";
+	snprintf(json, sizeof(json), "{\"frame_number\": %ld}", frame_number);
+
+	if(frame->frame_number != frame_number) return -1;
+	if((frame->type & input_frame_type_image_masks) != input_frame_type_bgra) return -1;
+	if(frame->width != FRAME_WIDTH || frame->height != FRAME_HEIGHT || frame->stride != FRAME_WIDTH * 4) return -1;
+	if(frame->length != (ssize_t)frame->stride * frame->height || NULL == frame->data) return -1;
+	if(NULL == frame->json_str || strcmp(frame->json_str, json)) return -1;
+
+	const uint32_t * pixels = (const uint32_t *)frame->data;
+	for(int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+	{
+		if(pixels[i] != (uint32_t)frame_number) return -1;
+	}
+	return 0;
+}
+
+static void * reader_thread(void * user_data)
+{
+	reader_context_t * reader = user_data;
+	io_input_t * input = reader->input;
+	input_frame_t copy[1];
+	memset(copy, 0, sizeof(copy));
+
+	long prev_frame = 0;
+	while(!reader->failed)
+	{
+		int done = __atomic_load_n(reader->done, __ATOMIC_ACQUIRE);
+		const input_frame_t * frame = NULL;
+		long frame_number = -1;
+		if(reader->copy)
+		{
+			frame_number = input->get_frame(input, prev_frame, copy);
+			if(frame_number > prev_frame) frame = copy;
+		}else
+		{
+			frame_number = input->get_frame_ref(input, prev_frame, &frame);
+		}
+
+		if(NULL == frame)
+		{
+			if(done) break;		// the last frame has been seen
+			sched_yield();
+			continue;
+		}
+
+		if(frame_number <= prev_frame || verify_frame(frame, frame_number)) {
+			fprintf(stderr, "[FAILED]: reader %d: frame %ld (prev %ld) is torn or out of order\n", reader->id, frame_number, prev_frame);
+			reader->failed = 1;
+		}else if(!reader->copy)
+		{
+			for(int i = 0; i < reader->hold; ++i) sched_yield();
+			if(verify_frame(frame, frame_number)) {	// the slot must not be recycled while referenced
+				fprintf(stderr, "[FAILED]: reader %d: frame %ld was recycled while held\n", reader->id, frame_number);
+				reader->failed = 1;
+			}
+		}
+		if(!reader->copy) input->release_frame(input, frame);
+
+		prev_frame = frame_number;
+		++reader->frames_read;
+	}
+	input_frame_clear(copy);
+	return NULL;
+}
+
+static int test_ring(int num_slots, long num_frames)
+{
+	io_input_t * input = io_input_init(NULL, s_plugin->type, NULL);
+	assert(input);
+	int rc = io_input_set_frame_slots(input, num_slots);
+	assert(0 == rc);
+
+	volatile int done = 0;
+	reader_context_t readers[NUM_READERS];
+	memset(readers, 0, sizeof(readers));
+	for(int i = 0; i < NUM_READERS; ++i)
+	{
+		readers[i].id = i;
+		readers[i].input = input;
+		readers[i].copy = (i == 0);
+		readers[i].hold = i * 4;
+		readers[i].done = &done;
+		rc = pthread_create(&readers[i].th, NULL, reader_thread, &readers[i]);
+		assert(0 == rc);
+	}
+
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, FRAME_WIDTH, FRAME_HEIGHT, NULL);
+	input_frame_t frame[1];
+	memset(frame, 0, sizeof(frame));
+
+	long published = 0, dropped = 0;
+	int failed = 0;
+	for(long frame_number = 1; frame_number <= num_frames; ++frame_number)
+	{
+		uint32_t * pixels = (uint32_t *)image->data;
+		for(int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i) pixels[i] = (uint32_t)frame_number;
+		char json[100] = "";
+		snprintf(json, sizeof(json), "{\"frame_number\": %ld}", frame_number);
+
+		input_frame_set_bgra(frame, image, json, -1);
+		frame->frame_number = frame_number;
+		long rc = input->set_frame(input, frame);
+		if(rc < 0) ++dropped;
+		else if(rc == frame_number) ++published;
+		else failed = 1;
+		sched_yield();		// let the readers interleave with the writer
+	}
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+	long frames_read = 0;
+	for(int i = 0; i < NUM_READERS; ++i)
+	{
+		pthread_join(readers[i].th, NULL);
+		failed |= readers[i].failed;
+		frames_read += readers[i].frames_read;
+	}
+	if(dropped != io_input_get_frames_dropped(input)) failed = 1;
+
+	input_frame_clear(frame);
+	bgra_image_clear(image);
+	io_input_cleanup(input);
+	free(input);
+
+	if(failed || 0 == published) {
+		fprintf(stderr, "[FAILED]: %d slots: %ld published, %ld dropped\n", num_slots, published, dropped);
+		return -1;
+	}
+	printf("[OK]: %d slots, %d readers: %ld published, %ld dropped, %ld reads\n",
+		num_slots, NUM_READERS, published, dropped, frames_read);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long num_frames = (argc > 1)?atol(argv[1]):20000;
+	assert(num_frames > 0);
+
+	ann_plugins_helpler_t * plugins = ann_plugins_helpler_get_default();
+	plugins->find = find_plugin;
+
+	static const int num_slots[] = { 2, 3, 4 };
+	for(size_t i = 0; i < sizeof(num_slots) / sizeof(num_slots[0]); ++i)
+	{
+		if(test_ring(num_slots[i], num_frames)) return 1;
+	}
+	return 0;
+}
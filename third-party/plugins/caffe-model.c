@@ -80,6 +80,7 @@ const char * ann_plugin_get_type(void);
 static void ai_plugin_caffe_cleanup(struct ai_engine * engine);
 static int ai_plugin_caffe_load_config(struct ai_engine * engine, json_object * jconfig);
 static int ai_plugin_caffe_predict(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults);
+static int ai_plugin_caffe_predict_batch(struct ai_engine * engine, const input_frame_t * frames[], int count, json_object * results[]);
 
 int ann_plugin_init(ai_engine_t * engine, json_object * jconfig);
 
@@ -103,16 +104,8 @@ static int ai_plugin_caffe_load_config(struct ai_engine * engine, json_object *
 	return 0;
 }
 
-static int ai_plugin_caffe_predict(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults)
+static bgra_image_t * frame_to_bgra(const input_frame_t * frame)
 {
-	debug_printf("%s(): frame: type=%d, size=%d x %d", __FUNCTION__,
-		frame->type,
-		frame->width, frame->height);
-		
-	int rc = -1;
-	caffe_model_plugin_t * plugin = engine->priv;
-	assert(plugin);
-
 	bgra_image_t * bgra = NULL;
 	int type = frame->type & input_frame_type_image_masks;
 
@@ -120,7 +113,7 @@ static int ai_plugin_caffe_predict(struct ai_engine * engine, const input_frame_
 	else if(type == input_frame_type_png || type == input_frame_type_jpeg)
 	{
 		bgra = bgra_image_init(NULL, frame->width, frame->height, NULL);
-		rc = bgra_image_load_data(bgra, frame->data, frame->length);
+		int rc = bgra_image_load_data(bgra, frame->data, frame->length);
 		if(rc)
 		{
 			bgra_image_clear(bgra);
@@ -128,60 +121,200 @@ static int ai_plugin_caffe_predict(struct ai_engine * engine, const input_frame_
 			bgra = NULL;
 		}
 	}
-	if(bgra)
+	return bgra;
+}
+
+/*
+ * a DetectionOutput layer merges the detections of the whole batch into one [1, 1, N, 7] blob,
+ * each row: [image_id, label, confidence, xmin, ymin, xmax, ymax]
+ */
+#define DETECTION_OUTPUT_COLUMNS	(7)
+static inline int is_detection_output(const caffe_tensor_t * tensor)
+{
+	return (tensor->n == 1 && tensor->c == 1 && tensor->w == DETECTION_OUTPUT_COLUMNS);
+}
+
+/* each output can be split among the @batch frames: along dims[0], or by the image_id column */
+static int outputs_splittable(const caffe_tensor_t * outputs, ssize_t count, int batch)
+{
+	if(batch == 1) return 1;
+	for(ssize_t i = 0; i < count; ++i)
 	{
-		caffe_tensor_t * results = NULL;
-		
-		app_timer_t timer[1];
-		double time_elapsed = 0;
-		app_timer_start(timer);
-		ssize_t count = plugin->predict(plugin, bgra, &results);
-		
-		time_elapsed = app_timer_stop(timer);
-		debug_printf("[INFO]::%s()::time_elapsed=%.3f ms", 
-			__FUNCTION__,
-			time_elapsed * 1000);
-		
-		if(count > 0  && p_jresults)
+		if(outputs[i].n != batch && !is_detection_output(&outputs[i])) return 0;
+	}
+	return 1;
+}
+
+static void add_output(json_object * jresults, const char * name, const int dims[static 4], const float * data)
+{
+	json_object * joutput = json_object_new_object();
+	json_object_object_add(jresults, name, joutput);
+
+	json_object * jdims = json_object_new_array();
+	json_object_object_add(joutput, "dims", jdims);
+	for(int i = 0; i < 4; ++i) json_object_array_add(jdims, json_object_new_int(dims[i]));
+
+	size_t size = (size_t)dims[0] * dims[1] * dims[2] * dims[3];
+	json_object * jdata = json_object_new_array();
+	json_object_object_add(joutput, "data", jdata);
+	for(size_t i = 0; i < size; ++i) json_object_array_add(jdata, json_object_new_double(data[i]));
+}
+
+/*
+ * build the json results of the @index-th frame of a batch of @batch frames (see outputs_splittable()):
+ * - dims[0] == batch: the output is sliced along dims[0]
+ * - DetectionOutput: the rows of the frame (image_id == index), or a single row of -1 (same as caffe) if none
+ * - batch == 1: any other output is passed through as is
+ */
+static json_object * tensors_to_json(const caffe_tensor_t * results, ssize_t count, int batch, int index)
+{
+	json_object * jresults = json_object_new_object();
+	json_object_object_add(jresults, "model", json_object_new_string("caffe-model"));
+	json_object_object_add(jresults, "num_outputs", json_object_new_int((int)count));
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		const caffe_tensor_t * result = &results[i];
+		assert(result->name);
+
+		if(result->n == batch)
 		{
-			json_object * jresults = json_object_new_object();
-			json_object_object_add(jresults, "model", json_object_new_string("caffe-model"));
-			json_object_object_add(jresults, "num_outputs", json_object_new_int((int)count));
-			for(ssize_t i = 0; i < count; ++i)
+			size_t size = (size_t)result->c * result->h * result->w;
+			assert(size > 0);
+			int dims[4] = { 1, result->c, result->h, result->w };
+			add_output(jresults, result->name, dims, result->data + size * index);
+		}else if(batch == 1)
+		{
+			add_output(jresults, result->name, result->dims, result->data);
+		}else
+		{
+			assert(is_detection_output(result));
+			float * rows = calloc(result->h + 1, sizeof(*rows) * DETECTION_OUTPUT_COLUMNS);
+			assert(rows);
+
+			int num_rows = 0;
+			for(int row = 0; row < result->h; ++row)
+			{
+				const float * data = result->data + (size_t)row * DETECTION_OUTPUT_COLUMNS;
+				if((int)data[0] != index) continue;
+				memcpy(rows + (size_t)num_rows * DETECTION_OUTPUT_COLUMNS, data, sizeof(*rows) * DETECTION_OUTPUT_COLUMNS);
+				++num_rows;
+			}
+			if(0 == num_rows)
 			{
-				caffe_tensor_t * result = &results[i];
-				assert(result->name);
-				
-				json_object * joutput = json_object_new_object();
-				json_object_object_add(jresults, result->name, joutput);
-
-				json_object * jdims = json_object_new_array();
-				json_object_object_add(joutput, "dims", jdims);
-				for(int ii = 0; ii < 4; ++ii) json_object_array_add(jdims, json_object_new_int(result->dims[ii]));
-				
-				size_t size = result->n * result->c * result->h * result->w;
-				assert(size > 0);
-				
-				json_object * jdata = json_object_new_array();
-				json_object_object_add(joutput, "data", jdata); 
-				for(size_t ii = 0; ii < size; ++ii) json_object_array_add(jdata, json_object_new_double(result->data[ii]));
+				for(int col = 0; col < DETECTION_OUTPUT_COLUMNS; ++col) rows[col] = -1;
+				num_rows = 1;
 			}
-			*p_jresults = jresults;
-			rc = 0;
+
+			int dims[4] = { 1, 1, num_rows, DETECTION_OUTPUT_COLUMNS };
+			add_output(jresults, result->name, dims, rows);
+			free(rows);
 		}
+	}
+	return jresults;
+}
+
+static void free_outputs(caffe_tensor_t * outputs, ssize_t num_outputs)
+{
+	if(NULL == outputs) return;
+	for(ssize_t i = 0; i < num_outputs; ++i) caffe_tensor_cleanup(&outputs[i]);
+	free(outputs);
+}
+
+static int ai_plugin_caffe_predict(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults)
+{
+	debug_printf("%s(): frame: type=%d, size=%d x %d", __FUNCTION__,
+		frame->type,
+		frame->width, frame->height);
+
+	json_object * results[1] = { NULL };
+	int num_results = engine->predict_batch(engine, &frame, 1, results);
+	if(num_results <= 0) return -1;
+
+	if(p_jresults) *p_jresults = results[0];
+	else json_object_put(results[0]);
+	return 0;
+}
+
+static int ai_plugin_caffe_predict_batch(struct ai_engine * engine, const input_frame_t * frames[], int count, json_object * results[])
+{
+	caffe_model_plugin_t * plugin = engine->priv;
+	assert(plugin);
+	if(count <= 0) return 0;
+
+	bgra_image_t * images[count];
+	bgra_image_t batch_frames[count];	// contiguous (shallow) copies, as required by plugin->predict_batch()
+	int batch_index[count];				// frames[i] --> batch_frames[batch_index[i]]
+
+	int batch = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		results[i] = NULL;
+		batch_index[i] = -1;
+		bgra_image_t * bgra = frame_to_bgra(frames[i]);
+		if(NULL == bgra) continue;
 
-		if(results) {
-			for(int i = 0; i < count; ++i) caffe_tensor_cleanup(&results[i]);
-			free(results);
+		batch_index[i] = batch;
+		images[batch] = bgra;
+		batch_frames[batch] = *bgra;
+		++batch;
+	}
+	if(batch == 0) return -1;
+
+	caffe_tensor_t * outputs = NULL;
+
+	app_timer_t timer[1];
+	double time_elapsed = 0;
+	app_timer_start(timer);
+	ssize_t num_outputs = plugin->predict_batch(plugin, batch, batch_frames, &outputs);
+
+	time_elapsed = app_timer_stop(timer);
+	debug_printf("[INFO]::%s(%d)::time_elapsed=%.3f ms",
+		__FUNCTION__, batch,
+		time_elapsed * 1000);
+
+	int single_passes = 0;
+	if(num_outputs > 0 && !outputs_splittable(outputs, num_outputs, batch))
+	{
+		// some output does not keep the frames apart: run them one by one
+		debug_printf("[WARNING]::%s(): outputs can not be split among %d frames, fall back to single-frame passes",
+			__FUNCTION__, batch);
+		free_outputs(outputs, num_outputs);
+		outputs = NULL;
+		num_outputs = 0;
+		single_passes = 1;
+	}
+
+	int num_results = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		int index = batch_index[i];
+		if(index < 0) continue;
+
+		if(num_outputs > 0)
+		{
+			results[i] = tensors_to_json(outputs, num_outputs, batch, index);
+			++num_results;
+		}else if(single_passes)
+		{
+			caffe_tensor_t * frame_outputs = NULL;
+			ssize_t num_frame_outputs = plugin->predict_batch(plugin, 1, &batch_frames[index], &frame_outputs);
+			if(num_frame_outputs > 0)
+			{
+				results[i] = tensors_to_json(frame_outputs, num_frame_outputs, 1, 0);
+				++num_results;
+			}
+			free_outputs(frame_outputs, num_frame_outputs);
 		}
-		
-		if(bgra != frame->bgra)
+
+		if(images[index] != frames[i]->bgra)
 		{
-			bgra_image_clear(bgra);
-			free(bgra);
+			bgra_image_clear(images[index]);
+			free(images[index]);
 		}
 	}
-	return rc;
+
+	free_outputs(outputs, num_outputs);
+	return num_results;
 }
 
 int ann_plugin_init(ai_engine_t * engine, json_object * jconfig)
@@ -195,6 +328,7 @@ int ann_plugin_init(ai_engine_t * engine, json_object * jconfig)
 	engine->cleanup = ai_plugin_caffe_cleanup;
 	engine->load_config = ai_plugin_caffe_load_config;
 	engine->predict = ai_plugin_caffe_predict;
+	engine->predict_batch = ai_plugin_caffe_predict_batch;
 	return 0;
 }
 
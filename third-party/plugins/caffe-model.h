@@ -26,6 +26,10 @@ typedef struct caffe_model_plugin
 	int gpu_index;
 	ssize_t (* predict)(struct caffe_model_plugin * plugin, const bgra_image_t frame[], caffe_tensor_t ** p_results);
 	
+	// run @count frames in one forward pass, each output tensor has dims[0] == count
+	// (except the layers which merge the batch, e.g. DetectionOutput: [1, 1, N, 7], N rows of all the frames)
+	ssize_t (* predict_batch)(struct caffe_model_plugin * plugin, int count, const bgra_image_t frames[], caffe_tensor_t ** p_results);
+	
 	ssize_t (* pre_process) (struct caffe_model_plugin * plugin, const bgra_image_t frame[], caffe_tensor_t ** p_input, void * input_layer);
 	ssize_t (* post_process)(struct caffe_model_plugin * plugin, ssize_t num_outputs, const caffe_tensor_t * raw_outputs[], caffe_tensor_t ** p_outputs, void * user_data);
 }caffe_model_plugin_t;
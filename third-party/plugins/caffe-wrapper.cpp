@@ -49,6 +49,7 @@
 
 extern "C" {
 static ssize_t caffe_model_predict(struct caffe_model_plugin * plugin, const bgra_image_t frame[], caffe_tensor_t ** p_results);
+static ssize_t caffe_model_predict_batch(struct caffe_model_plugin * plugin, int count, const bgra_image_t frames[], caffe_tensor_t ** p_results);
 }
 
 struct caffe_model_private
@@ -68,6 +69,8 @@ struct caffe_model_private
 	int has_means_scalar;
 	std::vector<float> means;
 	
+	float channel_means[3];		// R, G, B: the means of each channel of the means_blob, or the scalar means
+	
 	float value_scale;	// value range: [ 0 , (255.0f * <value_scale>) ]
 	int has_output_names;
 	std::vector<const char *> output_names;
@@ -134,6 +137,19 @@ public:
 			means.push_back(128.0f);
 			means.push_back(128.0f);
 		}
+		for(int c = 0; c < 3; ++c) channel_means[c] = means[c % means.size()];
+		
+		if(has_means_blob) {
+			// use the mean value of each channel (as caffe's classification example does)
+			int channels = means_blob.channels();
+			int size = means_blob.height() * means_blob.width();
+			const float * data = means_blob.cpu_data();
+			for(int c = 0; c < 3 && c < channels && size > 0; ++c) {
+				double sum = 0;
+				for(int i = 0; i < size; ++i) sum += data[c * size + i];
+				channel_means[c] = (float)(sum / size);
+			}
+		}
 		
 		json_object * joutputs = NULL;
 		ok = json_object_object_get_ex(jconfig, "outputs", &joutputs);
@@ -177,6 +193,7 @@ caffe_model_plugin_t * caffe_model_plugin_new(json_object * jconfig, void * user
 	
 	plugin->user_data = user_data;
 	plugin->predict = caffe_model_predict;
+	plugin->predict_batch = caffe_model_predict_batch;
 	
 	json_object * jcfg_file = NULL;
 	json_bool ok = json_object_object_get_ex(jconfig, "conf_file", &jcfg_file);
@@ -203,10 +220,13 @@ void caffe_model_plugin_free(caffe_model_plugin_t * plugin)
 	free(plugin);
 }
 
+/*
+ * means: per-channel (R, G, B) means
+ */
 static int bgra_to_float32_planes(
 	int count, const bgra_image_t * frames, 
 	int width, int height, // net.dims 
-	const float * means,  
+	const float means[3],  
 	const float value_scale,
 	float ** p_rgb_planes)
 {
@@ -219,6 +239,8 @@ static int bgra_to_float32_planes(
 	assert(dst);
 	*p_rgb_planes = dst;
 	
+	const float scales[3] = { value_scale, value_scale, value_scale };
+	
 	float * rgb_planes = dst;
 	for(int i = 0; i < count; ++i)
 	{
@@ -227,13 +249,14 @@ static int bgra_to_float32_planes(
 		
 		cairo_surface_t * image = NULL;
 		const unsigned char * image_data = frame->data;
+		int stride = (frame->stride >= frame->width * 4)?frame->stride:0;
 		if(frame->width != width || frame->height != height)	// resize image
 		{
 			cairo_surface_t * surface = cairo_image_surface_create_for_data(
-				(unsigned char *)frame, 
+				(unsigned char *)frame->data, 
 				CAIRO_FORMAT_ARGB32, 
 				frame->width, frame->height,
-				frame->width * 4);
+				stride?stride:(frame->width * 4));
 			assert(surface && cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS);
 			
 			image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
@@ -248,35 +271,14 @@ static int bgra_to_float32_planes(
 			cairo_destroy(cr);
 			
 			cairo_surface_destroy(surface);
+			cairo_surface_flush(image);
 			image_data = cairo_image_surface_get_data(image);
+			stride = cairo_image_surface_get_stride(image);
 		}
 		
-
-		ssize_t size = width * height;
-		
-		float * r_plane = rgb_planes;
-		float * g_plane = r_plane + size;
-		float * b_plane = g_plane + size;
+		int rc = img_bgra_to_planar_f32(image_data, width, height, stride, means, scales, rgb_planes);
+		assert(0 == rc);
 		
-		const unsigned char * data = image_data;
-		if(means) {
-			for(ssize_t ii = 0; ii < size; ++ii)
-			{
-				r_plane[ii] = ((float)data[2] - means[0]) * value_scale;
-				g_plane[ii] = ((float)data[1] - means[1]) * value_scale;
-				b_plane[ii] = ((float)data[0] - means[2]) * value_scale;
-				data += 4;
-				means += 3;
-			}
-		}else {
-			for(ssize_t ii = 0; ii < size; ++ii)
-			{
-				r_plane[ii] = ((float)data[2] - 128.0f) * value_scale;
-				g_plane[ii] = ((float)data[1] - 128.0f) * value_scale;
-				b_plane[ii] = ((float)data[0] - 128.0f) * value_scale;
-				data += 4;
-			}
-		}
 		if(image) cairo_surface_destroy(image);
 		image = NULL;
 		
@@ -319,10 +321,16 @@ static inline void caffe_tensor_set_output(caffe_tensor_t * result, const char *
 }
 
 static ssize_t caffe_model_predict(struct caffe_model_plugin * plugin, const bgra_image_t frames[], caffe_tensor_t ** p_results)
+{
+	return caffe_model_predict_batch(plugin, 1, frames, p_results);
+}
+
+static ssize_t caffe_model_predict_batch(struct caffe_model_plugin * plugin, int count, const bgra_image_t frames[], caffe_tensor_t ** p_results)
 {
 	caffe_model_private * priv = (caffe_model_private *)plugin->priv;
 	assert(priv);
 	caffe::Net<float> &net = priv->net;
+	if(count <= 0) return -1;
 	
 	caffe::Blob<float> * input_layer = net.input_blobs()[0];
 	
@@ -332,6 +340,13 @@ static ssize_t caffe_model_predict(struct caffe_model_plugin * plugin, const bgr
 	int width = input_layer->width();
 	int height = input_layer->height();
 	
+	// resize the batch dimension to the number of frames, the outputs will be {count, c, h, w}
+	if(n != count) {
+		input_layer->Reshape(count, input_layer->channels(), height, width);
+		net.Reshape();
+		n = count;
+	}
+	
 	// data transform
 	caffe_tensor_t *input = NULL;
 	float * input_data = NULL;
@@ -341,7 +356,7 @@ static ssize_t caffe_model_predict(struct caffe_model_plugin * plugin, const bgr
 	}
 	else {
 		bgra_to_float32_planes(n, frames, width, height, 
-			priv->has_means_blob?priv->means_blob.cpu_data():NULL, 
+			priv->channel_means, 
 			priv->value_scale,
 			&input_data);
 		assert(input_data);
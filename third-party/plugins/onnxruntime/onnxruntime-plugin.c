@@ -0,0 +1,832 @@
+/*
+ * onnxruntime-plugin.c
+ *
+ * Copyright 2020 Che Hongwei <htc.chehw@gmail.com>
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include <json-c/json.h>
+#include <onnxruntime_c_api.h>
+
+#include "utils.h"
+#include "img_proc.h"
+#include "ai-engine.h"
+#include "ai-detections.h"
+#include "input-frame.h"
+
+#define AI_PLUGIN_TYPE_STRING "ai-engine::onnxruntime"
+#define ONNX_WORKSPACE_ALIGNMENT (64)
+
+/*
+ * config:
+ *   "model_file":           *.onnx (required)
+ *   "model_type":           "yolov5" ([N, boxes, 5 + classes]), "yolov8" ([N, 4 + classes, boxes]), "classifier" ([N, classes])
+ *   "labels_file":          one label per line
+ *   "intra_op_threads":     threads of one operator, default 1 (the engine pool runs several sessions)
+ *   "inter_op_threads":     threads of the parallel executor, default 1
+ *   "execution_mode":       "sequential" (default) | "parallel"
+ *   "graph_optimization":   "disable" | "basic" | "extended" | "all" (default)
+ *   "allow_spinning":       default 1, 0: the idle threads sleep instead of spinning
+ *   "max_batch":            used when the batch dimension of the model is dynamic, default 1
+ *   "input_width", "input_height": used when the spatial dimensions of the model are dynamic, default 640
+ *   "means", "scales":      per-channel (R, G, B) normalization: (pixel - mean) * scale, default 0, 1/255
+ *   "letterbox", "pad_value", "preprocess_threads"
+ *   "threshold", "nms", "top_k", "relative", "softmax" (classifier)
+ */
+enum onnx_model_type
+{
+	onnx_model_type_yolov5 = 0,
+	onnx_model_type_yolov8,
+	onnx_model_type_classifier,
+};
+
+typedef struct onnx_plugin
+{
+	ai_engine_t * engine;
+	json_object * jconfig;
+	char * model_name;
+
+	OrtSession * session;
+	OrtMemoryInfo * memory_info;
+	OrtAllocator * allocator;
+	OrtIoBinding * binding;
+
+	char * input_name;
+	size_t num_outputs;
+	char ** output_names;
+
+	/*
+	 * workspace: the input tensor {max_batch, 3, height, width},
+	 * input_values[n - 1]: a tensor of {n, 3, height, width} over the same memory, created on demand.
+	 */
+	int fixed_batch;			// the batch dimension of the model is not dynamic
+	int max_batch;
+	int width, height;
+	ai_tensor_t input[1];
+	OrtValue ** input_values;
+	int bound_batch;			// batch size of the input currently bound, 0: none
+
+	img_letterbox_t * letterboxes;	// [max_batch]: geometry of the images of the current batch
+	int * image_sizes;				// [max_batch * 2]: width, height
+	ai_detections_t ** batch_results;	// [max_batch]: results of the images of the current batch
+	ai_detections_t * detections;		// [max_batch]: predict_batch() (json results), reused
+
+	// preprocessing
+	float means[3];
+	float scales[3];
+	int letterbox;
+	float pad_value;
+	int preprocess_threads;
+
+	// post-processing
+	enum onnx_model_type model_type;
+	ssize_t num_labels;
+	char ** labels;
+	float thresh;
+	float nms;
+	int top_k;
+	int relative;
+	int softmax;
+
+	ai_nms_context_t * nms_ctx;
+	ssize_t candidates_capacity;
+	ai_nms_box_t * candidates;
+}onnx_plugin_t;
+
+/******************************************************************************
+ * OrtApi / OrtEnv: one per process
+ *****************************************************************************/
+static const OrtApi * g_ort;
+static OrtEnv * s_env;
+static int s_env_refs;
+static pthread_mutex_t s_env_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int ort_check_status(OrtStatus * status, const char * func, int line)
+{
+	if(NULL == status) return 0;
+	fprintf(stderr, "[ERROR]::%s(%d)::onnxruntime: %s\n", func, line, g_ort->GetErrorMessage(status));
+	g_ort->ReleaseStatus(status);
+	return -1;
+}
+#define ORT_CHECK(status) ort_check_status(status, __FUNCTION__, __LINE__)
+
+static OrtEnv * onnx_env_acquire(void)
+{
+	pthread_mutex_lock(&s_env_mutex);
+	if(NULL == g_ort) g_ort = OrtGetApiBase()->GetApi(ORT_API_VERSION);
+	assert(g_ort);
+	if(NULL == s_env) {
+		int rc = ORT_CHECK(g_ort->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "ann-plugin", &s_env));
+		assert(0 == rc && s_env);
+	}
+	++s_env_refs;
+	pthread_mutex_unlock(&s_env_mutex);
+	return s_env;
+}
+
+static void onnx_env_release(void)
+{
+	pthread_mutex_lock(&s_env_mutex);
+	if(s_env_refs > 0 && --s_env_refs == 0) {
+		g_ort->ReleaseEnv(s_env);
+		s_env = NULL;
+	}
+	pthread_mutex_unlock(&s_env_mutex);
+}
+
+/******************************************************************************
+ * onnx_plugin
+ *****************************************************************************/
+static char ** load_labels(const char * labels_file, ssize_t * p_count)
+{
+	FILE * fp = fopen(labels_file, "r");
+	if(NULL == fp) {
+		fprintf(stderr, "[WARNING]::%s(%s): open failed\n", __FUNCTION__, labels_file);
+		return NULL;
+	}
+
+	ssize_t count = 0;
+	char ** labels = NULL;
+	char buf[4096] = "";
+	char * line = NULL;
+	while((line = fgets(buf, sizeof(buf) - 1, fp))) {
+		char * p_comments = strchr(line, '#');
+		if(p_comments) *p_comments = '\0';
+		char * p_end = line + strlen(line);
+		line = trim(line, p_end);
+		if(strlen(line) == 0) continue;
+
+		labels = realloc(labels, sizeof(*labels) * (count + 1));
+		assert(labels);
+		labels[count++] = strdup(line);
+	}
+	fclose(fp);
+	*p_count = count;
+	return labels;
+}
+
+static OrtSessionOptions * onnx_session_options_new(json_object * jconfig)
+{
+	OrtSessionOptions * options = NULL;
+	int rc = ORT_CHECK(g_ort->CreateSessionOptions(&options));
+	assert(0 == rc && options);
+
+	int intra_op_threads = json_get_value_default(jconfig, int, intra_op_threads, 1);
+	int inter_op_threads = json_get_value_default(jconfig, int, inter_op_threads, 1);
+	const char * execution_mode = json_get_value_default(jconfig, string, execution_mode, "sequential");
+	const char * optimization = json_get_value_default(jconfig, string, graph_optimization, "all");
+	int allow_spinning = json_get_value_default(jconfig, int, allow_spinning, 1);
+
+	GraphOptimizationLevel level = ORT_ENABLE_ALL;
+	if(strcasecmp(optimization, "disable") == 0) level = ORT_DISABLE_ALL;
+	else if(strcasecmp(optimization, "basic") == 0) level = ORT_ENABLE_BASIC;
+	else if(strcasecmp(optimization, "extended") == 0) level = ORT_ENABLE_EXTENDED;
+
+	rc = ORT_CHECK(g_ort->SetIntraOpNumThreads(options, intra_op_threads));
+	if(0 == rc) rc = ORT_CHECK(g_ort->SetInterOpNumThreads(options, inter_op_threads));
+	if(0 == rc) rc = ORT_CHECK(g_ort->SetSessionExecutionMode(options,
+		(strcasecmp(execution_mode, "parallel") == 0)?ORT_PARALLEL:ORT_SEQUENTIAL));
+	if(0 == rc) rc = ORT_CHECK(g_ort->SetSessionGraphOptimizationLevel(options, level));
+	if(0 == rc) rc = ORT_CHECK(g_ort->AddSessionConfigEntry(options, "session.intra_op.allow_spinning", allow_spinning?"1":"0"));
+	assert(0 == rc);
+
+	debug_printf("%s(): intra_op_threads=%d, inter_op_threads=%d, execution_mode=%s, graph_optimization=%s",
+		__FUNCTION__, intra_op_threads, inter_op_threads, execution_mode, optimization);
+	return options;
+}
+
+/* {N, 3, H, W} float32, the dynamic dimensions (< 0) are taken from the config */
+static int onnx_load_input_info(onnx_plugin_t * plugin, json_object * jconfig)
+{
+	OrtTypeInfo * type_info = NULL;
+	const OrtTensorTypeAndShapeInfo * tensor_info = NULL;
+	int rc = ORT_CHECK(g_ort->SessionGetInputTypeInfo(plugin->session, 0, &type_info));
+	if(rc) return -1;
+
+	size_t num_dims = 0;
+	int64_t dims[4] = { -1, -1, -1, -1 };
+	ONNXTensorElementDataType type = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+
+	rc = ORT_CHECK(g_ort->CastTypeInfoToTensorInfo(type_info, &tensor_info));
+	if(0 == rc) rc = ORT_CHECK(g_ort->GetTensorElementType(tensor_info, &type));
+	if(0 == rc) rc = ORT_CHECK(g_ort->GetDimensionsCount(tensor_info, &num_dims));
+	if(0 == rc && num_dims == 4) rc = ORT_CHECK(g_ort->GetDimensions(tensor_info, dims, 4));
+	g_ort->ReleaseTypeInfo(type_info);
+
+	if(rc || num_dims != 4 || type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT || (dims[1] > 0 && dims[1] != 3)) {
+		fprintf(stderr, "[ERROR]::%s(): unsupported input '%s' (NCHW float32 RGB only)\n", __FUNCTION__, plugin->input_name);
+		return -1;
+	}
+
+	plugin->fixed_batch = (dims[0] > 0);
+	plugin->max_batch = plugin->fixed_batch?(int)dims[0]:json_get_value_default(jconfig, int, max_batch, 1);
+	plugin->height = (dims[2] > 0)?(int)dims[2]:json_get_value_default(jconfig, int, input_height, 640);
+	plugin->width = (dims[3] > 0)?(int)dims[3]:json_get_value_default(jconfig, int, input_width, 640);
+	if(plugin->max_batch < 1) plugin->max_batch = 1;
+	assert(plugin->width > 0 && plugin->height > 0);
+	return 0;
+}
+
+static void onnx_workspace_init(onnx_plugin_t * plugin)
+{
+	int_dim4 size = { .n = plugin->max_batch, .c = 3, .h = plugin->height, .w = plugin->width };
+	ai_tensor_t * input = plugin->input;
+	input->type = ai_tensor_data_type_float32;
+	input->dim[0] = size;
+	input->length = (size_t)size.n * size.c * size.h * size.w;
+
+	void * data = NULL;
+	int rc = posix_memalign(&data, ONNX_WORKSPACE_ALIGNMENT, sizeof(float) * input->length);
+	assert(0 == rc && data);
+	memset(data, 0, sizeof(float) * input->length);
+	input->data = data;
+
+	plugin->input_values = calloc(plugin->max_batch, sizeof(*plugin->input_values));
+	plugin->letterboxes = calloc(plugin->max_batch, sizeof(*plugin->letterboxes));
+	plugin->image_sizes = calloc(plugin->max_batch * 2, sizeof(*plugin->image_sizes));
+	plugin->batch_results = calloc(plugin->max_batch, sizeof(*plugin->batch_results));
+	plugin->detections = calloc(plugin->max_batch, sizeof(*plugin->detections));
+	assert(plugin->input_values && plugin->letterboxes && plugin->image_sizes);
+	assert(plugin->batch_results && plugin->detections);
+
+	plugin->nms_ctx = ai_nms_context_new();
+}
+
+static void onnx_plugin_free(onnx_plugin_t * plugin)
+{
+	if(NULL == plugin) return;
+
+	if(plugin->binding) g_ort->ReleaseIoBinding(plugin->binding);
+	if(plugin->input_values) {
+		for(int i = 0; i < plugin->max_batch; ++i) if(plugin->input_values[i]) g_ort->ReleaseValue(plugin->input_values[i]);
+		free(plugin->input_values);
+	}
+	if(plugin->session) g_ort->ReleaseSession(plugin->session);
+	if(plugin->memory_info) g_ort->ReleaseMemoryInfo(plugin->memory_info);
+
+	if(plugin->allocator) {
+		if(plugin->input_name) g_ort->AllocatorFree(plugin->allocator, plugin->input_name);
+		for(size_t i = 0; i < plugin->num_outputs; ++i) g_ort->AllocatorFree(plugin->allocator, plugin->output_names[i]);
+	}
+	free(plugin->output_names);
+
+	free(plugin->input->data);
+	free(plugin->letterboxes);
+	free(plugin->image_sizes);
+	free(plugin->batch_results);
+	if(plugin->detections) {
+		for(int i = 0; i < plugin->max_batch; ++i) ai_detections_cleanup(&plugin->detections[i]);
+		free(plugin->detections);
+	}
+	ai_nms_context_free(plugin->nms_ctx);
+	free(plugin->candidates);
+
+	if(plugin->labels) {
+		for(ssize_t i = 0; i < plugin->num_labels; ++i) free(plugin->labels[i]);
+		free(plugin->labels);
+	}
+	free(plugin->model_name);
+	if(plugin->jconfig) json_object_put(plugin->jconfig);
+	free(plugin);
+
+	onnx_env_release();
+}
+
+static onnx_plugin_t * onnx_plugin_new(json_object * jconfig, ai_engine_t * engine)
+{
+	const char * model_file = json_get_value(jconfig, string, model_file);
+	if(NULL == model_file) {
+		fprintf(stderr, "[ERROR]::%s(): no model_file\n", __FUNCTION__);
+		return NULL;
+	}
+
+	OrtEnv * env = onnx_env_acquire();
+	onnx_plugin_t * plugin = calloc(1, sizeof(*plugin));
+	assert(plugin);
+	plugin->engine = engine;
+	plugin->jconfig = json_object_get(jconfig);
+
+	// session: created once, reused by every predict
+	OrtSessionOptions * options = onnx_session_options_new(jconfig);
+	int rc = ORT_CHECK(g_ort->CreateSession(env, model_file, options, &plugin->session));
+	g_ort->ReleaseSessionOptions(options);
+	if(rc) {
+		onnx_plugin_free(plugin);
+		return NULL;
+	}
+
+	rc = ORT_CHECK(g_ort->GetAllocatorWithDefaultOptions(&plugin->allocator));
+	if(0 == rc) rc = ORT_CHECK(g_ort->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &plugin->memory_info));
+	if(0 == rc) rc = ORT_CHECK(g_ort->SessionGetInputName(plugin->session, 0, plugin->allocator, &plugin->input_name));
+	if(0 == rc) rc = ORT_CHECK(g_ort->SessionGetOutputCount(plugin->session, &plugin->num_outputs));
+	if(0 == rc && plugin->num_outputs > 0) {
+		plugin->output_names = calloc(plugin->num_outputs, sizeof(*plugin->output_names));
+		assert(plugin->output_names);
+		for(size_t i = 0; 0 == rc && i < plugin->num_outputs; ++i) {
+			rc = ORT_CHECK(g_ort->SessionGetOutputName(plugin->session, i, plugin->allocator, &plugin->output_names[i]));
+		}
+	}
+	if(0 == rc) rc = onnx_load_input_info(plugin, jconfig);
+	if(0 == rc) rc = ORT_CHECK(g_ort->CreateIoBinding(plugin->session, &plugin->binding));
+	for(size_t i = 0; 0 == rc && i < plugin->num_outputs; ++i) {
+		// the outputs are allocated by onnxruntime (their shapes may depend on the batch size)
+		rc = ORT_CHECK(g_ort->BindOutputToDevice(plugin->binding, plugin->output_names[i], plugin->memory_info));
+	}
+	if(rc || plugin->num_outputs == 0) {
+		onnx_plugin_free(plugin);
+		return NULL;
+	}
+
+	const char * model_type = json_get_value_default(jconfig, string, model_type, "yolov5");
+	if(strcasecmp(model_type, "yolov8") == 0) plugin->model_type = onnx_model_type_yolov8;
+	else if(strcasecmp(model_type, "classifier") == 0) plugin->model_type = onnx_model_type_classifier;
+	else plugin->model_type = onnx_model_type_yolov5;
+
+	char model_name[1024] = "";
+	snprintf(model_name, sizeof(model_name), "onnxruntime::%s", model_type);
+	plugin->model_name = strdup(model_name);
+
+	const char * labels_file = json_get_value(jconfig, string, labels_file);
+	if(labels_file) plugin->labels = load_labels(labels_file, &plugin->num_labels);
+
+	int is_classifier = (plugin->model_type == onnx_model_type_classifier);
+	plugin->thresh = json_get_value_default(jconfig, double, threshold, is_classifier?0.0:0.5);
+	plugin->nms = json_get_value_default(jconfig, double, nms, 0.45);
+	plugin->top_k = json_get_value_default(jconfig, int, top_k, is_classifier?5:0);
+	plugin->relative = json_get_value_default(jconfig, int, relative, 1);
+	plugin->softmax = json_get_value_default(jconfig, int, softmax, 0);
+
+	plugin->letterbox = json_get_value_default(jconfig, int, letterbox, !is_classifier);
+	plugin->pad_value = json_get_value_default(jconfig, double, pad_value, 114.0 / 255.0);
+	plugin->preprocess_threads = json_get_value_default(jconfig, int, preprocess_threads, 1);
+
+	json_object * jmeans = NULL, * jscales = NULL;
+	json_object_object_get_ex(jconfig, "means", &jmeans);
+	json_object_object_get_ex(jconfig, "scales", &jscales);
+	for(int c = 0; c < 3; ++c) {
+		int num_means = jmeans?json_object_array_length(jmeans):0;
+		int num_scales = jscales?json_object_array_length(jscales):0;
+		plugin->means[c] = (num_means > 0)?json_object_get_double(json_object_array_get_idx(jmeans, c % num_means)):0.0f;
+		plugin->scales[c] = (num_scales > 0)?json_object_get_double(json_object_array_get_idx(jscales, c % num_scales)):(1.0f / 255.0f);
+	}
+
+	onnx_workspace_init(plugin);
+	debug_printf("%s(%s): input '%s' {%d%s, 3, %d, %d}, %d outputs", __FUNCTION__, model_file,
+		plugin->input_name, plugin->max_batch, plugin->fixed_batch?"":" (dynamic)", plugin->height, plugin->width,
+		(int)plugin->num_outputs);
+	return plugin;
+}
+
+/******************************************************************************
+ * pre-processing
+ *****************************************************************************/
+static bgra_image_t * frame_to_bgra(const input_frame_t * frame)
+{
+	bgra_image_t * bgra = NULL;
+	int type = frame->type & input_frame_type_image_masks;
+
+	if(type == input_frame_type_bgra || type == input_frame_type_rgb_planar) bgra = (bgra_image_t *)frame->bgra;
+	else if(type == input_frame_type_png || type == input_frame_type_jpeg)
+	{
+		bgra = bgra_image_init(NULL, frame->width, frame->height, NULL);
+		int rc = bgra_image_load_data(bgra, frame->data, frame->length);
+		if(rc)
+		{
+			bgra_image_clear(bgra);
+			free(bgra);
+			bgra = NULL;
+		}
+	}
+	return bgra;
+}
+
+/* write one image into the batch item @index of the workspace */
+static int onnx_load_input(onnx_plugin_t * plugin, const bgra_image_t * image, int index)
+{
+	const ssize_t plane_size = (ssize_t)plugin->width * plugin->height;
+	float * dst = plugin->input->f32 + plane_size * 3 * index;
+	img_letterbox_t * letterbox = &plugin->letterboxes[index];
+	plugin->image_sizes[index * 2] = image->width;
+	plugin->image_sizes[index * 2 + 1] = image->height;
+
+	if(image->channels == 3)	// RGB planar, already scaled to the network size
+	{
+		if(image->width != plugin->width || image->height != plugin->height) return -1;
+		int stride = (image->stride > 0)?image->stride:image->width;
+		for(int c = 0; c < 3; ++c)
+		{
+			const unsigned char * plane = image->data + (ssize_t)stride * image->height * c;
+			for(int y = 0; y < image->height; ++y) {
+				img_u8_to_f32(plane + (ssize_t)stride * y, image->width, plugin->means[c], plugin->scales[c],
+					dst + plane_size * c + (ssize_t)plugin->width * y);
+			}
+		}
+		*letterbox = (img_letterbox_t){ .x = 0, .y = 0, .width = plugin->width, .height = plugin->height };
+		return 0;
+	}
+
+	img_resize_params_t params = {
+		.mode = img_resize_mode_auto,
+		.letterbox = plugin->letterbox,
+		.pad_value = plugin->pad_value,
+		.mean = plugin->means,
+		.scale = plugin->scales,
+		.num_threads = plugin->preprocess_threads,
+	};
+	int stride = (image->stride >= image->width * 4)?image->stride:0;
+	return img_bgra_resize_to_planar_f32(image->data, image->width, image->height, stride,
+		plugin->width, plugin->height, &params, dst, letterbox);
+}
+
+/******************************************************************************
+ * inference
+ *****************************************************************************/
+static int onnx_bind_input(onnx_plugin_t * plugin, int batch)
+{
+	if(batch == plugin->bound_batch) return 0;
+
+	OrtValue ** p_value = &plugin->input_values[batch - 1];
+	if(NULL == *p_value) {
+		// a view of the workspace, no copy
+		int64_t shape[4] = { batch, 3, plugin->height, plugin->width };
+		size_t size = sizeof(float) * batch * 3 * plugin->height * plugin->width;
+		int rc = ORT_CHECK(g_ort->CreateTensorWithDataAsOrtValue(plugin->memory_info, plugin->input->data, size,
+			shape, 4, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, p_value));
+		if(rc) return -1;
+	}
+
+	g_ort->ClearBoundInputs(plugin->binding);
+	int rc = ORT_CHECK(g_ort->BindInput(plugin->binding, plugin->input_name, *p_value));
+	plugin->bound_batch = rc?0:batch;
+	return rc;
+}
+
+static void onnx_reserve_candidates(onnx_plugin_t * plugin, ssize_t count)
+{
+	if(count <= plugin->candidates_capacity) return;
+	ssize_t capacity = plugin->candidates_capacity * 2;
+	if(capacity < count) capacity = count;
+	plugin->candidates = realloc(plugin->candidates, sizeof(*plugin->candidates) * capacity);
+	assert(plugin->candidates);
+	plugin->candidates_capacity = capacity;
+}
+
+/* network input pixels --> (relative) coordinates of the source image */
+static void onnx_set_box(const onnx_plugin_t * plugin, int index, const ai_nms_box_t * candidate, ai_detection_box_t * box)
+{
+	const img_letterbox_t * letterbox = &plugin->letterboxes[index];
+	float lb_width = (letterbox->width > 0)?letterbox->width:plugin->width;
+	float lb_height = (letterbox->height > 0)?letterbox->height:plugin->height;
+
+	box->left = (candidate->left - letterbox->x) / lb_width;
+	box->top = (candidate->top - letterbox->y) / lb_height;
+	box->width = candidate->width / lb_width;
+	box->height = candidate->height / lb_height;
+	if(!plugin->relative) {
+		box->left *= plugin->image_sizes[index * 2];
+		box->width *= plugin->image_sizes[index * 2];
+		box->top *= plugin->image_sizes[index * 2 + 1];
+		box->height *= plugin->image_sizes[index * 2 + 1];
+	}
+	box->confidence = candidate->score;
+	box->class_index = candidate->class_index;
+}
+
+/*
+ * yolov5: data[num_boxes][5 + num_classes] = { cx, cy, w, h, objectness, class scores ... }
+ * yolov8: data[4 + num_classes][num_boxes], no objectness
+ */
+static void decode_yolo(onnx_plugin_t * plugin, int index, const float * data, const int64_t dims[3], ai_detections_t * result)
+{
+	int yolov8 = (plugin->model_type == onnx_model_type_yolov8);
+	ssize_t num_boxes = yolov8?dims[2]:dims[1];
+	ssize_t num_fields = yolov8?dims[1]:dims[2];
+	int num_classes = (int)num_fields - (yolov8?4:5);
+	if(num_boxes <= 0 || num_classes <= 0) return;
+
+	const ssize_t box_stride = yolov8?1:num_fields;		// next box
+	const ssize_t field_stride = yolov8?num_boxes:1;	// next field of one box
+
+	ssize_t num_candidates = 0;
+	for(ssize_t i = 0; i < num_boxes; ++i)
+	{
+		const float * p = data + box_stride * i;
+		float objectness = yolov8?1.0f:p[4 * field_stride];
+		if(objectness <= plugin->thresh) continue;
+
+		const float * scores = p + field_stride * (yolov8?4:5);
+		for(int k = 0; k < num_classes; ++k)
+		{
+			float score = objectness * scores[field_stride * k];
+			if(score <= plugin->thresh) continue;
+
+			onnx_reserve_candidates(plugin, num_candidates + 1);
+			ai_nms_box_t * candidate = &plugin->candidates[num_candidates++];
+			float w = p[2 * field_stride], h = p[3 * field_stride];
+			candidate->left = p[0] - w / 2;
+			candidate->top = p[field_stride] - h / 2;
+			candidate->width = w;
+			candidate->height = h;
+			candidate->score = score;
+			candidate->class_index = k;
+			candidate->index = (int32_t)i;
+		}
+	}
+
+	ssize_t num_kept = ai_nms(plugin->nms_ctx, plugin->candidates, num_candidates, plugin->nms, plugin->top_k);
+	int rc = ai_detections_reserve(result, num_kept);
+	assert(0 == rc);
+	for(ssize_t i = 0; i < num_kept; ++i) onnx_set_box(plugin, index, &plugin->candidates[i], &result->boxes[i]);
+	result->count = num_kept;
+}
+
+/* the top_k classes (score > threshold) as boxes of the whole image */
+static void decode_classifier(onnx_plugin_t * plugin, int index, const float * data, ssize_t num_classes, ai_detections_t * result)
+{
+	if(num_classes <= 0) return;
+
+	float max_value = data[0], sum = 0;
+	if(plugin->softmax) {
+		for(ssize_t k = 1; k < num_classes; ++k) if(data[k] > max_value) max_value = data[k];
+		for(ssize_t k = 0; k < num_classes; ++k) sum += expf(data[k] - max_value);
+	}
+
+	ssize_t top_k = (plugin->top_k > 0 && plugin->top_k < num_classes)?plugin->top_k:num_classes;
+	int rc = ai_detections_reserve(result, top_k);
+	assert(0 == rc);
+
+	// insertion into the (short) sorted list
+	ssize_t count = 0;
+	for(ssize_t k = 0; k < num_classes; ++k)
+	{
+		float score = plugin->softmax?(expf(data[k] - max_value) / sum):data[k];
+		if(score <= plugin->thresh) continue;
+		if(count == top_k && score <= result->boxes[count - 1].confidence) continue;
+
+		ssize_t pos = (count < top_k)?count++:(count - 1);
+		while(pos > 0 && result->boxes[pos - 1].confidence < score) {
+			result->boxes[pos] = result->boxes[pos - 1];
+			--pos;
+		}
+		result->boxes[pos] = (ai_detection_box_t){
+			.left = 0, .top = 0,
+			.width = plugin->relative?1:plugin->image_sizes[index * 2],
+			.height = plugin->relative?1:plugin->image_sizes[index * 2 + 1],
+			.confidence = score, .class_index = (int32_t)k
+		};
+	}
+	result->count = count;
+}
+
+/* run the first @batch items of the workspace, results[i]: the detections of item i */
+static int onnx_run_batch(onnx_plugin_t * plugin, int batch, ai_detections_t * results[])
+{
+	assert(batch > 0 && batch <= plugin->max_batch);
+	int run_batch = plugin->fixed_batch?plugin->max_batch:batch;	// a fixed batch dimension always runs full batches
+
+	if(onnx_bind_input(plugin, run_batch)) return -1;
+	if(ORT_CHECK(g_ort->RunWithBinding(plugin->session, NULL, plugin->binding))) return -1;
+
+	OrtValue ** outputs = NULL;
+	size_t num_outputs = 0;
+	if(ORT_CHECK(g_ort->GetBoundOutputValues(plugin->binding, plugin->allocator, &outputs, &num_outputs))) return -1;
+	assert(num_outputs > 0);
+
+	// the first output: detections or class scores
+	OrtTensorTypeAndShapeInfo * info = NULL;
+	float * data = NULL;
+	size_t num_dims = 0;
+	int64_t dims[8] = { 0 };
+	int rc = ORT_CHECK(g_ort->GetTensorTypeAndShape(outputs[0], &info));
+	if(0 == rc) rc = ORT_CHECK(g_ort->GetDimensionsCount(info, &num_dims));
+	if(0 == rc && num_dims <= 8) rc = ORT_CHECK(g_ort->GetDimensions(info, dims, num_dims));
+	if(info) g_ort->ReleaseTensorTypeAndShapeInfo(info);
+	if(0 == rc) rc = ORT_CHECK(g_ort->GetTensorMutableData(outputs[0], (void **)&data));
+
+	if(0 == rc && num_dims >= 2 && num_dims <= 8 && dims[0] == run_batch)
+	{
+		ssize_t item_size = 1;
+		for(size_t i = 1; i < num_dims; ++i) item_size *= dims[i];
+
+		for(int i = 0; i < batch; ++i)
+		{
+			ai_detections_t * result = results[i];
+			const float * item = data + item_size * i;
+			if(plugin->model_type == onnx_model_type_classifier) decode_classifier(plugin, i, item, item_size, result);
+			else if(num_dims == 3) decode_yolo(plugin, i, item, dims, result);
+		}
+	}else if(0 == rc) {
+		fprintf(stderr, "[ERROR]::%s(): unexpected output shape (%d dims)\n", __FUNCTION__, (int)num_dims);
+		rc = -1;
+	}
+
+	for(size_t i = 0; i < num_outputs; ++i) g_ort->ReleaseValue(outputs[i]);
+	g_ort->AllocatorFree(plugin->allocator, outputs);
+	return rc?-1:batch;
+}
+
+/*
+ * frames[i] --> results[i], (frames == NULL: the input was written into the workspace by the caller)
+ * return the number of frames predicted, or -1 on error
+ */
+static int onnx_predict_frames(onnx_plugin_t * plugin, const input_frame_t * frames[], int count, ai_detections_t results[])
+{
+	for(int i = 0; i < count; ++i) {
+		results[i].model = plugin->model_name;
+		results[i].num_labels = plugin->num_labels;
+		results[i].labels = (const char * const *)plugin->labels;
+		ai_detections_reset(&results[i]);
+	}
+
+	ai_detections_t ** batch_results = plugin->batch_results;
+	if(NULL == frames) {
+		if(count > plugin->max_batch) return -1;
+		for(int i = 0; i < count; ++i) {
+			plugin->letterboxes[i] = (img_letterbox_t){ .x = 0, .y = 0, .width = plugin->width, .height = plugin->height };
+			plugin->image_sizes[i * 2] = plugin->width;
+			plugin->image_sizes[i * 2 + 1] = plugin->height;
+			batch_results[i] = &results[i];
+		}
+		return onnx_run_batch(plugin, count, batch_results);
+	}
+
+	int num_predicted = 0;
+	int index = 0;
+	while(index < count)
+	{
+		int batch = 0;
+		for(; index < count && batch < plugin->max_batch; ++index)
+		{
+			bgra_image_t * image = frame_to_bgra(frames[index]);
+			if(NULL == image) continue;
+
+			int rc = onnx_load_input(plugin, image, batch);
+			if(image != frames[index]->bgra) {
+				bgra_image_clear(image);
+				free(image);
+			}
+			if(rc) continue;
+			batch_results[batch++] = &results[index];
+		}
+		if(batch == 0) continue;
+
+		app_timer_t timer[1];
+		double time_elapsed = 0;
+		app_timer_start(timer);
+		int rc = onnx_run_batch(plugin, batch, batch_results);
+		time_elapsed = app_timer_stop(timer);
+		debug_printf("[INFO]::%s(%d)::time_elapsed=%.3f ms", __FUNCTION__, batch, time_elapsed * 1000);
+		if(rc < 0) return -1;
+		num_predicted += batch;
+	}
+	return num_predicted;
+}
+
+/******************************************************************************
+ * ai_engine interface
+ *****************************************************************************/
+/* Entry-Point Functions */
+#ifdef __cplusplus
+extern "C" {
+#endif
+const char * ann_plugin_get_type(void);
+int ann_plugin_init(ai_engine_t * engine, json_object * jconfig);
+
+#ifdef __cplusplus
+}
+#endif
+
+const char * ann_plugin_get_type(void)
+{
+	return AI_PLUGIN_TYPE_STRING;
+}
+
+static void ai_plugin_onnx_cleanup(struct ai_engine * engine)
+{
+	onnx_plugin_free(engine->priv);
+	engine->priv = NULL;
+}
+
+static int ai_plugin_onnx_load_config(struct ai_engine * engine, json_object * jconfig)
+{
+	return 0;
+}
+
+static int ai_plugin_onnx_predict_detections(struct ai_engine * engine, const input_frame_t * frames[], int count, ai_detections_t results[])
+{
+	onnx_plugin_t * plugin = engine->priv;
+	assert(plugin);
+	if(count <= 0) return 0;
+	return onnx_predict_frames(plugin, frames, count, results);
+}
+
+static int ai_plugin_onnx_predict_batch(struct ai_engine * engine, const input_frame_t * frames[], int count, json_object * results[])
+{
+	onnx_plugin_t * plugin = engine->priv;
+	assert(plugin);
+	if(count <= 0) return 0;
+
+	int num_results = 0;
+	for(int offset = 0; offset < count; offset += plugin->max_batch)
+	{
+		int batch = count - offset;
+		if(batch > plugin->max_batch) batch = plugin->max_batch;
+
+		ai_detections_t * detections = plugin->detections;	// reset by onnx_predict_frames()
+		int rc = onnx_predict_frames(plugin, frames?(frames + offset):NULL, batch, detections);
+
+		for(int i = 0; i < batch; ++i)
+		{
+			results[offset + i] = NULL;
+			if(rc > 0 && detections[i].count > 0) {
+				results[offset + i] = ai_detections_to_json(&detections[i]);
+				++num_results;
+			}
+		}
+		if(rc < 0) return -1;
+	}
+	return num_results;
+}
+
+static int ai_plugin_onnx_predict(struct ai_engine * engine, const input_frame_t * frame, json_object ** p_jresults)
+{
+	json_object * results[1] = { NULL };
+	int num_results = engine->predict_batch(engine, &frame, 1, results);
+	if(num_results <= 0) return -1;
+
+	if(p_jresults) *p_jresults = results[0];
+	else json_object_put(results[0]);
+	return 0;
+}
+
+static int ai_plugin_onnx_update(struct ai_engine * engine, const ai_tensor_t * truth)
+{
+	return 0;
+}
+static int ai_plugin_onnx_get_property(struct ai_engine * engine, const char * name, void ** p_value)
+{
+	return 0;
+}
+static int ai_plugin_onnx_set_property(struct ai_engine * engine, const char * name, const void * value, size_t length)
+{
+	return 0;
+}
+
+static ai_tensor_t * ai_plugin_onnx_get_workspace(struct ai_engine * engine)
+{
+	onnx_plugin_t * plugin = engine->priv;
+	assert(plugin);
+	return plugin->input;
+}
+
+int ann_plugin_init(ai_engine_t * engine, json_object * jconfig)
+{
+	assert(jconfig);
+	onnx_plugin_t * plugin = onnx_plugin_new(jconfig, engine);
+	if(NULL == plugin) return -1;
+
+	engine->priv = plugin;
+	engine->init = ann_plugin_init;
+	engine->cleanup = ai_plugin_onnx_cleanup;
+	engine->load_config = ai_plugin_onnx_load_config;
+	engine->predict = ai_plugin_onnx_predict;
+	engine->predict_batch = ai_plugin_onnx_predict_batch;
+	engine->predict_detections = ai_plugin_onnx_predict_detections;
+	engine->update = ai_plugin_onnx_update;
+	engine->get_property = ai_plugin_onnx_get_property;
+	engine->set_property = ai_plugin_onnx_set_property;
+	engine->get_workspace = ai_plugin_onnx_get_workspace;
+	return 0;
+}
+
+#undef ONNX_WORKSPACE_ALIGNMENT
+#undef AI_PLUGIN_TYPE_STRING
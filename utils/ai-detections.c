@@ -0,0 +1,403 @@
+/*
+ * ai-detections.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <endian.h>
+
+#include "ai-detections.h"
+
+ai_detections_t * ai_detections_init(ai_detections_t * detections, ssize_t capacity)
+{
+	if(NULL == detections) detections = calloc(1, sizeof(*detections));
+	assert(detections);
+
+	if(capacity > 0) {
+		int rc = ai_detections_reserve(detections, capacity);
+		assert(0 == rc);
+	}
+	return detections;
+}
+
+void ai_detections_cleanup(ai_detections_t * detections)
+{
+	if(NULL == detections) return;
+	free(detections->boxes);
+	detections->boxes = NULL;
+	detections->count = 0;
+	detections->capacity = 0;
+	return;
+}
+
+int ai_detections_reserve(ai_detections_t * detections, ssize_t count)
+{
+	if(count <= detections->capacity) return 0;
+
+	ssize_t new_capacity = detections->capacity * 2;
+	if(new_capacity < count) new_capacity = count;
+	if(new_capacity < 16) new_capacity = 16;
+
+	ai_detection_box_t * boxes = realloc(detections->boxes, sizeof(*boxes) * new_capacity);
+	if(NULL == boxes) return -1;
+
+	detections->boxes = boxes;
+	detections->capacity = new_capacity;
+	return 0;
+}
+
+ai_detection_box_t * ai_detections_add(ai_detections_t * detections)
+{
+	int rc = ai_detections_reserve(detections, detections->count + 1);
+	if(rc) return NULL;
+	return &detections->boxes[detections->count++];
+}
+
+/******************************************************************************
+ * content negotiation
+ *****************************************************************************/
+static const char * s_mime_types[ai_detections_formats_count] = {
+	[ai_detections_format_json] = "application/json",
+	[ai_detections_format_binary] = "application/x-ai-detections",
+	[ai_detections_format_msgpack] = "application/msgpack",
+};
+
+const char * ai_detections_format_to_mime_type(enum ai_detections_format format)
+{
+	if(format < 0 || format >= ai_detections_formats_count) return NULL;
+	return s_mime_types[format];
+}
+
+static int match_media_range(const char * range, size_t length, enum ai_detections_format * p_format)
+{
+	static const struct { const char * type; enum ai_detections_format format; } s_types[] = {
+		{ "application/json", ai_detections_format_json },
+		{ "application/x-ai-detections", ai_detections_format_binary },
+		{ "application/octet-stream", ai_detections_format_binary },
+		{ "application/msgpack", ai_detections_format_msgpack },
+		{ "application/x-msgpack", ai_detections_format_msgpack },
+		{ "application/*", ai_detections_format_json },
+		{ "*/*", ai_detections_format_json },
+	};
+
+	for(size_t i = 0; i < sizeof(s_types) / sizeof(s_types[0]); ++i)
+	{
+		if(length == strlen(s_types[i].type) && strncasecmp(range, s_types[i].type, length) == 0) {
+			*p_format = s_types[i].format;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Accept: <media-range>[;q=<weight>], ...
+ * the first supported media range with the highest weight wins.
+ */
+enum ai_detections_format ai_detections_format_from_accept(const char * accept)
+{
+	enum ai_detections_format format = ai_detections_format_json;
+	if(NULL == accept) return format;
+
+	double best_weight = -1.0;
+	const char * p = accept;
+	while(*p)
+	{
+		const char * p_end = strchr(p, ',');
+		if(NULL == p_end) p_end = p + strlen(p);
+
+		while(p < p_end && (*p == ' ' || *p == '\t')) ++p;
+		const char * range_end = p;
+		while(range_end < p_end && *range_end != ';' && *range_end != ' ') ++range_end;
+
+		double weight = 1.0;
+		const char * q = range_end;
+		while(q < p_end)
+		{
+			if(q[0] == 'q' && q[1] == '=') { weight = atof(q + 2); break; }
+			++q;
+		}
+
+		enum ai_detections_format cur_format;
+		if(weight > best_weight && match_media_range(p, range_end - p, &cur_format))
+		{
+			format = cur_format;
+			best_weight = weight;
+		}
+
+		p = (*p_end)?(p_end + 1):p_end;
+	}
+	return format;
+}
+
+/******************************************************************************
+ * serialization
+ *****************************************************************************/
+static inline unsigned char * buffer_reserve(auto_buffer_t * buf, ssize_t size)
+{
+	int rc = auto_buffer_resize(buf, buf->length + size + 1);
+	assert(0 == rc);
+	return buf->data + buf->length;
+}
+
+static void buffer_printf(auto_buffer_t * buf, const char * fmt, ...)
+{
+	ssize_t size = 64;
+	while(1)
+	{
+		char * p = (char *)buffer_reserve(buf, size);
+		va_list ap;
+		va_start(ap, fmt);
+		int cb = vsnprintf(p, size, fmt, ap);
+		va_end(ap);
+		assert(cb >= 0);
+
+		if(cb < size) {
+			buf->length += cb;
+			return;
+		}
+		size = cb + 1;
+	}
+}
+
+static void json_write_string(auto_buffer_t * buf, const char * sz)
+{
+	size_t length = strlen(sz);
+	unsigned char * p = buffer_reserve(buf, length * 6 + 2);	// "\u00XX" at most
+	unsigned char * p_start = p;
+
+	*p++ = '"';
+	for(size_t i = 0; i < length; ++i)
+	{
+		unsigned char c = sz[i];
+		if(c == '"' || c == '\\') { *p++ = '\\'; *p++ = c; }
+		else if(c < 0x20) p += sprintf((char *)p, "\\u%04x", c);
+		else *p++ = c;
+	}
+	*p++ = '"';
+	buf->length += p - p_start;
+}
+
+static ssize_t serialize_json(const ai_detections_t * detections, auto_buffer_t * buf)
+{
+	buffer_printf(buf, "{\"model\":");
+	json_write_string(buf, detections->model?detections->model:"");
+	buffer_printf(buf, ",\"detections\":[");
+
+	for(ssize_t i = 0; i < detections->count; ++i)
+	{
+		const ai_detection_box_t * box = &detections->boxes[i];
+		buffer_printf(buf, "%s{\"class\":", (i > 0)?",":"");
+		json_write_string(buf, ai_detections_get_label(detections, box->class_index));
+		buffer_printf(buf, ",\"class_index\":%d,\"confidence\":%.6g,"
+			"\"left\":%.6g,\"top\":%.6g,\"width\":%.6g,\"height\":%.6g}",
+			box->class_index, box->confidence,
+			box->left, box->top, box->width, box->height);
+	}
+	buffer_printf(buf, "]}");
+	return 0;
+}
+
+static inline void put_le16(unsigned char * p, uint16_t value) { value = htole16(value); memcpy(p, &value, 2); }
+static inline void put_le32(unsigned char * p, uint32_t value) { value = htole32(value); memcpy(p, &value, 4); }
+static inline void put_be16(unsigned char * p, uint16_t value) { value = htobe16(value); memcpy(p, &value, 2); }
+static inline void put_be32(unsigned char * p, uint32_t value) { value = htobe32(value); memcpy(p, &value, 4); }
+
+static inline uint32_t float_bits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static ssize_t serialize_binary(const ai_detections_t * detections, auto_buffer_t * buf)
+{
+	const char * model = detections->model?detections->model:"";
+	size_t model_length = strlen(model);
+	int num_labels = detections->labels?detections->num_labels:0;
+
+	ssize_t labels_size = 0;
+	for(int i = 0; i < num_labels; ++i) labels_size += 2 + strlen(detections->labels[i]);
+
+	ssize_t size = 24 + model_length + labels_size + detections->count * 24;
+	unsigned char * p = buffer_reserve(buf, size);
+	unsigned char * p_start = p;
+
+	memcpy(p, AI_DETECTIONS_BINARY_MAGIC, 4);
+	put_le16(p + 4, AI_DETECTIONS_BINARY_VERSION);
+	put_le16(p + 6, 24);
+	put_le32(p + 8, (uint32_t)detections->count);
+	put_le32(p + 12, (uint32_t)num_labels);
+	put_le32(p + 16, (uint32_t)model_length);
+	put_le32(p + 20, 0);
+	p += 24;
+
+	memcpy(p, model, model_length);
+	p += model_length;
+
+	for(int i = 0; i < num_labels; ++i)
+	{
+		size_t length = strlen(detections->labels[i]);
+		assert(length <= UINT16_MAX);
+		put_le16(p, (uint16_t)length);
+		memcpy(p + 2, detections->labels[i], length);
+		p += 2 + length;
+	}
+
+	for(ssize_t i = 0; i < detections->count; ++i, p += 24)
+	{
+		const ai_detection_box_t * box = &detections->boxes[i];
+		put_le32(p + 0, float_bits(box->left));
+		put_le32(p + 4, float_bits(box->top));
+		put_le32(p + 8, float_bits(box->width));
+		put_le32(p + 12, float_bits(box->height));
+		put_le32(p + 16, float_bits(box->confidence));
+		put_le32(p + 20, (uint32_t)box->class_index);
+	}
+	assert((p - p_start) == size);
+	buf->length += size;
+	return 0;
+}
+
+/* msgpack: https://github.com/msgpack/msgpack/blob/master/spec.md */
+static unsigned char * msgpack_write_str(unsigned char * p, const char * sz, size_t length)
+{
+	if(length < 32) *p++ = 0xa0 | (unsigned char)length;
+	else if(length < 256) { *p++ = 0xd9; *p++ = (unsigned char)length; }
+	else if(length < 65536) { *p++ = 0xda; put_be16(p, (uint16_t)length); p += 2; }
+	else { *p++ = 0xdb; put_be32(p, (uint32_t)length); p += 4; }
+	memcpy(p, sz, length);
+	return p + length;
+}
+#define msgpack_write_key(p, key) msgpack_write_str(p, key, sizeof(key) - 1)
+
+static inline unsigned char * msgpack_write_float(unsigned char * p, float value)
+{
+	*p++ = 0xca;
+	put_be32(p, float_bits(value));
+	return p + 4;
+}
+
+static inline unsigned char * msgpack_write_int(unsigned char * p, int32_t value)
+{
+	if(value >= 0 && value < 128) *p++ = (unsigned char)value;
+	else if(value < 0 && value >= -32) *p++ = (unsigned char)(0xe0 | (value + 32));
+	else { *p++ = 0xd2; put_be32(p, (uint32_t)value); p += 4; }
+	return p;
+}
+
+static ssize_t serialize_msgpack(const ai_detections_t * detections, auto_buffer_t * buf)
+{
+	const char * model = detections->model?detections->model:"";
+	size_t model_length = strlen(model);
+
+	// upper bound: the map keys + 7 fields (<= 5 bytes each) + the label of each box
+	ssize_t size = 32 + model_length + 5;
+	for(ssize_t i = 0; i < detections->count; ++i)
+	{
+		size += 1 + 64 + 7 * 5 + 5 + strlen(ai_detections_get_label(detections, detections->boxes[i].class_index));
+	}
+
+	unsigned char * p = buffer_reserve(buf, size);
+	unsigned char * p_start = p;
+
+	*p++ = 0x82;	// fixmap(2)
+	p = msgpack_write_key(p, "model");
+	p = msgpack_write_str(p, model, model_length);
+	p = msgpack_write_key(p, "detections");
+
+	ssize_t count = detections->count;
+	if(count < 16) *p++ = 0x90 | (unsigned char)count;
+	else if(count < 65536) { *p++ = 0xdc; put_be16(p, (uint16_t)count); p += 2; }
+	else { *p++ = 0xdd; put_be32(p, (uint32_t)count); p += 4; }
+
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		const ai_detection_box_t * box = &detections->boxes[i];
+		const char * label = ai_detections_get_label(detections, box->class_index);
+
+		*p++ = 0x87;	// fixmap(7)
+		p = msgpack_write_key(p, "class");
+		p = msgpack_write_str(p, label, strlen(label));
+		p = msgpack_write_key(p, "class_index");
+		p = msgpack_write_int(p, box->class_index);
+		p = msgpack_write_key(p, "confidence");
+		p = msgpack_write_float(p, box->confidence);
+		p = msgpack_write_key(p, "left");
+		p = msgpack_write_float(p, box->left);
+		p = msgpack_write_key(p, "top");
+		p = msgpack_write_float(p, box->top);
+		p = msgpack_write_key(p, "width");
+		p = msgpack_write_float(p, box->width);
+		p = msgpack_write_key(p, "height");
+		p = msgpack_write_float(p, box->height);
+	}
+	assert((p - p_start) <= size);
+	buf->length += p - p_start;
+	return 0;
+}
+
+ssize_t ai_detections_serialize(const ai_detections_t * detections, enum ai_detections_format format, auto_buffer_t * buf)
+{
+	assert(detections && buf);
+	ssize_t length = buf->length;
+	ssize_t rc = -1;
+	switch(format)
+	{
+	case ai_detections_format_json: rc = serialize_json(detections, buf); break;
+	case ai_detections_format_binary: rc = serialize_binary(detections, buf); break;
+	case ai_detections_format_msgpack: rc = serialize_msgpack(detections, buf); break;
+	default: break;
+	}
+	if(rc) return -1;
+
+	buf->data[buf->length] = '\0';
+	return buf->length - length;
+}
+
+json_object * ai_detections_to_json(const ai_detections_t * detections)
+{
+	json_object * jresults = json_object_new_object();
+	json_object_object_add(jresults, "model", json_object_new_string(detections->model?detections->model:""));
+
+	json_object * jdetections = json_object_new_array();
+	json_object_object_add(jresults, "detections", jdetections);
+
+	for(ssize_t i = 0; i < detections->count; ++i)
+	{
+		const ai_detection_box_t * box = &detections->boxes[i];
+		json_object * jdet = json_object_new_object();
+		json_object_object_add(jdet, "class", json_object_new_string(ai_detections_get_label(detections, box->class_index)));
+		json_object_object_add(jdet, "class_index", json_object_new_int(box->class_index));
+		json_object_object_add(jdet, "confidence", json_object_new_double(box->confidence));
+		json_object_object_add(jdet, "left", json_object_new_double(box->left));
+		json_object_object_add(jdet, "top", json_object_new_double(box->top));
+		json_object_object_add(jdet, "width", json_object_new_double(box->width));
+		json_object_object_add(jdet, "height", json_object_new_double(box->height));
+		json_object_array_add(jdetections, jdet);
+	}
+	return jresults;
+}
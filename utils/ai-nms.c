@@ -0,0 +1,244 @@
+/*
+ * ai-nms.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "ai-detections.h"
+#include "img_proc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AI_NMS_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * the boxes of one class as a structure of arrays,
+ * so that one kept box can be compared with many boxes at once.
+ */
+struct ai_nms_context
+{
+	ssize_t capacity;
+	float * x1;
+	float * y1;
+	float * x2;
+	float * y2;
+	float * area;
+	unsigned char * suppressed;
+	ssize_t * kept;
+};
+
+ai_nms_context_t * ai_nms_context_new(void)
+{
+	ai_nms_context_t * nms = calloc(1, sizeof(*nms));
+	assert(nms);
+	return nms;
+}
+
+void ai_nms_context_free(ai_nms_context_t * nms)
+{
+	if(NULL == nms) return;
+	free(nms->x1);
+	free(nms->y1);
+	free(nms->x2);
+	free(nms->y2);
+	free(nms->area);
+	free(nms->suppressed);
+	free(nms->kept);
+	free(nms);
+}
+
+static void nms_reserve(ai_nms_context_t * nms, ssize_t count)
+{
+	if(count <= nms->capacity) return;
+	ssize_t capacity = nms->capacity * 2;
+	if(capacity < count) capacity = count;
+
+	nms->x1 = realloc(nms->x1, sizeof(float) * capacity);
+	nms->y1 = realloc(nms->y1, sizeof(float) * capacity);
+	nms->x2 = realloc(nms->x2, sizeof(float) * capacity);
+	nms->y2 = realloc(nms->y2, sizeof(float) * capacity);
+	nms->area = realloc(nms->area, sizeof(float) * capacity);
+	nms->suppressed = realloc(nms->suppressed, capacity);
+	nms->kept = realloc(nms->kept, sizeof(*nms->kept) * capacity);
+	assert(nms->x1 && nms->y1 && nms->x2 && nms->y2 && nms->area && nms->suppressed && nms->kept);
+	nms->capacity = capacity;
+}
+
+/*
+ * kernels: suppressed[j] = 1 if IoU(box[i], box[j]) > thresh, j in [begin, end)
+ *   IoU > thresh  <==>  inter > thresh * (area_i + area_j - inter)  (no division)
+ */
+typedef void (* nms_suppress_func)(const ai_nms_context_t * nms, ssize_t i, ssize_t begin, ssize_t end, float thresh);
+
+static void nms_suppress_scalar(const ai_nms_context_t * nms, ssize_t i, ssize_t begin, ssize_t end, float thresh)
+{
+	const float x1 = nms->x1[i], y1 = nms->y1[i], x2 = nms->x2[i], y2 = nms->y2[i], area = nms->area[i];
+	unsigned char * suppressed = nms->suppressed;
+	for(ssize_t j = begin; j < end; ++j)
+	{
+		float w = ((x2 < nms->x2[j])?x2:nms->x2[j]) - ((x1 > nms->x1[j])?x1:nms->x1[j]);
+		float h = ((y2 < nms->y2[j])?y2:nms->y2[j]) - ((y1 > nms->y1[j])?y1:nms->y1[j]);
+		if(w <= 0 || h <= 0) continue;
+		float inter = w * h;
+		if(inter > thresh * (area + nms->area[j] - inter)) suppressed[j] = 1;
+	}
+}
+
+#ifdef AI_NMS_X86
+static inline void set_suppressed(unsigned char * suppressed, int mask)
+{
+	while(mask)
+	{
+		int bit = __builtin_ctz(mask);
+		suppressed[bit] = 1;
+		mask &= mask - 1;
+	}
+}
+
+__attribute__((target("sse4.1")))
+static void nms_suppress_sse4(const ai_nms_context_t * nms, ssize_t i, ssize_t begin, ssize_t end, float thresh)
+{
+	const __m128 x1 = _mm_set1_ps(nms->x1[i]), y1 = _mm_set1_ps(nms->y1[i]);
+	const __m128 x2 = _mm_set1_ps(nms->x2[i]), y2 = _mm_set1_ps(nms->y2[i]);
+	const __m128 area = _mm_set1_ps(nms->area[i]);
+	const __m128 t = _mm_set1_ps(thresh);
+	const __m128 zero = _mm_setzero_ps();
+
+	ssize_t j = begin;
+	for(; j + 4 <= end; j += 4)
+	{
+		__m128 w = _mm_sub_ps(_mm_min_ps(x2, _mm_loadu_ps(nms->x2 + j)), _mm_max_ps(x1, _mm_loadu_ps(nms->x1 + j)));
+		__m128 h = _mm_sub_ps(_mm_min_ps(y2, _mm_loadu_ps(nms->y2 + j)), _mm_max_ps(y1, _mm_loadu_ps(nms->y1 + j)));
+		__m128 inter = _mm_mul_ps(_mm_max_ps(w, zero), _mm_max_ps(h, zero));
+		__m128 uni = _mm_sub_ps(_mm_add_ps(area, _mm_loadu_ps(nms->area + j)), inter);
+		__m128 gt = _mm_and_ps(_mm_cmpgt_ps(inter, _mm_mul_ps(t, uni)), _mm_cmpgt_ps(inter, zero));
+		set_suppressed(nms->suppressed + j, _mm_movemask_ps(gt));
+	}
+	nms_suppress_scalar(nms, i, j, end, thresh);
+}
+
+__attribute__((target("avx2")))
+static void nms_suppress_avx2(const ai_nms_context_t * nms, ssize_t i, ssize_t begin, ssize_t end, float thresh)
+{
+	const __m256 x1 = _mm256_set1_ps(nms->x1[i]), y1 = _mm256_set1_ps(nms->y1[i]);
+	const __m256 x2 = _mm256_set1_ps(nms->x2[i]), y2 = _mm256_set1_ps(nms->y2[i]);
+	const __m256 area = _mm256_set1_ps(nms->area[i]);
+	const __m256 t = _mm256_set1_ps(thresh);
+	const __m256 zero = _mm256_setzero_ps();
+
+	ssize_t j = begin;
+	for(; j + 8 <= end; j += 8)
+	{
+		__m256 w = _mm256_sub_ps(_mm256_min_ps(x2, _mm256_loadu_ps(nms->x2 + j)), _mm256_max_ps(x1, _mm256_loadu_ps(nms->x1 + j)));
+		__m256 h = _mm256_sub_ps(_mm256_min_ps(y2, _mm256_loadu_ps(nms->y2 + j)), _mm256_max_ps(y1, _mm256_loadu_ps(nms->y1 + j)));
+		__m256 inter = _mm256_mul_ps(_mm256_max_ps(w, zero), _mm256_max_ps(h, zero));
+		__m256 uni = _mm256_sub_ps(_mm256_add_ps(area, _mm256_loadu_ps(nms->area + j)), inter);
+		__m256 gt = _mm256_and_ps(_mm256_cmp_ps(inter, _mm256_mul_ps(t, uni), _CMP_GT_OQ),
+			_mm256_cmp_ps(inter, zero, _CMP_GT_OQ));
+		set_suppressed(nms->suppressed + j, _mm256_movemask_ps(gt));
+	}
+	nms_suppress_scalar(nms, i, j, end, thresh);
+}
+#endif
+
+static nms_suppress_func get_suppress_kernel(void)
+{
+#ifdef AI_NMS_X86
+	enum img_simd_level level = img_preprocess_get_simd_level();
+	if(level >= img_simd_level_avx2) return nms_suppress_avx2;	// 8 lanes are enough for the IoU
+	if(level >= img_simd_level_sse4) return nms_suppress_sse4;
+#endif
+	return nms_suppress_scalar;
+}
+
+/* class (ascending), score (descending), then the original order */
+static int compare_by_class(const void * a, const void * b)
+{
+	const ai_nms_box_t * box_a = a;
+	const ai_nms_box_t * box_b = b;
+	if(box_a->class_index != box_b->class_index) return (box_a->class_index < box_b->class_index)?-1:1;
+	if(box_a->score != box_b->score) return (box_a->score > box_b->score)?-1:1;
+	return (box_a->index < box_b->index)?-1:(box_a->index > box_b->index);
+}
+
+static int compare_by_score(const void * a, const void * b)
+{
+	const ai_nms_box_t * box_a = a;
+	const ai_nms_box_t * box_b = b;
+	if(box_a->score != box_b->score) return (box_a->score > box_b->score)?-1:1;
+	if(box_a->class_index != box_b->class_index) return (box_a->class_index < box_b->class_index)?-1:1;
+	return (box_a->index < box_b->index)?-1:(box_a->index > box_b->index);
+}
+
+ssize_t ai_nms(ai_nms_context_t * nms, ai_nms_box_t * boxes, ssize_t count, float iou_thresh, ssize_t top_k)
+{
+	assert(nms && (boxes || count == 0));
+	if(count <= 0) return 0;
+
+	nms_reserve(nms, count);
+	qsort(boxes, count, sizeof(*boxes), compare_by_class);
+
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		const ai_nms_box_t * box = &boxes[i];
+		nms->x1[i] = box->left;
+		nms->y1[i] = box->top;
+		nms->x2[i] = box->left + box->width;
+		nms->y2[i] = box->top + box->height;
+		nms->area[i] = box->width * box->height;
+	}
+	memset(nms->suppressed, 0, count);
+
+	nms_suppress_func suppress = get_suppress_kernel();
+	ssize_t num_kept = 0;
+	for(ssize_t begin = 0; begin < count; )
+	{
+		ssize_t end = begin + 1;
+		while(end < count && boxes[end].class_index == boxes[begin].class_index) ++end;
+
+		ssize_t class_kept = 0;
+		for(ssize_t i = begin; i < end; ++i)
+		{
+			if(nms->suppressed[i]) continue;
+			nms->kept[num_kept++] = i;
+			if(top_k > 0 && ++class_kept >= top_k) break;	// no more boxes of this class can be returned
+			suppress(nms, i, i + 1, end, iou_thresh);
+		}
+		begin = end;
+	}
+
+	// kept[] is ascending, so the boxes can be moved to the front in place
+	for(ssize_t i = 0; i < num_kept; ++i)
+	{
+		if(nms->kept[i] != i) boxes[i] = boxes[nms->kept[i]];
+	}
+	qsort(boxes, num_kept, sizeof(*boxes), compare_by_score);
+
+	if(top_k > 0 && num_kept > top_k) num_kept = top_k;
+	return num_kept;
+}
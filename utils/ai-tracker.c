@@ -0,0 +1,517 @@
+/*
+ * ai-tracker.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <float.h>
+
+#include "ai-tracker.h"
+
+/*
+ * Kalman filter of one coordinate: state (x, v), constant velocity, dt = 1 frame,
+ * the four coordinates of a box (cx, cy, w, h) are filtered independently.
+ */
+typedef struct kalman_axis
+{
+	double x, v;
+	double p00, p01, p11;		// covariance
+}kalman_axis_t;
+
+enum { AXIS_CX, AXIS_CY, AXIS_W, AXIS_H, AXES_COUNT };
+
+typedef struct tracker_item
+{
+	ai_track_t track;
+	kalman_axis_t axes[AXES_COUNT];
+}tracker_item_t;
+
+struct ai_tracker
+{
+	ai_tracker_params_t params;
+
+	uint32_t next_id;
+	int has_inference;
+	int frames_since_inference;
+
+	ssize_t count;
+	ssize_t capacity;
+	tracker_item_t * items;
+	ai_track_t * tracks;		// public copies, in the order of the items
+
+	// label table of the last detections
+	const char * model;
+	int num_labels;
+	const char * const * labels;
+
+	// association scratch
+	ssize_t scratch_size;
+	double * cost;				// [tracks][detections]
+	ssize_t * det_to_track;
+	unsigned char * matched;
+};
+
+void ai_tracker_params_init(ai_tracker_params_t * params)
+{
+	assert(params);
+	memset(params, 0, sizeof(*params));
+	params->iou_thresh = 0.3f;
+	params->min_hits = 3;
+	params->max_misses = 5;
+	params->keyframe_interval = 3;
+	params->min_confidence = 0.3f;
+	params->confidence_decay = 0.9f;
+	params->std_position = 1.0f / 20.0f;
+	params->std_velocity = 1.0f / 160.0f;
+}
+
+ai_tracker_t * ai_tracker_new(const ai_tracker_params_t * params)
+{
+	ai_tracker_t * tracker = calloc(1, sizeof(*tracker));
+	assert(tracker);
+
+	if(params) tracker->params = *params;
+	else ai_tracker_params_init(&tracker->params);
+
+	if(tracker->params.min_hits < 1) tracker->params.min_hits = 1;
+	if(tracker->params.max_misses < 0) tracker->params.max_misses = 0;
+	if(tracker->params.keyframe_interval < 1) tracker->params.keyframe_interval = 1;
+	tracker->next_id = 1;
+	return tracker;
+}
+
+void ai_tracker_free(ai_tracker_t * tracker)
+{
+	if(NULL == tracker) return;
+	free(tracker->items);
+	free(tracker->tracks);
+	free(tracker->cost);
+	free(tracker->det_to_track);
+	free(tracker->matched);
+	free(tracker);
+}
+
+void ai_tracker_reset(ai_tracker_t * tracker)
+{
+	assert(tracker);
+	tracker->count = 0;
+	tracker->next_id = 1;
+	tracker->has_inference = 0;
+	tracker->frames_since_inference = 0;
+}
+
+int ai_tracker_need_inference(const ai_tracker_t * tracker)
+{
+	assert(tracker);
+	if(!tracker->has_inference) return 1;
+	if(tracker->frames_since_inference + 1 >= tracker->params.keyframe_interval) return 1;
+
+	for(ssize_t i = 0; i < tracker->count; ++i)
+	{
+		const ai_track_t * track = &tracker->items[i].track;
+		if(!track->confirmed) return 1;		// confirm (or drop) the new tracks quickly
+		if(track->box.confidence < tracker->params.min_confidence) return 1;
+	}
+	return 0;
+}
+
+ssize_t ai_tracker_get_tracks(const ai_tracker_t * tracker, const ai_track_t ** p_tracks)
+{
+	assert(tracker);
+	if(p_tracks) *p_tracks = tracker->tracks;
+	return tracker->count;
+}
+
+/******************************************************************************
+ * Kalman filter
+ *****************************************************************************/
+static inline double item_height(const tracker_item_t * item)
+{
+	double height = item->axes[AXIS_H].x;
+	return (height > 1e-6)?height:1e-6;
+}
+
+static void kalman_init(const ai_tracker_t * tracker, tracker_item_t * item, const ai_detection_box_t * box)
+{
+	const double values[AXES_COUNT] = {
+		box->left + box->width / 2, box->top + box->height / 2, box->width, box->height
+	};
+	double height = (box->height > 1e-6)?box->height:1e-6;
+	double std_position = 2.0 * tracker->params.std_position * height;
+	double std_velocity = 10.0 * tracker->params.std_velocity * height;
+	for(int i = 0; i < AXES_COUNT; ++i)
+	{
+		kalman_axis_t * axis = &item->axes[i];
+		axis->x = values[i];
+		axis->v = 0;
+		axis->p00 = std_position * std_position;
+		axis->p01 = 0;
+		axis->p11 = std_velocity * std_velocity;
+	}
+}
+
+static void kalman_predict(const ai_tracker_t * tracker, tracker_item_t * item)
+{
+	double height = item_height(item);
+	double q0 = tracker->params.std_position * height;
+	double q1 = tracker->params.std_velocity * height;
+	q0 *= q0;
+	q1 *= q1;
+
+	for(int i = 0; i < AXES_COUNT; ++i)
+	{
+		kalman_axis_t * axis = &item->axes[i];
+		axis->x += axis->v;
+		axis->p00 += 2 * axis->p01 + axis->p11 + q0;
+		axis->p01 += axis->p11;
+		axis->p11 += q1;
+	}
+
+	// a shrinking box stops at a small size
+	for(int i = AXIS_W; i <= AXIS_H; ++i)
+	{
+		kalman_axis_t * axis = &item->axes[i];
+		if(axis->x < 1e-6) {
+			axis->x = 1e-6;
+			axis->v = 0;
+		}
+	}
+}
+
+static void kalman_correct(const ai_tracker_t * tracker, tracker_item_t * item, const ai_detection_box_t * box)
+{
+	const double values[AXES_COUNT] = {
+		box->left + box->width / 2, box->top + box->height / 2, box->width, box->height
+	};
+	double r = tracker->params.std_position * item_height(item);
+	r *= r;
+
+	for(int i = 0; i < AXES_COUNT; ++i)
+	{
+		kalman_axis_t * axis = &item->axes[i];
+		double s = axis->p00 + r;
+		double k0 = axis->p00 / s;
+		double k1 = axis->p01 / s;
+		double y = values[i] - axis->x;
+
+		axis->x += k0 * y;
+		axis->v += k1 * y;
+		axis->p11 -= k1 * axis->p01;
+		axis->p00 *= (1.0 - k0);
+		axis->p01 *= (1.0 - k0);
+	}
+}
+
+/* state --> public track */
+static void item_sync(tracker_item_t * item)
+{
+	ai_track_t * track = &item->track;
+	const kalman_axis_t * axes = item->axes;
+	track->box.width = (float)axes[AXIS_W].x;
+	track->box.height = (float)axes[AXIS_H].x;
+	track->box.left = (float)(axes[AXIS_CX].x - axes[AXIS_W].x / 2);
+	track->box.top = (float)(axes[AXIS_CY].x - axes[AXIS_H].x / 2);
+	track->box.class_index = track->class_index;
+	track->vx = (float)axes[AXIS_CX].v;
+	track->vy = (float)axes[AXIS_CY].v;
+}
+
+/******************************************************************************
+ * association
+ *****************************************************************************/
+static inline double box_iou(const ai_detection_box_t * a, const ai_detection_box_t * b)
+{
+	double x1 = (a->left > b->left)?a->left:b->left;
+	double y1 = (a->top > b->top)?a->top:b->top;
+	double x2 = ((a->left + a->width) < (b->left + b->width))?(a->left + a->width):(b->left + b->width);
+	double y2 = ((a->top + a->height) < (b->top + b->height))?(a->top + a->height):(b->top + b->height);
+	if(x2 <= x1 || y2 <= y1) return 0;
+
+	double inter = (x2 - x1) * (y2 - y1);
+	double uni = (double)a->width * a->height + (double)b->width * b->height - inter;
+	return (uni > 0)?(inter / uni):0;
+}
+
+/*
+ * Hungarian algorithm (Kuhn-Munkres with potentials), O(rows^2 * cols), rows <= cols.
+ * cost: [rows][cols], assignment[row] = col
+ */
+static void hungarian(const double * cost, ssize_t rows, ssize_t cols, ssize_t * assignment)
+{
+	assert(rows <= cols);
+	double * u = calloc(rows + 1, sizeof(double));
+	double * v = calloc(cols + 1, sizeof(double));
+	double * min_v = calloc(cols + 1, sizeof(double));
+	ssize_t * p = calloc(cols + 1, sizeof(ssize_t));
+	ssize_t * way = calloc(cols + 1, sizeof(ssize_t));
+	unsigned char * used = calloc(cols + 1, 1);
+	assert(u && v && min_v && p && way && used);
+
+	for(ssize_t i = 1; i <= rows; ++i)
+	{
+		p[0] = i;
+		ssize_t j0 = 0;
+		for(ssize_t j = 0; j <= cols; ++j) {
+			min_v[j] = DBL_MAX;
+			used[j] = 0;
+		}
+
+		do {
+			used[j0] = 1;
+			ssize_t i0 = p[j0], j1 = 0;
+			double delta = DBL_MAX;
+			for(ssize_t j = 1; j <= cols; ++j)
+			{
+				if(used[j]) continue;
+				double cur = cost[(i0 - 1) * cols + (j - 1)] - u[i0] - v[j];
+				if(cur < min_v[j]) {
+					min_v[j] = cur;
+					way[j] = j0;
+				}
+				if(min_v[j] < delta) {
+					delta = min_v[j];
+					j1 = j;
+				}
+			}
+			for(ssize_t j = 0; j <= cols; ++j)
+			{
+				if(used[j]) {
+					u[p[j]] += delta;
+					v[j] -= delta;
+				}else {
+					min_v[j] -= delta;
+				}
+			}
+			j0 = j1;
+		}while(p[j0] != 0);
+
+		do {
+			ssize_t j1 = way[j0];
+			p[j0] = p[j1];
+			j0 = j1;
+		}while(j0);
+	}
+
+	for(ssize_t i = 0; i < rows; ++i) assignment[i] = -1;
+	for(ssize_t j = 1; j <= cols; ++j) {
+		if(p[j]) assignment[p[j] - 1] = j - 1;
+	}
+
+	free(u);
+	free(v);
+	free(min_v);
+	free(p);
+	free(way);
+	free(used);
+}
+
+static void tracker_reserve(ai_tracker_t * tracker, ssize_t count)
+{
+	if(count <= tracker->capacity) return;
+	ssize_t capacity = tracker->capacity * 2;
+	if(capacity < count) capacity = count;
+	if(capacity < 16) capacity = 16;
+
+	tracker->items = realloc(tracker->items, sizeof(*tracker->items) * capacity);
+	tracker->tracks = realloc(tracker->tracks, sizeof(*tracker->tracks) * capacity);
+	assert(tracker->items && tracker->tracks);
+	tracker->capacity = capacity;
+}
+
+/*
+ * det_to_track[d]: index of the track matched with the detection d, or -1
+ */
+static void associate(ai_tracker_t * tracker, const ai_detections_t * detections)
+{
+	const ssize_t num_tracks = tracker->count;
+	const ssize_t num_dets = detections->count;
+
+	ssize_t size = num_tracks * num_dets + num_tracks + num_dets;
+	if(size > tracker->scratch_size)
+	{
+		tracker->cost = realloc(tracker->cost, sizeof(*tracker->cost) * size);
+		tracker->det_to_track = realloc(tracker->det_to_track, sizeof(*tracker->det_to_track) * size);
+		tracker->matched = realloc(tracker->matched, size);
+		assert(tracker->cost && tracker->det_to_track && tracker->matched);
+		tracker->scratch_size = size;
+	}
+	for(ssize_t d = 0; d < num_dets; ++d) tracker->det_to_track[d] = -1;
+	if(num_tracks == 0 || num_dets == 0) return;
+
+	// rows: the smaller side
+	int transposed = (num_tracks > num_dets);
+	ssize_t rows = transposed?num_dets:num_tracks;
+	ssize_t cols = transposed?num_tracks:num_dets;
+	for(ssize_t t = 0; t < num_tracks; ++t)
+	{
+		const ai_track_t * track = &tracker->items[t].track;
+		for(ssize_t d = 0; d < num_dets; ++d)
+		{
+			const ai_detection_box_t * box = &detections->boxes[d];
+			double cost = 2.0;	// forbidden
+			if(box->class_index == track->class_index) cost = 1.0 - box_iou(&track->box, box);
+			if(transposed) tracker->cost[d * cols + t] = cost;
+			else tracker->cost[t * cols + d] = cost;
+		}
+	}
+
+	ssize_t * assignment = tracker->det_to_track + num_dets;
+	hungarian(tracker->cost, rows, cols, assignment);
+
+	for(ssize_t r = 0; r < rows; ++r)
+	{
+		ssize_t c = assignment[r];
+		if(c < 0) continue;
+		ssize_t t = transposed?c:r;
+		ssize_t d = transposed?r:c;
+		double iou = box_iou(&tracker->items[t].track.box, &detections->boxes[d]);
+		if(detections->boxes[d].class_index != tracker->items[t].track.class_index) continue;
+		if(iou < tracker->params.iou_thresh) continue;
+		tracker->det_to_track[d] = t;
+	}
+}
+
+/******************************************************************************
+ * update / predict
+ *****************************************************************************/
+static void tracker_publish(ai_tracker_t * tracker)
+{
+	for(ssize_t i = 0; i < tracker->count; ++i)
+	{
+		item_sync(&tracker->items[i]);
+		tracker->tracks[i] = tracker->items[i].track;
+	}
+}
+
+ssize_t ai_tracker_predict(ai_tracker_t * tracker)
+{
+	assert(tracker);
+	for(ssize_t i = 0; i < tracker->count; ++i)
+	{
+		tracker_item_t * item = &tracker->items[i];
+		kalman_predict(tracker, item);
+		++item->track.age;
+		item->track.box.confidence *= tracker->params.confidence_decay;
+	}
+	++tracker->frames_since_inference;
+	tracker_publish(tracker);
+	return tracker->count;
+}
+
+ssize_t ai_tracker_update(ai_tracker_t * tracker, const ai_detections_t * detections)
+{
+	assert(tracker && detections);
+	if(detections->labels) {
+		tracker->model = detections->model;
+		tracker->num_labels = detections->num_labels;
+		tracker->labels = detections->labels;
+	}
+
+	for(ssize_t i = 0; i < tracker->count; ++i)
+	{
+		tracker_item_t * item = &tracker->items[i];
+		kalman_predict(tracker, item);
+		++item->track.age;
+		item_sync(item);
+	}
+
+	associate(tracker, detections);
+
+	unsigned char * matched = tracker->matched;
+	if(tracker->count > 0) memset(matched, 0, tracker->count);
+	for(ssize_t d = 0; d < detections->count; ++d)
+	{
+		ssize_t t = tracker->det_to_track[d];
+		if(t < 0) continue;
+
+		tracker_item_t * item = &tracker->items[t];
+		kalman_correct(tracker, item, &detections->boxes[d]);
+		item->track.box.confidence = detections->boxes[d].confidence;
+		item->track.misses = 0;
+		if(++item->track.hits >= tracker->params.min_hits) item->track.confirmed = 1;
+		matched[t] = 1;
+	}
+
+	// drop the lost tracks (the unconfirmed ones at their first miss), keep the order
+	ssize_t count = 0;
+	for(ssize_t i = 0; i < tracker->count; ++i)
+	{
+		tracker_item_t * item = &tracker->items[i];
+		if(!matched[i])
+		{
+			++item->track.misses;
+			item->track.box.confidence *= tracker->params.confidence_decay;
+			if(!item->track.confirmed || item->track.misses > tracker->params.max_misses) continue;
+		}
+		if(count != i) tracker->items[count] = *item;
+		++count;
+	}
+	tracker->count = count;
+
+	// new tracks, in the order of the detections
+	for(ssize_t d = 0; d < detections->count; ++d)
+	{
+		if(tracker->det_to_track[d] >= 0) continue;
+		const ai_detection_box_t * box = &detections->boxes[d];
+		if(box->width <= 0 || box->height <= 0) continue;
+
+		tracker_reserve(tracker, tracker->count + 1);
+		tracker_item_t * item = &tracker->items[tracker->count++];
+		memset(item, 0, sizeof(*item));
+		item->track.id = tracker->next_id++;
+		item->track.class_index = box->class_index;
+		item->track.box.confidence = box->confidence;
+		item->track.hits = 1;
+		item->track.confirmed = (tracker->params.min_hits <= 1);
+		kalman_init(tracker, item, box);
+	}
+
+	tracker->has_inference = 1;
+	tracker->frames_since_inference = 0;
+	tracker_publish(tracker);
+	return tracker->count;
+}
+
+ssize_t ai_tracker_to_detections(const ai_tracker_t * tracker, ai_detections_t * results, uint32_t * track_ids)
+{
+	assert(tracker && results);
+	ai_detections_reset(results);
+	results->model = tracker->model;
+	results->num_labels = tracker->num_labels;
+	results->labels = tracker->labels;
+
+	for(ssize_t i = 0; i < tracker->count; ++i)
+	{
+		const ai_track_t * track = &tracker->tracks[i];
+		if(!track->confirmed) continue;
+
+		if(track_ids) track_ids[results->count] = track->id;
+		ai_detection_box_t * box = ai_detections_add(results);
+		if(NULL == box) return -1;
+		*box = track->box;
+	}
+	return results->count;
+}
@@ -0,0 +1,597 @@
+/*
+ * img_preprocess.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <pthread.h>
+
+#include "img_proc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMG_PREPROCESS_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * kernels: dst = (float)src * scale + bias,  (bias = -mean * scale)
+ * each BGRA pixel is loaded as a little-endian uint32: B = bits[0..7], G = bits[8..15], R = bits[16..23]
+ */
+typedef void (* bgra_row_func)(const unsigned char * src, int count,
+	float * r, float * g, float * b,
+	const float scale[3], const float bias[3]);
+typedef void (* u8_row_func)(const unsigned char * src, ssize_t count, float * dst, float scale, float bias);
+
+static void bgra_row_scalar(const unsigned char * src, int count,
+	float * r, float * g, float * b,
+	const float scale[3], const float bias[3])
+{
+	for(int i = 0; i < count; ++i, src += 4)
+	{
+		r[i] = (float)src[2] * scale[0] + bias[0];
+		g[i] = (float)src[1] * scale[1] + bias[1];
+		b[i] = (float)src[0] * scale[2] + bias[2];
+	}
+}
+
+static void u8_row_scalar(const unsigned char * src, ssize_t count, float * dst, float scale, float bias)
+{
+	for(ssize_t i = 0; i < count; ++i) dst[i] = (float)src[i] * scale + bias;
+}
+
+#ifdef IMG_PREPROCESS_X86
+__attribute__((target("sse4.1")))
+static void bgra_row_sse4(const unsigned char * src, int count,
+	float * r, float * g, float * b,
+	const float scale[3], const float bias[3])
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	const __m128 sr = _mm_set1_ps(scale[0]), br = _mm_set1_ps(bias[0]);
+	const __m128 sg = _mm_set1_ps(scale[1]), bg = _mm_set1_ps(bias[1]);
+	const __m128 sb = _mm_set1_ps(scale[2]), bb = _mm_set1_ps(bias[2]);
+
+	int i = 0;
+	for(; (i + 4) <= count; i += 4)
+	{
+		__m128i px = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		__m128 vb = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+		__m128 vg = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+		__m128 vr = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+		_mm_storeu_ps(r + i, _mm_add_ps(_mm_mul_ps(vr, sr), br));
+		_mm_storeu_ps(g + i, _mm_add_ps(_mm_mul_ps(vg, sg), bg));
+		_mm_storeu_ps(b + i, _mm_add_ps(_mm_mul_ps(vb, sb), bb));
+	}
+	bgra_row_scalar(src + i * 4, count - i, r + i, g + i, b + i, scale, bias);
+}
+
+__attribute__((target("sse4.1")))
+static void u8_row_sse4(const unsigned char * src, ssize_t count, float * dst, float scale, float bias)
+{
+	const __m128 vs = _mm_set1_ps(scale), vb = _mm_set1_ps(bias);
+	ssize_t i = 0;
+	for(; (i + 4) <= count; i += 4)
+	{
+		int32_t pixels;
+		memcpy(&pixels, src + i, sizeof(pixels));
+		__m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(pixels));
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), vs), vb));
+	}
+	u8_row_scalar(src + i, count - i, dst + i, scale, bias);
+}
+
+__attribute__((target("avx2,fma")))
+static void bgra_row_avx2(const unsigned char * src, int count,
+	float * r, float * g, float * b,
+	const float scale[3], const float bias[3])
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	const __m256 sr = _mm256_set1_ps(scale[0]), br = _mm256_set1_ps(bias[0]);
+	const __m256 sg = _mm256_set1_ps(scale[1]), bg = _mm256_set1_ps(bias[1]);
+	const __m256 sb = _mm256_set1_ps(scale[2]), bb = _mm256_set1_ps(bias[2]);
+
+	int i = 0;
+	for(; (i + 8) <= count; i += 8)
+	{
+		__m256i px = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+		__m256 vb = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+		__m256 vg = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+		__m256 vr = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+		_mm256_storeu_ps(r + i, _mm256_fmadd_ps(vr, sr, br));
+		_mm256_storeu_ps(g + i, _mm256_fmadd_ps(vg, sg, bg));
+		_mm256_storeu_ps(b + i, _mm256_fmadd_ps(vb, sb, bb));
+	}
+	bgra_row_scalar(src + i * 4, count - i, r + i, g + i, b + i, scale, bias);
+}
+
+__attribute__((target("avx2,fma")))
+static void u8_row_avx2(const unsigned char * src, ssize_t count, float * dst, float scale, float bias)
+{
+	const __m256 vs = _mm256_set1_ps(scale), vb = _mm256_set1_ps(bias);
+	ssize_t i = 0;
+	for(; (i + 8) <= count; i += 8)
+	{
+		__m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(v), vs, vb));
+	}
+	u8_row_scalar(src + i, count - i, dst + i, scale, bias);
+}
+
+__attribute__((target("avx512f")))
+static void bgra_row_avx512(const unsigned char * src, int count,
+	float * r, float * g, float * b,
+	const float scale[3], const float bias[3])
+{
+	const __m512i mask = _mm512_set1_epi32(0xff);
+	const __m512 sr = _mm512_set1_ps(scale[0]), br = _mm512_set1_ps(bias[0]);
+	const __m512 sg = _mm512_set1_ps(scale[1]), bg = _mm512_set1_ps(bias[1]);
+	const __m512 sb = _mm512_set1_ps(scale[2]), bb = _mm512_set1_ps(bias[2]);
+
+	int i = 0;
+	for(; (i + 16) <= count; i += 16)
+	{
+		__m512i px = _mm512_loadu_si512((const void *)(src + i * 4));
+		__m512 vb = _mm512_cvtepi32_ps(_mm512_and_si512(px, mask));
+		__m512 vg = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(px, 8), mask));
+		__m512 vr = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(px, 16), mask));
+		_mm512_storeu_ps(r + i, _mm512_fmadd_ps(vr, sr, br));
+		_mm512_storeu_ps(g + i, _mm512_fmadd_ps(vg, sg, bg));
+		_mm512_storeu_ps(b + i, _mm512_fmadd_ps(vb, sb, bb));
+	}
+	bgra_row_avx2(src + i * 4, count - i, r + i, g + i, b + i, scale, bias);
+}
+
+__attribute__((target("avx512f")))
+static void u8_row_avx512(const unsigned char * src, ssize_t count, float * dst, float scale, float bias)
+{
+	const __m512 vs = _mm512_set1_ps(scale), vb = _mm512_set1_ps(bias);
+	ssize_t i = 0;
+	for(; (i + 16) <= count; i += 16)
+	{
+		__m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+		_mm512_storeu_ps(dst + i, _mm512_fmadd_ps(_mm512_cvtepi32_ps(v), vs, vb));
+	}
+	u8_row_avx2(src + i, count - i, dst + i, scale, bias);
+}
+#endif
+
+static const struct
+{
+	const char * name;
+	bgra_row_func bgra_row;
+	u8_row_func u8_row;
+}s_kernels[img_simd_levels_count] = {
+	[img_simd_level_scalar] = { "scalar", bgra_row_scalar, u8_row_scalar },
+#ifdef IMG_PREPROCESS_X86
+	[img_simd_level_sse4] 	= { "sse4.1", bgra_row_sse4, u8_row_sse4 },
+	[img_simd_level_avx2] 	= { "avx2", bgra_row_avx2, u8_row_avx2 },
+	[img_simd_level_avx512] = { "avx512", bgra_row_avx512, u8_row_avx512 },
+#else
+	[img_simd_level_sse4] 	= { "sse4.1" },
+	[img_simd_level_avx2] 	= { "avx2" },
+	[img_simd_level_avx512] = { "avx512" },
+#endif
+};
+
+static int s_simd_level = -1;	// not initialized
+
+static enum img_simd_level detect_simd_level(void)
+{
+#ifdef IMG_PREPROCESS_X86
+	__builtin_cpu_init();
+	int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if(has_avx2 && __builtin_cpu_supports("avx512f")) return img_simd_level_avx512;	// the avx512 kernels use avx2 for the tails
+	if(has_avx2) return img_simd_level_avx2;
+	if(__builtin_cpu_supports("sse4.1")) return img_simd_level_sse4;
+#endif
+	return img_simd_level_scalar;
+}
+
+enum img_simd_level img_preprocess_get_simd_level(void)
+{
+	int level = __atomic_load_n(&s_simd_level, __ATOMIC_RELAXED);
+	if(level < 0)
+	{
+		level = detect_simd_level();
+		__atomic_store_n(&s_simd_level, level, __ATOMIC_RELAXED);
+	}
+	return level;
+}
+
+int img_preprocess_set_simd_level(enum img_simd_level level)
+{
+	if(level < 0 || level >= img_simd_levels_count) return -1;
+	if(level > detect_simd_level()) return -1;
+	__atomic_store_n(&s_simd_level, level, __ATOMIC_RELAXED);
+	return 0;
+}
+
+const char * img_simd_level_to_string(enum img_simd_level level)
+{
+	if(level < 0 || level >= img_simd_levels_count) return "unknown";
+	return s_kernels[level].name;
+}
+
+int img_bgra_to_planar_f32(const unsigned char * bgra, int width, int height, int stride,
+	const float mean[3], const float scale[3], float * dst)
+{
+	assert(bgra && dst);
+	if(width <= 0 || height <= 0) return -1;
+	if(stride <= 0) stride = width * 4;
+	if(stride < (width * 4)) return -1;
+
+	float scales[3] = { 1.0f, 1.0f, 1.0f };
+	float bias[3] = { 0.0f, 0.0f, 0.0f };
+	for(int c = 0; c < 3; ++c)
+	{
+		if(scale) scales[c] = scale[c];
+		if(mean) bias[c] = -mean[c] * scales[c];
+	}
+
+	bgra_row_func bgra_row = s_kernels[img_preprocess_get_simd_level()].bgra_row;
+	ssize_t size = (ssize_t)width * (ssize_t)height;
+	float * r_plane = dst;
+	float * g_plane = r_plane + size;
+	float * b_plane = g_plane + size;
+
+	if(stride == (width * 4))	// continuous
+	{
+		// the kernels take an int count, split huge images by rows
+		if(size <= INT32_MAX)
+		{
+			bgra_row(bgra, (int)size, r_plane, g_plane, b_plane, scales, bias);
+			return 0;
+		}
+	}
+
+	for(int y = 0; y < height; ++y)
+	{
+		ssize_t offset = (ssize_t)y * width;
+		bgra_row(bgra + (ssize_t)y * stride, width,
+			r_plane + offset, g_plane + offset, b_plane + offset,
+			scales, bias);
+	}
+	return 0;
+}
+
+int img_u8_to_f32(const unsigned char * src, ssize_t count, float mean, float scale, float * dst)
+{
+	assert(src && dst);
+	if(count < 0) return -1;
+	s_kernels[img_preprocess_get_simd_level()].u8_row(src, count, dst, scale, -mean * scale);
+	return 0;
+}
+
+/******************************************************************************
+ * fused resize + letterbox + normalize
+ *****************************************************************************/
+typedef struct resize_context
+{
+	const unsigned char * src;
+	int src_width, src_height, src_stride;
+
+	int width, height;			// size of the resized image
+	int dst_width, dst_height;
+	int dx, dy;					// letterbox offsets
+	float * dst;
+
+	enum img_resize_mode mode;
+	float scales[3];
+	float bias[3];
+
+	// horizontal tables, per output column
+	int * x0;		// bilinear: left pixel, area: first pixel
+	int * x1;		// bilinear: right pixel, area: last pixel + 1
+	float * fx;		// bilinear only
+}resize_context_t;
+
+typedef struct resize_band
+{
+	resize_context_t * ctx;
+	int y_begin, y_end;
+	pthread_t th;
+}resize_band_t;
+
+static inline void store_row(const resize_context_t * ctx, int y, const float * rgb)
+{
+	ssize_t plane_size = (ssize_t)ctx->dst_width * ctx->dst_height;
+	ssize_t offset = (ssize_t)(y + ctx->dy) * ctx->dst_width + ctx->dx;
+	int width = ctx->width;
+	for(int c = 0; c < 3; ++c)
+	{
+		float * dst = ctx->dst + plane_size * c + offset;
+		const float * row = rgb + width * c;
+		const float scale = ctx->scales[c];
+		const float bias = ctx->bias[c];
+		for(int x = 0; x < width; ++x) dst[x] = row[x] * scale + bias;
+	}
+}
+
+// horizontal pass of one source row into R, G, B rows
+static void bilinear_hresample(const resize_context_t * ctx, int sy, float * rgb)
+{
+	const unsigned char * src = ctx->src + (ssize_t)sy * ctx->src_stride;
+	int width = ctx->width;
+	float * r = rgb;
+	float * g = r + width;
+	float * b = g + width;
+	for(int x = 0; x < width; ++x)
+	{
+		const unsigned char * p0 = src + ctx->x0[x] * 4;
+		const unsigned char * p1 = src + ctx->x1[x] * 4;
+		float fx = ctx->fx[x];
+		r[x] = (float)p0[2] + ((float)p1[2] - (float)p0[2]) * fx;
+		g[x] = (float)p0[1] + ((float)p1[1] - (float)p0[1]) * fx;
+		b[x] = (float)p0[0] + ((float)p1[0] - (float)p0[0]) * fx;
+	}
+}
+
+static void resize_band_bilinear(resize_band_t * band)
+{
+	const resize_context_t * ctx = band->ctx;
+	int width = ctx->width;
+	int row_size = width * 3;
+	float * buffer = malloc(sizeof(*buffer) * row_size * 3);
+	assert(buffer);
+
+	// two cached source rows (horizontally resampled) + the output row
+	float * rows[2] = { buffer, buffer + row_size };
+	int cached[2] = { -1, -1 };
+	float * out = buffer + row_size * 2;
+
+	const float sy_scale = (float)ctx->src_height / (float)ctx->height;
+	for(int y = band->y_begin; y < band->y_end; ++y)
+	{
+		float sy = ((float)y + 0.5f) * sy_scale - 0.5f;
+		if(sy < 0) sy = 0;
+		int y0 = (int)sy;
+		if(y0 > ctx->src_height - 1) y0 = ctx->src_height - 1;
+		int y1 = (y0 < ctx->src_height - 1)?(y0 + 1):y0;
+		float fy = sy - (float)y0;
+
+		// reuse the rows of the previous output row when possible
+		if(cached[0] != y0)
+		{
+			if(cached[1] == y0)
+			{
+				float * tmp = rows[0]; rows[0] = rows[1]; rows[1] = tmp;
+				cached[1] = cached[0];
+				cached[0] = y0;
+			}else
+			{
+				bilinear_hresample(ctx, y0, rows[0]);
+				cached[0] = y0;
+			}
+		}
+		if(cached[1] != y1)
+		{
+			bilinear_hresample(ctx, y1, rows[1]);
+			cached[1] = y1;
+		}
+
+		const float * a = rows[0];
+		const float * b = rows[1];
+		for(int i = 0; i < row_size; ++i) out[i] = a[i] + (b[i] - a[i]) * fy;
+		store_row(ctx, y, out);
+	}
+	free(buffer);
+}
+
+static void resize_band_area(resize_band_t * band)
+{
+	const resize_context_t * ctx = band->ctx;
+	int width = ctx->width;
+	float * acc = malloc(sizeof(*acc) * width * 3);
+	assert(acc);
+	float * r = acc;
+	float * g = r + width;
+	float * b = g + width;
+
+	for(int y = band->y_begin; y < band->y_end; ++y)
+	{
+		int sy0 = (int)((int64_t)y * ctx->src_height / ctx->height);
+		int sy1 = (int)((int64_t)(y + 1) * ctx->src_height / ctx->height);
+		if(sy1 <= sy0) sy1 = sy0 + 1;
+
+		memset(acc, 0, sizeof(*acc) * width * 3);
+		for(int sy = sy0; sy < sy1; ++sy)	// source rows are read sequentially
+		{
+			const unsigned char * src = ctx->src + (ssize_t)sy * ctx->src_stride;
+			for(int x = 0; x < width; ++x)
+			{
+				unsigned int sum_r = 0, sum_g = 0, sum_b = 0;
+				const unsigned char * p = src + ctx->x0[x] * 4;
+				const unsigned char * p_end = src + ctx->x1[x] * 4;
+				for(; p < p_end; p += 4) { sum_b += p[0]; sum_g += p[1]; sum_r += p[2]; }
+				r[x] += (float)sum_r;
+				g[x] += (float)sum_g;
+				b[x] += (float)sum_b;
+			}
+		}
+
+		for(int x = 0; x < width; ++x)
+		{
+			float area = (float)((sy1 - sy0) * (ctx->x1[x] - ctx->x0[x]));
+			float k = 1.0f / area;
+			r[x] *= k; g[x] *= k; b[x] *= k;
+		}
+		store_row(ctx, y, acc);
+	}
+	free(acc);
+}
+
+static void * resize_band_thread(void * user_data)
+{
+	resize_band_t * band = user_data;
+	if(band->ctx->mode == img_resize_mode_area) resize_band_area(band);
+	else resize_band_bilinear(band);
+	return band;
+}
+
+static void fill_borders(const resize_context_t * ctx, float pad_value)
+{
+	ssize_t plane_size = (ssize_t)ctx->dst_width * ctx->dst_height;
+	for(int c = 0; c < 3; ++c)
+	{
+		float * plane = ctx->dst + plane_size * c;
+		for(int y = 0; y < ctx->dst_height; ++y)
+		{
+			float * row = plane + (ssize_t)y * ctx->dst_width;
+			if(y < ctx->dy || y >= (ctx->dy + ctx->height))
+			{
+				for(int x = 0; x < ctx->dst_width; ++x) row[x] = pad_value;
+				continue;
+			}
+			for(int x = 0; x < ctx->dx; ++x) row[x] = pad_value;
+			for(int x = ctx->dx + ctx->width; x < ctx->dst_width; ++x) row[x] = pad_value;
+		}
+	}
+}
+
+int img_bgra_resize_to_planar_f32(const unsigned char * bgra, int width, int height, int stride,
+	int dst_width, int dst_height, const img_resize_params_t * params,
+	float * dst, img_letterbox_t * p_letterbox)
+{
+	static const img_resize_params_t default_params[1] = {{ .mode = img_resize_mode_auto, }};
+	assert(bgra && dst);
+	if(width <= 0 || height <= 0 || dst_width <= 0 || dst_height <= 0) return -1;
+	if(stride <= 0) stride = width * 4;
+	if(stride < (width * 4)) return -1;
+	if(NULL == params) params = default_params;
+
+	resize_context_t ctx[1];
+	memset(ctx, 0, sizeof(ctx));
+	ctx->src = bgra;
+	ctx->src_width = width;
+	ctx->src_height = height;
+	ctx->src_stride = stride;
+	ctx->dst = dst;
+	ctx->dst_width = dst_width;
+	ctx->dst_height = dst_height;
+	ctx->width = dst_width;
+	ctx->height = dst_height;
+
+	if(params->letterbox)
+	{
+		if(((float)dst_width / width) < ((float)dst_height / height))
+		{
+			ctx->width = dst_width;
+			ctx->height = (height * dst_width) / width;
+		}else
+		{
+			ctx->height = dst_height;
+			ctx->width = (width * dst_height) / height;
+		}
+		if(ctx->width < 1) ctx->width = 1;
+		if(ctx->height < 1) ctx->height = 1;
+		ctx->dx = (dst_width - ctx->width) / 2;
+		ctx->dy = (dst_height - ctx->height) / 2;
+	}
+	if(p_letterbox)
+	{
+		p_letterbox->x = ctx->dx;
+		p_letterbox->y = ctx->dy;
+		p_letterbox->width = ctx->width;
+		p_letterbox->height = ctx->height;
+	}
+
+	for(int c = 0; c < 3; ++c)
+	{
+		ctx->scales[c] = params->scale?params->scale[c]:1.0f;
+		ctx->bias[c] = params->mean?(-params->mean[c] * ctx->scales[c]):0.0f;
+	}
+
+	// the same size: plain conversion
+	if(ctx->width == width && ctx->height == height && ctx->dx == 0 && ctx->dy == 0)
+	{
+		return img_bgra_to_planar_f32(bgra, width, height, stride, params->mean, ctx->scales, dst);
+	}
+
+	ctx->mode = params->mode;
+	if(ctx->mode == img_resize_mode_auto)
+	{
+		ctx->mode = (width >= ctx->width * 2 && height >= ctx->height * 2)?
+			img_resize_mode_area:img_resize_mode_bilinear;
+	}
+
+	int * tables = malloc(sizeof(int) * ctx->width * 2);
+	float * fx = malloc(sizeof(float) * ctx->width);
+	assert(tables && fx);
+	ctx->x0 = tables;
+	ctx->x1 = tables + ctx->width;
+	ctx->fx = fx;
+
+	if(ctx->mode == img_resize_mode_area)
+	{
+		for(int x = 0; x < ctx->width; ++x)
+		{
+			int x0 = (int)((int64_t)x * width / ctx->width);
+			int x1 = (int)((int64_t)(x + 1) * width / ctx->width);
+			if(x1 <= x0) x1 = x0 + 1;
+			if(x1 > width) x1 = width;
+			ctx->x0[x] = x0;
+			ctx->x1[x] = x1;
+		}
+	}else
+	{
+		const float sx_scale = (float)width / (float)ctx->width;
+		for(int x = 0; x < ctx->width; ++x)
+		{
+			float sx = ((float)x + 0.5f) * sx_scale - 0.5f;
+			if(sx < 0) sx = 0;
+			int x0 = (int)sx;
+			if(x0 > width - 1) x0 = width - 1;
+			ctx->x0[x] = x0;
+			ctx->x1[x] = (x0 < width - 1)?(x0 + 1):x0;
+			ctx->fx[x] = sx - (float)x0;
+		}
+	}
+
+	if(params->letterbox) fill_borders(ctx, params->pad_value);
+
+	int num_bands = params->num_threads;
+	if(num_bands < 1) num_bands = 1;
+	if(num_bands > ctx->height) num_bands = ctx->height;
+
+	resize_band_t bands[num_bands];
+	for(int i = 0; i < num_bands; ++i)
+	{
+		bands[i].ctx = ctx;
+		bands[i].y_begin = (int)((int64_t)ctx->height * i / num_bands);
+		bands[i].y_end = (int)((int64_t)ctx->height * (i + 1) / num_bands);
+	}
+	for(int i = 1; i < num_bands; ++i)
+	{
+		int rc = pthread_create(&bands[i].th, NULL, resize_band_thread, &bands[i]);
+		assert(0 == rc);
+	}
+	resize_band_thread(&bands[0]);
+	for(int i = 1; i < num_bands; ++i) pthread_join(bands[i].th, NULL);
+
+	free(tables);
+	free(fx);
+	return 0;
+}
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include "img_proc.h"
@@ -76,6 +77,8 @@ void bgra_image_clear(bgra_image_t * image)
 #include <unistd.h>
 #include <setjmp.h>
 
+#include "jpeg-encoder.h"
+
 enum image_type
 {
 	image_type_unknown,
@@ -123,94 +126,214 @@ static void on_jpeg_decompress_error(j_common_ptr cinfo)
 	longjmp(jerr->setjmp_buffer, 1);
 }
 
+/*
+ * header-only probes: the dimensions are read from the stream, nothing is decoded
+ */
+#define read_u16_be(p) (((unsigned int)(p)[0] << 8) | (p)[1])
+#define read_u32_be(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (p)[3])
+
+/* scan the markers up to the first SOFn (frame header) */
 int img_utils_get_jpeg_size(const unsigned char * jpeg, size_t length, int * p_width, int * p_height)
 {
-	struct jpeg_decompress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-	memset(&cinfo, 0, sizeof(cinfo));
-	memset(&jerr, 0, sizeof(jerr));
+	if(NULL == jpeg || length < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8) return -1;	// SOI
 
-	cinfo.err = jpeg_std_error(&jerr);
-	
-	jpeg_create_decompress(&cinfo);
-	jpeg_mem_src(&cinfo, jpeg, length);
-	int width = 0;
-	int height = 0;
-	
-	int rc = jpeg_read_header(&cinfo, FALSE);
-	if(rc != JPEG_HEADER_OK) return -1;
+	const unsigned char * p = jpeg + 2;
+	const unsigned char * p_end = jpeg + length;
+	while(p < p_end)
+	{
+		if(*p != 0xff) return -1;
+		while(p < p_end && *p == 0xff) ++p;	// fill bytes
+		if(p >= p_end) return -1;
 
-	width = cinfo.image_width;
-	height = cinfo.image_height;
+		unsigned char marker = *p++;
+		if(marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) continue;	// TEM, RSTn: no payload
+		if(marker == 0xd9 || marker == 0xda) return -1;	// EOI / SOS before the frame header
 
-	if(p_width) *p_width = width;
-	if(p_height) * p_height = height;
+		if(p + 2 > p_end) return -1;
+		unsigned int segment_length = read_u16_be(p);
+		if(segment_length < 2 || p + segment_length > p_end) return -1;
 
-	jpeg_destroy_decompress(&cinfo);
-	
-	return 0;
+		// SOF0 ~ SOF15, except DHT (c4), JPG (c8) and DAC (cc)
+		if(marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+		{
+			if(segment_length < 8) return -1;
+			int height = read_u16_be(p + 3);
+			int width = read_u16_be(p + 5);
+			if(width <= 0 || height <= 0) return -1;	// height == 0: defined by a DNL marker, unsupported
+
+			if(p_width) *p_width = width;
+			if(p_height) *p_height = height;
+			return 0;
+		}
+		p += segment_length;
+	}
+	return -1;
 }
 
-int bgra_image_from_jpeg_stream(bgra_image_t * image, const unsigned char * jpeg, size_t length)
+void img_jpeg_decode_params_init(img_jpeg_decode_params_t * params)
+{
+	assert(params);
+	memset(params, 0, sizeof(*params));
+	return;
+}
+
+/* the smallest DCT scale (scale_num / 8) which keeps the (cropped) output >= min_width x min_height */
+static unsigned int jpeg_choose_scale_num(int width, int height, int min_width, int min_height)
+{
+	static const unsigned int scales[] = { 1, 2, 4 };
+	for(size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); ++i)
+	{
+		int scaled_width = (int)(((long)width * scales[i] + 7) / 8);
+		int scaled_height = (int)(((long)height * scales[i] + 7) / 8);
+		if(scaled_width >= min_width && scaled_height >= min_height) return scales[i];
+	}
+	return 8;
+}
+
+#define JPEG_DECODE_MAX_ROWS (16)
+
+/*
+ * decode @jpeg into @dst (BGRA, @stride bytes per row),
+ *   dst == NULL && image != NULL: (re)allocate the image to the output size,
+ *   dst == NULL && image == NULL: only report the output size.
+ */
+static int jpeg_decode(const unsigned char * jpeg, size_t length, const img_jpeg_decode_params_t * params,
+	bgra_image_t * image, unsigned char * dst, int stride, size_t capacity,
+	int * p_width, int * p_height)
 {
 	int rc = -1;
 	struct jpeg_decompress_struct cinfo;
 	memset(&cinfo, 0, sizeof(cinfo));
-	
+	unsigned char * volatile band = NULL;	// the iMCU-aligned rows of a crop
+
 	custom_jpeg_err_t jerr;
 	memset(&jerr, 0, sizeof(jerr));
-	
 	cinfo.err = jpeg_std_error((struct jpeg_error_mgr *)&jerr);
 	jerr.base->error_exit = on_jpeg_decompress_error;
 	if(setjmp(jerr.setjmp_buffer))
 	{
+		rc = -1;
 		goto label_cleanup;
 	}
-	
+
 	jpeg_create_decompress(&cinfo);
 	jpeg_mem_src(&cinfo, jpeg, length);
-	int width = 0;
-	int height = 0;
-	
-	(void)jpeg_read_header(&cinfo, TRUE);
-	
+	if(jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) goto label_cleanup;
+
+	// crop rectangle, in source pixels
+	int x = 0, y = 0;
+	int width = cinfo.image_width;
+	int height = cinfo.image_height;
+	if(params && params->crop_width > 0 && params->crop_height > 0)
+	{
+		x = (params->crop_x > 0)?params->crop_x:0;
+		y = (params->crop_y > 0)?params->crop_y:0;
+		if(x >= width || y >= height) goto label_cleanup;
+		int right = params->crop_x + params->crop_width;
+		int bottom = params->crop_y + params->crop_height;
+		if(right > width) right = width;
+		if(bottom > height) bottom = height;
+		if(right <= x || bottom <= y) goto label_cleanup;
+		width = right - x;
+		height = bottom - y;
+	}
+
 	cinfo.out_color_space = JCS_EXT_BGRA;
+	cinfo.scale_num = 8;
+	cinfo.scale_denom = 8;
+	if(params && (params->min_width > 0 || params->min_height > 0)) {
+		cinfo.scale_num = jpeg_choose_scale_num(width, height, params->min_width, params->min_height);
+	}
+	jpeg_calc_output_dimensions(&cinfo);
+
+	// the crop rectangle in output pixels
+	JDIMENSION out_x = (JDIMENSION)((long)x * cinfo.scale_num / 8);
+	JDIMENSION out_y = (JDIMENSION)((long)y * cinfo.scale_num / 8);
+	JDIMENSION out_right = (JDIMENSION)(((long)(x + width) * cinfo.scale_num + 7) / 8);
+	JDIMENSION out_bottom = (JDIMENSION)(((long)(y + height) * cinfo.scale_num + 7) / 8);
+	if(out_right > cinfo.output_width) out_right = cinfo.output_width;
+	if(out_bottom > cinfo.output_height) out_bottom = cinfo.output_height;
+	width = out_right - out_x;
+	height = out_bottom - out_y;
+
+	if(p_width) *p_width = width;
+	if(p_height) *p_height = height;
+	if(NULL == dst)
+	{
+		if(NULL == image) { rc = 0; goto label_cleanup; }
+		image = bgra_image_init(image, width, height, NULL);
+		assert(image);
+		dst = image->data;
+		stride = width * 4;
+		capacity = (size_t)stride * height;
+	}
+	if(stride < width * 4 || capacity < (size_t)stride * (height - 1) + width * 4) goto label_cleanup;
+
 	(void)jpeg_start_decompress(&cinfo);
-	
-	printf("dst size: %d x %d, channels=%d color_space=%d\n", 
-		cinfo.output_width, cinfo.output_height, 
-		cinfo.output_components,
-		cinfo.out_color_space);
-
-	width = cinfo.output_width;
-	height = cinfo.output_height;
-	printf("-->image size: %d x %d\n", width, height);
-	
-	
-	assert(cinfo.out_color_space == JCS_EXT_BGRA);
-	image = bgra_image_init(image, width, height, NULL);
-	assert(image);
-	
-	unsigned char * row = image->data;
-	int row_stride = image->width * 4;
-	JSAMPLE * row_pointer[1];
-	memset(row_pointer, 0, sizeof(row_pointer));
-	while(cinfo.output_scanline < cinfo.output_height)
+	assert(cinfo.output_components == 4);
+
+	// columns: libjpeg-turbo widens the crop to the iMCU boundaries
+	JDIMENSION crop_x = out_x, crop_width = width;
+	if(crop_x > 0 || crop_width < cinfo.output_width) jpeg_crop_scanline(&cinfo, &crop_x, &crop_width);
+	int offset = (out_x - crop_x) * 4;
+	if(crop_x != out_x || (int)crop_width != width)
 	{
-		row_pointer[0] = (JSAMPLE *)row;
-		int n = jpeg_read_scanlines(&cinfo, row_pointer, 1);
-		assert(n == 1);
-		
-		row += row_stride;
+		band = malloc((size_t)crop_width * 4 * JPEG_DECODE_MAX_ROWS);
+		assert(band);
 	}
-	
+
+	// rows: skip the lines above the crop, stop after the last one
+	if(out_y > 0) jpeg_skip_scanlines(&cinfo, out_y);
+
+	JSAMPROW rows[JPEG_DECODE_MAX_ROWS];
+	int row = 0;
+	while(row < height)
+	{
+		int num_rows = height - row;
+		if(num_rows > JPEG_DECODE_MAX_ROWS) num_rows = JPEG_DECODE_MAX_ROWS;
+		for(int i = 0; i < num_rows; ++i)
+		{
+			rows[i] = band?(band + (size_t)crop_width * 4 * i):(dst + (size_t)stride * (row + i));
+		}
+
+		int n = jpeg_read_scanlines(&cinfo, rows, num_rows);
+		if(n <= 0) goto label_cleanup;
+		if(band)
+		{
+			for(int i = 0; i < n; ++i) memcpy(dst + (size_t)stride * (row + i), rows[i] + offset, width * 4);
+		}
+		row += n;
+	}
+
+	// the rows below the crop are never decoded: abort rather than finish
+	if(cinfo.output_scanline < cinfo.output_height) jpeg_abort_decompress(&cinfo);
+	else jpeg_finish_decompress(&cinfo);
 	rc = 0;
-label_cleanup:
-	jpeg_finish_decompress(&cinfo);
 
+label_cleanup:
 	jpeg_destroy_decompress(&cinfo);
+	free(band);
 	return rc;
+}
+#undef JPEG_DECODE_MAX_ROWS
+
+int img_jpeg_decode(const unsigned char * jpeg, size_t length, const img_jpeg_decode_params_t * params,
+	unsigned char * dst, int stride, size_t capacity, int * p_width, int * p_height)
+{
+	assert(jpeg && length > 0);
+	return jpeg_decode(jpeg, length, params, NULL, dst, stride, capacity, p_width, p_height);
+}
+
+int bgra_image_from_jpeg_stream_scaled(bgra_image_t * image, const unsigned char * jpeg, size_t length,
+	const img_jpeg_decode_params_t * params)
+{
+	assert(image && jpeg && length > 0);
+	return jpeg_decode(jpeg, length, params, image, NULL, 0, 0, NULL, NULL);
+}
 
+int bgra_image_from_jpeg_stream(bgra_image_t * image, const unsigned char * jpeg, size_t length)
+{
+	return bgra_image_from_jpeg_stream_scaled(image, jpeg, length, NULL);
 }
 
 typedef struct png_closure
@@ -252,19 +375,23 @@ int bgra_image_from_png_stream(bgra_image_t * image, const unsigned char * png,
 	return rc;
 }
 
+/* signature (8 bytes) + the IHDR chunk: length (4), type (4), width (4), height (4) */
 int img_utils_get_png_size(const unsigned char * png, size_t length, int * p_width, int * p_height)
 {
-	bgra_image_t bgra[1];
-	memset(bgra, 0, sizeof(bgra));
-	int rc = bgra_image_from_png_stream(bgra, png, length);
-	if(rc) return -1;
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	if(NULL == png || length < 24 || memcmp(png, signature, sizeof(signature)) != 0) return -1;
+	if(read_u32_be(png + 8) != 13 || memcmp(png + 12, "IHDR", 4) != 0) return -1;
 
-	if(p_width) *p_width = bgra->width;
-	if(p_height) * p_height = bgra->height;
+	uint32_t width = read_u32_be(png + 16);
+	uint32_t height = read_u32_be(png + 20);
+	if(width == 0 || height == 0 || width > INT32_MAX || height > INT32_MAX) return -1;
 
-	bgra_image_clear(bgra);
+	if(p_width) *p_width = width;
+	if(p_height) *p_height = height;
 	return 0;
 }
+#undef read_u16_be
+#undef read_u32_be
 
 
 int bgra_image_load_data(bgra_image_t * image, 
@@ -274,7 +401,7 @@ int bgra_image_load_data(bgra_image_t * image,
 	enum image_type type = guess_image_type(NULL, image_data, length);
 	switch(type)
 	{
-	case image_type_jpeg: bgra_image_from_jpeg_stream(image, image_data, length); break;
+	case image_type_jpeg: return bgra_image_from_jpeg_stream(image, image_data, length);
 	case image_type_png: bgra_image_from_png_stream(image, image_data, length); break;
 	default:
 		fprintf(stderr, "[WARNING]::%s()::unable to load image! (UNKNOWN TYPE)\n", __FUNCTION__);
@@ -333,43 +460,24 @@ int bgra_image_load_from_file(bgra_image_t * image, const char * filename)
 }
 
 
+/*
+ * encoded by the shared jpeg_encoder (sliced over its workers, the same tables as a libjpeg default encode),
+ * *jpeg_stream: a new buffer, to be freed by the caller
+ */
 ssize_t bgra_image_to_jpeg_stream(bgra_image_t * image, unsigned char ** jpeg_stream, int quality)
 {
-	struct jpeg_compress_struct cinfo;
-	struct jpeg_error_mgr jerr;
-	memset(&jerr, 0, sizeof(jerr));
-	
-	memset(&cinfo, 0, sizeof(cinfo));
-	
-	int rc = 0;
-	unsigned long cb_jpeg = 0;
-	cinfo.err = jpeg_std_error(&jerr);
-	jpeg_create_compress(&cinfo);
-	jpeg_mem_dest(&cinfo, jpeg_stream, &cb_jpeg);
-	
-	cinfo.image_width = image->width;
-	cinfo.image_height = image->height;
-	cinfo.input_components = 4;
-	cinfo.in_color_space = JCS_EXT_BGRA;
-	jpeg_set_defaults(&cinfo);
-	jpeg_set_quality(&cinfo, quality, TRUE);
-	
-	jpeg_start_compress(&cinfo, TRUE);
-	JSAMPROW row_pointer[1] = { NULL };
-	
-	unsigned char * row = image->data;
-	int row_stride = image->stride?image->stride:(image->width * 4);
-	while(cinfo.next_scanline < cinfo.image_height)
-	{
-		row_pointer[0] = (JSAMPLE *)row;
-		int n = jpeg_write_scanlines(&cinfo, row_pointer, 1);
-		if(n != 1) { rc = -1; break; }
-		row += row_stride;
+	jpeg_encode_params_t params[1];
+	jpeg_encode_params_init(params);
+	params->quality = quality;
+	
+	unsigned char * jpeg = NULL;
+	size_t capacity = 0;
+	ssize_t cb_jpeg = jpeg_encoder_encode(jpeg_encoder_get_default(), image, params, &jpeg, &capacity);
+	if(cb_jpeg <= 0) {
+		free(jpeg);
+		return 0;
 	}
-	jpeg_finish_compress(&cinfo);
-	jpeg_destroy_compress(&cinfo);
-	if(rc) return 0;
-	
+	*jpeg_stream = jpeg;
 	return cb_jpeg;
 }
 ssize_t bgra_image_to_png_stream(bgra_image_t * image, unsigned char ** png_stream)
@@ -26,14 +26,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "img_proc.h"
 #include "input-frame.h"
 #include <json-c/json.h>
 
 
-static const char * input_image_type_string[input_frame_type_png + 1] = {
+static const char * input_image_type_string[input_frame_type_nv12 + 1] = {
 	[input_frame_type_bgra] = "BGRA",
+	[input_frame_type_rgb_planar] = "RGBP",
+	[input_frame_type_gray8] = "GRAY8",
+	[input_frame_type_nv12] = "NV12",
 #ifndef _WIN32
 	[input_frame_type_jpeg] = "image/jpeg",
 	[input_frame_type_png] = "image/png",
@@ -85,11 +89,26 @@ enum input_frame_type input_frame_type_from_string(const char * sz_type)
 			if(image_flags) { type = input_frame_type_invalid; break; }
 			image_flags = 1;
 			type |= input_frame_type_png;
-		}else if(strcasecmp(t, "bgra") == 0 || strcasecmp(t, "bgr") || strcasecmp(t, "grayscale") == 0)
+		}else if(strcasecmp(t, "bgra") == 0 || strcasecmp(t, "bgrx") == 0 || strcasecmp(t, "bgr") == 0 || strcasecmp(t, "grayscale") == 0)
 		{
 			if(image_flags) { type = input_frame_type_invalid; break; }
 			image_flags = 1;
 			type |= input_frame_type_bgra;
+		}else if(strcasecmp(t, "rgbp") == 0 || strcasecmp(t, "rgb_planar") == 0)
+		{
+			if(image_flags) { type = input_frame_type_invalid; break; }
+			image_flags = 1;
+			type |= input_frame_type_rgb_planar;
+		}else if(strcasecmp(t, "gray8") == 0)
+		{
+			if(image_flags) { type = input_frame_type_invalid; break; }
+			image_flags = 1;
+			type |= input_frame_type_gray8;
+		}else if(strcasecmp(t, "nv12") == 0)
+		{
+			if(image_flags) { type = input_frame_type_invalid; break; }
+			image_flags = 1;
+			type |= input_frame_type_nv12;
 		}
 		else if(strcasecmp(t, "json") == 0 || strcasecmp(t, "application/json") == 0 || strcasecmp(t, ".json") == 0)
 		{
@@ -119,6 +138,9 @@ ssize_t	input_frame_type_to_string(enum input_frame_type type, char sz_type[], s
 		case input_frame_type_bgra:
 		case input_frame_type_jpeg:
 		case input_frame_type_png:
+		case input_frame_type_rgb_planar:
+		case input_frame_type_gray8:
+		case input_frame_type_nv12:
 			cb = snprintf(p, p_end - p, "%s",  input_image_type_string[img_type]);
 			break;
 		default:
@@ -139,21 +161,191 @@ ssize_t	input_frame_type_to_string(enum input_frame_type type, char sz_type[], s
 	return p_end - p;
 }
 
-void input_frame_clear(input_frame_t * frame)
+/*********************************
+ * input_frame_payload
+ *********************************/
+#define FRAME_POOL_MIN_CLASS_BITS	(12)		// 4 KBytes
+#define FRAME_POOL_MAX_CLASS_BITS	(26)		// 64 MBytes
+#define FRAME_POOL_NUM_CLASSES		(FRAME_POOL_MAX_CLASS_BITS - FRAME_POOL_MIN_CLASS_BITS + 1)
+#define FRAME_POOL_WRAPPED_CLASS	(FRAME_POOL_NUM_CLASSES)	// header-only payloads (adopted buffers)
+#define FRAME_POOL_UNPOOLED_CLASS	(-1)						// oversized
+#define FRAME_POOL_DEFAULT_LIMIT	((size_t)256 << 20)
+#define FRAME_PAYLOAD_ALIGNMENT		(64)
+
+struct input_frame_payload
 {
-	if(NULL == frame) return;
-	if(frame->data)
+	long refs;
+	int size_class;
+	size_t size;
+	unsigned char * data;
+
+	input_frame_payload_release_func release;
+	void * user_data;
+	
+	struct input_frame_payload * next;		// freelist
+};
+#define FRAME_PAYLOAD_HDR_SIZE	((sizeof(struct input_frame_payload) + FRAME_PAYLOAD_ALIGNMENT - 1) & ~(FRAME_PAYLOAD_ALIGNMENT - 1))
+
+static struct
+{
+	pthread_mutex_t mutex;
+	input_frame_payload_t * free_list[FRAME_POOL_NUM_CLASSES + 1];
+	size_t cached_bytes;
+	size_t max_cached_bytes;
+}s_frame_pool[1] = {{
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.max_cached_bytes = FRAME_POOL_DEFAULT_LIMIT,
+}};
+
+static inline int frame_pool_size_class(size_t size)
+{
+	int bits = FRAME_POOL_MIN_CLASS_BITS;
+	while(bits <= FRAME_POOL_MAX_CLASS_BITS && ((size_t)1 << bits) < size) ++bits;
+	if(bits > FRAME_POOL_MAX_CLASS_BITS) return FRAME_POOL_UNPOOLED_CLASS;
+	return bits - FRAME_POOL_MIN_CLASS_BITS;
+}
+
+static inline size_t frame_pool_class_size(int size_class)
+{
+	if(size_class == FRAME_POOL_WRAPPED_CLASS) return 0;
+	return (size_t)1 << (size_class + FRAME_POOL_MIN_CLASS_BITS);
+}
+
+static input_frame_payload_t * frame_pool_alloc(int size_class, size_t size)
+{
+	input_frame_payload_t * payload = NULL;
+	if(size_class >= 0)
+	{
+		pthread_mutex_lock(&s_frame_pool->mutex);
+		payload = s_frame_pool->free_list[size_class];
+		if(payload)
+		{
+			s_frame_pool->free_list[size_class] = payload->next;
+			s_frame_pool->cached_bytes -= frame_pool_class_size(size_class);
+		}
+		pthread_mutex_unlock(&s_frame_pool->mutex);
+	}
+	
+	if(NULL == payload)
+	{
+		size_t capacity = (size_class >= 0)?frame_pool_class_size(size_class):size;
+		int rc = posix_memalign((void **)&payload, FRAME_PAYLOAD_ALIGNMENT, FRAME_PAYLOAD_HDR_SIZE + capacity);
+		assert(0 == rc && payload);
+	}
+	
+	memset(payload, 0, sizeof(*payload));
+	payload->refs = 1;
+	payload->size_class = size_class;
+	payload->size = size;
+	return payload;
+}
+
+static void frame_pool_recycle(input_frame_payload_t * payload)
+{
+	int size_class = payload->size_class;
+	if(size_class >= 0)
+	{
+		size_t class_size = frame_pool_class_size(size_class);
+		pthread_mutex_lock(&s_frame_pool->mutex);
+		if((s_frame_pool->cached_bytes + class_size) <= s_frame_pool->max_cached_bytes)
+		{
+			payload->next = s_frame_pool->free_list[size_class];
+			s_frame_pool->free_list[size_class] = payload;
+			s_frame_pool->cached_bytes += class_size;
+			payload = NULL;
+		}
+		pthread_mutex_unlock(&s_frame_pool->mutex);
+	}
+	free(payload);
+	return;
+}
+
+void input_frame_pool_set_limit(size_t max_cached_bytes)
+{
+	pthread_mutex_lock(&s_frame_pool->mutex);
+	s_frame_pool->max_cached_bytes = max_cached_bytes;
+	pthread_mutex_unlock(&s_frame_pool->mutex);
+	return;
+}
+
+input_frame_payload_t * input_frame_payload_new(size_t size)
+{
+	assert(size > 0);
+	input_frame_payload_t * payload = frame_pool_alloc(frame_pool_size_class(size), size);
+	payload->data = (unsigned char *)payload + FRAME_PAYLOAD_HDR_SIZE;
+	return payload;
+}
+
+input_frame_payload_t * input_frame_payload_wrap(void * data, size_t size, 
+	input_frame_payload_release_func release, void * user_data)
+{
+	assert(data);
+	input_frame_payload_t * payload = frame_pool_alloc(FRAME_POOL_WRAPPED_CLASS, size);
+	payload->data = data;
+	payload->release = release;
+	payload->user_data = user_data;
+	return payload;
+}
+
+input_frame_payload_t * input_frame_payload_ref(input_frame_payload_t * payload)
+{
+	if(NULL == payload) return NULL;
+	__atomic_add_fetch(&payload->refs, 1, __ATOMIC_RELAXED);
+	return payload;
+}
+
+void input_frame_payload_unref(input_frame_payload_t * payload)
+{
+	if(NULL == payload) return;
+	long refs = __atomic_sub_fetch(&payload->refs, 1, __ATOMIC_ACQ_REL);
+	assert(refs >= 0);
+	if(refs > 0) return;
+	
+	if(payload->release) payload->release(payload->data, payload->user_data);
+	frame_pool_recycle(payload);
+	return;
+}
+
+unsigned char * input_frame_payload_get_data(const input_frame_payload_t * payload)
+{
+	return payload?payload->data:NULL;
+}
+
+size_t input_frame_payload_get_size(const input_frame_payload_t * payload)
+{
+	return payload?payload->size:0;
+}
+
+/*********************************
+ * input_frame
+ *********************************/
+static inline void input_frame_detach_data(input_frame_t * frame)
+{
+	if(frame->payload)
+	{
+		input_frame_payload_unref(frame->payload);
+		frame->payload = NULL;
+	}else if(frame->data)
 	{
 		free(frame->data);
-		frame->data = NULL;
 	}
+	frame->data = NULL;
+	frame->length = 0;
+}
+
+void input_frame_clear(input_frame_t * frame)
+{
+	if(NULL == frame) return;
+	input_frame_detach_data(frame);
 
 	if(frame->json_str)
 	{
 		free(frame->json_str);
 		frame->json_str = NULL;
 	}
+	long refs = frame->refs;
 	memset(frame, 0, sizeof(*frame));
+	frame->refs = refs;
 }
 
 
@@ -170,37 +362,97 @@ input_frame_t * input_frame_new()
 {
 	input_frame_t * frame = calloc(1, sizeof(*frame));
 	assert(frame);
+	frame->refs = 1;
+	return frame;
+}
+
+input_frame_t * input_frame_ref(input_frame_t * frame)
+{
+	if(NULL == frame) return NULL;
+	assert(frame->refs > 0);	// stack or embedded objects can not be referenced
+	__atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
 	return frame;
 }
 
+void input_frame_unref(input_frame_t * frame)
+{
+	if(NULL == frame) return;
+	long refs = __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL);
+	assert(refs >= 0);
+	if(0 == refs) input_frame_free(frame);
+	return;
+}
+
+int input_frame_attach_payload(input_frame_t * frame, enum input_frame_type type, 
+	input_frame_payload_t * payload, ssize_t length, 
+	int width, int height, int channels, int stride)
+{
+	assert(frame && payload);
+	input_frame_detach_data(frame);
+	
+	frame->payload = payload;
+	frame->data = payload->data;
+	frame->length = (length > 0)?length:(ssize_t)payload->size;
+	frame->width = width;
+	frame->height = height;
+	frame->channels = channels;
+	frame->stride = stride;
+	frame->type = (frame->type & input_frame_type_json_flag) | (type & input_frame_type_image_masks);
+	return 0;
+}
+
+int input_frame_adopt_buffer(input_frame_t * frame, enum input_frame_type type,
+	unsigned char * data, ssize_t length,
+	int width, int height, int channels, int stride,
+	input_frame_payload_release_func release, void * user_data)
+{
+	assert(frame && data && length > 0);
+	input_frame_payload_t * payload = input_frame_payload_wrap(data, length, release, user_data);
+	return input_frame_attach_payload(frame, type, payload, length, width, height, channels, stride);
+}
+
+static inline int input_frame_set_pixels(input_frame_t * frame, enum input_frame_type type, 
+	const unsigned char * data, ssize_t length, 
+	int width, int height, int channels, int stride)
+{
+	input_frame_payload_t * payload = frame->payload;
+	// reuse the private payload; an unpooled one is allocated at its exact size and may be too small
+	// (acquire: the last reader's unref happens before the payload is overwritten)
+	if(payload && __atomic_load_n(&payload->refs, __ATOMIC_ACQUIRE) == 1 && payload->size_class >= 0 && payload->size_class == frame_pool_size_class(length))
+	{
+		frame->payload = NULL;
+		frame->data = NULL;
+		payload->size = length;
+	}else
+	{
+		payload = input_frame_payload_new(length);
+	}
+	memcpy(payload->data, data, length);
+	return input_frame_attach_payload(frame, type, payload, length, width, height, channels, stride);
+}
 
 int input_frame_set_json(input_frame_t * frame, const char * json_str, ssize_t cb_json)
 {
 	assert(frame);
 
-	if(frame->json_str) {
-
+	if(json_str && cb_json <= 0) cb_json = strlen(json_str);
+	if(NULL == json_str || cb_json <= 0)
+	{
 		free(frame->json_str);
 		frame->json_str = NULL;
 		frame->cb_json = 0;
+		return 0;
 	}
 	
-	if(json_str)
-	{
-		if(cb_json <= 0) cb_json = strlen(json_str);
-
-		if(cb_json > 0)
-		{
-			frame->type |= input_frame_type_json_flag;
-			char * buf = calloc(1, cb_json + 1);
-			assert(buf);
+	frame->type |= input_frame_type_json_flag;
+	char * buf = realloc(frame->json_str, cb_json + 1);		// reuse the previous buffer
+	assert(buf);
 
-			memcpy(buf, json_str, cb_json);
-			
-			frame->json_str = buf;
-			frame->cb_json = cb_json;
-		}
-	}
+	memcpy(buf, json_str, cb_json);
+	buf[cb_json] = '\0';
+	
+	frame->json_str = buf;
+	frame->cb_json = cb_json;
 	return 0;
 }
 
@@ -210,11 +462,11 @@ int input_frame_set_bgra(input_frame_t * frame, const bgra_image_t * bgra, const
 	frame->type = input_frame_type_unknown;
 	if(bgra)
 	{
-		frame->type |= input_frame_type_bgra;
-		bgra_image_init(frame->bgra, bgra->width, bgra->height, bgra->data);
-		frame->bgra->channels = bgra->channels;
-		frame->bgra->stride = bgra->stride;
-
+		if(bgra->width <= 0 || bgra->height <= 0 || NULL == bgra->data) return -1;
+		int channels = (bgra->channels > 0)?bgra->channels:4;
+		int stride = (bgra->stride > 0)?bgra->stride:(bgra->width * channels);
+		input_frame_set_pixels(frame, input_frame_type_bgra, bgra->data, (ssize_t)stride * bgra->height,
+			bgra->width, bgra->height, channels, stride);
 	}
 	if(json_str) input_frame_set_json(frame, json_str, cb_json);
 	return 0;
@@ -234,16 +486,8 @@ int input_frame_set_jpeg(input_frame_t * frame, const unsigned char * data, ssiz
 
 		if(0 == rc && width > 0 && height > 0)
 		{
-			frame->type |= input_frame_type_jpeg;
-			unsigned char * buf = realloc(frame->data, length);
-			assert(buf);
-			memcpy(buf, data, length);
-			
-			frame->data = buf;
-			frame->length = length;
-			
-			frame->width = width;
-			frame->height = height;
+			input_frame_set_pixels(frame, input_frame_type_jpeg, data, length, width, height, 0, 0);
+
 		}else
 		{
 			return -1;	// invalid jpeg format
@@ -265,16 +509,7 @@ int input_frame_set_png(input_frame_t * frame, const unsigned char * data, ssize
 
 		if(0 == rc && width > 0 && height > 0)
 		{
-			frame->type |= input_frame_type_png;
-			unsigned char * buf = realloc(frame->data, length);
-			assert(buf);
-			memcpy(buf, data, length);
-		
-			frame->data = buf;
-			frame->length = length;
-			
-			frame->width = width;
-			frame->height = height;
+			input_frame_set_pixels(frame, input_frame_type_png, data, length, width, height, 0, 0);
 		}else
 		{
 			return -1;	// invalid png format
@@ -294,35 +529,53 @@ input_frame_t * input_frame_copy(input_frame_t * _dst, const input_frame_t * src
 		dst = input_frame_new();
 	}
 	
+	if(dst == src) return dst;
+	
 	int image_type = src->type & input_frame_type_image_masks;
 	int rc = -1;
-	switch(image_type)
+	if(src->payload && image_type != input_frame_type_unknown)	// share the image data by reference
 	{
-	case input_frame_type_bgra:
-		if(src->width <= 0 || src->height <= 0) break;
-		rc = input_frame_set_bgra(dst, src->bgra, src->json_str, src->cb_json);
-		break;
-	case input_frame_type_png:
-	case input_frame_type_jpeg:
-		if(src->length <= 0) break;
-		
-		if(image_type == input_frame_type_png)
-		{
-			rc = input_frame_set_png(dst, src->data, src->length, src->json_str, src->cb_json);
-		}else
+		rc = input_frame_attach_payload(dst, image_type, input_frame_payload_ref(src->payload), src->length,
+			src->width, src->height, src->channels, src->stride);
+		if(0 == rc) rc = input_frame_set_json(dst, src->json_str, src->cb_json);
+	}else
+	{
+		switch(image_type)
 		{
-			rc = input_frame_set_jpeg(dst, src->data, src->length, src->json_str, src->cb_json);
+		case input_frame_type_bgra:
+			if(src->width <= 0 || src->height <= 0) break;
+			rc = input_frame_set_bgra(dst, src->bgra, src->json_str, src->cb_json);
+			break;
+		case input_frame_type_png:
+		case input_frame_type_jpeg:
+			if(src->length <= 0) break;
+			
+			if(image_type == input_frame_type_png)
+			{
+				rc = input_frame_set_png(dst, src->data, src->length, src->json_str, src->cb_json);
+			}else
+			{
+				rc = input_frame_set_jpeg(dst, src->data, src->length, src->json_str, src->cb_json);
+			}
+			break;
+		case input_frame_type_rgb_planar:
+		case input_frame_type_gray8:
+		case input_frame_type_nv12:
+			if(src->length <= 0 || NULL == src->data) break;
+			rc = input_frame_set_pixels(dst, image_type, src->data, src->length, 
+				src->width, src->height, src->channels, src->stride);
+			if(0 == rc) rc = input_frame_set_json(dst, src->json_str, src->cb_json);
+			break;
+		default:
+			break;
 		}
-		break;
-	default:
-		break;
 	}
 
 	if(rc)
 	{
 		if(NULL == _dst)
 		{
-			free(dst);
+			input_frame_free(dst);
 			dst = NULL;
 		}
 	}else
@@ -0,0 +1,473 @@
+/*
+ * int8_conv.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+
+#include "int8_conv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INT8_CONV_X86
+#include <immintrin.h>
+#endif
+
+#define INT8_CONV_ALIGNMENT	(64)
+#define INT8_CONV_K_ALIGN	(32)		// bytes per vpdpbusd (256-bit)
+#define INT8_CONV_N_TILE	(64)		// output positions per im2col tile
+
+static inline void * aligned_alloc_zero(size_t size)
+{
+	void * data = NULL;
+	int rc = posix_memalign(&data, INT8_CONV_ALIGNMENT, size);
+	assert(0 == rc && data);
+	memset(data, 0, size);
+	return data;
+}
+
+/******************************************************************************
+ * kernels
+ *
+ * dot4x2: acc[r][c] = dot(w[r], x[c]), r = 0..3, c = 0..1, over k_padded int8 elements,
+ *   w rows and x rows are 32-byte multiples, the padding is zero in the weights.
+ *****************************************************************************/
+typedef void (* quantize_func)(const float * src, ssize_t count, float inv_scale, int8_t * dst);
+typedef void (* dot4x2_func)(const int8_t * w, ssize_t w_stride, const int8_t * x, ssize_t x_stride, int k, int32_t acc[4][2]);
+typedef int32_t (* dot1_func)(const int8_t * w, const int8_t * x, int k);
+
+static inline int8_t quantize_one(float value, float inv_scale)
+{
+	float q = value * inv_scale;
+	if(q > 127.0f) q = 127.0f;
+	else if(q < -127.0f) q = -127.0f;
+	return (int8_t)lrintf(q);
+}
+
+static void quantize_scalar(const float * src, ssize_t count, float inv_scale, int8_t * dst)
+{
+	for(ssize_t i = 0; i < count; ++i) dst[i] = quantize_one(src[i], inv_scale);
+}
+
+static int32_t dot1_scalar(const int8_t * w, const int8_t * x, int k)
+{
+	int32_t sum = 0;
+	for(int i = 0; i < k; ++i) sum += (int32_t)w[i] * (int32_t)x[i];
+	return sum;
+}
+
+static void dot4x2_scalar(const int8_t * w, ssize_t w_stride, const int8_t * x, ssize_t x_stride, int k, int32_t acc[4][2])
+{
+	for(int r = 0; r < 4; ++r)
+	{
+		for(int c = 0; c < 2; ++c) acc[r][c] = dot1_scalar(w + w_stride * r, x + x_stride * c, k);
+	}
+}
+
+#ifdef INT8_CONV_X86
+__attribute__((target("avx2")))
+static inline int32_t hsum_epi32_avx2(__m256i v)
+{
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+	return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+static void quantize_avx2(const float * src, ssize_t count, float inv_scale, int8_t * dst)
+{
+	const __m256 scale = _mm256_set1_ps(inv_scale);
+	const __m256 max_value = _mm256_set1_ps(127.0f);
+	const __m256 min_value = _mm256_set1_ps(-127.0f);
+	const __m256i permute = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	ssize_t i = 0;
+	for(; i + 32 <= count; i += 32)
+	{
+		__m256i q[4];
+		for(int j = 0; j < 4; ++j)
+		{
+			__m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i + j * 8), scale);
+			v = _mm256_min_ps(_mm256_max_ps(v, min_value), max_value);
+			q[j] = _mm256_cvtps_epi32(v);	// round to nearest even, the same as lrintf()
+		}
+		__m256i q16_0 = _mm256_packs_epi32(q[0], q[1]);
+		__m256i q16_1 = _mm256_packs_epi32(q[2], q[3]);
+		__m256i q8 = _mm256_packs_epi16(q16_0, q16_1);
+		q8 = _mm256_permutevar8x32_epi32(q8, permute);	// undo the in-lane packing order
+		_mm256_storeu_si256((__m256i *)(dst + i), q8);
+	}
+	quantize_scalar(src + i, count - i, inv_scale, dst + i);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot1_avx2(const int8_t * w, const int8_t * x, int k)
+{
+	__m256i acc = _mm256_setzero_si256();
+	for(int i = 0; i < k; i += 16)
+	{
+		__m256i wv = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + i)));
+		__m256i xv = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(x + i)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(wv, xv));
+	}
+	return hsum_epi32_avx2(acc);
+}
+
+__attribute__((target("avx2")))
+static void dot4x2_avx2(const int8_t * w, ssize_t w_stride, const int8_t * x, ssize_t x_stride, int k, int32_t acc[4][2])
+{
+	__m256i sum[4][2];
+	for(int r = 0; r < 4; ++r) { sum[r][0] = _mm256_setzero_si256(); sum[r][1] = _mm256_setzero_si256(); }
+
+	for(int i = 0; i < k; i += 16)
+	{
+		__m256i x0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(x + i)));
+		__m256i x1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(x + x_stride + i)));
+		for(int r = 0; r < 4; ++r)
+		{
+			__m256i wv = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(w + w_stride * r + i)));
+			sum[r][0] = _mm256_add_epi32(sum[r][0], _mm256_madd_epi16(wv, x0));
+			sum[r][1] = _mm256_add_epi32(sum[r][1], _mm256_madd_epi16(wv, x1));
+		}
+	}
+	for(int r = 0; r < 4; ++r)
+	{
+		acc[r][0] = hsum_epi32_avx2(sum[r][0]);
+		acc[r][1] = hsum_epi32_avx2(sum[r][1]);
+	}
+}
+
+/*
+ * vpdpbusd multiplies unsigned bytes by signed bytes:
+ *   dot(w, x) = dot(w, x ^ 0x80) - 128 * sum(w), the caller adds the correction.
+ */
+__attribute__((target("avx2,avx512vnni,avx512vl")))
+static int32_t dot1_vnni(const int8_t * w, const int8_t * x, int k)
+{
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	__m256i acc = _mm256_setzero_si256();
+	for(int i = 0; i < k; i += 32)
+	{
+		__m256i xv = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x + i)), bias);
+		acc = _mm256_dpbusd_epi32(acc, xv, _mm256_loadu_si256((const __m256i *)(w + i)));
+	}
+	return hsum_epi32_avx2(acc);
+}
+
+__attribute__((target("avx2,avx512vnni,avx512vl")))
+static void dot4x2_vnni(const int8_t * w, ssize_t w_stride, const int8_t * x, ssize_t x_stride, int k, int32_t acc[4][2])
+{
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	__m256i sum[4][2];
+	for(int r = 0; r < 4; ++r) { sum[r][0] = _mm256_setzero_si256(); sum[r][1] = _mm256_setzero_si256(); }
+
+	for(int i = 0; i < k; i += 32)
+	{
+		__m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x + i)), bias);
+		__m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(x + x_stride + i)), bias);
+		for(int r = 0; r < 4; ++r)
+		{
+			__m256i wv = _mm256_loadu_si256((const __m256i *)(w + w_stride * r + i));
+			sum[r][0] = _mm256_dpbusd_epi32(sum[r][0], x0, wv);
+			sum[r][1] = _mm256_dpbusd_epi32(sum[r][1], x1, wv);
+		}
+	}
+	for(int r = 0; r < 4; ++r)
+	{
+		acc[r][0] = hsum_epi32_avx2(sum[r][0]);
+		acc[r][1] = hsum_epi32_avx2(sum[r][1]);
+	}
+}
+#endif
+
+static const struct
+{
+	const char * name;
+	quantize_func quantize;
+	dot4x2_func dot4x2;
+	dot1_func dot1;
+	int unsigned_input;		// the weight sums correction is required
+}s_kernels[int8_conv_levels_count] = {
+	[int8_conv_level_scalar] = { "scalar", quantize_scalar, dot4x2_scalar, dot1_scalar, 0 },
+#ifdef INT8_CONV_X86
+	[int8_conv_level_avx2] = { "avx2", quantize_avx2, dot4x2_avx2, dot1_avx2, 0 },
+	[int8_conv_level_vnni] = { "avx512-vnni", quantize_avx2, dot4x2_vnni, dot1_vnni, 1 },
+#else
+	[int8_conv_level_avx2] = { "avx2" },
+	[int8_conv_level_vnni] = { "avx512-vnni" },
+#endif
+};
+
+static int s_level = -1;	// not initialized
+
+static enum int8_conv_level detect_level(void)
+{
+#ifdef INT8_CONV_X86
+	__builtin_cpu_init();
+	if(!__builtin_cpu_supports("avx2")) return int8_conv_level_scalar;
+	if(__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")) return int8_conv_level_vnni;
+	return int8_conv_level_avx2;
+#endif
+	return int8_conv_level_scalar;
+}
+
+enum int8_conv_level int8_conv_get_level(void)
+{
+	int level = __atomic_load_n(&s_level, __ATOMIC_RELAXED);
+	if(level < 0)
+	{
+		level = detect_level();
+		__atomic_store_n(&s_level, level, __ATOMIC_RELAXED);
+	}
+	return level;
+}
+
+int int8_conv_set_level(enum int8_conv_level level)
+{
+	if(level < 0 || level >= int8_conv_levels_count) return -1;
+	if(level > detect_level()) return -1;
+	__atomic_store_n(&s_level, level, __ATOMIC_RELAXED);
+	return 0;
+}
+
+const char * int8_conv_level_to_string(enum int8_conv_level level)
+{
+	if(level < 0 || level >= int8_conv_levels_count) return "unknown";
+	return s_kernels[level].name;
+}
+
+/******************************************************************************
+ * int8_conv
+ *****************************************************************************/
+int8_conv_t * int8_conv_init(int8_conv_t * conv, int in_c, int in_h, int in_w,
+	int out_c, int size, int stride, int pad,
+	const float * weights, const float * scales, const float * biases)
+{
+	assert(in_c > 0 && in_h > 0 && in_w > 0 && out_c > 0 && size > 0 && stride > 0 && pad >= 0);
+	assert(weights);
+
+	if(NULL == conv) conv = calloc(1, sizeof(*conv));
+	assert(conv);
+	memset(conv, 0, sizeof(*conv));
+
+	conv->in_c = in_c;
+	conv->in_h = in_h;
+	conv->in_w = in_w;
+	conv->out_c = out_c;
+	conv->size = size;
+	conv->stride = stride;
+	conv->pad = pad;
+	conv->out_h = (in_h + 2 * pad - size) / stride + 1;
+	conv->out_w = (in_w + 2 * pad - size) / stride + 1;
+
+	int k = in_c * size * size;
+	int k_padded = (k + INT8_CONV_K_ALIGN - 1) / INT8_CONV_K_ALIGN * INT8_CONV_K_ALIGN;
+	conv->k = k;
+	conv->k_padded = k_padded;
+
+	conv->weights = aligned_alloc_zero((size_t)out_c * k_padded);
+	conv->weight_sums = calloc(out_c, sizeof(*conv->weight_sums));
+	conv->multipliers = calloc(out_c, sizeof(*conv->multipliers));
+	conv->biases = calloc(out_c, sizeof(*conv->biases));
+	assert(conv->weight_sums && conv->multipliers && conv->biases);
+
+	// symmetric, per output channel
+	for(int m = 0; m < out_c; ++m)
+	{
+		const float * row = weights + (ssize_t)m * k;
+		float max_value = int8_max_abs(row, k);
+		float scale = (max_value > 0)?(max_value / 127.0f):1.0f;
+
+		int8_t * q = conv->weights + (ssize_t)m * k_padded;
+		quantize_scalar(row, k, 1.0f / scale, q);
+
+		int32_t sum = 0;
+		for(int i = 0; i < k; ++i) sum += q[i];
+		conv->weight_sums[m] = sum;
+		conv->multipliers[m] = scale * (scales?scales[m]:1.0f);
+		conv->biases[m] = biases?biases[m]:0.0f;
+	}
+	return conv;
+}
+
+void int8_conv_cleanup(int8_conv_t * conv)
+{
+	if(NULL == conv) return;
+	free(conv->weights);
+	free(conv->weight_sums);
+	free(conv->multipliers);
+	free(conv->biases);
+	memset(conv, 0, sizeof(*conv));
+}
+
+void int8_conv_scratch_cleanup(int8_conv_scratch_t * scratch)
+{
+	if(NULL == scratch) return;
+	free(scratch->data);
+	scratch->data = NULL;
+	scratch->size = 0;
+}
+
+static void * scratch_reserve(int8_conv_scratch_t * scratch, size_t size)
+{
+	if(size <= scratch->size) return scratch->data;
+	free(scratch->data);
+	scratch->data = aligned_alloc_zero(size);
+	scratch->size = size;
+	return scratch->data;
+}
+
+float int8_max_abs(const float * data, ssize_t count)
+{
+	float max_value = 0;
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		float value = fabsf(data[i]);
+		if(value > max_value) max_value = value;
+	}
+	return max_value;
+}
+
+/* the transposed im2col of output positions [n_begin, n_end): cols[n][k_padded] */
+static void im2col_tile(const int8_conv_t * conv, const int8_t * input, int n_begin, int n_end, int8_t * cols)
+{
+	const int size = conv->size, stride = conv->stride, pad = conv->pad;
+	const int in_h = conv->in_h, in_w = conv->in_w;
+	const ssize_t plane_size = (ssize_t)in_h * in_w;
+
+	for(int n = n_begin; n < n_end; ++n)
+	{
+		int oy = n / conv->out_w;
+		int ox = n % conv->out_w;
+		int8_t * row = cols + (ssize_t)(n - n_begin) * conv->k_padded;
+
+		if(size == 1 && pad == 0)	// 1x1: gather one pixel of every channel
+		{
+			const int8_t * src = input + (ssize_t)(oy * stride) * in_w + ox * stride;
+			for(int c = 0; c < conv->in_c; ++c) row[c] = src[plane_size * c];
+		}else
+		{
+			int8_t * dst = row;
+			for(int c = 0; c < conv->in_c; ++c)
+			{
+				const int8_t * plane = input + plane_size * c;
+				for(int ky = 0; ky < size; ++ky)
+				{
+					int iy = oy * stride + ky - pad;
+					if(iy < 0 || iy >= in_h) {
+						memset(dst, 0, size);
+						dst += size;
+						continue;
+					}
+					const int8_t * src = plane + (ssize_t)iy * in_w;
+					for(int kx = 0; kx < size; ++kx)
+					{
+						int ix = ox * stride + kx - pad;
+						*dst++ = (ix < 0 || ix >= in_w)?0:src[ix];
+					}
+				}
+			}
+		}
+		memset(row + conv->k, 0, conv->k_padded - conv->k);
+	}
+}
+
+void int8_conv_forward(const int8_conv_t * conv, const float * input, float * output, int8_conv_scratch_t * scratch)
+{
+	assert(conv && input && output && scratch);
+	const enum int8_conv_level level = int8_conv_get_level();
+	const quantize_func quantize = s_kernels[level].quantize;
+	const dot4x2_func dot4x2 = s_kernels[level].dot4x2;
+	const dot1_func dot1 = s_kernels[level].dot1;
+	const int unsigned_input = s_kernels[level].unsigned_input;
+
+	const ssize_t input_size = (ssize_t)conv->in_c * conv->in_h * conv->in_w;
+	const int M = conv->out_c;
+	const int N = conv->out_h * conv->out_w;
+	const int Kp = conv->k_padded;
+
+	size_t input_bytes = (input_size + INT8_CONV_ALIGNMENT - 1) / INT8_CONV_ALIGNMENT * INT8_CONV_ALIGNMENT;
+	int8_t * q_input = scratch_reserve(scratch, input_bytes + (size_t)INT8_CONV_N_TILE * Kp);
+	int8_t * cols = q_input + input_bytes;
+
+	float input_scale = conv->input_scale;
+	if(input_scale <= 0)
+	{
+		float max_value = int8_max_abs(input, input_size);
+		input_scale = (max_value > 0)?(max_value / 127.0f):1.0f;
+	}
+	quantize(input, input_size, 1.0f / input_scale, q_input);
+
+	for(int n0 = 0; n0 < N; n0 += INT8_CONV_N_TILE)
+	{
+		int n1 = n0 + INT8_CONV_N_TILE;
+		if(n1 > N) n1 = N;
+		im2col_tile(conv, q_input, n0, n1, cols);
+
+		for(int m = 0; m < M; m += 4)
+		{
+			int rows = (M - m < 4)?(M - m):4;
+			const int8_t * w = conv->weights + (ssize_t)m * Kp;
+			float multipliers[4];
+			int32_t corrections[4];
+			for(int r = 0; r < rows; ++r)
+			{
+				multipliers[r] = input_scale * conv->multipliers[m + r];
+				corrections[r] = unsigned_input?(128 * conv->weight_sums[m + r]):0;
+			}
+
+			int n = n0;
+			if(rows == 4)
+			{
+				for(; n + 2 <= n1; n += 2)
+				{
+					int32_t acc[4][2];
+					dot4x2(w, Kp, cols + (ssize_t)(n - n0) * Kp, Kp, Kp, acc);
+					for(int r = 0; r < 4; ++r)
+					{
+						float * dst = output + (ssize_t)(m + r) * N + n;
+						dst[0] = (float)(acc[r][0] - corrections[r]) * multipliers[r] + conv->biases[m + r];
+						dst[1] = (float)(acc[r][1] - corrections[r]) * multipliers[r] + conv->biases[m + r];
+					}
+				}
+			}
+			for(; n < n1; ++n)	// the remaining rows / columns
+			{
+				const int8_t * x = cols + (ssize_t)(n - n0) * Kp;
+				for(int r = 0; r < rows; ++r)
+				{
+					int32_t acc = dot1(w + (ssize_t)r * Kp, x, Kp);
+					output[(ssize_t)(m + r) * N + n] = (float)(acc - corrections[r]) * multipliers[r] + conv->biases[m + r];
+				}
+			}
+		}
+	}
+}
+
+#undef INT8_CONV_ALIGNMENT
+#undef INT8_CONV_K_ALIGN
+#undef INT8_CONV_N_TILE
@@ -0,0 +1,510 @@
+/*
+ * jpeg-encoder.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "jpeg-encoder.h"
+#include "utils.h"
+
+#define JPEG_ENCODER_MAX_WORKERS	(256)
+#define JPEG_ENCODER_MIN_SLICE_ROWS	(64)		// smaller slices do not pay for their headers
+#define JPEG_ENCODER_MAX_ROWS		(16)		// scanlines per jpeg_write_scanlines()
+#define JPEG_ENCODER_MIN_BUFFER		(64 * 1024)
+
+typedef struct jpeg_buffer
+{
+	unsigned char * data;
+	size_t length;
+	size_t capacity;
+	struct jpeg_buffer * next;		// free list
+}jpeg_buffer_t;
+
+typedef struct jpeg_encode_job jpeg_encode_job_t;
+typedef struct jpeg_slice
+{
+	jpeg_encode_job_t * job;
+	int y, height;					// pixel rows of the frame
+	jpeg_buffer_t * output;
+	struct jpeg_slice * next;		// ready queue
+}jpeg_slice_t;
+
+struct jpeg_encode_job
+{
+	const bgra_image_t * image;
+	const jpeg_encode_params_t * params;
+	unsigned int restart_interval;	// MCUs, 0: single slice
+	int pending;					// slices not yet encoded, protected by the encoder's mutex
+	int failed;
+};
+
+typedef struct jpeg_worker
+{
+	jpeg_encoder_t * encoder;
+	pthread_t th;
+
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	jmp_buf setjmp_buffer;
+	struct jpeg_destination_mgr dest;
+	jpeg_buffer_t * output;			// the buffer of the current slice
+}jpeg_worker_t;
+
+struct jpeg_encoder
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;			// ready queue is not empty / quit
+	pthread_cond_t done_cond;		// a slice has been encoded
+	int quit;
+
+	int num_workers;
+	jpeg_worker_t * workers;
+
+	jpeg_slice_t * head;			// ready queue
+	jpeg_slice_t * tail;
+	jpeg_buffer_t * free_buffers;
+};
+
+void jpeg_encode_params_init(jpeg_encode_params_t * params)
+{
+	assert(params);
+	params->quality = 95;
+	params->subsampling = jpeg_subsampling_420;
+	params->max_slices = 0;
+}
+
+static int jpeg_buffer_reserve(jpeg_buffer_t * buffer, size_t size)
+{
+	if(size <= buffer->capacity) return 0;
+	size_t new_size = buffer->capacity?buffer->capacity:JPEG_ENCODER_MIN_BUFFER;
+	while(new_size < size) new_size *= 2;
+
+	unsigned char * data = realloc(buffer->data, new_size);
+	assert(data);
+	buffer->data = data;
+	buffer->capacity = new_size;
+	return 0;
+}
+
+/*****************************************************************
+ * libjpeg callbacks: errors and a growing memory destination
+ *****************************************************************/
+static void on_jpeg_compress_error(j_common_ptr cinfo)
+{
+	jpeg_worker_t * worker = cinfo->client_data;
+	assert(worker);
+	cinfo->err->output_message(cinfo);
+	longjmp(worker->setjmp_buffer, 1);
+}
+
+static void dest_init(j_compress_ptr cinfo)
+{
+	jpeg_worker_t * worker = cinfo->client_data;
+	jpeg_buffer_t * output = worker->output;
+	jpeg_buffer_reserve(output, JPEG_ENCODER_MIN_BUFFER);
+	worker->dest.next_output_byte = output->data;
+	worker->dest.free_in_buffer = output->capacity;
+}
+
+static boolean dest_empty_output_buffer(j_compress_ptr cinfo)
+{
+	// called when the whole buffer is full
+	jpeg_worker_t * worker = cinfo->client_data;
+	jpeg_buffer_t * output = worker->output;
+	size_t length = output->capacity;
+	jpeg_buffer_reserve(output, length * 2);
+	worker->dest.next_output_byte = output->data + length;
+	worker->dest.free_in_buffer = output->capacity - length;
+	return TRUE;
+}
+
+static void dest_term(j_compress_ptr cinfo)
+{
+	jpeg_worker_t * worker = cinfo->client_data;
+	worker->output->length = worker->output->capacity - worker->dest.free_in_buffer;
+}
+
+/*****************************************************************
+ * workers
+ *****************************************************************/
+static int encode_slice(jpeg_worker_t * worker, jpeg_slice_t * slice)
+{
+	struct jpeg_compress_struct * cinfo = &worker->cinfo;
+	const jpeg_encode_job_t * job = slice->job;
+	const bgra_image_t * image = job->image;
+	const jpeg_encode_params_t * params = job->params;
+
+	worker->output = slice->output;
+	if(setjmp(worker->setjmp_buffer))
+	{
+		jpeg_abort_compress(cinfo);		// the compressor is reusable
+		return -1;
+	}
+
+	cinfo->image_width = image->width;
+	cinfo->image_height = slice->height;
+	cinfo->input_components = 4;
+	cinfo->in_color_space = JCS_EXT_BGRA;
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, params->quality, TRUE);
+
+	static const int luma_factors[][2] = {
+		[jpeg_subsampling_444] = { 1, 1 },
+		[jpeg_subsampling_422] = { 2, 1 },
+		[jpeg_subsampling_420] = { 2, 2 },
+	};
+	cinfo->comp_info[0].h_samp_factor = luma_factors[params->subsampling][0];
+	cinfo->comp_info[0].v_samp_factor = luma_factors[params->subsampling][1];
+	for(int i = 1; i < cinfo->num_components; ++i) {
+		cinfo->comp_info[i].h_samp_factor = 1;
+		cinfo->comp_info[i].v_samp_factor = 1;
+	}
+	cinfo->restart_interval = job->restart_interval;
+
+	jpeg_start_compress(cinfo, TRUE);
+
+	int stride = image->stride?image->stride:(image->width * 4);
+	const unsigned char * data = image->data + (size_t)stride * slice->y;
+	JSAMPROW rows[JPEG_ENCODER_MAX_ROWS];
+	while(cinfo->next_scanline < cinfo->image_height)
+	{
+		int num_rows = cinfo->image_height - cinfo->next_scanline;
+		if(num_rows > JPEG_ENCODER_MAX_ROWS) num_rows = JPEG_ENCODER_MAX_ROWS;
+		for(int i = 0; i < num_rows; ++i) {
+			rows[i] = (JSAMPROW)(data + (size_t)stride * (cinfo->next_scanline + i));
+		}
+		jpeg_write_scanlines(cinfo, rows, num_rows);
+	}
+	jpeg_finish_compress(cinfo);
+	return 0;
+}
+
+static jpeg_slice_t * ready_queue_pop(jpeg_encoder_t * encoder)
+{
+	jpeg_slice_t * slice = encoder->head;
+	if(NULL == slice) return NULL;
+
+	encoder->head = slice->next;
+	if(NULL == encoder->head) encoder->tail = NULL;
+	slice->next = NULL;
+	return slice;
+}
+
+/* encoder->mutex locked */
+static void ready_queue_push(jpeg_encoder_t * encoder, jpeg_slice_t * slice)
+{
+	slice->next = NULL;
+	if(encoder->tail) encoder->tail->next = slice;
+	else encoder->head = slice;
+	encoder->tail = slice;
+}
+
+static void * jpeg_worker_thread(void * user_data)
+{
+	jpeg_worker_t * worker = user_data;
+	jpeg_encoder_t * encoder = worker->encoder;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while(!encoder->quit)
+	{
+		jpeg_slice_t * slice = ready_queue_pop(encoder);
+		if(NULL == slice)
+		{
+			pthread_cond_wait(&encoder->cond, &encoder->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&encoder->mutex);
+
+		int rc = encode_slice(worker, slice);
+
+		pthread_mutex_lock(&encoder->mutex);
+		if(rc) slice->job->failed = 1;
+		if(--slice->job->pending == 0) pthread_cond_broadcast(&encoder->done_cond);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+	pthread_exit((void *)(long)0);
+}
+
+jpeg_encoder_t * jpeg_encoder_new(int num_workers)
+{
+	if(num_workers <= 0) num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(num_workers <= 0) num_workers = 1;
+	if(num_workers > JPEG_ENCODER_MAX_WORKERS) num_workers = JPEG_ENCODER_MAX_WORKERS;
+
+	jpeg_encoder_t * encoder = calloc(1, sizeof(*encoder));
+	assert(encoder);
+	int rc = pthread_mutex_init(&encoder->mutex, NULL);
+	assert(0 == rc);
+	rc = pthread_cond_init(&encoder->cond, NULL);
+	assert(0 == rc);
+	rc = pthread_cond_init(&encoder->done_cond, NULL);
+	assert(0 == rc);
+
+	encoder->workers = calloc(num_workers, sizeof(*encoder->workers));
+	assert(encoder->workers);
+	encoder->num_workers = num_workers;
+	for(int i = 0; i < num_workers; ++i)
+	{
+		jpeg_worker_t * worker = &encoder->workers[i];
+		worker->encoder = encoder;
+
+		struct jpeg_compress_struct * cinfo = &worker->cinfo;
+		cinfo->err = jpeg_std_error(&worker->jerr);
+		worker->jerr.error_exit = on_jpeg_compress_error;
+		jpeg_create_compress(cinfo);
+		cinfo->client_data = worker;
+
+		worker->dest.init_destination = dest_init;
+		worker->dest.empty_output_buffer = dest_empty_output_buffer;
+		worker->dest.term_destination = dest_term;
+		cinfo->dest = &worker->dest;
+
+		rc = pthread_create(&worker->th, NULL, jpeg_worker_thread, worker);
+		assert(0 == rc);
+	}
+	debug_printf("%s(): %d workers", __FUNCTION__, num_workers);
+	return encoder;
+}
+
+void jpeg_encoder_free(jpeg_encoder_t * encoder)
+{
+	if(NULL == encoder) return;
+
+	pthread_mutex_lock(&encoder->mutex);
+	encoder->quit = 1;
+	pthread_cond_broadcast(&encoder->cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	for(int i = 0; i < encoder->num_workers; ++i)
+	{
+		jpeg_worker_t * worker = &encoder->workers[i];
+		void * exit_code = NULL;
+		pthread_join(worker->th, &exit_code);
+
+		worker->cinfo.dest = NULL;		// not allocated by libjpeg
+		jpeg_destroy_compress(&worker->cinfo);
+	}
+	free(encoder->workers);
+
+	jpeg_buffer_t * buffer = encoder->free_buffers;
+	while(buffer)
+	{
+		jpeg_buffer_t * next = buffer->next;
+		free(buffer->data);
+		free(buffer);
+		buffer = next;
+	}
+
+	pthread_cond_destroy(&encoder->done_cond);
+	pthread_cond_destroy(&encoder->cond);
+	pthread_mutex_destroy(&encoder->mutex);
+	free(encoder);
+}
+
+static pthread_once_t s_once_key = PTHREAD_ONCE_INIT;
+static jpeg_encoder_t * s_default_encoder;
+static void init_default_encoder(void)
+{
+	s_default_encoder = jpeg_encoder_new(0);
+}
+
+jpeg_encoder_t * jpeg_encoder_get_default(void)
+{
+	pthread_once(&s_once_key, init_default_encoder);
+	return s_default_encoder;
+}
+
+/*****************************************************************
+ * slices --> one stream
+ *****************************************************************/
+
+/* the offset of the first byte after the segment of @marker (SOI excluded), 0: not found */
+static size_t find_segment_end(const unsigned char * jpeg, size_t length, unsigned char marker, size_t * p_segment)
+{
+	size_t offset = 2;
+	while(offset + 4 <= length)
+	{
+		if(jpeg[offset] != 0xff) return 0;
+		size_t segment_length = ((size_t)jpeg[offset + 2] << 8) | jpeg[offset + 3];
+		if(offset + 2 + segment_length > length) return 0;
+		if(jpeg[offset + 1] == marker)
+		{
+			if(p_segment) *p_segment = offset;
+			return offset + 2 + segment_length;
+		}
+		offset += 2 + segment_length;
+	}
+	return 0;
+}
+
+/*
+ * slices[0]: headers (SOF height patched to the whole frame) + entropy-coded segment,
+ * slices[k]: RST((k - 1) % 8) + entropy-coded segment, then EOI.
+ */
+static ssize_t join_slices(const jpeg_slice_t * slices, int num_slices, int height, unsigned char ** p_jpeg, size_t * p_capacity)
+{
+	size_t total = 0;
+	size_t scan_offsets[num_slices];
+	for(int i = 0; i < num_slices; ++i)
+	{
+		const jpeg_buffer_t * output = slices[i].output;
+		size_t offset = find_segment_end(output->data, output->length, 0xda, NULL);	// SOS
+		if(0 == offset || output->length < offset + 2) return -1;
+		if(output->data[output->length - 2] != 0xff || output->data[output->length - 1] != 0xd9) return -1;	// EOI
+
+		scan_offsets[i] = offset;
+		total += (i == 0)?(output->length - 2):(2 + output->length - 2 - offset);
+	}
+	total += 2;
+
+	unsigned char * jpeg = *p_jpeg;
+	if(NULL == jpeg || *p_capacity < total)
+	{
+		jpeg = realloc(jpeg, total);
+		assert(jpeg);
+		*p_jpeg = jpeg;
+		*p_capacity = total;
+	}
+
+	unsigned char * p = jpeg;
+	memcpy(p, slices[0].output->data, slices[0].output->length - 2);
+	size_t sof = 0;
+	if(0 == find_segment_end(p, scan_offsets[0], 0xc0, &sof)) return -1;	// baseline SOF0: length, precision, height
+	p[sof + 5] = (unsigned char)(height >> 8);
+	p[sof + 6] = (unsigned char)(height & 0xff);
+	p += slices[0].output->length - 2;
+
+	for(int i = 1; i < num_slices; ++i)
+	{
+		const jpeg_buffer_t * output = slices[i].output;
+		*p++ = 0xff;
+		*p++ = 0xd0 + ((i - 1) & 7);
+		size_t length = output->length - 2 - scan_offsets[i];
+		memcpy(p, output->data + scan_offsets[i], length);
+		p += length;
+	}
+	*p++ = 0xff;
+	*p++ = 0xd9;
+	assert((size_t)(p - jpeg) == total);
+	return total;
+}
+
+ssize_t jpeg_encoder_encode(jpeg_encoder_t * encoder, const bgra_image_t * image, const jpeg_encode_params_t * _params,
+	unsigned char ** p_jpeg, size_t * p_capacity)
+{
+	assert(encoder && image && p_jpeg && p_capacity);
+	if(NULL == image->data || image->width < 1 || image->height < 1) return -1;
+	assert(image->channels == 0 || image->channels == 4);
+
+	jpeg_encode_params_t params = { 0 };
+	if(_params) params = *_params;
+	else jpeg_encode_params_init(&params);
+	if(params.quality < 1 || params.quality > 100) params.quality = 95;
+	if(params.subsampling < jpeg_subsampling_444 || params.subsampling > jpeg_subsampling_420) params.subsampling = jpeg_subsampling_420;
+
+	// slices of whole MCU rows, the restart interval (DRI) is 16 bits
+	int mcu_width = (params.subsampling == jpeg_subsampling_444)?8:16;
+	int mcu_height = (params.subsampling == jpeg_subsampling_420)?16:8;
+	int mcus_per_row = (image->width + mcu_width - 1) / mcu_width;
+	int mcu_rows = (image->height + mcu_height - 1) / mcu_height;
+
+	int num_slices = (params.max_slices > 0)?params.max_slices:encoder->num_workers;
+	int max_slices = image->height / JPEG_ENCODER_MIN_SLICE_ROWS;
+	if(num_slices > max_slices) num_slices = max_slices;
+	if(mcus_per_row > 65535) num_slices = 1;
+
+	int slice_mcu_rows = mcu_rows;
+	if(num_slices > 1)
+	{
+		slice_mcu_rows = (mcu_rows + num_slices - 1) / num_slices;
+		if(slice_mcu_rows * mcus_per_row > 65535) slice_mcu_rows = 65535 / mcus_per_row;
+		num_slices = (mcu_rows + slice_mcu_rows - 1) / slice_mcu_rows;
+	}
+	if(num_slices < 1) num_slices = 1;
+
+	jpeg_encode_job_t job = {
+		.image = image,
+		.params = &params,
+		.restart_interval = (num_slices > 1)?(unsigned int)(slice_mcu_rows * mcus_per_row):0,
+		.pending = num_slices,
+	};
+	jpeg_slice_t slices[num_slices];
+	memset(slices, 0, sizeof(slices));
+
+	// a single slice is written into the caller's buffer
+	jpeg_buffer_t caller_buffer = { .data = *p_jpeg, .capacity = *p_jpeg?*p_capacity:0 };
+
+	pthread_mutex_lock(&encoder->mutex);
+	for(int i = 0; i < num_slices; ++i)
+	{
+		jpeg_slice_t * slice = &slices[i];
+		slice->job = &job;
+		slice->y = i * slice_mcu_rows * mcu_height;
+		slice->height = (i == num_slices - 1)?(image->height - slice->y):(slice_mcu_rows * mcu_height);
+
+		if(num_slices == 1) slice->output = &caller_buffer;
+		else if(encoder->free_buffers)
+		{
+			slice->output = encoder->free_buffers;
+			encoder->free_buffers = slice->output->next;
+			slice->output->next = NULL;
+		}else
+		{
+			slice->output = calloc(1, sizeof(*slice->output));
+			assert(slice->output);
+		}
+		ready_queue_push(encoder, slice);
+	}
+	pthread_cond_broadcast(&encoder->cond);
+	while(job.pending > 0) pthread_cond_wait(&encoder->done_cond, &encoder->mutex);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	ssize_t length = -1;
+	if(num_slices == 1)
+	{
+		*p_jpeg = caller_buffer.data;
+		*p_capacity = caller_buffer.capacity;
+		if(!job.failed) length = caller_buffer.length;
+		return length;
+	}
+
+	if(!job.failed) length = join_slices(slices, num_slices, image->height, p_jpeg, p_capacity);
+
+	pthread_mutex_lock(&encoder->mutex);
+	for(int i = 0; i < num_slices; ++i)
+	{
+		slices[i].output->next = encoder->free_buffers;
+		encoder->free_buffers = slices[i].output;
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+	return length;
+}
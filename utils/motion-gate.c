@@ -0,0 +1,301 @@
+/*
+ * motion-gate.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "motion-gate.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTION_GATE_X86
+#include <immintrin.h>
+#endif
+
+#define MOTION_GATE_MAX_BLOCK	(256)	// 256 rows * 255 fit in the uint16 sums
+
+struct motion_gate
+{
+	motion_gate_params_t params;
+	motion_gate_stats_t stats;
+
+	// geometry of the last frame
+	int frame_width, frame_height;
+	int block;						// source pixels per gray pixel (in both directions)
+	int width, height;				// gray image
+
+	uint16_t * sums;				// [frame_width], one row of blocks
+	unsigned char * current;		// [width * height]
+	unsigned char * reference;		// gray image of the last inference
+	int has_reference;
+
+	int cooldown;					// frames left to predict after the last motion
+	int skipped;					// frames since the last inference
+};
+
+void motion_gate_params_init(motion_gate_params_t * params)
+{
+	assert(params);
+	memset(params, 0, sizeof(*params));
+	params->width = 160;
+	params->pixel_thresh = 20;
+	params->change_ratio = 0.002;
+	params->cooldown = 5;
+	params->max_skipped = 150;
+}
+
+motion_gate_t * motion_gate_new(const motion_gate_params_t * params)
+{
+	motion_gate_t * gate = calloc(1, sizeof(*gate));
+	assert(gate);
+
+	if(params) gate->params = *params;
+	else motion_gate_params_init(&gate->params);
+
+	if(gate->params.width < 1) gate->params.width = 160;
+	if(gate->params.pixel_thresh < 0) gate->params.pixel_thresh = 0;
+	if(gate->params.pixel_thresh > 255) gate->params.pixel_thresh = 255;
+	if(gate->params.cooldown < 0) gate->params.cooldown = 0;
+	return gate;
+}
+
+void motion_gate_free(motion_gate_t * gate)
+{
+	if(NULL == gate) return;
+	free(gate->sums);
+	free(gate->current);
+	free(gate->reference);
+	free(gate);
+}
+
+void motion_gate_reset(motion_gate_t * gate)
+{
+	assert(gate);
+	gate->has_reference = 0;
+	gate->cooldown = 0;
+	gate->skipped = 0;
+}
+
+void motion_gate_get_stats(const motion_gate_t * gate, motion_gate_stats_t * stats)
+{
+	assert(gate && stats);
+	*stats = gate->stats;
+}
+
+/******************************************************************************
+ * kernels
+ *   gray = (B * 15 + G * 75 + R * 38) >> 7, (BT.601 weights in 7 bits, no overflow in int16)
+ *****************************************************************************/
+static void luma_row_scalar(const unsigned char * bgra, int width, uint16_t * sums)
+{
+	for(int x = 0; x < width; ++x, bgra += 4)
+	{
+		sums[x] += (bgra[0] * 15 + bgra[1] * 75 + bgra[2] * 38) >> 7;
+	}
+}
+
+static ssize_t count_changed_scalar(const unsigned char * a, const unsigned char * b, ssize_t count, int thresh)
+{
+	ssize_t changed = 0;
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		int diff = (int)a[i] - (int)b[i];
+		if(diff > thresh || diff < -thresh) ++changed;
+	}
+	return changed;
+}
+
+#ifdef MOTION_GATE_X86
+__attribute__((target("sse4.1")))
+static ssize_t count_changed_sse4(const unsigned char * a, const unsigned char * b, ssize_t count, int thresh)
+{
+	const __m128i t = _mm_set1_epi8((char)thresh);
+	const __m128i zero = _mm_setzero_si128();
+	ssize_t changed = 0;
+	ssize_t i = 0;
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		int unchanged = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(diff, t), zero));
+		changed += 16 - __builtin_popcount(unchanged);
+	}
+	return changed + count_changed_scalar(a + i, b + i, count - i, thresh);
+}
+
+__attribute__((target("avx2")))
+static void luma_row_avx2(const unsigned char * bgra, int width, uint16_t * sums)
+{
+	const __m256i weights = _mm256_set1_epi32(0x00264b0f);	// B: 15, G: 75, R: 38, A: 0
+	int x = 0;
+	for(; x + 16 <= width; x += 16)
+	{
+		// 2 x 8 pixels --> [B*15 + G*75, R*38] pairs --> 16 gray values in pixel order
+		__m256i p0 = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(bgra + x * 4)), weights);
+		__m256i p1 = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(bgra + x * 4 + 32)), weights);
+		__m256i gray = _mm256_permute4x64_epi64(_mm256_hadd_epi16(p0, p1), _MM_SHUFFLE(3, 1, 2, 0));
+		gray = _mm256_srli_epi16(gray, 7);
+
+		__m256i sum = _mm256_loadu_si256((const __m256i *)(sums + x));
+		_mm256_storeu_si256((__m256i *)(sums + x), _mm256_add_epi16(sum, gray));
+	}
+	luma_row_scalar(bgra + x * 4, width - x, sums + x);
+}
+
+__attribute__((target("avx2")))
+static ssize_t count_changed_avx2(const unsigned char * a, const unsigned char * b, ssize_t count, int thresh)
+{
+	const __m256i t = _mm256_set1_epi8((char)thresh);
+	const __m256i zero = _mm256_setzero_si256();
+	ssize_t changed = 0;
+	ssize_t i = 0;
+	for(; i + 32 <= count; i += 32)
+	{
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		__m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+		unsigned int unchanged = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(diff, t), zero));
+		changed += 32 - __builtin_popcount(unchanged);
+	}
+	return changed + count_changed_scalar(a + i, b + i, count - i, thresh);
+}
+#endif
+
+void motion_gate_luma_row(const unsigned char * bgra, int width, uint16_t * sums, enum img_simd_level level)
+{
+#ifdef MOTION_GATE_X86
+	if(level >= img_simd_level_avx2) { luma_row_avx2(bgra, width, sums); return; }
+#endif
+	luma_row_scalar(bgra, width, sums);
+}
+
+ssize_t motion_gate_count_changed(const unsigned char * a, const unsigned char * b, ssize_t count, int thresh, enum img_simd_level level)
+{
+#ifdef MOTION_GATE_X86
+	if(level >= img_simd_level_avx2) return count_changed_avx2(a, b, count, thresh);
+	if(level >= img_simd_level_sse4) return count_changed_sse4(a, b, count, thresh);
+#endif
+	return count_changed_scalar(a, b, count, thresh);
+}
+
+/******************************************************************************
+ * gate
+ *****************************************************************************/
+static void motion_gate_resize(motion_gate_t * gate, int frame_width, int frame_height)
+{
+	if(frame_width == gate->frame_width && frame_height == gate->frame_height) return;
+
+	int block = frame_width / gate->params.width;
+	if(block < 1) block = 1;
+	if(block > MOTION_GATE_MAX_BLOCK) block = MOTION_GATE_MAX_BLOCK;
+	if(block > frame_height) block = frame_height;
+
+	gate->frame_width = frame_width;
+	gate->frame_height = frame_height;
+	gate->block = block;
+	gate->width = frame_width / block;
+	gate->height = frame_height / block;
+
+	gate->sums = realloc(gate->sums, sizeof(*gate->sums) * frame_width);
+	gate->current = realloc(gate->current, gate->width * gate->height);
+	gate->reference = realloc(gate->reference, gate->width * gate->height);
+	assert(gate->sums && gate->current && gate->reference);
+
+	gate->has_reference = 0;
+	debug_printf("%s(): %d x %d --> %d x %d", __FUNCTION__, frame_width, frame_height, gate->width, gate->height);
+}
+
+static void motion_gate_downscale(motion_gate_t * gate, const bgra_image_t * image, enum img_simd_level level)
+{
+	const int block = gate->block;
+	const int stride = (image->stride >= image->width * 4)?image->stride:(image->width * 4);
+	const int row_width = gate->width * block;
+	const unsigned int area = block * block;
+
+	for(int gy = 0; gy < gate->height; ++gy)
+	{
+		memset(gate->sums, 0, sizeof(*gate->sums) * row_width);
+		const unsigned char * row = image->data + (ssize_t)stride * gy * block;
+		for(int y = 0; y < block; ++y, row += stride) motion_gate_luma_row(row, row_width, gate->sums, level);
+
+		unsigned char * dst = gate->current + gy * gate->width;
+		const uint16_t * sums = gate->sums;
+		for(int gx = 0; gx < gate->width; ++gx, sums += block)
+		{
+			unsigned int sum = 0;
+			for(int x = 0; x < block; ++x) sum += sums[x];
+			dst[gx] = (unsigned char)(sum / area);
+		}
+	}
+}
+
+int motion_gate_update(motion_gate_t * gate, const bgra_image_t * image)
+{
+	assert(gate);
+	if(NULL == image || NULL == image->data || image->width < 1 || image->height < 1) return -1;
+
+	enum img_simd_level level = img_preprocess_get_simd_level();
+	motion_gate_resize(gate, image->width, image->height);
+	motion_gate_downscale(gate, image, level);
+
+	++gate->stats.frames;
+	int predict = 1;
+	if(gate->has_reference)
+	{
+		ssize_t count = (ssize_t)gate->width * gate->height;
+		ssize_t changed = motion_gate_count_changed(gate->current, gate->reference, count, gate->params.pixel_thresh, level);
+		gate->stats.last_ratio = (double)changed / (double)count;
+
+		int motion = (changed > 0 && gate->stats.last_ratio >= gate->params.change_ratio);
+		if(motion) {
+			gate->cooldown = gate->params.cooldown;
+		}else if(gate->cooldown > 0) {
+			--gate->cooldown;
+			motion = 1;
+		}
+
+		predict = motion || (gate->params.max_skipped > 0 && gate->skipped >= gate->params.max_skipped);
+	}
+
+	if(!predict) {
+		++gate->skipped;
+		++gate->stats.skipped;
+		return 0;
+	}
+
+	// the next frames are compared with this one
+	unsigned char * reference = gate->reference;
+	gate->reference = gate->current;
+	gate->current = reference;
+	gate->has_reference = 1;
+	gate->skipped = 0;
+	++gate->stats.predicted;
+	return 1;
+}
+
+#undef MOTION_GATE_MAX_BLOCK
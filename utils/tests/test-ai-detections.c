@@ -0,0 +1,239 @@
+/*
+ * test-ai-detections.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "ai-detections.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-ai-detections [--bench [num_boxes iterations]]
+ *   check the serialization formats and the content negotiation,
+ *   and optionally compare them with building json-c trees.
+ */
+
+static const char * s_labels[] = { "person", "car", "traffic \"light\"", "dog" };
+
+static void fill_detections(ai_detections_t * detections, int num_boxes)
+{
+	detections->model = "test-model";
+	detections->labels = s_labels;
+	detections->num_labels = sizeof(s_labels) / sizeof(s_labels[0]);
+	ai_detections_reset(detections);
+
+	for(int i = 0; i < num_boxes; ++i)
+	{
+		ai_detection_box_t * box = ai_detections_add(detections);
+		assert(box);
+		box->left = (float)i / num_boxes;
+		box->top = 0.25f;
+		box->width = 0.125f;
+		box->height = 0.5f + (float)i / (num_boxes * 4);
+		box->confidence = 0.5f + (float)(i % 50) / 100.0f;
+		box->class_index = i % detections->num_labels;
+	}
+}
+
+static int test_json(const ai_detections_t * detections)
+{
+	auto_buffer_t buf[1];
+	memset(buf, 0, sizeof(buf));
+	ssize_t cb = ai_detections_serialize(detections, ai_detections_format_json, buf);
+	assert(cb > 0 && cb == buf->length);
+
+	json_object * jresults = json_tokener_parse((char *)buf->data);
+	assert(jresults);
+
+	json_object * jdetections = NULL;
+	json_object_object_get_ex(jresults, "detections", &jdetections);
+	assert(jdetections);
+	assert(json_object_array_length(jdetections) == detections->count);
+
+	for(ssize_t i = 0; i < detections->count; ++i)
+	{
+		const ai_detection_box_t * box = &detections->boxes[i];
+		json_object * jdet = json_object_array_get_idx(jdetections, i);
+		json_object * jvalue = NULL;
+
+		json_object_object_get_ex(jdet, "class", &jvalue);
+		assert(strcmp(json_object_get_string(jvalue), s_labels[box->class_index]) == 0);
+		json_object_object_get_ex(jdet, "class_index", &jvalue);
+		assert(json_object_get_int(jvalue) == box->class_index);
+		json_object_object_get_ex(jdet, "height", &jvalue);
+		assert(fabs(json_object_get_double(jvalue) - box->height) < 1e-5);
+		json_object_object_get_ex(jdet, "confidence", &jvalue);
+		assert(fabs(json_object_get_double(jvalue) - box->confidence) < 1e-5);
+	}
+	json_object_put(jresults);
+	auto_buffer_cleanup(buf);
+	printf("[OK]: json, %ld boxes\n", (long)detections->count);
+	return 0;
+}
+
+static int test_binary(const ai_detections_t * detections)
+{
+	auto_buffer_t buf[1];
+	memset(buf, 0, sizeof(buf));
+	ssize_t cb = ai_detections_serialize(detections, ai_detections_format_binary, buf);
+	assert(cb > 24);
+
+	const unsigned char * p = buf->data;
+	assert(memcmp(p, AI_DETECTIONS_BINARY_MAGIC, 4) == 0);
+	assert(p[4] == AI_DETECTIONS_BINARY_VERSION && p[5] == 0);
+	assert(p[6] == 24);
+
+	uint32_t count = p[8] | (p[9] << 8) | (p[10] << 16) | ((uint32_t)p[11] << 24);
+	uint32_t num_labels = p[12] | (p[13] << 8);
+	uint32_t model_length = p[16] | (p[17] << 8);
+	assert(count == detections->count);
+	assert(num_labels == detections->num_labels);
+	assert(model_length == strlen(detections->model));
+	p += 24 + model_length;
+
+	for(uint32_t i = 0; i < num_labels; ++i)
+	{
+		size_t length = p[0] | (p[1] << 8);
+		assert(length == strlen(s_labels[i]) && memcmp(p + 2, s_labels[i], length) == 0);
+		p += 2 + length;
+	}
+
+	assert((buf->data + cb) - p == (ssize_t)count * 24);
+	for(uint32_t i = 0; i < count; ++i, p += 24)
+	{
+		ai_detection_box_t box;
+		memcpy(&box, p, sizeof(box));	// little-endian host
+		assert(memcmp(&box, &detections->boxes[i], sizeof(box)) == 0);
+	}
+	auto_buffer_cleanup(buf);
+	printf("[OK]: binary, %ld bytes\n", (long)cb);
+	return 0;
+}
+
+static int test_msgpack(const ai_detections_t * detections)
+{
+	auto_buffer_t buf[1];
+	memset(buf, 0, sizeof(buf));
+	ssize_t cb = ai_detections_serialize(detections, ai_detections_format_msgpack, buf);
+	assert(cb > 0);
+
+	const unsigned char * p = buf->data;
+	assert(p[0] == 0x82);								// fixmap(2)
+	assert(p[1] == (0xa0 | 5) && memcmp(p + 2, "model", 5) == 0);
+	p += 7;
+	assert(p[0] == (0xa0 | strlen(detections->model)));
+	p += 1 + strlen(detections->model);
+	assert(p[0] == (0xa0 | 10) && memcmp(p + 1, "detections", 10) == 0);
+	p += 11;
+
+	if(detections->count < 16) { assert(p[0] == (0x90 | detections->count)); p += 1; }
+	else if(detections->count < 65536) { assert(p[0] == 0xdc && ((p[1] << 8) | p[2]) == detections->count); p += 3; }
+	if(detections->count > 0) assert(p[0] == 0x87);	// fixmap(7)
+	printf("[OK]: msgpack, %ld bytes\n", (long)cb);
+
+	auto_buffer_cleanup(buf);
+	return 0;
+}
+
+static int test_accept(void)
+{
+	static const struct { const char * accept; enum ai_detections_format format; } s_cases[] = {
+		{ NULL, ai_detections_format_json },
+		{ "*/*", ai_detections_format_json },
+		{ "application/msgpack", ai_detections_format_msgpack },
+		{ "text/html, application/x-ai-detections", ai_detections_format_binary },
+		{ "application/json;q=0.5, application/x-msgpack;q=0.9", ai_detections_format_msgpack },
+		{ "application/octet-stream;q=0.1, */*;q=0.8", ai_detections_format_json },
+		{ "image/png", ai_detections_format_json },
+	};
+	for(size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); ++i)
+	{
+		enum ai_detections_format format = ai_detections_format_from_accept(s_cases[i].accept);
+		if(format != s_cases[i].format)
+		{
+			fprintf(stderr, "[FAILED]: accept='%s': %d != %d\n", s_cases[i].accept, format, s_cases[i].format);
+			return -1;
+		}
+	}
+	printf("[OK]: content negotiation\n");
+	return 0;
+}
+
+static void bench(int num_boxes, int iterations)
+{
+	ai_detections_t detections[1];
+	memset(detections, 0, sizeof(detections));
+	fill_detections(detections, num_boxes);
+
+	auto_buffer_t buf[1];
+	memset(buf, 0, sizeof(buf));
+
+	printf("benchmark: %d boxes, %d iterations\n", num_boxes, iterations);
+	double begin = app_timer_get_time();
+	for(int i = 0; i < iterations; ++i)
+	{
+		json_object * jresults = ai_detections_to_json(detections);
+		const char * sz = json_object_to_json_string_ext(jresults, JSON_C_TO_STRING_PLAIN);
+		assert(sz);
+		json_object_put(jresults);
+	}
+	printf("  %-8s: %8.3f ms\n", "json-c", test_bench_ms(begin, iterations));
+
+	for(int format = 0; format < ai_detections_formats_count; ++format)
+	{
+		begin = app_timer_get_time();
+		for(int i = 0; i < iterations; ++i)
+		{
+			auto_buffer_reset(buf);
+			ai_detections_serialize(detections, format, buf);
+		}
+		printf("  %-8s: %8.3f ms, %ld bytes\n", ai_detections_format_to_mime_type(format),
+			test_bench_ms(begin, iterations), (long)buf->length);
+	}
+	auto_buffer_cleanup(buf);
+	ai_detections_cleanup(detections);
+}
+
+int main(int argc, char **argv)
+{
+	ai_detections_t detections[1];
+	memset(detections, 0, sizeof(detections));
+
+	static const int num_boxes[] = { 0, 1, 15, 16, 300 };
+	for(size_t i = 0; i < sizeof(num_boxes) / sizeof(num_boxes[0]); ++i)
+	{
+		fill_detections(detections, num_boxes[i]);
+		if(test_json(detections) || test_binary(detections) || test_msgpack(detections)) return 1;
+	}
+	ai_detections_cleanup(detections);
+
+	if(test_accept()) return 1;
+
+	int args[2] = { 500, 1000 };	// num_boxes iterations
+	if(test_bench_args(argc, argv, 2, args)) bench(args[0], args[1]);
+	return 0;
+}
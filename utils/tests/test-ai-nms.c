@@ -0,0 +1,260 @@
+/*
+ * test-ai-nms.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ai-detections.h"
+#include "img_proc.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-ai-nms [--bench [num_boxes num_classes iterations]]
+ *   compare ai_nms() (every simd level) with a straightforward per-class NMS,
+ *   and optionally measure it against darknet's do_nms_sort() approach on synthetic boxes.
+ */
+
+#define NUM_CLASSES (80)
+
+/* clustered boxes (like the raw outputs of the yolo layers), with a few classes above the threshold */
+typedef struct synthetic_det
+{
+	float x, y, w, h;		// center + size (darknet's box)
+	float prob[NUM_CLASSES];
+}synthetic_det_t;
+
+static synthetic_det_t * generate_dets(int count, int num_classes, float thresh)
+{
+	synthetic_det_t * dets = calloc(count, sizeof(*dets));
+	assert(dets);
+
+	int num_clusters = count / 50 + 1;
+	for(int i = 0; i < count; ++i)
+	{
+		synthetic_det_t * det = &dets[i];
+		int cluster = rand() % num_clusters;
+		srand(cluster * 7919 + 1);
+		float cx = test_frand(), cy = test_frand(), cw = 0.02f + test_frand() * 0.2f, ch = 0.02f + test_frand() * 0.2f;
+		int klass = rand() % num_classes;
+		srand(i * 104729 + 7);
+
+		det->x = cx + (test_frand() - 0.5f) * cw * 0.5f;
+		det->y = cy + (test_frand() - 0.5f) * ch * 0.5f;
+		det->w = cw * (0.7f + test_frand() * 0.6f);
+		det->h = ch * (0.7f + test_frand() * 0.6f);
+
+		// darknet zeroes the probabilities below the threshold
+		if(test_frand() < 0.3f) det->prob[klass] = thresh + test_frand() * (1.0f - thresh);
+		if(test_frand() < 0.05f) det->prob[(klass + 1) % num_classes] = thresh + test_frand() * (1.0f - thresh);
+	}
+	return dets;
+}
+
+static ssize_t prefilter(const synthetic_det_t * dets, int count, int num_classes, float thresh, ai_nms_box_t * boxes)
+{
+	ssize_t num_boxes = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		for(int k = 0; k < num_classes; ++k)
+		{
+			if(dets[i].prob[k] <= thresh) continue;
+			ai_nms_box_t * box = &boxes[num_boxes++];
+			box->left = dets[i].x - dets[i].w / 2;
+			box->top = dets[i].y - dets[i].h / 2;
+			box->width = dets[i].w;
+			box->height = dets[i].h;
+			box->score = dets[i].prob[k];
+			box->class_index = k;
+			box->index = i;
+		}
+	}
+	return num_boxes;
+}
+
+/* reference: the same decision rule as ai_nms(), one box at a time */
+static int compare_score(const void * a, const void * b)
+{
+	const ai_nms_box_t * box_a = a, * box_b = b;
+	if(box_a->score != box_b->score) return (box_a->score > box_b->score)?-1:1;
+	if(box_a->class_index != box_b->class_index) return (box_a->class_index < box_b->class_index)?-1:1;
+	return (box_a->index < box_b->index)?-1:(box_a->index > box_b->index);
+}
+
+static ssize_t reference_nms(ai_nms_box_t * boxes, ssize_t count, float iou_thresh)
+{
+	qsort(boxes, count, sizeof(*boxes), compare_score);
+	char * suppressed = calloc(count + 1, 1);
+	ssize_t num_kept = 0;
+	for(ssize_t i = 0; i < count; ++i)
+	{
+		if(suppressed[i]) continue;
+		const ai_nms_box_t a = boxes[i];
+		boxes[num_kept++] = a;
+		for(ssize_t j = i + 1; j < count; ++j)
+		{
+			const ai_nms_box_t * b = &boxes[j];
+			if(b->class_index != a.class_index) continue;
+			float x1 = (a.left > b->left)?a.left:b->left;
+			float y1 = (a.top > b->top)?a.top:b->top;
+			float x2 = (a.left + a.width < b->left + b->width)?(a.left + a.width):(b->left + b->width);
+			float y2 = (a.top + a.height < b->top + b->height)?(a.top + a.height):(b->top + b->height);
+			if(x2 <= x1 || y2 <= y1) continue;
+			float inter = (x2 - x1) * (y2 - y1);
+			if(inter > iou_thresh * (a.width * a.height + b->width * b->height - inter)) suppressed[j] = 1;
+		}
+	}
+	free(suppressed);
+	return num_kept;
+}
+
+static int test_level(enum img_simd_level level)
+{
+	static const int sizes[] = { 0, 1, 2, 7, 33, 500, 3000 };
+	ai_nms_context_t * nms = ai_nms_context_new();
+	img_preprocess_set_simd_level(level);
+
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		int count = sizes[i];
+		synthetic_det_t * dets = generate_dets(count, 4, 0.25f);
+		ai_nms_box_t * boxes = calloc(count * 4 + 1, sizeof(*boxes));
+		ai_nms_box_t * expected = calloc(count * 4 + 1, sizeof(*expected));
+		assert(boxes && expected);
+
+		ssize_t num_boxes = prefilter(dets, count, 4, 0.25f, boxes);
+		memcpy(expected, boxes, sizeof(*boxes) * num_boxes);
+		ssize_t num_expected = reference_nms(expected, num_boxes, 0.45f);
+
+		for(int top_k = 0; top_k <= 5; top_k += 5)
+		{
+			ai_nms_box_t * result = calloc(num_boxes + 1, sizeof(*result));
+			memcpy(result, boxes, sizeof(*boxes) * num_boxes);
+			ssize_t num_kept = ai_nms(nms, result, num_boxes, 0.45f, top_k);
+
+			ssize_t num_check = (top_k > 0 && num_expected > top_k)?top_k:num_expected;
+			if(num_kept != num_check || memcmp(result, expected, sizeof(*result) * num_check))
+			{
+				fprintf(stderr, "[FAILED]: nms(%s): %ld candidates, top_k=%d, kept %ld != %ld\n",
+					img_simd_level_to_string(level), (long)num_boxes, top_k, (long)num_kept, (long)num_check);
+				return -1;
+			}
+			free(result);
+		}
+		free(dets);
+		free(boxes);
+		free(expected);
+	}
+	ai_nms_context_free(nms);
+	printf("[OK]: nms(%s)\n", img_simd_level_to_string(level));
+	return 0;
+}
+
+/* the darknet approach: every class sorts and scans all the boxes */
+typedef struct { synthetic_det_t * det; int klass; } sortable_det_t;
+static int compare_det_prob(const void * a, const void * b)
+{
+	const sortable_det_t * det_a = a, * det_b = b;
+	float diff = det_a->det->prob[det_a->klass] - det_b->det->prob[det_b->klass];
+	return (diff < 0)?1:(diff > 0)?-1:0;
+}
+
+static void darknet_style_nms(synthetic_det_t * dets, int count, int num_classes, float iou_thresh)
+{
+	sortable_det_t * sorted = malloc(sizeof(*sorted) * count);
+	for(int k = 0; k < num_classes; ++k)
+	{
+		for(int i = 0; i < count; ++i) { sorted[i].det = &dets[i]; sorted[i].klass = k; }
+		qsort(sorted, count, sizeof(*sorted), compare_det_prob);
+		for(int i = 0; i < count; ++i)
+		{
+			synthetic_det_t * a = sorted[i].det;
+			if(a->prob[k] == 0) continue;
+			for(int j = i + 1; j < count; ++j)
+			{
+				synthetic_det_t * b = sorted[j].det;
+				float w = ((a->x + a->w / 2 < b->x + b->w / 2)?(a->x + a->w / 2):(b->x + b->w / 2))
+					- ((a->x - a->w / 2 > b->x - b->w / 2)?(a->x - a->w / 2):(b->x - b->w / 2));
+				float h = ((a->y + a->h / 2 < b->y + b->h / 2)?(a->y + a->h / 2):(b->y + b->h / 2))
+					- ((a->y - a->h / 2 > b->y - b->h / 2)?(a->y - a->h / 2):(b->y - b->h / 2));
+				if(w <= 0 || h <= 0) continue;
+				float inter = w * h;
+				if(inter / (a->w * a->h + b->w * b->h - inter) > iou_thresh) b->prob[k] = 0;
+			}
+		}
+	}
+	free(sorted);
+}
+
+static void bench(int count, int num_classes, int iterations)
+{
+	const float thresh = 0.5f;
+	synthetic_det_t * dets = generate_dets(count, num_classes, thresh);
+	synthetic_det_t * work = malloc(sizeof(*work) * count);
+	ai_nms_box_t * boxes = malloc(sizeof(*boxes) * count * num_classes);
+	assert(work && boxes);
+
+	printf("benchmark: %d boxes, %d classes, %d iterations\n", count, num_classes, iterations);
+
+	double begin = app_timer_get_time();
+	for(int i = 0; i < iterations; ++i)
+	{
+		memcpy(work, dets, sizeof(*work) * count);
+		darknet_style_nms(work, count, num_classes, 0.45f);
+	}
+	printf("  %-22s: %9.3f ms\n", "do_nms_sort (darknet)", test_bench_ms(begin, iterations));
+
+	ai_nms_context_t * nms = ai_nms_context_new();
+	test_each_level(level, img_preprocess_get_simd_level, img_preprocess_set_simd_level,
+		img_preprocess_set_simd_level(level);
+		ssize_t num_kept = 0, num_boxes = 0;
+		begin = app_timer_get_time();
+		for(int i = 0; i < iterations; ++i)
+		{
+			num_boxes = prefilter(dets, count, num_classes, thresh, boxes);
+			num_kept = ai_nms(nms, boxes, num_boxes, 0.45f, 0);
+		}
+		printf("  prefilter + ai_nms(%-6s): %9.3f ms, %ld candidates, %ld kept\n", img_simd_level_to_string(level),
+			test_bench_ms(begin, iterations), (long)num_boxes, (long)num_kept);
+	);
+
+	ai_nms_context_free(nms);
+	free(boxes);
+	free(work);
+	free(dets);
+}
+
+int main(int argc, char **argv)
+{
+	test_each_level(level, img_preprocess_get_simd_level, img_preprocess_set_simd_level, if(test_level(level)) return 1);
+
+	int args[3] = { 10000, NUM_CLASSES, 10 };	// num_boxes num_classes iterations
+	if(test_bench_args(argc, argv, 3, args))
+	{
+		assert(args[1] <= NUM_CLASSES);
+		bench(args[0], args[1], args[2]);
+	}
+	return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * test-ai-tracker.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ai-tracker.h"
+
+/*
+ * usuage: test-ai-tracker [detections.txt [keyframe_interval]]
+ *   without arguments: track synthetic moving objects and check the ids, the propagated boxes,
+ *   the deletion of the lost tracks and the determinism.
+ *   with a recorded stream (one detection per line: 'frame class_index confidence left top width height',
+ *   ordered by frame): replay it, and print the tracks of every frame ('frame id class_index left top width height').
+ */
+
+#define NUM_FRAMES (90)
+
+static const char * s_labels[] = { "car", "person" };
+
+typedef struct object
+{
+	int class_index;
+	float left, top, width, height;
+	float vx, vy;
+	int last_frame;		// disappears after this frame
+}object_t;
+
+static const object_t s_objects[] = {
+	{ 0, 0.05f, 0.50f, 0.10f, 0.08f,  0.006f,  0.000f, NUM_FRAMES },	// car, left --> right
+	{ 0, 0.80f, 0.30f, 0.10f, 0.08f, -0.004f,  0.001f, NUM_FRAMES },	// car, right --> left
+	{ 1, 0.40f, 0.10f, 0.03f, 0.09f,  0.000f,  0.005f, NUM_FRAMES },	// person, crosses the first car
+	{ 1, 0.60f, 0.70f, 0.03f, 0.09f,  0.001f,  0.000f, 40 },			// person, leaves at frame 40
+};
+#define NUM_OBJECTS (sizeof(s_objects) / sizeof(s_objects[0]))
+
+/* deterministic noise in [-1, 1] */
+static uint32_t s_seed = 12345;
+static float noise(void)
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return (float)((s_seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+}
+
+static ai_detection_box_t object_at(const object_t * object, int frame)
+{
+	ai_detection_box_t box = {
+		.left = object->left + object->vx * frame,
+		.top = object->top + object->vy * frame,
+		.width = object->width,
+		.height = object->height,
+		.confidence = 0.9f,
+		.class_index = object->class_index,
+	};
+	return box;
+}
+
+static void detect(ai_detections_t * detections, int frame)
+{
+	ai_detections_reset(detections);
+	detections->model = "synthetic";
+	detections->labels = s_labels;
+	detections->num_labels = 2;
+	for(size_t i = 0; i < NUM_OBJECTS; ++i)
+	{
+		if(frame > s_objects[i].last_frame) continue;
+		ai_detection_box_t * box = ai_detections_add(detections);
+		*box = object_at(&s_objects[i], frame);
+		box->left += noise() * 0.003f;
+		box->top += noise() * 0.003f;
+		box->width *= 1.0f + noise() * 0.03f;
+		box->height *= 1.0f + noise() * 0.03f;
+		box->confidence = 0.8f + noise() * 0.1f;
+	}
+}
+
+static float iou(const ai_detection_box_t * a, const ai_detection_box_t * b)
+{
+	float x1 = (a->left > b->left)?a->left:b->left;
+	float y1 = (a->top > b->top)?a->top:b->top;
+	float x2 = ((a->left + a->width) < (b->left + b->width))?(a->left + a->width):(b->left + b->width);
+	float y2 = ((a->top + a->height) < (b->top + b->height))?(a->top + a->height):(b->top + b->height);
+	if(x2 <= x1 || y2 <= y1) return 0;
+	float inter = (x2 - x1) * (y2 - y1);
+	return inter / (a->width * a->height + b->width * b->height - inter);
+}
+
+/* run the synthetic stream, return the number of inferred frames, or -1 on error */
+static int run_synthetic(int keyframe_interval, ai_detection_box_t history[NUM_FRAMES][NUM_OBJECTS])
+{
+	ai_tracker_params_t params[1];
+	ai_tracker_params_init(params);
+	params->keyframe_interval = keyframe_interval;
+	ai_tracker_t * tracker = ai_tracker_new(params);
+
+	ai_detections_t detections[1];
+	memset(detections, 0, sizeof(detections));
+
+	s_seed = 12345;
+	uint32_t ids[NUM_OBJECTS] = { 0 };
+	int num_inferred = 0;
+	for(int frame = 0; frame < NUM_FRAMES; ++frame)
+	{
+		if(ai_tracker_need_inference(tracker)) {
+			detect(detections, frame);
+			ai_tracker_update(tracker, detections);
+			++num_inferred;
+		}else {
+			ai_tracker_predict(tracker);
+		}
+
+		const ai_track_t * tracks = NULL;
+		ssize_t count = ai_tracker_get_tracks(tracker, &tracks);
+		memset(history[frame], 0, sizeof(history[frame]));
+
+		// each visible object: the confirmed track with the best overlap
+		for(size_t i = 0; i < NUM_OBJECTS; ++i)
+		{
+			if(frame > s_objects[i].last_frame) continue;
+			ai_detection_box_t truth = object_at(&s_objects[i], frame);
+			const ai_track_t * best = NULL;
+			float best_iou = 0;
+			for(ssize_t t = 0; t < count; ++t)
+			{
+				if(!tracks[t].confirmed || tracks[t].class_index != truth.class_index) continue;
+				float value = iou(&tracks[t].box, &truth);
+				if(value > best_iou) { best_iou = value; best = &tracks[t]; }
+			}
+			if(frame < 2 * keyframe_interval + 3) continue;	// min_hits inferences to confirm
+
+			if(NULL == best || best_iou < 0.6f) {
+				fprintf(stderr, "[FAILED]: K=%d, frame %d, object %d: IoU %.3f\n", keyframe_interval, frame, (int)i, best_iou);
+				return -1;
+			}
+			if(0 == ids[i]) ids[i] = best->id;
+			if(ids[i] != best->id) {
+				fprintf(stderr, "[FAILED]: K=%d, frame %d, object %d: id %u --> %u\n", keyframe_interval, frame, (int)i, ids[i], best->id);
+				return -1;
+			}
+			history[frame][i] = best->box;
+		}
+
+		// the lost track is deleted after max_misses inferences
+		if(frame > s_objects[3].last_frame + (params->max_misses + 1) * keyframe_interval)
+		{
+			for(ssize_t t = 0; t < count; ++t)
+			{
+				if(tracks[t].id == ids[3]) {
+					fprintf(stderr, "[FAILED]: K=%d, frame %d: track %u not deleted\n", keyframe_interval, frame, ids[3]);
+					return -1;
+				}
+			}
+		}
+	}
+
+	// the boxes of the confirmed tracks, with the labels of the detections
+	uint32_t track_ids[16];
+	ssize_t count = ai_tracker_to_detections(tracker, detections, track_ids);
+	assert(count == NUM_OBJECTS - 1 && detections->labels == s_labels);
+	for(ssize_t i = 0; i < count; ++i) assert(track_ids[i] == ids[i]);
+
+	ai_detections_cleanup(detections);
+	ai_tracker_free(tracker);
+	return num_inferred;
+}
+
+static int test_synthetic(void)
+{
+	static ai_detection_box_t history[2][NUM_FRAMES][NUM_OBJECTS];
+	for(int keyframe_interval = 1; keyframe_interval <= 3; ++keyframe_interval)
+	{
+		int num_inferred = run_synthetic(keyframe_interval, history[0]);
+		if(num_inferred < 0) return -1;
+		if(num_inferred > NUM_FRAMES / keyframe_interval + 2 * keyframe_interval + 4) {
+			fprintf(stderr, "[FAILED]: K=%d: %d / %d frames inferred\n", keyframe_interval, num_inferred, NUM_FRAMES);
+			return -1;
+		}
+
+		if(run_synthetic(keyframe_interval, history[1]) != num_inferred
+			|| memcmp(history[0], history[1], sizeof(history[0])) != 0)
+		{
+			fprintf(stderr, "[FAILED]: K=%d: not deterministic\n", keyframe_interval);
+			return -1;
+		}
+		printf("[OK]: K=%d, %d / %d frames inferred\n", keyframe_interval, num_inferred, NUM_FRAMES);
+	}
+	return 0;
+}
+
+static int replay(const char * filename, int keyframe_interval)
+{
+	FILE * fp = fopen(filename, "r");
+	if(NULL == fp) {
+		perror(filename);
+		return -1;
+	}
+
+	ai_tracker_params_t params[1];
+	ai_tracker_params_init(params);
+	params->keyframe_interval = keyframe_interval;
+	ai_tracker_t * tracker = ai_tracker_new(params);
+
+	ai_detections_t detections[1];
+	memset(detections, 0, sizeof(detections));
+
+	char line[256];
+	int frame = 0, next_frame = -1;
+	ai_detection_box_t pending;
+	int has_pending = 0, eof = 0;
+	while(!eof || has_pending)
+	{
+		// collect the detections of @frame
+		ai_detections_reset(detections);
+		if(has_pending && next_frame == frame) {
+			*ai_detections_add(detections) = pending;
+			has_pending = 0;
+		}
+		while(!has_pending && !eof)
+		{
+			if(NULL == fgets(line, sizeof(line), fp)) { eof = 1; break; }
+			ai_detection_box_t box;
+			if(sscanf(line, "%d %d %f %f %f %f %f", &next_frame, &box.class_index, &box.confidence,
+				&box.left, &box.top, &box.width, &box.height) != 7) continue;
+			if(next_frame == frame) *ai_detections_add(detections) = box;
+			else { pending = box; has_pending = 1; }
+		}
+
+		if(ai_tracker_need_inference(tracker)) ai_tracker_update(tracker, detections);
+		else ai_tracker_predict(tracker);
+
+		const ai_track_t * tracks = NULL;
+		ssize_t count = ai_tracker_get_tracks(tracker, &tracks);
+		for(ssize_t t = 0; t < count; ++t)
+		{
+			if(!tracks[t].confirmed) continue;
+			printf("%d %u %d %.4f %.4f %.4f %.4f\n", frame, tracks[t].id, tracks[t].class_index,
+				tracks[t].box.left, tracks[t].box.top, tracks[t].box.width, tracks[t].box.height);
+		}
+		++frame;
+	}
+
+	fclose(fp);
+	ai_detections_cleanup(detections);
+	ai_tracker_free(tracker);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc > 1) return replay(argv[1], (argc > 2)?atoi(argv[2]):3)?1:0;
+	return test_synthetic()?1:0;
+}
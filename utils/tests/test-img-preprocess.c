@@ -0,0 +1,245 @@
+/*
+ * test-img-preprocess.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "img_proc.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-img-preprocess [--bench [width height iterations]]
+ *   compare every simd kernel supported by this cpu against the scalar reference,
+ *   and optionally measure their throughput.
+ */
+
+static int test_level(enum img_simd_level level)
+{
+	static const int sizes[][2] = {
+		{ 1, 1 }, { 3, 2 }, { 15, 7 }, { 17, 5 }, { 33, 9 }, { 640, 480 }, { 641, 3 },
+	};
+	static const float mean[3] = { 123.68f, 116.78f, 103.94f };
+	static const float scale[3] = { 1.0f / 58.4f, 1.0f / 57.1f, 1.0f / 57.4f };
+
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		int width = sizes[i][0];
+		int height = sizes[i][1];
+		int stride = width * 4 + 12;	// padded rows
+		ssize_t size = (ssize_t)width * height;
+
+		unsigned char * bgra = malloc((size_t)stride * height);
+		float * expected = malloc(sizeof(float) * size * 3);
+		float * result = malloc(sizeof(float) * size * 3);
+		assert(bgra && expected && result);
+		test_fill_random(bgra, (size_t)stride * height);
+
+		for(int pass = 0; pass < 3; ++pass)
+		{
+			int cur_stride = (pass == 2)?stride:0;		// 0: continuous
+			const float * cur_mean = (pass == 0)?NULL:mean;
+			const float * cur_scale = (pass == 0)?NULL:scale;
+
+			img_preprocess_set_simd_level(img_simd_level_scalar);
+			int rc = img_bgra_to_planar_f32(bgra, width, height, cur_stride, cur_mean, cur_scale, expected);
+			assert(0 == rc);
+
+			img_preprocess_set_simd_level(level);
+			memset(result, 0, sizeof(float) * size * 3);
+			rc = img_bgra_to_planar_f32(bgra, width, height, cur_stride, cur_mean, cur_scale, result);
+			assert(0 == rc);
+
+			if(test_compare_f32(expected, result, size * 3))
+			{
+				fprintf(stderr, "[FAILED]: bgra_to_planar_f32(%s): %d x %d, stride=%d\n",
+					img_simd_level_to_string(level), width, height, cur_stride);
+				return -1;
+			}
+		}
+
+		// single channel
+		img_preprocess_set_simd_level(img_simd_level_scalar);
+		img_u8_to_f32(bgra, size, 128.0f, 1.0f / 255.0f, expected);
+		img_preprocess_set_simd_level(level);
+		img_u8_to_f32(bgra, size, 128.0f, 1.0f / 255.0f, result);
+		if(test_compare_f32(expected, result, size))
+		{
+			fprintf(stderr, "[FAILED]: u8_to_f32(%s): count=%ld\n", img_simd_level_to_string(level), (long)size);
+			return -1;
+		}
+
+		free(bgra);
+		free(expected);
+		free(result);
+	}
+	printf("[OK]: %s\n", img_simd_level_to_string(level));
+	return 0;
+}
+
+static int test_resize(void)
+{
+	static const float scale[3] = { 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f };
+	static const int sizes[][4] = {	// src --> dst
+		{ 1920, 1080, 416, 416 }, { 640, 480, 416, 416 }, { 300, 500, 608, 608 }, { 33, 17, 64, 32 },
+	};
+
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		int width = sizes[i][0], height = sizes[i][1];
+		int dst_width = sizes[i][2], dst_height = sizes[i][3];
+		ssize_t dst_size = (ssize_t)dst_width * dst_height * 3;
+
+		unsigned char * bgra = malloc((size_t)width * height * 4);
+		float * single = malloc(sizeof(float) * dst_size);
+		float * multi = malloc(sizeof(float) * dst_size);
+		assert(bgra && single && multi);
+
+		for(int mode = img_resize_mode_bilinear; mode <= img_resize_mode_area; ++mode)
+		{
+			// a flat color must stay flat, the borders must be padded
+			for(ssize_t ii = 0; ii < (ssize_t)width * height; ++ii)
+			{
+				bgra[ii * 4 + 0] = 30; bgra[ii * 4 + 1] = 120; bgra[ii * 4 + 2] = 240; bgra[ii * 4 + 3] = 255;
+			}
+			img_resize_params_t params = {
+				.mode = mode, .letterbox = 1, .pad_value = 0.5f,
+				.scale = scale, .num_threads = 1,
+			};
+			img_letterbox_t box;
+			int rc = img_bgra_resize_to_planar_f32(bgra, width, height, 0, dst_width, dst_height, &params, single, &box);
+			assert(0 == rc);
+
+			static const float expected[3] = { 240.0f / 255.0f, 120.0f / 255.0f, 30.0f / 255.0f };
+			for(int c = 0; c < 3; ++c)
+			{
+				const float * plane = single + (ssize_t)dst_width * dst_height * c;
+				for(int y = 0; y < dst_height; ++y)
+				{
+					for(int x = 0; x < dst_width; ++x)
+					{
+						int inside = (x >= box.x && x < box.x + box.width && y >= box.y && y < box.y + box.height);
+						float value = plane[(ssize_t)y * dst_width + x];
+						float target = inside?expected[c]:0.5f;
+						if(fabsf(value - target) > 1e-5f)
+						{
+							fprintf(stderr, "[FAILED]: resize(mode=%d): %d x %d --> %d x %d, (%d, %d, c=%d): %f != %f\n",
+								mode, width, height, dst_width, dst_height, x, y, c, value, target);
+							return -1;
+						}
+					}
+				}
+			}
+
+			// row bands must produce the same results
+			test_fill_random(bgra, (size_t)width * height * 4);
+			img_bgra_resize_to_planar_f32(bgra, width, height, 0, dst_width, dst_height, &params, single, NULL);
+			params.num_threads = 4;
+			img_bgra_resize_to_planar_f32(bgra, width, height, 0, dst_width, dst_height, &params, multi, NULL);
+			if(memcmp(single, multi, sizeof(float) * dst_size))
+			{
+				fprintf(stderr, "[FAILED]: resize(mode=%d, num_threads=4): %d x %d --> %d x %d\n",
+					mode, width, height, dst_width, dst_height);
+				return -1;
+			}
+		}
+		free(bgra);
+		free(single);
+		free(multi);
+	}
+	printf("[OK]: resize + letterbox\n");
+	return 0;
+}
+
+static void bench_resize(int width, int height, int dst_width, int dst_height, int num_threads, int iterations)
+{
+	unsigned char * bgra = malloc((size_t)width * height * 4);
+	float * dst = malloc(sizeof(float) * dst_width * dst_height * 3);
+	assert(bgra && dst);
+	test_fill_random(bgra, (size_t)width * height * 4);
+
+	static const float scale[3] = { 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f };
+	img_resize_params_t params = { .letterbox = 1, .pad_value = 0.5f, .scale = scale, .num_threads = num_threads };
+	img_bgra_resize_to_planar_f32(bgra, width, height, 0, dst_width, dst_height, &params, dst, NULL);
+
+	double begin = app_timer_get_time();
+	for(int i = 0; i < iterations; ++i)
+	{
+		img_bgra_resize_to_planar_f32(bgra, width, height, 0, dst_width, dst_height, &params, dst, NULL);
+	}
+	printf("  resize %d x %d --> %d x %d, threads=%d: %8.3f ms/frame\n",
+		width, height, dst_width, dst_height, num_threads, test_bench_ms(begin, iterations));
+
+	free(bgra);
+	free(dst);
+}
+
+static void bench_level(enum img_simd_level level, int width, int height, int iterations)
+{
+	ssize_t size = (ssize_t)width * height;
+	unsigned char * bgra = malloc(size * 4);
+	float * dst = malloc(sizeof(float) * size * 3);
+	assert(bgra && dst);
+	test_fill_random(bgra, size * 4);
+
+	static const float scale[3] = { 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f };
+	img_preprocess_set_simd_level(level);
+	img_bgra_to_planar_f32(bgra, width, height, 0, NULL, scale, dst);	// warm up
+
+	double begin = app_timer_get_time();
+	for(int i = 0; i < iterations; ++i) img_bgra_to_planar_f32(bgra, width, height, 0, NULL, scale, dst);
+
+	double per_frame = test_bench_ms(begin, iterations);
+	printf("  %-8s: %8.3f ms/frame, %8.2f Mpixels/s\n",
+		img_simd_level_to_string(level),
+		per_frame,
+		(double)size / per_frame / 1000.0);
+
+	free(bgra);
+	free(dst);
+}
+
+int main(int argc, char **argv)
+{
+	printf("cpu simd level: %s\n", img_simd_level_to_string(img_preprocess_get_simd_level()));
+
+	test_each_level(level, img_preprocess_get_simd_level, img_preprocess_set_simd_level, if(test_level(level)) return 1);
+	if(test_resize()) return 1;
+
+	int args[3] = { 1920, 1080, 200 };	// width height iterations
+	if(test_bench_args(argc, argv, 3, args))
+	{
+		int width = args[0], height = args[1], iterations = args[2];
+		printf("benchmark: bgra_to_planar_f32, %d x %d, %d iterations\n", width, height, iterations);
+		test_each_level(level, img_preprocess_get_simd_level, img_preprocess_set_simd_level,
+			bench_level(level, width, height, iterations));
+		for(int num_threads = 1; num_threads <= 4; num_threads *= 2)
+		{
+			bench_resize(width, height, 416, 416, num_threads, iterations);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * test-img-probe.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "img_proc.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-img-probe
+ *   check img_utils_get_jpeg_size() / img_utils_get_png_size() on encoded, hand-made and truncated streams.
+ */
+
+/* every prefix shorter than @min_length is rejected (and not over-read) */
+static int check_truncated(int (* probe)(const unsigned char *, size_t, int *, int *),
+	const unsigned char * data, size_t min_length)
+{
+	for(size_t length = 0; length < min_length; ++length)
+	{
+		unsigned char * copy = malloc(length + 1);	// exact size: out of bounds reads are caught by ASan
+		assert(copy);
+		memcpy(copy, data, length);
+		int width = 0, height = 0;
+		int rc = probe(copy, length, &width, &height);
+		free(copy);
+		if(0 == rc) return -1;
+	}
+	return 0;
+}
+
+static int test_jpeg(void)
+{
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, 321, 123, NULL);
+	memset(image->data, 0x80, image->width * image->height * 4);
+
+	unsigned char * jpeg = NULL;
+	ssize_t length = bgra_image_to_jpeg_stream(image, &jpeg, 90);
+	assert(length > 0 && jpeg);
+
+	int width = 0, height = 0;
+	int rc = img_utils_get_jpeg_size(jpeg, length, &width, &height);
+	check("jpeg: encoded", 0 == rc && width == 321 && height == 123);
+
+	// SOI, APP0 (JFIF), COM, fill bytes, SOF2 (progressive) 640 x 480
+	static const unsigned char progressive[] = {
+		0xff, 0xd8,
+		0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+		0xff, 0xfe, 0x00, 0x06, 0xff, 0xc0, 0xff, 0xd9,		// a comment which looks like SOF0 / EOI
+		0xff, 0xff, 0xff,
+		0xff, 0xc2, 0x00, 0x0b, 0x08, 0x01, 0xe0, 0x02, 0x80, 0x01, 0x01, 0x11, 0x00,
+	};
+	rc = img_utils_get_jpeg_size(progressive, sizeof(progressive), &width, &height);
+	check("jpeg: markers before SOF2", 0 == rc && width == 640 && height == 480);
+	check("jpeg: truncated", 0 == check_truncated(img_utils_get_jpeg_size, progressive, sizeof(progressive)));
+
+	// DHT (c4) is not a frame header, SOS before any SOF
+	static const unsigned char no_sof[] = {
+		0xff, 0xd8,
+		0xff, 0xc4, 0x00, 0x08, 0x00, 0x01, 0xe0, 0x02, 0x80, 0x01,
+		0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00,
+	};
+	rc = img_utils_get_jpeg_size(no_sof, sizeof(no_sof), &width, &height);
+	check("jpeg: no SOF", rc != 0);
+
+	static const unsigned char png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	rc = img_utils_get_jpeg_size(png_signature, sizeof(png_signature), &width, &height);
+	check("jpeg: not a jpeg", rc != 0);
+
+	free(jpeg);
+	bgra_image_clear(image);
+	return 0;
+}
+
+static int test_png(void)
+{
+	// signature, IHDR: 4000 x 3000, 8 bits RGBA
+	static const unsigned char png[] = {
+		0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+		0x00, 0x00, 0x00, 0x0d, 'I', 'H', 'D', 'R',
+		0x00, 0x00, 0x0f, 0xa0, 0x00, 0x00, 0x0b, 0xb8,
+		0x08, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	int width = 0, height = 0;
+	int rc = img_utils_get_png_size(png, sizeof(png), &width, &height);
+	check("png: IHDR", 0 == rc && width == 4000 && height == 3000);
+	check("png: truncated", 0 == check_truncated(img_utils_get_png_size, png, 24));
+
+	unsigned char bad[sizeof(png)];
+	memcpy(bad, png, sizeof(png));
+	bad[12] = 'i';
+	check("png: not IHDR", img_utils_get_png_size(bad, sizeof(bad), &width, &height) != 0);
+
+	memcpy(bad, png, sizeof(png));
+	memset(bad + 16, 0, 4);
+	check("png: zero width", img_utils_get_png_size(bad, sizeof(bad), &width, &height) != 0);
+
+	memcpy(bad, png, sizeof(png));
+	bad[20] = 0x80;
+	check("png: height > INT32_MAX", img_utils_get_png_size(bad, sizeof(bad), &width, &height) != 0);
+	return 0;
+}
+#undef check
+
+int main(int argc, char **argv)
+{
+	if(test_jpeg() || test_png()) return 1;
+	return 0;
+}
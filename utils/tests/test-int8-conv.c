@@ -0,0 +1,203 @@
+/*
+ * test-int8-conv.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "int8_conv.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-int8-conv [--bench [in_c in_hw out_c size iterations]]
+ *   compare int8_conv_forward() (every supported level) with a float32 convolution,
+ *   and optionally measure it against the float32 im2col + gemm.
+ */
+
+static float * random_array(ssize_t count, float amplitude)
+{
+	float * data = malloc(sizeof(float) * count);
+	assert(data);
+	for(ssize_t i = 0; i < count; ++i) data[i] = (test_frand() * 2.0f - 1.0f) * amplitude;
+	return data;
+}
+
+/* float32 reference, the same layout as darknet: im2col + gemm */
+static void reference_conv(int in_c, int in_h, int in_w, int out_c, int size, int stride, int pad,
+	const float * weights, const float * scales, const float * biases, const float * input, float * output)
+{
+	int out_h = (in_h + 2 * pad - size) / stride + 1;
+	int out_w = (in_w + 2 * pad - size) / stride + 1;
+	int k = in_c * size * size;
+	int N = out_h * out_w;
+
+	float * cols = malloc(sizeof(float) * k * N);
+	assert(cols);
+	for(int c = 0; c < in_c; ++c)
+	for(int ky = 0; ky < size; ++ky)
+	for(int kx = 0; kx < size; ++kx)
+	{
+		float * row = cols + (ssize_t)((c * size + ky) * size + kx) * N;
+		for(int oy = 0; oy < out_h; ++oy)
+		for(int ox = 0; ox < out_w; ++ox)
+		{
+			int iy = oy * stride + ky - pad, ix = ox * stride + kx - pad;
+			row[oy * out_w + ox] = (iy < 0 || iy >= in_h || ix < 0 || ix >= in_w)?0:input[((ssize_t)c * in_h + iy) * in_w + ix];
+		}
+	}
+
+	for(int m = 0; m < out_c; ++m)
+	{
+		float * dst = output + (ssize_t)m * N;
+		memset(dst, 0, sizeof(float) * N);
+		for(int i = 0; i < k; ++i)
+		{
+			float w = weights[(ssize_t)m * k + i];
+			const float * src = cols + (ssize_t)i * N;
+			for(int n = 0; n < N; ++n) dst[n] += w * src[n];
+		}
+		for(int n = 0; n < N; ++n) dst[n] = dst[n] * scales[m] + biases[m];
+	}
+	free(cols);
+}
+
+typedef struct conv_case
+{
+	int in_c, in_hw, out_c, size, stride, pad;
+}conv_case_t;
+
+static int test_level(enum int8_conv_level level)
+{
+	static const conv_case_t cases[] = {
+		{ 3, 17, 5, 3, 1, 1 },		// first layer like, k = 27 (padded to 32)
+		{ 16, 13, 8, 3, 2, 1 },		// strided
+		{ 32, 9, 7, 1, 1, 0 },		// 1x1, out_c % 4 != 0
+		{ 8, 11, 12, 5, 1, 2 },
+		{ 64, 6, 4, 3, 1, 1 },
+	};
+	if(int8_conv_set_level(level)) return 0;	// not supported by the cpu
+
+	int8_conv_scratch_t scratch[1] = {{ 0 }};
+	for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		const conv_case_t * c = &cases[i];
+		int k = c->in_c * c->size * c->size;
+		float * weights = random_array((ssize_t)c->out_c * k, 0.5f);
+		float * scales = random_array(c->out_c, 1.0f);
+		float * biases = random_array(c->out_c, 0.1f);
+		float * input = random_array((ssize_t)c->in_c * c->in_hw * c->in_hw, 2.0f);
+
+		int8_conv_t conv[1];
+		int8_conv_init(conv, c->in_c, c->in_hw, c->in_hw, c->out_c, c->size, c->stride, c->pad, weights, scales, biases);
+		ssize_t output_size = (ssize_t)c->out_c * conv->out_h * conv->out_w;
+		float * expected = malloc(sizeof(float) * output_size);
+		float * output = malloc(sizeof(float) * output_size);
+		assert(expected && output);
+
+		reference_conv(c->in_c, c->in_hw, c->in_hw, c->out_c, c->size, c->stride, c->pad,
+			weights, scales, biases, input, expected);
+
+		for(int calibrated = 0; calibrated < 2; ++calibrated)
+		{
+			conv->input_scale = calibrated?(int8_max_abs(input, (ssize_t)c->in_c * c->in_hw * c->in_hw) / 127.0f):0;
+			int8_conv_forward(conv, input, output, scratch);
+
+			// the quantization error grows with sqrt(k): compare with the output range
+			float max_value = int8_max_abs(expected, output_size);
+			float max_error = 0;
+			for(ssize_t j = 0; j < output_size; ++j)
+			{
+				float error = fabsf(output[j] - expected[j]);
+				if(error > max_error) max_error = error;
+			}
+			if(max_error > max_value * 0.03f)
+			{
+				fprintf(stderr, "[FAILED]: int8_conv(%s): case %d, max error %g (output range %g)\n",
+					int8_conv_level_to_string(level), (int)i, max_error, max_value);
+				return -1;
+			}
+		}
+
+		int8_conv_cleanup(conv);
+		free(weights);
+		free(scales);
+		free(biases);
+		free(input);
+		free(expected);
+		free(output);
+	}
+	int8_conv_scratch_cleanup(scratch);
+	printf("[OK]: int8_conv(%s)\n", int8_conv_level_to_string(level));
+	return 0;
+}
+
+static void bench(int in_c, int in_hw, int out_c, int size, int iterations)
+{
+	int k = in_c * size * size;
+	float * weights = random_array((ssize_t)out_c * k, 0.5f);
+	float * scales = random_array(out_c, 1.0f);
+	float * biases = random_array(out_c, 0.1f);
+	float * input = random_array((ssize_t)in_c * in_hw * in_hw, 2.0f);
+	float * output = malloc(sizeof(float) * out_c * in_hw * in_hw);
+	assert(output);
+
+	printf("benchmark: %dx%dx%d -> %d, %dx%d kernel, %d iterations\n", in_c, in_hw, in_hw, out_c, size, size, iterations);
+
+	double begin = app_timer_get_time();
+	for(int i = 0; i < iterations; ++i)
+	{
+		reference_conv(in_c, in_hw, in_hw, out_c, size, 1, size / 2, weights, scales, biases, input, output);
+	}
+	printf("  %-17s: %9.3f ms\n", "float32", test_bench_ms(begin, iterations));
+
+	int8_conv_t conv[1];
+	int8_conv_scratch_t scratch[1] = {{ 0 }};
+	int8_conv_init(conv, in_c, in_hw, in_hw, out_c, size, 1, size / 2, weights, scales, biases);
+
+	test_each_level(level, int8_conv_get_level, int8_conv_set_level,
+		int8_conv_set_level(level);
+		begin = app_timer_get_time();
+		for(int i = 0; i < iterations; ++i) int8_conv_forward(conv, input, output, scratch);
+		printf("  int8(%-11s): %9.3f ms\n", int8_conv_level_to_string(level), test_bench_ms(begin, iterations));
+	);
+
+	int8_conv_cleanup(conv);
+	int8_conv_scratch_cleanup(scratch);
+	free(weights);
+	free(scales);
+	free(biases);
+	free(input);
+	free(output);
+}
+
+int main(int argc, char **argv)
+{
+	test_each_level(level, int8_conv_get_level, int8_conv_set_level, if(test_level(level)) return 1);
+
+	int args[5] = { 128, 52, 256, 3, 5 };	// in_c in_hw out_c size iterations
+	if(test_bench_args(argc, argv, 5, args)) bench(args[0], args[1], args[2], args[3], args[4]);
+	return 0;
+}
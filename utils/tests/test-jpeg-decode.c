@@ -0,0 +1,223 @@
+/*
+ * test-jpeg-decode.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "img_proc.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-jpeg-decode [--bench [iterations]]
+ *   encode a synthetic 1920x1080 frame, and compare the scaled / cropped decodes with the full decode.
+ *   --bench: time the full, the scaled (416 x 416) and the cropped decodes.
+ */
+
+#define FRAME_WIDTH		(1920)
+#define FRAME_HEIGHT	(1080)
+
+static void draw_frame(bgra_image_t * image)
+{
+	for(int row = 0; row < image->height; ++row)
+	{
+		unsigned char * p = image->data + (ssize_t)image->width * 4 * row;
+		for(int col = 0; col < image->width; ++col, p += 4)
+		{
+			int inside = (col >= 600 && col < 900 && row >= 300 && row < 700);
+			p[0] = inside?40:(col * 255 / image->width);
+			p[1] = inside?200:(row * 255 / image->height);
+			p[2] = inside?80:((col + row) * 255 / (image->width + image->height));
+			p[3] = 255;
+		}
+	}
+}
+
+/* mean absolute difference of the BGR channels, dst(x, y) vs the box average of src over scale x scale pixels */
+static double compare(const unsigned char * dst, int dst_stride, int width, int height,
+	const bgra_image_t * src, int src_x, int src_y, int scale)
+{
+	double sum = 0;
+	for(int y = 0; y < height; ++y)
+	{
+		for(int x = 0; x < width; ++x)
+		{
+			for(int c = 0; c < 3; ++c)
+			{
+				int value = 0;
+				for(int dy = 0; dy < scale; ++dy)
+				{
+					for(int dx = 0; dx < scale; ++dx)
+					{
+						int sx = src_x + x * scale + dx;
+						int sy = src_y + y * scale + dy;
+						if(sx >= src->width) sx = src->width - 1;
+						if(sy >= src->height) sy = src->height - 1;
+						value += src->data[((ssize_t)sy * src->width + sx) * 4 + c];
+					}
+				}
+				value /= scale * scale;
+				int diff = (int)dst[(ssize_t)y * dst_stride + x * 4 + c] - value;
+				sum += (diff < 0)?-diff:diff;
+			}
+		}
+	}
+	return sum / ((double)width * height * 3);
+}
+
+static int test_decode(const unsigned char * jpeg, size_t length)
+{
+	bgra_image_t full[1], image[1];
+	memset(full, 0, sizeof(full));
+	memset(image, 0, sizeof(image));
+	img_jpeg_decode_params_t params[1];
+	img_jpeg_decode_params_init(params);
+	int width = 0, height = 0;
+
+	int rc = bgra_image_from_jpeg_stream(full, jpeg, length);
+	check("full decode", 0 == rc && full->width == FRAME_WIDTH && full->height == FRAME_HEIGHT);
+
+	// network input 416 x 416: 1/8 and 1/4 are too small, 1/2 is used
+	params->min_width = 416;
+	params->min_height = 416;
+	rc = img_jpeg_decode(jpeg, length, params, NULL, 0, 0, &width, &height);
+	check("output size", 0 == rc && width == FRAME_WIDTH / 2 && height == FRAME_HEIGHT / 2);
+
+	rc = bgra_image_from_jpeg_stream_scaled(image, jpeg, length, params);
+	check("scale 1/2", 0 == rc && image->width == width && image->height == height
+		&& compare(image->data, image->width * 4, width, height, full, 0, 0, 2) < 3.0);
+
+	params->min_width = 200;
+	params->min_height = 100;
+	rc = bgra_image_from_jpeg_stream_scaled(image, jpeg, length, params);
+	check("scale 1/8", 0 == rc && image->width == FRAME_WIDTH / 8 && image->height == FRAME_HEIGHT / 8
+		&& compare(image->data, image->width * 4, image->width, image->height, full, 0, 0, 8) < 3.0);
+
+	// crop at full resolution, into a padded buffer: the pixels of the full decode, the padding untouched
+	params->min_width = 0;
+	params->min_height = 0;
+	params->crop_x = 333;
+	params->crop_y = 211;
+	params->crop_width = 500;
+	params->crop_height = 300;
+	int stride = 600 * 4;
+	size_t capacity = (size_t)stride * 300;
+	unsigned char * buffer = malloc(capacity);
+	assert(buffer);
+	memset(buffer, 0xcd, capacity);
+	rc = img_jpeg_decode(jpeg, length, params, buffer, stride, capacity, &width, &height);
+	int padding_ok = 1;
+	for(int y = 0; y < height; ++y) {
+		for(int x = width * 4; x < stride; ++x) if(buffer[(size_t)stride * y + x] != 0xcd) padding_ok = 0;
+	}
+	check("crop", 0 == rc && width == 500 && height == 300 && padding_ok
+		&& compare(buffer, stride, width, height, full, 333, 211, 1) < 1.0);
+
+	// crop and scale: the region is >= 200 x 100 at 1/2
+	params->min_width = 200;
+	params->min_height = 100;
+	rc = img_jpeg_decode(jpeg, length, params, buffer, stride, capacity, &width, &height);
+	check("crop, scale 1/2", 0 == rc && width == 251 && height == 151
+		&& compare(buffer, stride, 250, 150, full, 332, 210, 2) < 3.0);
+
+	// clipped to the image
+	params->min_width = 0;
+	params->min_height = 0;
+	params->crop_x = FRAME_WIDTH - 100;
+	params->crop_y = FRAME_HEIGHT - 50;
+	rc = img_jpeg_decode(jpeg, length, params, buffer, stride, capacity, &width, &height);
+	check("crop, clipped", 0 == rc && width == 100 && height == 50
+		&& compare(buffer, stride, width, height, full, FRAME_WIDTH - 100, FRAME_HEIGHT - 50, 1) < 1.0);
+
+	// errors
+	params->crop_x = FRAME_WIDTH;
+	rc = img_jpeg_decode(jpeg, length, params, buffer, stride, capacity, &width, &height);
+	check("crop outside the image", rc != 0);
+
+	params->crop_x = 0;
+	params->crop_y = 0;
+	params->crop_width = 0;
+	params->crop_height = 0;
+	rc = img_jpeg_decode(jpeg, length, params, buffer, stride, capacity, &width, &height);
+	check("buffer too small", rc != 0 && width == FRAME_WIDTH && height == FRAME_HEIGHT);
+
+	unsigned char garbage[256];
+	memset(garbage, 0x5a, sizeof(garbage));
+	garbage[0] = 0xff; garbage[1] = 0xd8;
+	rc = img_jpeg_decode(garbage, sizeof(garbage), NULL, NULL, 0, 0, &width, &height);
+	check("not a jpeg", rc != 0);
+
+	free(buffer);
+	bgra_image_clear(image);
+	bgra_image_clear(full);
+	return 0;
+}
+#undef check
+
+static void bench(const unsigned char * jpeg, size_t length, int iterations)
+{
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	img_jpeg_decode_params_t params[3];
+	for(int i = 0; i < 3; ++i) img_jpeg_decode_params_init(&params[i]);
+	params[1].min_width = 416;
+	params[1].min_height = 416;
+	params[2].min_width = 416;
+	params[2].min_height = 416;
+	params[2].crop_x = 480;
+	params[2].crop_y = 270;
+	params[2].crop_width = 960;
+	params[2].crop_height = 540;
+	static const char * titles[3] = { "full", "scaled (416x416)", "crop 960x540, scaled (416x416)" };
+
+	printf("jpeg decode, %d x %d, %ld bytes:\n", FRAME_WIDTH, FRAME_HEIGHT, (long)length);
+	for(int i = 0; i < 3; ++i)
+	{
+		double begin = app_timer_get_time();
+		for(int k = 0; k < iterations; ++k) bgra_image_from_jpeg_stream_scaled(image, jpeg, length, &params[i]);
+		printf("  %-32s: %8.3f ms (%d x %d)\n", titles[i], test_bench_ms(begin, iterations),
+			image->width, image->height);
+	}
+	bgra_image_clear(image);
+}
+
+int main(int argc, char **argv)
+{
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, FRAME_WIDTH, FRAME_HEIGHT, NULL);
+	draw_frame(image);
+
+	unsigned char * jpeg = NULL;
+	ssize_t length = bgra_image_to_jpeg_stream(image, &jpeg, 95);
+	assert(length > 0 && jpeg);
+	bgra_image_clear(image);
+
+	int rc = test_decode(jpeg, length);
+	int iterations = 50;
+	if(0 == rc && test_bench_args(argc, argv, 1, &iterations)) bench(jpeg, length, iterations);
+	free(jpeg);
+	return rc?1:0;
+}
@@ -0,0 +1,258 @@
+/*
+ * test-jpeg-encoder.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <jpeglib.h>
+
+#include "jpeg-encoder.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-jpeg-encoder [--bench [num_streams iterations]]
+ *   compare the sliced encodes with single-pass libjpeg encodes (same restart interval): byte-identical,
+ *   and encode from several threads at once.
+ *   --bench: one 1080p stream single-threaded / sliced, and @num_streams concurrent streams.
+ */
+
+static void draw_frame(bgra_image_t * image, int seed)
+{
+	for(int row = 0; row < image->height; ++row)
+	{
+		unsigned char * p = image->data + (ssize_t)image->stride * row;
+		for(int col = 0; col < image->width; ++col, p += 4)
+		{
+			p[0] = (unsigned char)(col + seed);
+			p[1] = (unsigned char)(row * 3 + ((col / 16) & 1) * 64);
+			p[2] = (unsigned char)((col * row + seed) >> 6);
+			p[3] = 255;
+		}
+	}
+}
+
+/* the restart interval of the DRI marker, 0: none */
+static unsigned int get_restart_interval(const unsigned char * jpeg, size_t length)
+{
+	for(size_t offset = 2; offset + 6 <= length && jpeg[offset] == 0xff; )
+	{
+		if(jpeg[offset + 1] == 0xdd) return ((unsigned int)jpeg[offset + 4] << 8) | jpeg[offset + 5];
+		if(jpeg[offset + 1] == 0xda) break;
+		offset += 2 + (((size_t)jpeg[offset + 2] << 8) | jpeg[offset + 3]);
+	}
+	return 0;
+}
+
+/* single-pass reference */
+static unsigned long reference_encode(const bgra_image_t * image, const jpeg_encode_params_t * params,
+	unsigned int restart_interval, unsigned char ** p_jpeg)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+
+	unsigned long length = 0;
+	jpeg_mem_dest(&cinfo, p_jpeg, &length);
+	cinfo.image_width = image->width;
+	cinfo.image_height = image->height;
+	cinfo.input_components = 4;
+	cinfo.in_color_space = JCS_EXT_BGRA;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, params->quality, TRUE);
+	cinfo.comp_info[0].h_samp_factor = (params->subsampling == jpeg_subsampling_444)?1:2;
+	cinfo.comp_info[0].v_samp_factor = (params->subsampling == jpeg_subsampling_420)?2:1;
+	cinfo.restart_interval = restart_interval;
+
+	jpeg_start_compress(&cinfo, TRUE);
+	while(cinfo.next_scanline < cinfo.image_height)
+	{
+		JSAMPROW row = image->data + (size_t)image->stride * cinfo.next_scanline;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return length;
+}
+
+static int test_identical(jpeg_encoder_t * encoder)
+{
+	static const int sizes[][2] = { { 1920, 1080 }, { 1001, 777 }, { 64, 48 } };
+	static const char * subsamplings[] = { "4:4:4", "4:2:2", "4:2:0" };
+
+	unsigned char * jpeg = NULL;
+	size_t capacity = 0;
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		bgra_image_t image[1];
+		memset(image, 0, sizeof(image));
+		bgra_image_init(image, sizes[i][0], sizes[i][1], NULL);
+		image->stride = image->width * 4;
+		draw_frame(image, (int)i);
+
+		for(int subsampling = jpeg_subsampling_444; subsampling <= jpeg_subsampling_420; ++subsampling)
+		{
+			jpeg_encode_params_t params[1];
+			jpeg_encode_params_init(params);
+			params->quality = 80;
+			params->subsampling = subsampling;
+
+			ssize_t length = jpeg_encoder_encode(encoder, image, params, &jpeg, &capacity);
+			unsigned int restart_interval = (length > 0)?get_restart_interval(jpeg, length):0;
+
+			unsigned char * expected = NULL;
+			unsigned long expected_length = reference_encode(image, params, restart_interval, &expected);
+			if(length != (ssize_t)expected_length || memcmp(jpeg, expected, length) != 0) {
+				fprintf(stderr, "[FAILED]: %d x %d, %s: %ld bytes, expected %lu\n",
+					image->width, image->height, subsamplings[subsampling], (long)length, expected_length);
+				return -1;
+			}
+			printf("[OK]: %d x %d, %s, restart interval %u: %ld bytes\n",
+				image->width, image->height, subsamplings[subsampling], restart_interval, (long)length);
+			free(expected);
+		}
+		bgra_image_clear(image);
+	}
+	free(jpeg);
+	return 0;
+}
+
+typedef struct stream
+{
+	pthread_t th;
+	jpeg_encoder_t * encoder;
+	bgra_image_t image[1];
+	int iterations;
+	const unsigned char * expected;		// NULL: do not check
+	size_t expected_length;
+	int failed;
+}stream_t;
+
+static void * stream_thread(void * user_data)
+{
+	stream_t * stream = user_data;
+	unsigned char * jpeg = NULL;
+	size_t capacity = 0;
+	for(int i = 0; i < stream->iterations; ++i)
+	{
+		ssize_t length = jpeg_encoder_encode(stream->encoder, stream->image, NULL, &jpeg, &capacity);
+		if(length <= 0) stream->failed = 1;
+		else if(stream->expected && ((size_t)length != stream->expected_length || memcmp(jpeg, stream->expected, length) != 0)) {
+			stream->failed = 1;
+		}
+	}
+	free(jpeg);
+	return NULL;
+}
+
+/* each stream encodes its own frame and checks it against a serial encode of the same frame */
+static double run_streams(jpeg_encoder_t * encoder, int num_streams, int width, int height, int iterations, int check)
+{
+	stream_t * streams = calloc(num_streams, sizeof(*streams));
+	unsigned char ** expected = calloc(num_streams, sizeof(*expected));
+	assert(streams && expected);
+	for(int i = 0; i < num_streams; ++i)
+	{
+		stream_t * stream = &streams[i];
+		stream->encoder = encoder;
+		stream->iterations = iterations;
+		bgra_image_init(stream->image, width, height, NULL);
+		stream->image->stride = width * 4;
+		draw_frame(stream->image, i * 7);
+		if(check) {
+			size_t capacity = 0;
+			ssize_t length = jpeg_encoder_encode(encoder, stream->image, NULL, &expected[i], &capacity);
+			assert(length > 0);
+			stream->expected = expected[i];
+			stream->expected_length = length;
+		}
+	}
+
+	double begin = app_timer_get_time();
+	for(int i = 0; i < num_streams; ++i) pthread_create(&streams[i].th, NULL, stream_thread, &streams[i]);
+	int failed = 0;
+	for(int i = 0; i < num_streams; ++i)
+	{
+		pthread_join(streams[i].th, NULL);
+		failed |= streams[i].failed;
+		bgra_image_clear(streams[i].image);
+		free(expected[i]);
+	}
+	double time_elapsed = app_timer_get_time() - begin;
+	free(streams);
+	free(expected);
+	return failed?-1:time_elapsed;
+}
+
+static void bench(int num_streams, int iterations)
+{
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, 1920, 1080, NULL);
+	image->stride = 1920 * 4;
+	draw_frame(image, 0);
+
+	jpeg_encoder_t * encoder = jpeg_encoder_new(0);
+	unsigned char * jpeg = NULL;
+	size_t capacity = 0;
+
+	jpeg_encode_params_t params[1];
+	jpeg_encode_params_init(params);
+	printf("jpeg encode, 1920 x 1080, quality %d, 4:2:0:\n", params->quality);
+	for(int max_slices = 1; max_slices >= 0; --max_slices)
+	{
+		params->max_slices = max_slices;
+		double begin = app_timer_get_time();
+		for(int i = 0; i < iterations; ++i) jpeg_encoder_encode(encoder, image, params, &jpeg, &capacity);
+		printf("  %-24s: %8.3f ms / frame\n", max_slices?"single slice":"sliced",
+			test_bench_ms(begin, iterations));
+	}
+
+	double time_elapsed = run_streams(encoder, num_streams, 1920, 1080, iterations, 0);
+	printf("  %2d streams (sliced)     : %8.3f ms / frame, %.1f fps in total\n", num_streams,
+		time_elapsed / (iterations * num_streams) * 1000, (iterations * num_streams) / time_elapsed);
+
+	free(jpeg);
+	jpeg_encoder_free(encoder);
+	bgra_image_clear(image);
+}
+
+int main(int argc, char **argv)
+{
+	jpeg_encoder_t * encoder = jpeg_encoder_new(4);
+	if(test_identical(encoder)) return 1;
+
+	if(run_streams(encoder, 8, 640, 480, 20, 1) < 0) {
+		fprintf(stderr, "[FAILED]: concurrent streams\n");
+		return 1;
+	}
+	printf("[OK]: 8 concurrent streams\n");
+	jpeg_encoder_free(encoder);
+
+	int args[2] = { 16, 20 };	// num_streams iterations
+	if(test_bench_args(argc, argv, 2, args)) bench(args[0], args[1]);
+	return 0;
+}
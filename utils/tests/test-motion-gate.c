@@ -0,0 +1,191 @@
+/*
+ * test-motion-gate.c
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "motion-gate.h"
+#include "test-utils.h"
+
+/*
+ * usuage: test-motion-gate [--bench [width height iterations]]
+ *   compare the simd kernels with the scalar ones, check the decisions of the gate on synthetic frames,
+ *   and optionally measure motion_gate_update() on full-size frames.
+ */
+
+static int test_kernels(void)
+{
+	static const int widths[] = { 1, 15, 16, 17, 33, 160, 1921 };
+	for(size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i)
+	{
+		int width = widths[i];
+		unsigned char * bgra = malloc(width * 4);
+		unsigned char * a = malloc(width);
+		unsigned char * b = malloc(width);
+		uint16_t * expected = calloc(width, sizeof(uint16_t));
+		uint16_t * sums = calloc(width, sizeof(uint16_t));
+		assert(bgra && a && b && expected && sums);
+
+		for(int x = 0; x < width * 4; ++x) bgra[x] = (x % 7 == 0)?255:(unsigned char)rand();
+		for(int x = 0; x < width; ++x) {
+			a[x] = (unsigned char)rand();
+			b[x] = (x & 1)?(unsigned char)rand():a[x] + (rand() % 41) - 20;
+		}
+		motion_gate_luma_row(bgra, width, expected, img_simd_level_scalar);
+		ssize_t expected_count = motion_gate_count_changed(a, b, width, 20, img_simd_level_scalar);
+
+		for(int level = img_simd_level_sse4; level <= img_preprocess_get_simd_level(); ++level)
+		{
+			memset(sums, 0, sizeof(uint16_t) * width);
+			motion_gate_luma_row(bgra, width, sums, level);
+			if(memcmp(sums, expected, sizeof(uint16_t) * width) != 0) {
+				fprintf(stderr, "[FAILED]: luma_row(%s), width = %d\n", img_simd_level_to_string(level), width);
+				return -1;
+			}
+			ssize_t count = motion_gate_count_changed(a, b, width, 20, level);
+			if(count != expected_count) {
+				fprintf(stderr, "[FAILED]: count_changed(%s), width = %d: %ld != %ld\n",
+					img_simd_level_to_string(level), width, (long)count, (long)expected_count);
+				return -1;
+			}
+		}
+		free(bgra);
+		free(a);
+		free(b);
+		free(expected);
+		free(sums);
+	}
+	printf("[OK]: kernels (scalar ... %s)\n", img_simd_level_to_string(img_preprocess_get_simd_level()));
+	return 0;
+}
+
+/* a textured static scene with sensor noise (+/- @noise) and an optional dark square */
+static void draw_scene(bgra_image_t * image, int noise, int x, int y, int size)
+{
+	for(int row = 0; row < image->height; ++row)
+	{
+		unsigned char * p = image->data + (ssize_t)image->width * 4 * row;
+		for(int col = 0; col < image->width; ++col, p += 4)
+		{
+			int inside = (size > 0 && col >= x && col < x + size && row >= y && row < y + size);
+			int value = inside?10:(96 + ((col / 8 + row / 8) & 1) * 64);
+			if(noise) value += (rand() % (noise * 2 + 1)) - noise;
+			p[0] = p[1] = p[2] = (unsigned char)value;
+			p[3] = 255;
+		}
+	}
+}
+
+#define expect(title, gate, image, value) do { \
+		int rc = motion_gate_update(gate, image); \
+		if(rc != (value)) { \
+			motion_gate_stats_t stats[1]; \
+			motion_gate_get_stats(gate, stats); \
+			fprintf(stderr, "[FAILED]: %s: %d != %d (changed: %.4f)\n", title, rc, (value), stats->last_ratio); \
+			return -1; \
+		} \
+	} while(0)
+
+static int test_gate(void)
+{
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, 640, 360, NULL);
+
+	motion_gate_params_t params[1];
+	motion_gate_params_init(params);
+	params->cooldown = 2;
+	params->max_skipped = 10;
+	motion_gate_t * gate = motion_gate_new(params);
+
+	draw_scene(image, 0, 0, 0, 0);
+	expect("first frame", gate, image, 1);
+	for(int i = 0; i < 5; ++i) {
+		draw_scene(image, 8, 0, 0, 0);
+		expect("sensor noise", gate, image, 0);
+	}
+
+	draw_scene(image, 8, 100, 100, 24);
+	expect("new object", gate, image, 1);
+	expect("cooldown 1", gate, image, 1);
+	expect("cooldown 2", gate, image, 1);
+	expect("settled", gate, image, 0);
+
+	draw_scene(image, 8, 140, 100, 24);
+	expect("moved object", gate, image, 1);
+
+	// an unchanged scene is refreshed after max_skipped frames
+	motion_gate_free(gate);
+	params->cooldown = 0;
+	gate = motion_gate_new(params);
+	expect("first frame", gate, image, 1);
+	for(int i = 0; i < params->max_skipped; ++i) expect("static scene", gate, image, 0);
+	expect("refresh", gate, image, 1);
+	expect("static scene", gate, image, 0);
+
+	motion_gate_reset(gate);
+	expect("reset", gate, image, 1);
+
+	motion_gate_stats_t stats[1];
+	motion_gate_get_stats(gate, stats);
+	assert(stats->frames == params->max_skipped + 4 && stats->predicted == 3);
+
+	motion_gate_free(gate);
+	bgra_image_clear(image);
+	printf("[OK]: gate\n");
+	return 0;
+}
+#undef expect
+
+static void bench(int width, int height, int iterations)
+{
+	bgra_image_t image[1];
+	memset(image, 0, sizeof(image));
+	bgra_image_init(image, width, height, NULL);
+	draw_scene(image, 8, 0, 0, 0);
+
+	printf("motion_gate_update(), %d x %d:\n", width, height);
+	test_each_level(level, img_preprocess_get_simd_level, img_preprocess_set_simd_level,
+		img_preprocess_set_simd_level(level);
+
+		motion_gate_t * gate = motion_gate_new(NULL);
+		motion_gate_update(gate, image);
+		double begin = app_timer_get_time();
+		for(int i = 0; i < iterations; ++i) motion_gate_update(gate, image);
+		printf("  %-8s: %8.3f ms\n", img_simd_level_to_string(level), test_bench_ms(begin, iterations));
+		motion_gate_free(gate);
+	);
+	bgra_image_clear(image);
+}
+
+int main(int argc, char **argv)
+{
+	if(test_kernels() || test_gate()) return 1;
+
+	int args[3] = { 1920, 1080, 100 };	// width height iterations
+	if(test_bench_args(argc, argv, 3, args)) bench(args[0], args[1], args[2]);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef _TEST_UTILS_H_
+#define _TEST_UTILS_H_
+/*
+ * test-utils.h
+ *
+ * Copyright 2020 chehw <htc.chehw@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/*
+ * the scaffolding shared by the unit tests:
+ *   test-xxx [--bench [arg1 arg2 ...]]
+ *   run the checks (on every simd level supported by this cpu), then optionally the benchmarks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "utils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* print "[OK]: title", or "[FAILED]: title: condition" and return -1 from the calling test */
+#define check(title, condition) do { \
+		if(!(condition)) { \
+			fprintf(stderr, "[FAILED]: %s: %s\n", title, #condition); \
+			return -1; \
+		} \
+		printf("[OK]: %s\n", title); \
+	} while(0)
+
+/*
+ * run the statements with @level = 0 (scalar) ... the level @get_level() selected for this cpu,
+ * then select that level again.
+ *   e.g. test_each_level(level, img_preprocess_get_simd_level, img_preprocess_set_simd_level, if(test_level(level)) return 1);
+ */
+#define test_each_level(level, get_level, set_level, ...) do { \
+		int max_level_ = (int)get_level(); \
+		for(int level = 0; level <= max_level_; ++level) { __VA_ARGS__; } \
+		set_level(max_level_); \
+	} while(0)
+
+static inline float test_frand(void)	// [0, 1]
+{
+	return (float)rand() / (float)RAND_MAX;
+}
+
+static inline void test_fill_random(unsigned char * data, size_t size)
+{
+	for(size_t i = 0; i < size; ++i) data[i] = (unsigned char)(rand() & 0xff);
+}
+
+// the simd kernels may use fused multiply-add, allow 1~2 ulp differences
+static inline int test_compare_f32(const float * a, const float * b, size_t count)
+{
+	for(size_t i = 0; i < count; ++i)
+	{
+		float tolerance = 1e-6f * (1.0f + fabsf(a[i]));
+		if(fabsf(a[i] - b[i]) > tolerance)
+		{
+			fprintf(stderr, "  mismatch at %lu: %.9f != %.9f\n", (unsigned long)i, a[i], b[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * returns 1 if argv[1] is "--bench",
+ * the (positive) integers that follow it replace the first defaults of @args[@count]
+ */
+static inline int test_bench_args(int argc, char ** argv, int count, int args[])
+{
+	if(argc < 2 || strcmp(argv[1], "--bench")) return 0;
+	for(int i = 0; i < count && (i + 2) < argc; ++i)
+	{
+		args[i] = atoi(argv[i + 2]);
+		assert(args[i] > 0);
+	}
+	return 1;
+}
+
+// milliseconds per iteration since @begin (app_timer_get_time())
+static inline double test_bench_ms(double begin, int iterations)
+{
+	return (app_timer_get_time() - begin) / iterations * 1000;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
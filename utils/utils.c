@@ -121,20 +121,21 @@ ssize_t hex2bin(const char * hex, size_t length, unsigned char * data)
  * app_timer
 *************************************************/
 static app_timer_t g_timer[1];
-double app_timer_start(app_timer_t * timer)
+double app_timer_get_time(void)
 {
 	struct timespec ts[1];
 	memset(ts, 0, sizeof(ts));
 	clock_gettime(CLOCK_MONOTONIC, ts);
-	timer->begin = (double)ts->tv_sec + (double)ts->tv_nsec / 1000000000.0;
+	return (double)ts->tv_sec + (double)ts->tv_nsec / 1000000000.0;
+}
+double app_timer_start(app_timer_t * timer)
+{
+	timer->begin = app_timer_get_time();
 	return timer->begin;
 }
 double app_timer_stop(app_timer_t * timer)
 {
-	struct timespec ts[1];
-	memset(ts, 0, sizeof(ts));
-	clock_gettime(CLOCK_MONOTONIC, ts);
-	timer->end = (double)ts->tv_sec + (double)ts->tv_nsec / 1000000000.0;
+	timer->end = app_timer_get_time();
 	return (timer->end - timer->begin);
 }
 